@@ -10,9 +10,16 @@
 #import "DTTextRange.h"
 #import "DTTextPosition.h"
 #import "DTTextSelectionRect.h"
+#import "DTAttributeEdit.h"
 
 // UI
 #import "DTRichTextEditorContentView.h"
+#import "DTRichTextImageAttachment.h"
+#import "DTHTMLFragmentCache.h"
+#import "DTCacheRegistry.h"
+#import "DTTextSearchIndex.h"
+#import "DTTextPreviewRenderer.h"
+#import "DTRichTextEditorMetrics.h"
 
 #import "DTRichTextEditorView.h"
 #import "DTRichTextEditorView+Attributes.h"
@@ -21,11 +28,13 @@
 #import "DTRichTextEditorView+Dictation.h"
 #import "DTRichTextEditorView+Lists.h"
 #import "DTRichTextEditorView+Ranges.h"
+#import "DTRichTextEditorView+Search.h"
 #import "DTRichTextEditorView+Styles.h"
 
 #import "DTTextSelectionView.h"
 
 #import "DTUndoManager.h"
+#import "DTUndoDelta.h"
 
 // time bomb set by integration server for nightly demo build
 #ifdef TIMEBOMB
@@ -0,0 +1,64 @@
+//
+//  DTAttributeEdit.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ A change of attributes in a range of the text, several of these are applied together by <[DTRichTextEditorView applyAttributeEdits:options:actionName:]>. The characters of the range are never changed.
+ */
+@interface DTAttributeEdit : NSObject
+
+/**
+ @name Creating Attribute Edits
+ */
+
+/**
+ Creates an edit that adds attributes to a range, existing attributes with the same names are replaced.
+ @param attributes The attributes to add
+ @param range The string range
+ @returns The attribute edit
+ */
++ (instancetype)editAddingAttributes:(NSDictionary *)attributes range:(NSRange)range;
+
+/**
+ Creates an edit that removes attributes from a range.
+ @param attributeNames The names of the attributes to remove
+ @param range The string range
+ @returns The attribute edit
+ */
++ (instancetype)editRemovingAttributes:(NSArray *)attributeNames range:(NSRange)range;
+
+/**
+ Creates an edit that first removes and then adds attributes.
+ @param attributeNames The names of the attributes to remove, can be `nil`
+ @param attributes The attributes to add, can be `nil`
+ @param range The string range
+ @returns An initialized attribute edit
+ */
+- (instancetype)initWithRemovedAttributes:(NSArray *)attributeNames addedAttributes:(NSDictionary *)attributes range:(NSRange)range;
+
+/**
+ @name Getting Information
+ */
+
+/**
+ The string range the edit applies to
+ */
+@property (nonatomic, readonly) NSRange range;
+
+/**
+ The names of the attributes that are removed from the range, removal happens before adding
+ */
+@property (nonatomic, readonly) NSArray *removedAttributeNames;
+
+/**
+ The attributes that are added to the range
+ */
+@property (nonatomic, readonly) NSDictionary *addedAttributes;
+
+@end
@@ -0,0 +1,51 @@
+//
+//  DTAttributeEdit.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTAttributeEdit.h"
+
+@implementation DTAttributeEdit
+{
+	NSRange _range;
+	NSArray *_removedAttributeNames;
+	NSDictionary *_addedAttributes;
+}
+
++ (instancetype)editAddingAttributes:(NSDictionary *)attributes range:(NSRange)range
+{
+	return [[self alloc] initWithRemovedAttributes:nil addedAttributes:attributes range:range];
+}
+
++ (instancetype)editRemovingAttributes:(NSArray *)attributeNames range:(NSRange)range
+{
+	return [[self alloc] initWithRemovedAttributes:attributeNames addedAttributes:nil range:range];
+}
+
+- (instancetype)initWithRemovedAttributes:(NSArray *)attributeNames addedAttributes:(NSDictionary *)attributes range:(NSRange)range
+{
+	self = [super init];
+	
+	if (self)
+	{
+		_range = range;
+		_removedAttributeNames = [attributeNames copy];
+		_addedAttributes = [attributes copy];
+	}
+	
+	return self;
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"<%@ range=%@ removed=%@ added=%@>", NSStringFromClass([self class]), NSStringFromRange(_range), _removedAttributeNames, _addedAttributes];
+}
+
+@synthesize range = _range;
+@synthesize removedAttributeNames = _removedAttributeNames;
+@synthesize addedAttributes = _addedAttributes;
+
+@end
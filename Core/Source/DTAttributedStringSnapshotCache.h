@@ -0,0 +1,49 @@
+//
+//  DTAttributedStringSnapshotCache.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "DTCacheRegistry.h"
+
+/**
+ Cache for immutable copies of the paragraphs of a string, used to create snapshots of the document that can be handed to a background queue without copying the entire string on every change.
+
+ The string is split into chunks of whole paragraphs. A snapshot is an immutable `NSAttributedString` made up of the current chunks, only the chunks that were modified since the previous snapshot are copied again. The cache is owned by <DTRichTextEditorContentView> which informs it about modifications via <invalidateRange:replacementLength:>.
+ */
+@interface DTAttributedStringSnapshotCache : NSObject <DTCacheRegistryCache>
+
+/**
+ @name Invalidating Chunks
+ */
+
+/**
+ Marks the chunks touched by replacing a range of the string as modified, including the adjacent chunks it might have merged with. Snapshots that were already created are not affected.
+ @param range The range of the string before the modification
+ @param length The length of the replacement text
+ */
+- (void)invalidateRange:(NSRange)range replacementLength:(NSUInteger)length;
+
+/**
+ Removes all cached chunks, for example if the string was replaced entirely.
+ */
+- (void)removeAllChunks;
+
+/**
+ @name Creating Snapshots
+ */
+
+/**
+ Creates an immutable snapshot of a string, copying only the chunks that were modified since the previous snapshot. This has to be called on the thread that modifies the string, usually the main thread.
+
+ The snapshot is safe to use from any thread. The values of the attributes, like text attachments, are shared with the string and not copied.
+ @param attributedString The current string
+ @returns The immutable snapshot
+ */
+- (NSAttributedString *)snapshotOfAttributedString:(NSAttributedString *)attributedString;
+
+@end
@@ -0,0 +1,375 @@
+//
+//  DTAttributedStringSnapshotCache.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTAttributedStringSnapshotCache.h"
+
+// paragraphs are combined into chunks of at least this many characters so that large documents don't need too many of them
+#define DTSnapshotChunkMinimumLength 2048
+
+// estimated memory used by a chunk besides its characters
+#define DTSnapshotChunkOverhead 64
+
+// whole paragraphs of the string, dirty chunks have no text and are copied again for the next snapshot
+@interface DTSnapshotChunk : NSObject
+{
+@public
+	NSUInteger _length;
+	NSAttributedString *_text;
+}
+
+@end
+
+@implementation DTSnapshotChunk
+
+@end
+
+
+// an immutable string made of chunks, only the primitive methods of NSAttributedString are implemented
+@interface DTAttributedStringSnapshot : NSAttributedString
+
+- (instancetype)initWithChunks:(NSArray *)chunks;
+
+@end
+
+@implementation DTAttributedStringSnapshot
+{
+	NSArray *_chunks;
+	NSUInteger *_offsets;
+	NSUInteger _length;
+
+	// created on demand
+	NSString *_string;
+}
+
+- (instancetype)initWithChunks:(NSArray *)chunks
+{
+	self = [super init];
+
+	if (self)
+	{
+		_chunks = [chunks copy];
+
+		NSUInteger numberOfChunks = [_chunks count];
+		_offsets = malloc(MAX(numberOfChunks, 1) * sizeof(NSUInteger));
+
+		for (NSUInteger i=0; i<numberOfChunks; i++)
+		{
+			_offsets[i] = _length;
+			_length += [[_chunks objectAtIndex:i] length];
+		}
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	free(_offsets);
+}
+
+// binary search for the chunk containing a string index
+- (NSUInteger)_indexOfChunkAtIndex:(NSUInteger)index
+{
+	NSUInteger lower = 0;
+	NSUInteger upper = [_chunks count];
+
+	while (upper - lower > 1)
+	{
+		NSUInteger middle = lower + (upper - lower) / 2;
+
+		if (_offsets[middle] <= index)
+		{
+			lower = middle;
+		}
+		else
+		{
+			upper = middle;
+		}
+	}
+
+	return lower;
+}
+
+#pragma mark - NSAttributedString
+
+- (NSString *)string
+{
+	// several threads might ask for the string at the same time
+	@synchronized(self)
+	{
+		if (!_string)
+		{
+			NSMutableString *string = [[NSMutableString alloc] initWithCapacity:_length];
+
+			for (NSAttributedString *chunk in _chunks)
+			{
+				[string appendString:[chunk string]];
+			}
+
+			_string = [string copy];
+		}
+
+		return _string;
+	}
+}
+
+- (NSUInteger)length
+{
+	return _length;
+}
+
+- (NSDictionary *)attributesAtIndex:(NSUInteger)location effectiveRange:(NSRangePointer)range
+{
+	if (location >= _length)
+	{
+		[NSException raise:NSRangeException format:@"Index %lu out of bounds; string length %lu", (unsigned long)location, (unsigned long)_length];
+	}
+
+	NSUInteger chunkIndex = [self _indexOfChunkAtIndex:location];
+	NSUInteger offset = _offsets[chunkIndex];
+
+	// effective ranges end at chunk boundaries
+	NSDictionary *attributes = [[_chunks objectAtIndex:chunkIndex] attributesAtIndex:location - offset effectiveRange:range];
+
+	if (range)
+	{
+		range->location += offset;
+	}
+
+	return attributes;
+}
+
+- (NSAttributedString *)attributedSubstringFromRange:(NSRange)range
+{
+	if (range.length && NSMaxRange(range) <= _length)
+	{
+		NSUInteger chunkIndex = [self _indexOfChunkAtIndex:range.location];
+		NSUInteger offset = _offsets[chunkIndex];
+		NSAttributedString *chunk = [_chunks objectAtIndex:chunkIndex];
+
+		// no need to go through the primitive methods if a single chunk has it all
+		if (NSMaxRange(range) <= offset + [chunk length])
+		{
+			return [chunk attributedSubstringFromRange:NSMakeRange(range.location - offset, range.length)];
+		}
+	}
+
+	return [super attributedSubstringFromRange:range];
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+	// immutable
+	return self;
+}
+
+- (Class)classForCoder
+{
+	return [NSAttributedString class];
+}
+
+@end
+
+
+// splits a range of the string into clean chunks of whole paragraphs
+static NSArray *_DTSnapshotChunksInRange(NSAttributedString *attributedString, NSRange range)
+{
+	NSString *string = [attributedString string];
+	NSMutableArray *chunks = [NSMutableArray array];
+
+	NSUInteger chunkStart = range.location;
+	NSUInteger index = range.location;
+
+	while (index < NSMaxRange(range))
+	{
+		NSRange paragraphRange = [string paragraphRangeForRange:NSMakeRange(index, 0)];
+		index = MIN(NSMaxRange(paragraphRange), NSMaxRange(range));
+
+		if (index - chunkStart < DTSnapshotChunkMinimumLength && index < NSMaxRange(range))
+		{
+			continue;
+		}
+
+		DTSnapshotChunk *chunk = [[DTSnapshotChunk alloc] init];
+		chunk->_length = index - chunkStart;
+
+		// the substring of a mutable string is an immutable copy
+		chunk->_text = [attributedString attributedSubstringFromRange:NSMakeRange(chunkStart, chunk->_length)];
+
+		[chunks addObject:chunk];
+
+		chunkStart = index;
+	}
+
+	return chunks;
+}
+
+
+@implementation DTAttributedStringSnapshotCache
+{
+	NSMutableArray *_chunks;
+	NSUInteger _length;
+}
+
+- (id)init
+{
+	self = [super init];
+
+	if (self)
+	{
+		_chunks = [[NSMutableArray alloc] init];
+
+		[[DTCacheRegistry sharedRegistry] registerCache:self evictionOrder:DTCacheEvictionOrderDerivedData];
+	}
+
+	return self;
+}
+
+#pragma mark - Invalidating Chunks
+
+- (void)invalidateRange:(NSRange)range replacementLength:(NSUInteger)length
+{
+	if (![_chunks count])
+	{
+		// nothing cached yet
+		return;
+	}
+
+	if (NSMaxRange(range) > _length)
+	{
+		// we missed a modification
+		[self removeAllChunks];
+		return;
+	}
+
+	NSUInteger location = 0;
+	NSUInteger firstIndex = NSNotFound;
+	NSUInteger lastIndex = NSNotFound;
+	NSUInteger mergedLength = 0;
+
+	NSUInteger numberOfChunks = [_chunks count];
+
+	for (NSUInteger i=0; i<numberOfChunks; i++)
+	{
+		DTSnapshotChunk *chunk = [_chunks objectAtIndex:i];
+		NSUInteger end = location + chunk->_length;
+
+		if (location > NSMaxRange(range))
+		{
+			break;
+		}
+
+		// adjacent chunks are included, removing a newline merges paragraphs
+		if (end >= range.location)
+		{
+			if (firstIndex == NSNotFound)
+			{
+				firstIndex = i;
+			}
+
+			lastIndex = i;
+			mergedLength += chunk->_length;
+		}
+
+		location = end;
+	}
+
+	NSRange replacedChunks = NSMakeRange(firstIndex, lastIndex - firstIndex + 1);
+
+	DTSnapshotChunk *dirtyChunk = [[DTSnapshotChunk alloc] init];
+	dirtyChunk->_length = mergedLength - range.length + length;
+
+	if (dirtyChunk->_length)
+	{
+		[_chunks replaceObjectsInRange:replacedChunks withObjectsFromArray:@[dirtyChunk]];
+	}
+	else
+	{
+		[_chunks removeObjectsInRange:replacedChunks];
+	}
+
+	_length = _length - range.length + length;
+}
+
+- (void)removeAllChunks
+{
+	[_chunks removeAllObjects];
+	_length = 0;
+}
+
+#pragma mark - Creating Snapshots
+
+- (NSAttributedString *)snapshotOfAttributedString:(NSAttributedString *)attributedString
+{
+	NSUInteger length = [attributedString length];
+
+	// start over with a single dirty chunk if the cache does not match the string
+	if (![_chunks count] || _length != length)
+	{
+		[self removeAllChunks];
+
+		if (length)
+		{
+			DTSnapshotChunk *dirtyChunk = [[DTSnapshotChunk alloc] init];
+			dirtyChunk->_length = length;
+
+			[_chunks addObject:dirtyChunk];
+			_length = length;
+		}
+	}
+
+	NSMutableArray *texts = [NSMutableArray arrayWithCapacity:[_chunks count]];
+
+	NSUInteger location = 0;
+	NSUInteger index = 0;
+
+	while (index < [_chunks count])
+	{
+		DTSnapshotChunk *chunk = [_chunks objectAtIndex:index];
+
+		if (!chunk->_text)
+		{
+			// copy the modified paragraphs again, the loop then continues with the first clean chunk
+			NSArray *cleanChunks = _DTSnapshotChunksInRange(attributedString, NSMakeRange(location, chunk->_length));
+			[_chunks replaceObjectsInRange:NSMakeRange(index, 1) withObjectsFromArray:cleanChunks];
+
+			continue;
+		}
+
+		[texts addObject:chunk->_text];
+
+		location += chunk->_length;
+		index++;
+	}
+
+	return [[DTAttributedStringSnapshot alloc] initWithChunks:texts];
+}
+
+#pragma mark - DTCacheRegistryCache
+
+- (NSUInteger)cacheCost
+{
+	NSUInteger cost = 0;
+
+	for (DTSnapshotChunk *chunk in _chunks)
+	{
+		if (chunk->_text)
+		{
+			cost += chunk->_length * sizeof(unichar) + DTSnapshotChunkOverhead;
+		}
+	}
+
+	return cost;
+}
+
+- (void)purgeCache
+{
+	[self removeAllChunks];
+}
+
+@end
@@ -0,0 +1,114 @@
+//
+//  DTCacheRegistry.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+
+/**
+ The order in which registered caches are evicted, caches that are cheapest to recreate go first
+ */
+typedef NS_ENUM(NSUInteger, DTCacheEvictionOrder)
+{
+	/**
+	 Bitmaps that can be drawn again, like rasterized paragraphs and decoded images. These are always evicted on memory pressure.
+	 */
+	DTCacheEvictionOrderRendering = 0,
+
+	/**
+	 Layout results that can be typeset again, like line sets and selection rectangles
+	 */
+	DTCacheEvictionOrderLayout,
+
+	/**
+	 Values derived from the text, like HTML fragments and word boundaries
+	 */
+	DTCacheEvictionOrderDerivedData,
+
+	/**
+	 Information that cannot be recreated, like the undo history. Only evicted if the budget cannot be met otherwise, cost that the other caches were not able to purge does not count.
+	 */
+	DTCacheEvictionOrderHistory
+};
+
+/**
+ Protocol for caches that are managed by <DTCacheRegistry>.
+ */
+@protocol DTCacheRegistryCache <NSObject>
+
+/**
+ The number of bytes the cache currently uses, an estimate is sufficient
+ */
+@property (nonatomic, readonly) NSUInteger cacheCost;
+
+/**
+ Asks the cache to remove all its contents that can be recreated. This is always called on the main thread.
+ */
+- (void)purgeCache;
+
+@end
+
+/**
+ The registry of all caches of the editor, it owns the decision when they have to shed memory.
+
+ Caches register themselves when they are created, the registry only keeps weak references. When the app receives a memory warning or enters the background then the caches are purged in their <DTCacheEvictionOrder> until the total cost is at most half of the <memoryBudget>, rendering caches are always purged. <trimToMemoryBudget> does the same down to the full budget without the special treatment of rendering caches.
+ */
+@interface DTCacheRegistry : NSObject
+
+/**
+ @name Getting the Registry
+ */
+
+/**
+ The registry that all caches of the editor register with
+ @returns The shared registry
+ */
++ (DTCacheRegistry *)sharedRegistry;
+
+/**
+ @name Registering Caches
+ */
+
+/**
+ Adds a cache to the receiver, it is not retained. Caches can be registered from any thread.
+ @param cache The cache
+ @param order When the cache is evicted relative to other caches
+ */
+- (void)registerCache:(id<DTCacheRegistryCache>)cache evictionOrder:(DTCacheEvictionOrder)order;
+
+/**
+ Removes a cache from the receiver. Caches that are deallocated are removed automatically.
+ @param cache The cache
+ */
+- (void)unregisterCache:(id<DTCacheRegistryCache>)cache;
+
+/**
+ @name Limiting Memory
+ */
+
+/**
+ The number of bytes that all registered caches together should not exceed. Reducing it trims the caches right away.
+
+ Defaults to 64 MB
+ */
+@property (nonatomic, assign) NSUInteger memoryBudget;
+
+/**
+ The number of bytes currently used by all registered caches
+ */
+@property (nonatomic, readonly) NSUInteger totalCost;
+
+/**
+ Purges caches in their eviction order until the total cost does not exceed the <memoryBudget>.
+ */
+- (void)trimToMemoryBudget;
+
+/**
+ Purges all rendering caches, then the others in their eviction order until the total cost is at most half of the <memoryBudget>. This is called automatically on memory warnings and when the app enters the background.
+ */
+- (void)handleMemoryPressure;
+
+@end
@@ -0,0 +1,227 @@
+//
+//  DTCacheRegistry.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTCacheRegistry.h"
+
+#define DTCacheRegistryDefaultMemoryBudget (64 * 1024 * 1024)
+
+@implementation DTCacheRegistry
+{
+	// eviction order by cache, the caches are weak keys
+	NSMapTable *_evictionOrders;
+
+	NSUInteger _memoryBudget;
+}
+
++ (DTCacheRegistry *)sharedRegistry
+{
+	static DTCacheRegistry *_sharedRegistry = nil;
+	static dispatch_once_t onceToken;
+
+	dispatch_once(&onceToken, ^{
+		_sharedRegistry = [[DTCacheRegistry alloc] init];
+	});
+
+	return _sharedRegistry;
+}
+
+- (instancetype)init
+{
+	self = [super init];
+
+	if (self)
+	{
+		_evictionOrders = [NSMapTable weakToStrongObjectsMapTable];
+		_memoryBudget = DTCacheRegistryDefaultMemoryBudget;
+
+		NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+		[center addObserver:self selector:@selector(applicationDidReceiveMemoryWarning:) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+		[center addObserver:self selector:@selector(applicationDidEnterBackground:) name:UIApplicationDidEnterBackgroundNotification object:nil];
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+#pragma mark - Registering Caches
+
+- (void)registerCache:(id<DTCacheRegistryCache>)cache evictionOrder:(DTCacheEvictionOrder)order
+{
+	NSParameterAssert(cache);
+
+	@synchronized(self)
+	{
+		[_evictionOrders setObject:[NSNumber numberWithUnsignedInteger:order] forKey:cache];
+	}
+}
+
+- (void)unregisterCache:(id<DTCacheRegistryCache>)cache
+{
+	@synchronized(self)
+	{
+		[_evictionOrders removeObjectForKey:cache];
+	}
+}
+
+// the live caches sorted by eviction order, caches with the same order are in no particular order
+- (NSArray *)_cachesInEvictionOrder
+{
+	NSMutableArray *cachesByOrder = [NSMutableArray array];
+
+	for (NSUInteger order=0; order<=DTCacheEvictionOrderHistory; order++)
+	{
+		[cachesByOrder addObject:[NSMutableArray array]];
+	}
+
+	@synchronized(self)
+	{
+		for (id cache in _evictionOrders)
+		{
+			NSUInteger order = MIN([[_evictionOrders objectForKey:cache] unsignedIntegerValue], (NSUInteger)DTCacheEvictionOrderHistory);
+
+			[[cachesByOrder objectAtIndex:order] addObject:cache];
+		}
+	}
+
+	NSMutableArray *caches = [NSMutableArray array];
+
+	for (NSArray *cachesWithOrder in cachesByOrder)
+	{
+		[caches addObjectsFromArray:cachesWithOrder];
+	}
+
+	return caches;
+}
+
+- (DTCacheEvictionOrder)_evictionOrderOfCache:(id<DTCacheRegistryCache>)cache
+{
+	@synchronized(self)
+	{
+		return [[_evictionOrders objectForKey:cache] unsignedIntegerValue];
+	}
+}
+
+#pragma mark - Limiting Memory
+
+- (NSUInteger)totalCost
+{
+	NSUInteger totalCost = 0;
+
+	for (id<DTCacheRegistryCache> cache in [self _cachesInEvictionOrder])
+	{
+		totalCost += cache.cacheCost;
+	}
+
+	return totalCost;
+}
+
+// purges caches in eviction order until the total cost fits
+- (void)_trimToCost:(NSUInteger)cost purgingRenderingCaches:(BOOL)purgeRenderingCaches
+{
+	NSAssert([NSThread isMainThread], @"Caches can only be trimmed on the main thread");
+
+	NSArray *caches = [self _cachesInEvictionOrder];
+
+	NSUInteger totalCost = 0;
+
+	for (id<DTCacheRegistryCache> cache in caches)
+	{
+		totalCost += cache.cacheCost;
+	}
+
+	// what the purged caches could not release
+	NSUInteger unpurgeableCost = 0;
+
+	for (id<DTCacheRegistryCache> cache in caches)
+	{
+		DTCacheEvictionOrder order = [self _evictionOrderOfCache:cache];
+		BOOL isRenderingCache = (order == DTCacheEvictionOrderRendering);
+
+		if (totalCost <= cost && !(purgeRenderingCaches && isRenderingCache))
+		{
+			break;
+		}
+
+		// history is only given up for cost that purging can actually reduce
+		if (order == DTCacheEvictionOrderHistory && totalCost - MIN(unpurgeableCost, totalCost) <= cost)
+		{
+			break;
+		}
+
+		NSUInteger cacheCost = cache.cacheCost;
+
+		[cache purgeCache];
+
+		NSUInteger remainingCost = MIN(cache.cacheCost, cacheCost);
+		totalCost -= MIN(cacheCost - remainingCost, totalCost);
+
+		if (order != DTCacheEvictionOrderHistory)
+		{
+			unpurgeableCost += remainingCost;
+		}
+	}
+}
+
+- (void)trimToMemoryBudget
+{
+	[self _trimToCost:self.memoryBudget purgingRenderingCaches:NO];
+}
+
+- (void)handleMemoryPressure
+{
+	[self _trimToCost:self.memoryBudget / 2 purgingRenderingCaches:YES];
+}
+
+#pragma mark - Notifications
+
+- (void)applicationDidReceiveMemoryWarning:(NSNotification *)notification
+{
+	[self handleMemoryPressure];
+}
+
+- (void)applicationDidEnterBackground:(NSNotification *)notification
+{
+	[self handleMemoryPressure];
+}
+
+#pragma mark - Properties
+
+- (void)setMemoryBudget:(NSUInteger)memoryBudget
+{
+	@synchronized(self)
+	{
+		_memoryBudget = memoryBudget;
+	}
+
+	if ([NSThread isMainThread])
+	{
+		[self trimToMemoryBudget];
+	}
+	else
+	{
+		dispatch_async(dispatch_get_main_queue(), ^{
+			[self trimToMemoryBudget];
+		});
+	}
+}
+
+- (NSUInteger)memoryBudget
+{
+	@synchronized(self)
+	{
+		return _memoryBudget;
+	}
+}
+
+@synthesize memoryBudget = _memoryBudget;
+
+@end
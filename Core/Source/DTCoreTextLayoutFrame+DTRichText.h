@@ -8,7 +8,7 @@
 
 #import <DTCoreText/DTCoreTextLayoutFrame.h>
 
-@class DTTextPosition, DTTextRange;
+@class DTTextPosition, DTTextRange, DTTextSelectionRect, DTCoreTextLayoutLine;
 
 /**
  Methods that extend DTCoreTextLayoutFrame for use by editors.
@@ -29,6 +29,22 @@
  */
 - (NSArray *)selectionRectsForRange:(NSRange)range;
 
+/**
+ The selection rects for a given range, only considering the given lines.
+ @param range The string range
+ @param lines The lines to search, sorted by string index. Usually a subset of the receiver's lines that contains the range.
+ @returns An array of the selection rects
+ */
+- (NSArray *)selectionRectsForRange:(NSRange)range inLines:(NSArray *)lines;
+
+/**
+ The selection rect for the part of a given range that lies in a single line. The line needs to be between the lines containing the start and the end of the range.
+ @param range The string range
+ @param line The line
+ @returns The selection rect for this line
+ */
+- (DTTextSelectionRect *)selectionRectForRange:(NSRange)range inLine:(DTCoreTextLayoutLine *)line;
+
 /**
  Determines the string index you arrive at if you start at a given index and to a certain number of lines upwards.
  @param index The index to start at
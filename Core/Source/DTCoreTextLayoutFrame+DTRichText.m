@@ -29,93 +29,39 @@
 }
 
 - (NSArray *)selectionRectsForRange:(NSRange)range
+{
+    return [self selectionRectsForRange:range inLines:self.lines];
+}
+
+- (NSArray *)selectionRectsForRange:(NSRange)range inLines:(NSArray *)lines
 {
     NSInteger fromIndex = range.location;
     NSInteger toIndex = range.location + range.length;
     
-    CGFloat fromCaretOffset = 0.0;
-    CGFloat toCaretOffset = 0.0;
-    
     BOOL haveStart = NO;
     BOOL haveEnd = NO;
     
-    NSMutableArray *retArray = [NSMutableArray arrayWithCapacity:[self.lines count]];
+    NSMutableArray *retArray = [NSMutableArray arrayWithCapacity:[lines count]];
     
-    for (DTCoreTextLayoutLine *oneLine in self.lines)
+    for (DTCoreTextLayoutLine *oneLine in lines)
 	{
-        BOOL lineContainsStart = NO;
-        BOOL lineContainsEnd = NO;
-        
 		if (NSLocationInRange(fromIndex, [oneLine stringRange]))
 		{
-            lineContainsStart = YES;
             haveStart = YES;
-            
-           fromCaretOffset = [oneLine offsetForStringIndex:fromIndex] + oneLine.frame.origin.x;
         }
 
         if (NSLocationInRange(toIndex, [oneLine stringRange]))
 		{
-            lineContainsEnd = YES;;
             haveEnd = YES;
-            
-            toCaretOffset = [oneLine offsetForStringIndex:toIndex] + oneLine.frame.origin.x;
         }
         
-        CGRect rectToAddForThisLine = oneLine.frame;
-        
         // continue looping through lines until we find the start
         if (!haveStart)
         {
             continue;
         }
-
-        if (lineContainsStart)
-        {
-            if (lineContainsEnd)
-            {
-                rectToAddForThisLine = CGRectStandardize(CGRectMake(fromCaretOffset, oneLine.frame.origin.y, toCaretOffset - fromCaretOffset, oneLine.frame.size.height));
-            }
-            else
-            {
-                // ending after this line
-                
-                if (oneLine.writingDirectionIsRightToLeft)
-                {
-                    // extend to left side of line
-                    rectToAddForThisLine = CGRectMake(oneLine.frame.origin.x, oneLine.frame.origin.y, fromCaretOffset - oneLine.frame.origin.x, oneLine.frame.size.height);
-                }
-                else
-                {
-                    // extend to right side of line
-                    rectToAddForThisLine = CGRectMake(fromCaretOffset, oneLine.frame.origin.y, oneLine.frame.origin.x + self.frame.size.width - fromCaretOffset, oneLine.frame.size.height);
-                }
-            }
-        }
-        else
-        {
-            if (lineContainsEnd)
-            {
-                if (oneLine.writingDirectionIsRightToLeft)
-                {
-                    // extend to right side of line
-                    rectToAddForThisLine = CGRectMake(toCaretOffset, oneLine.frame.origin.y, oneLine.frame.origin.x + self.frame.size.width - toCaretOffset, oneLine.frame.size.height);
-                }
-                else
-                {
-                    // extend to left side of line
-                    rectToAddForThisLine = CGRectMake(oneLine.frame.origin.x, oneLine.frame.origin.y, toCaretOffset - oneLine.frame.origin.x, oneLine.frame.size.height);
-                }
-            }
-        }
         
-        // make new DTTextSelectionRect, was NSValue with CGRect before
-        DTTextSelectionRect *selectionRect = [DTTextSelectionRect textSelectionRectWithRect:CGRectIntegral(rectToAddForThisLine)];
-        
-        selectionRect.containsStart = lineContainsStart;
-        selectionRect.containsEnd = lineContainsEnd;
-        
-        [retArray addObject:selectionRect];
+        [retArray addObject:[self selectionRectForRange:range inLine:oneLine]];
         
         if (haveStart && haveEnd)
         {
@@ -132,6 +78,81 @@
     return nil;
 }
 
+- (DTTextSelectionRect *)selectionRectForRange:(NSRange)range inLine:(DTCoreTextLayoutLine *)line
+{
+    NSInteger fromIndex = range.location;
+    NSInteger toIndex = range.location + range.length;
+    
+    CGFloat fromCaretOffset = 0.0;
+    CGFloat toCaretOffset = 0.0;
+    
+    BOOL lineContainsStart = NO;
+    BOOL lineContainsEnd = NO;
+    
+    if (NSLocationInRange(fromIndex, [line stringRange]))
+    {
+        lineContainsStart = YES;
+        
+        fromCaretOffset = [line offsetForStringIndex:fromIndex] + line.frame.origin.x;
+    }
+    
+    if (NSLocationInRange(toIndex, [line stringRange]))
+    {
+        lineContainsEnd = YES;
+        
+        toCaretOffset = [line offsetForStringIndex:toIndex] + line.frame.origin.x;
+    }
+    
+    CGRect rectToAddForThisLine = line.frame;
+    
+    if (lineContainsStart)
+    {
+        if (lineContainsEnd)
+        {
+            rectToAddForThisLine = CGRectStandardize(CGRectMake(fromCaretOffset, line.frame.origin.y, toCaretOffset - fromCaretOffset, line.frame.size.height));
+        }
+        else
+        {
+            // ending after this line
+            
+            if (line.writingDirectionIsRightToLeft)
+            {
+                // extend to left side of line
+                rectToAddForThisLine = CGRectMake(line.frame.origin.x, line.frame.origin.y, fromCaretOffset - line.frame.origin.x, line.frame.size.height);
+            }
+            else
+            {
+                // extend to right side of line
+                rectToAddForThisLine = CGRectMake(fromCaretOffset, line.frame.origin.y, line.frame.origin.x + self.frame.size.width - fromCaretOffset, line.frame.size.height);
+            }
+        }
+    }
+    else
+    {
+        if (lineContainsEnd)
+        {
+            if (line.writingDirectionIsRightToLeft)
+            {
+                // extend to right side of line
+                rectToAddForThisLine = CGRectMake(toCaretOffset, line.frame.origin.y, line.frame.origin.x + self.frame.size.width - toCaretOffset, line.frame.size.height);
+            }
+            else
+            {
+                // extend to left side of line
+                rectToAddForThisLine = CGRectMake(line.frame.origin.x, line.frame.origin.y, toCaretOffset - line.frame.origin.x, line.frame.size.height);
+            }
+        }
+    }
+    
+    // make new DTTextSelectionRect, was NSValue with CGRect before
+    DTTextSelectionRect *selectionRect = [DTTextSelectionRect textSelectionRectWithRect:CGRectIntegral(rectToAddForThisLine)];
+    
+    selectionRect.containsStart = lineContainsStart;
+    selectionRect.containsEnd = lineContainsEnd;
+    
+    return selectionRect;
+}
+
 - (NSInteger)indexForPositionUpwardsFromIndex:(NSInteger)index offset:(NSInteger)offset
 {
 	NSInteger lineIndex = [self lineIndexForGlyphIndex:index];
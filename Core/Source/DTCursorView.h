@@ -8,7 +8,12 @@
 
 #import <UIKit/UIKit.h>
 
-extern NSString * const DTCursorViewDidBlink;
+/**
+ Notification that used to be posted whenever the cursor blinked.
+ 
+ @warning The cursor blinks with a Core Animation animation and no longer posts this notification. The name is only kept so that existing references still link.
+ */
+extern NSString * const DTCursorViewDidBlink __attribute__((deprecated("The cursor no longer posts this notification, blinking is a Core Animation animation.")));
 
 /**
  The current cursor state
@@ -30,6 +35,8 @@ typedef NS_ENUM(NSUInteger, DTCursorState)
  Class for representing a caret (aka cursor) in DTRichTextEditorView.
  
  The backgroundColor of the cursor view is the caret color, the default is the same blue that Apple uses.
+ 
+ Blinking is a repeating keyframe animation of the layer opacity, it restarts with the cursor visible whenever the frame changes.
  */
 @interface DTCursorView : UIView 
 
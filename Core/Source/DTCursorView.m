@@ -8,12 +8,14 @@
 
 #import "DTCursorView.h"
 
+#import <QuartzCore/QuartzCore.h>
 
+
+// kept for binary compatibility, never posted
 NSString * const DTCursorViewDidBlink = @"DTCursorViewDidBlink";
 
 @implementation DTCursorView
 {
-	NSTimer *blinkingTimer;
 	DTCursorState _state;
 }
 
@@ -34,63 +36,47 @@ NSString * const DTCursorViewDidBlink = @"DTCursorViewDidBlink";
 	return self;
 }
 
-- (void)dealloc
-{
-	[blinkingTimer invalidate], blinkingTimer = nil;
-}
-
-- (void)setTimerForNextBlink
+// blinking is done by the render server, so an idle cursor does not wake up the app
+- (void)_startBlinking
 {
-	[blinkingTimer invalidate], blinkingTimer = nil;
+	[self.layer removeAnimationForKey:@"blink"];
 	
-	if (self.hidden)
+	if (_state != DTCursorStateBlinking || !self.window)
 	{
-		blinkingTimer = [NSTimer scheduledTimerWithTimeInterval:0.4 target:self selector:@selector(blink:) userInfo:nil repeats:NO];
-	}
-	else 
-	{
-		blinkingTimer = [NSTimer scheduledTimerWithTimeInterval:0.8 target:self selector:@selector(blink:) userInfo:nil repeats:NO];
+		return;
 	}
+	
+	// visible for 0.8 seconds, then hidden for 0.4 seconds
+	CAKeyframeAnimation *animation = [CAKeyframeAnimation animationWithKeyPath:@"opacity"];
+	animation.values = @[@1.0f, @0.0f];
+	animation.keyTimes = @[@0.0f, @(0.8f/1.2f), @1.0f];
+	animation.calculationMode = kCAAnimationDiscrete;
+	animation.duration = 1.2;
+	animation.repeatCount = HUGE_VALF;
+	animation.removedOnCompletion = NO;
+	
+	[self.layer addAnimation:animation forKey:@"blink"];
 }
 
-// start timer when becoming visible, stop when off a window
-- (void)willMoveToWindow:(UIWindow *)newWindow
+// start blinking when becoming visible, stop when off a window
+- (void)didMoveToWindow
 {
-	if (newWindow)
-	{
-		// blink after a while again
-		[self setTimerForNextBlink];
-	}
-	else 
-	{
-		[blinkingTimer invalidate], blinkingTimer = nil;
-	}
+	[super didMoveToWindow];
+	
+	[self _startBlinking];
 }
 
 - (void)setFrame:(CGRect)newFrame
 {
+	BOOL didChange = !CGRectEqualToRect(newFrame, self.frame);
+	
 	[super setFrame:newFrame];
 	
-	// frame changing keeps cursor visible
-	[blinkingTimer invalidate], blinkingTimer = nil;
-	self.hidden = NO;
-
-	// blink after a while again
-	[self setTimerForNextBlink];
-}
-
-- (void)blink:(NSTimer *)timer
-{
-	if (_state == DTCursorStateStatic)
+	// frame changing keeps cursor visible, blink after a while again
+	if (didChange)
 	{
-		return;
+		[self _startBlinking];
 	}
-	
-	self.hidden = !self.hidden;
-	
-	[self setTimerForNextBlink];
-	
-	[[NSNotificationCenter defaultCenter] postNotificationName:DTCursorViewDidBlink object:self];
 }
 
 - (void)tintColorDidChange
@@ -104,24 +90,8 @@ NSString * const DTCursorViewDidBlink = @"DTCursorViewDidBlink";
 {
 	_state = state;
 	
-	switch (state) 
-	{
-		case DTCursorStateBlinking:
-		{
-			[self setTimerForNextBlink];
-			
-			break;
-		}
-			
-		case DTCursorStateStatic:
-		{
-			[blinkingTimer invalidate], blinkingTimer = nil;
-			
-			self.hidden = NO;
-			
-			break;
-		}
-	}
+	// static cursors are shown without the animation
+	[self _startBlinking];
 }
 
 @synthesize state = _state;
@@ -0,0 +1,71 @@
+//
+//  DTFontCache.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <CoreText/CoreText.h>
+
+@class DTCoreTextFontDescriptor;
+
+/**
+ The trait changes that <DTFontCache> can apply to a font
+ */
+typedef enum
+{
+	DTFontTraitTransformToggleBold = 0,
+	DTFontTraitTransformToggleItalic,
+	DTFontTraitTransformAddBold,
+	DTFontTraitTransformRemoveBold,
+	DTFontTraitTransformAddItalic,
+	DTFontTraitTransformRemoveItalic
+} DTFontTraitTransform;
+
+/**
+ Shared cache for fonts derived from other fonts. Finding the font of the same family with different traits requires creating a font descriptor, looking up the family name and matching a new font. Documents usually only contain a handful of fonts spread over many attribute runs, so the result is cached per font and transform.
+ 
+ The cache is thread-safe and evicts its contents under memory pressure.
+ */
+@interface DTFontCache : NSObject
+
+/**
+ @name Getting the Shared Cache
+ */
+
+/**
+ The shared font cache
+ @returns The cache instance shared by the editing categories
+ */
++ (DTFontCache *)sharedCache;
+
+/**
+ @name Getting Fonts
+ */
+
+/**
+ Creates a font of the same family and size with the trait transform applied.
+ @param transform The trait transform
+ @param font The original font
+ @returns The transformed font, the caller needs to release it
+ */
+- (CTFontRef)newFontByApplyingTraitTransform:(DTFontTraitTransform)transform toFont:(CTFontRef)font;
+
+/**
+ Creates the font matching a font descriptor.
+ @param fontDescriptor The font descriptor
+ @returns The matching font, the caller needs to release it
+ */
+- (CTFontRef)newFontMatchingFontDescriptor:(DTCoreTextFontDescriptor *)fontDescriptor;
+
+/**
+ @name Managing the Cache
+ */
+
+/**
+ Removes all cached fonts
+ */
+- (void)removeAllFonts;
+
+@end
@@ -0,0 +1,248 @@
+//
+//  DTFontCache.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTFontCache.h"
+
+#import <DTCoreText/DTCoreText.h>
+
+#define DTFontTraitTransformCount 6
+
+// the values of a font descriptor that determine the matching font. NSDictionary hashes by count, so the font attributes would put all descriptors into the same bucket.
+@interface DTFontDescriptorCacheKey : NSObject <NSCopying>
+{
+@public
+	NSString *_fontFamily;
+	NSString *_fontName;
+	CGFloat _pointSize;
+	CTFontSymbolicTraits _symbolicTraits;
+	BOOL _smallCapsFeature;
+	NSUInteger _hash;
+}
+
+- (instancetype)initWithFontDescriptor:(DTCoreTextFontDescriptor *)fontDescriptor;
+
+@end
+
+@implementation DTFontDescriptorCacheKey
+
+- (instancetype)initWithFontDescriptor:(DTCoreTextFontDescriptor *)fontDescriptor
+{
+	self = [super init];
+	
+	if (self)
+	{
+		_fontFamily = [fontDescriptor.fontFamily copy];
+		_fontName = [fontDescriptor.fontName copy];
+		_pointSize = fontDescriptor.pointSize;
+		_symbolicTraits = fontDescriptor.symbolicTraits;
+		_smallCapsFeature = fontDescriptor.smallCapsFeature;
+		
+		// families and names hash fine, sizes and traits distinguish the fonts of a family
+		NSUInteger hash = [_fontFamily hash];
+		hash = hash * 31 + [_fontName hash];
+		hash = hash * 31 + (NSUInteger)(_pointSize * 100.0f);
+		hash = hash * 31 + _symbolicTraits;
+		hash = hash * 31 + _smallCapsFeature;
+		
+		_hash = hash;
+	}
+	
+	return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+	// immutable
+	return self;
+}
+
+- (NSUInteger)hash
+{
+	return _hash;
+}
+
+- (BOOL)isEqual:(id)object
+{
+	if (object == self)
+	{
+		return YES;
+	}
+	
+	if (![object isKindOfClass:[DTFontDescriptorCacheKey class]])
+	{
+		return NO;
+	}
+	
+	DTFontDescriptorCacheKey *other = object;
+	
+	if (other->_hash != _hash || other->_pointSize != _pointSize || other->_symbolicTraits != _symbolicTraits || other->_smallCapsFeature != _smallCapsFeature)
+	{
+		return NO;
+	}
+	
+	if (_fontFamily != other->_fontFamily && ![_fontFamily isEqualToString:other->_fontFamily])
+	{
+		return NO;
+	}
+	
+	if (_fontName != other->_fontName && ![_fontName isEqualToString:other->_fontName])
+	{
+		return NO;
+	}
+	
+	return YES;
+}
+
+@end
+
+
+@implementation DTFontCache
+{
+	// one cache per transform, keyed by the original font
+	NSCache *_transformCaches[DTFontTraitTransformCount];
+	
+	// keyed by the family, name, size and traits of the descriptors
+	NSCache *_descriptorCache;
+}
+
++ (DTFontCache *)sharedCache
+{
+	static DTFontCache *_sharedCache = nil;
+	static dispatch_once_t onceToken;
+	
+	dispatch_once(&onceToken, ^{
+		_sharedCache = [[DTFontCache alloc] init];
+	});
+	
+	return _sharedCache;
+}
+
+- (instancetype)init
+{
+	self = [super init];
+	
+	if (self)
+	{
+		for (NSUInteger i=0; i<DTFontTraitTransformCount; i++)
+		{
+			_transformCaches[i] = [[NSCache alloc] init];
+		}
+		
+		_descriptorCache = [[NSCache alloc] init];
+	}
+	
+	return self;
+}
+
+- (CTFontRef)newFontByApplyingTraitTransform:(DTFontTraitTransform)transform toFont:(CTFontRef)font
+{
+	NSParameterAssert(font);
+	NSAssert(transform < DTFontTraitTransformCount, @"Unknown font trait transform %d", (int)transform);
+	
+	NSCache *cache = _transformCaches[transform];
+	
+	// NSCache is thread-safe, a race only causes the same font to be matched twice
+	id cachedFont = [cache objectForKey:(__bridge id)font];
+	
+	if (cachedFont)
+	{
+		return (CTFontRef)CFBridgingRetain(cachedFont);
+	}
+	
+	DTCoreTextFontDescriptor *desc = [DTCoreTextFontDescriptor fontDescriptorForCTFont:font];
+	
+	// need to replace name with family
+	CFStringRef family = CTFontCopyFamilyName(font);
+	desc.fontFamily = (__bridge NSString *)family;
+	CFRelease(family);
+	
+	desc.fontName = nil;
+	
+	switch (transform)
+	{
+		case DTFontTraitTransformToggleBold:
+		{
+			desc.boldTrait = !desc.boldTrait;
+			break;
+		}
+			
+		case DTFontTraitTransformToggleItalic:
+		{
+			desc.italicTrait = !desc.italicTrait;
+			break;
+		}
+			
+		case DTFontTraitTransformAddBold:
+		{
+			desc.boldTrait = YES;
+			break;
+		}
+			
+		case DTFontTraitTransformRemoveBold:
+		{
+			desc.boldTrait = NO;
+			break;
+		}
+			
+		case DTFontTraitTransformAddItalic:
+		{
+			desc.italicTrait = YES;
+			break;
+		}
+			
+		case DTFontTraitTransformRemoveItalic:
+		{
+			desc.italicTrait = NO;
+			break;
+		}
+	}
+	
+	CTFontRef newFont = [desc newMatchingFont];
+	
+	if (newFont)
+	{
+		[cache setObject:(__bridge id)newFont forKey:(__bridge id)font];
+	}
+	
+	return newFont;
+}
+
+- (CTFontRef)newFontMatchingFontDescriptor:(DTCoreTextFontDescriptor *)fontDescriptor
+{
+	NSParameterAssert(fontDescriptor);
+	
+	// the descriptor is mutable, so the key captures its current values
+	DTFontDescriptorCacheKey *key = [[DTFontDescriptorCacheKey alloc] initWithFontDescriptor:fontDescriptor];
+	id cachedFont = [_descriptorCache objectForKey:key];
+	
+	if (cachedFont)
+	{
+		return (CTFontRef)CFBridgingRetain(cachedFont);
+	}
+	
+	CTFontRef newFont = [fontDescriptor newMatchingFont];
+	
+	if (newFont)
+	{
+		[_descriptorCache setObject:(__bridge id)newFont forKey:key];
+	}
+	
+	return newFont;
+}
+
+- (void)removeAllFonts
+{
+	for (NSUInteger i=0; i<DTFontTraitTransformCount; i++)
+	{
+		[_transformCaches[i] removeAllObjects];
+	}
+	
+	[_descriptorCache removeAllObjects];
+}
+
+@end
@@ -0,0 +1,86 @@
+//
+//  DTHTMLFragmentCache.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+
+#import "DTCacheRegistry.h"
+
+@class DTRichTextEditorMetrics;
+
+/**
+ Cache for the HTML fragments of the paragraphs of an attributed string, used by <DTRichTextEditorContentView> so that generating HTML only has to convert the paragraphs that were modified since the last time.
+
+ The cache only stores the lengths of the paragraphs and their HTML. It is informed about modifications via <invalidateRange:replacementLength:> and regenerates the invalidated paragraphs when HTML is requested for the attributed string. Lists and text blocks are cached as a whole together with everything nested in them because DTHTMLWriter needs to see all their paragraphs to nest them correctly.
+
+ The HTML of the paragraphs is put together so that it is the same as the output of a single DTHTMLWriter for the whole text, the markup the writer puts around a fragment is only output once and documents get a single style sheet.
+ */
+@interface DTHTMLFragmentCache : NSObject <DTCacheRegistryCache>
+
+/**
+ @name Invalidating Fragments
+ */
+
+/**
+ Marks the paragraphs touched by replacing a range of the attributed string as dirty, including the adjacent paragraphs it might have merged with.
+ @param range The range of the attributed string before the modification
+ @param length The length of the replacement text
+ */
+- (void)invalidateRange:(NSRange)range replacementLength:(NSUInteger)length;
+
+/**
+ Removes all cached fragments, for example if the attributed string was replaced entirely.
+ */
+- (void)removeAllFragments;
+
+/**
+ @name Getting HTML
+ */
+
+/**
+ Determines the paragraphs whose HTML needs to be generated again.
+ @param attributedString The current attributed string
+ @returns An array of `NSValue` ranges of the dirty paragraphs
+ */
+- (NSArray *)rangesOfDirtyParagraphsInAttributedString:(NSAttributedString *)attributedString;
+
+/**
+ Generates an HTML fragment for the paragraphs intersecting a range, all paragraphs returned by <rangesOfDirtyParagraphsInAttributedString:> in this range are clean afterwards.
+ @param range The range of the attributed string
+ @param attributedString The current attributed string
+ @param textScale The text scale for DTHTMLWriter, changing it discards all fragments
+ @returns The HTML fragment with inline styles
+ */
+- (NSString *)HTMLFragmentForParagraphsInRange:(NSRange)range ofAttributedString:(NSAttributedString *)attributedString textScale:(CGFloat)textScale;
+
+/**
+ Generates an HTML document for the attributed string from the cached paragraphs, all paragraphs are clean afterwards.
+ @param attributedString The current attributed string
+ @param textScale The text scale for DTHTMLWriter, changing it discards all fragments
+ @returns The HTML document with a style sheet
+ */
+- (NSString *)HTMLStringForAttributedString:(NSAttributedString *)attributedString textScale:(CGFloat)textScale;
+
+/**
+ Generates HTML for the attributed string from the cached paragraphs, the dirty paragraphs are converted on a background queue. They are clean afterwards unless they were modified in the meantime.
+ @param attributedString An immutable snapshot of the current attributed string
+ @param textScale The text scale for DTHTMLWriter, changing it discards all fragments
+ @param fragment `YES` for an HTML fragment with inline styles, `NO` for a document with a style sheet
+ @param completion The block to execute on the main thread with the generated HTML
+ */
+- (void)HTMLStringForAttributedString:(NSAttributedString *)attributedString textScale:(CGFloat)textScale fragment:(BOOL)fragment completion:(void (^)(NSString *HTMLString))completion;
+
+/**
+ @name Measuring Performance
+ */
+
+/**
+ If set then every cached paragraph that is used counts as a hit and every paragraph that is converted again as a miss. Set by <DTRichTextEditorContentView>.
+ */
+@property (nonatomic, strong) DTRichTextEditorMetrics *metrics;
+
+@end
@@ -0,0 +1,781 @@
+//
+//  DTHTMLFragmentCache.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTHTMLFragmentCache.h"
+#import "DTRichTextEditorMetrics.h"
+
+#import <DTCoreText/DTCoreText.h>
+
+// a paragraph or a list with its HTML, dirty fragments have no HTML and might span several paragraphs
+@interface DTHTMLFragment : NSObject
+{
+@public
+	NSUInteger _length;
+	NSString *_HTML;
+}
+
+@end
+
+@implementation DTHTMLFragment
+
+@end
+
+
+// determines if a paragraph needs to be included for a range
+static BOOL _DTParagraphRangeIntersectsRange(NSRange paragraphRange, NSRange range)
+{
+	if (!range.length)
+	{
+		return (range.location >= paragraphRange.location && range.location < NSMaxRange(paragraphRange));
+	}
+	
+	return (NSIntersectionRange(paragraphRange, range).length > 0);
+}
+
+// DTHTMLWriter has no lists or text blocks open before a paragraph that is not part of one, the text before and after it can be written separately
+static BOOL _DTFragmentCanStartAtIndex(NSAttributedString *attributedString, NSUInteger index)
+{
+	if (!index || index >= [attributedString length])
+	{
+		return YES;
+	}
+	
+	NSDictionary *attributes = [attributedString attributesAtIndex:index effectiveRange:NULL];
+	
+	return (![[attributes objectForKey:DTTextListsAttribute] count] && ![[attributes objectForKey:DTTextBlocksAttribute] count]);
+}
+
+// splits a range into paragraphs, lists and text blocks stay together with everything nested in them
+static NSArray *_DTFragmentRangesInRange(NSAttributedString *attributedString, NSRange range)
+{
+	NSString *string = [attributedString string];
+	NSMutableArray *ranges = [NSMutableArray array];
+	
+	NSRange fragmentRange = NSMakeRange(range.location, 0);
+	
+	NSUInteger index = range.location;
+	
+	while (index < NSMaxRange(range))
+	{
+		NSRange paragraphRange = [string paragraphRangeForRange:NSMakeRange(index, 0)];
+		NSUInteger paragraphEnd = MIN(NSMaxRange(paragraphRange), NSMaxRange(range));
+		NSUInteger paragraphLength = paragraphEnd - index;
+		
+		if (fragmentRange.length && !_DTFragmentCanStartAtIndex(attributedString, index))
+		{
+			fragmentRange.length += paragraphLength;
+		}
+		else
+		{
+			if (fragmentRange.length)
+			{
+				[ranges addObject:[NSValue valueWithRange:fragmentRange]];
+			}
+			
+			fragmentRange = NSMakeRange(index, paragraphLength);
+		}
+		
+		index = paragraphEnd;
+	}
+	
+	if (fragmentRange.length)
+	{
+		[ranges addObject:[NSValue valueWithRange:fragmentRange]];
+	}
+	
+	return ranges;
+}
+
+// the markup DTHTMLWriter puts around every fragment, found by comparing the fragment of a paragraph with the one of the same paragraph twice
+static BOOL _DTWrapperOfHTMLFragments(NSString *single, NSString *twice, NSString **prefix, NSString **suffix)
+{
+	if ([twice length] < [single length] || [twice length] > 2 * [single length])
+	{
+		return NO;
+	}
+	
+	NSUInteger bodyLength = [twice length] - [single length];
+	NSUInteger wrapperLength = [single length] - bodyLength;
+	
+	for (NSUInteger location=0; location<=wrapperLength; location++)
+	{
+		NSString *head = [single substringToIndex:location + bodyLength];
+		NSString *tail = [single substringFromIndex:location];
+		
+		if ([twice isEqualToString:[head stringByAppendingString:tail]])
+		{
+			*prefix = [single substringToIndex:location];
+			*suffix = [single substringFromIndex:location + bodyLength];
+			
+			return YES;
+		}
+	}
+	
+	return NO;
+}
+
+// the HTML of paragraphs without the fragment wrapper so that it can be concatenated with the HTML of other paragraphs
+static NSString *_DTHTMLBodyOfParagraphs(NSAttributedString *attributedString, NSRange range, CGFloat textScale, NSString *prefix, NSString *suffix)
+{
+	DTHTMLWriter *writer = [[DTHTMLWriter alloc] initWithAttributedString:[attributedString attributedSubstringFromRange:range]];
+	writer.textScale = textScale;  // the writer will divide font sizes by this value
+	
+	NSString *HTML = [writer HTMLFragment] ?: @"";
+	
+	if ([HTML length] >= [prefix length] + [suffix length] && [HTML hasPrefix:prefix] && [HTML hasSuffix:suffix])
+	{
+		return [HTML substringWithRange:NSMakeRange([prefix length], [HTML length] - [prefix length] - [suffix length])];
+	}
+	
+	return HTML;
+}
+
+// replaces the inline styles of fragment HTML with the classes DTHTMLWriter uses for a document, numbered per element in the order of their first use
+static NSString *_DTHTMLByReplacingInlineStylesWithClasses(NSString *HTML, NSString **styleSheet)
+{
+	NSMutableString *output = [NSMutableString string];
+	NSMutableDictionary *styleLookup = [NSMutableDictionary dictionary];
+	
+	NSUInteger length = [HTML length];
+	NSUInteger location = 0;
+	
+	while (location < length)
+	{
+		NSRange styleRange = [HTML rangeOfString:@" style=\"" options:NSLiteralSearch range:NSMakeRange(location, length - location)];
+		
+		if (styleRange.location == NSNotFound)
+		{
+			break;
+		}
+		
+		NSUInteger valueStart = NSMaxRange(styleRange);
+		NSRange quoteRange = [HTML rangeOfString:@"\"" options:NSLiteralSearch range:NSMakeRange(valueStart, length - valueStart)];
+		
+		if (quoteRange.location == NSNotFound)
+		{
+			break;
+		}
+		
+		NSRange searchRange = NSMakeRange(0, styleRange.location);
+		NSRange tagStartRange = [HTML rangeOfString:@"<" options:NSLiteralSearch | NSBackwardsSearch range:searchRange];
+		NSRange tagEndRange = [HTML rangeOfString:@">" options:NSLiteralSearch | NSBackwardsSearch range:searchRange];
+		
+		// text outside of a tag stays as it is
+		if (tagStartRange.location == NSNotFound || (tagEndRange.location != NSNotFound && tagEndRange.location > tagStartRange.location))
+		{
+			[output appendString:[HTML substringWithRange:NSMakeRange(location, valueStart - location)]];
+			location = valueStart;
+			
+			continue;
+		}
+		
+		NSRange nameRange = NSMakeRange(NSMaxRange(tagStartRange), styleRange.location - NSMaxRange(tagStartRange));
+		NSRange nameEndRange = [HTML rangeOfCharacterFromSet:[NSCharacterSet whitespaceAndNewlineCharacterSet] options:NSLiteralSearch range:nameRange];
+		
+		if (nameEndRange.location != NSNotFound)
+		{
+			nameRange.length = nameEndRange.location - nameRange.location;
+		}
+		
+		NSString *elementName = [HTML substringWithRange:nameRange];
+		NSString *style = [HTML substringWithRange:NSMakeRange(valueStart, quoteRange.location - valueStart)];
+		
+		NSMutableArray *styles = [styleLookup objectForKey:elementName];
+		
+		if (!styles)
+		{
+			styles = [NSMutableArray array];
+			[styleLookup setObject:styles forKey:elementName];
+		}
+		
+		NSUInteger index = [styles indexOfObject:style];
+		
+		if (index == NSNotFound)
+		{
+			[styles addObject:style];
+			index = [styles count] - 1;
+		}
+		
+		[output appendString:[HTML substringWithRange:NSMakeRange(location, styleRange.location - location)]];
+		[output appendFormat:@" class=\"%@%lu\"", [elementName substringToIndex:1], (unsigned long)index + 1];
+		
+		location = NSMaxRange(quoteRange);
+	}
+	
+	if (location < length)
+	{
+		[output appendString:[HTML substringFromIndex:location]];
+	}
+	
+	NSMutableString *styles = [NSMutableString string];
+	
+	for (NSString *elementName in [[styleLookup allKeys] sortedArrayUsingSelector:@selector(compare:)])
+	{
+		[[styleLookup objectForKey:elementName] enumerateObjectsUsingBlock:^(NSString *style, NSUInteger idx, BOOL *stop) {
+			[styles appendFormat:@"%@.%@%lu {%@}\n", elementName, [elementName substringToIndex:1], (unsigned long)idx + 1, style];
+		}];
+	}
+	
+	*styleSheet = styles;
+	
+	return output;
+}
+
+
+// puts the HTML of the paragraphs into the document format of DTHTMLWriter, determined by -[DTHTMLFragmentCache _calibrateWriter]
+static NSString *_DTHTMLDocumentWithBody(NSString *body, NSString *head, NSString *styleSheetEnd, NSString *tail)
+{
+	NSString *styleSheet = nil;
+	NSString *documentBody = _DTHTMLByReplacingInlineStylesWithClasses(body, &styleSheet);
+	
+	// the writer might leave out the style sheet without styles
+	if (!head || ![styleSheet length])
+	{
+		return nil;
+	}
+	
+	return [NSString stringWithFormat:@"%@%@%@%@%@", head, styleSheet, styleSheetEnd, documentBody, tail];
+}
+
+
+@implementation DTHTMLFragmentCache
+{
+	NSMutableArray *_fragments;
+	NSUInteger _length;
+	CGFloat _textScale;
+	
+	// the output format of DTHTMLWriter, see _calibrateWriter
+	BOOL _writerCalibrated;
+	NSString *_fragmentPrefix;
+	NSString *_fragmentSuffix;
+	NSString *_documentHead;
+	NSString *_documentStyleSheetEnd;
+	NSString *_documentTail;
+	
+	DTRichTextEditorMetrics *_metrics;
+}
+
+- (id)init
+{
+	self = [super init];
+	
+	if (self)
+	{
+		_fragments = [[NSMutableArray alloc] init];
+		_textScale = 1.0f;
+		
+		[[DTCacheRegistry sharedRegistry] registerCache:self evictionOrder:DTCacheEvictionOrderDerivedData];
+	}
+	
+	return self;
+}
+
+#pragma mark - Invalidating Fragments
+
+- (void)invalidateRange:(NSRange)range replacementLength:(NSUInteger)length
+{
+	if (![_fragments count])
+	{
+		// nothing cached yet
+		return;
+	}
+	
+	if (NSMaxRange(range) > _length)
+	{
+		// we missed a modification
+		[self removeAllFragments];
+		return;
+	}
+	
+	NSUInteger location = 0;
+	NSUInteger firstIndex = NSNotFound;
+	NSUInteger lastIndex = NSNotFound;
+	NSUInteger mergedLength = 0;
+	
+	NSUInteger numberOfFragments = [_fragments count];
+	
+	for (NSUInteger i=0; i<numberOfFragments; i++)
+	{
+		DTHTMLFragment *fragment = [_fragments objectAtIndex:i];
+		NSUInteger end = location + fragment->_length;
+		
+		if (location > NSMaxRange(range))
+		{
+			break;
+		}
+		
+		// adjacent fragments are included, removing a newline merges paragraphs
+		if (end >= range.location)
+		{
+			if (firstIndex == NSNotFound)
+			{
+				firstIndex = i;
+			}
+			
+			lastIndex = i;
+			mergedLength += fragment->_length;
+		}
+		
+		location = end;
+	}
+	
+	NSRange replacedFragments = NSMakeRange(firstIndex, lastIndex - firstIndex + 1);
+	
+	DTHTMLFragment *dirtyFragment = [[DTHTMLFragment alloc] init];
+	dirtyFragment->_length = mergedLength - range.length + length;
+	
+	if (dirtyFragment->_length)
+	{
+		[_fragments replaceObjectsInRange:replacedFragments withObjectsFromArray:@[dirtyFragment]];
+	}
+	else
+	{
+		[_fragments removeObjectsInRange:replacedFragments];
+	}
+	
+	_length = _length - range.length + length;
+}
+
+- (void)removeAllFragments
+{
+	[_fragments removeAllObjects];
+	_length = 0;
+}
+
+// starts over with a single dirty fragment if the cache does not match the string
+- (void)_synchronizeWithAttributedString:(NSAttributedString *)attributedString textScale:(CGFloat)textScale
+{
+	NSUInteger length = [attributedString length];
+	
+	if ([_fragments count] && _length == length && _textScale == textScale)
+	{
+		return;
+	}
+	
+	[self removeAllFragments];
+	
+	if (_textScale != textScale)
+	{
+		_textScale = textScale;
+		_writerCalibrated = NO;
+	}
+	
+	if (length)
+	{
+		DTHTMLFragment *dirtyFragment = [[DTHTMLFragment alloc] init];
+		dirtyFragment->_length = length;
+		
+		[_fragments addObject:dirtyFragment];
+		_length = length;
+	}
+}
+
+// dirty fragments take over the neighbours a list or text block continues into, these have to be written together
+- (void)_extendDirtyFragmentsOfAttributedString:(NSAttributedString *)attributedString
+{
+	NSUInteger location = 0;
+	NSUInteger index = 0;
+	
+	while (index < [_fragments count])
+	{
+		DTHTMLFragment *fragment = [_fragments objectAtIndex:index];
+		NSUInteger end = location + fragment->_length;
+		
+		if (fragment->_HTML)
+		{
+			location = end;
+			index++;
+			
+			continue;
+		}
+		
+		NSRange mergedFragments = NSMakeRange(index, 1);
+		NSUInteger mergedLength = fragment->_length;
+		
+		if (index && !_DTFragmentCanStartAtIndex(attributedString, location))
+		{
+			DTHTMLFragment *previousFragment = [_fragments objectAtIndex:index - 1];
+			
+			mergedFragments.location--;
+			mergedFragments.length++;
+			mergedLength += previousFragment->_length;
+			location -= previousFragment->_length;
+		}
+		
+		if (index + 1 < [_fragments count] && !_DTFragmentCanStartAtIndex(attributedString, end))
+		{
+			DTHTMLFragment *nextFragment = [_fragments objectAtIndex:index + 1];
+			
+			mergedFragments.length++;
+			mergedLength += nextFragment->_length;
+		}
+		
+		if (mergedFragments.length == 1)
+		{
+			location = end;
+			index++;
+			
+			continue;
+		}
+		
+		// the loop checks the boundaries of the merged fragment again
+		DTHTMLFragment *dirtyFragment = [[DTHTMLFragment alloc] init];
+		dirtyFragment->_length = mergedLength;
+		
+		[_fragments replaceObjectsInRange:mergedFragments withObjectsFromArray:@[dirtyFragment]];
+		index = mergedFragments.location;
+	}
+}
+
+// splits the dirty fragments intersecting a range into the parts DTHTMLWriter converts separately, returns the indexes of the fragments intersecting the range
+- (NSRange)_prepareFragmentsForParagraphsInRange:(NSRange)range ofAttributedString:(NSAttributedString *)attributedString location:(NSUInteger *)firstLocation
+{
+	[self _extendDirtyFragmentsOfAttributedString:attributedString];
+	
+	NSUInteger location = 0;
+	NSUInteger index = 0;
+	NSUInteger firstIndex = NSNotFound;
+	
+	while (index < [_fragments count])
+	{
+		DTHTMLFragment *fragment = [_fragments objectAtIndex:index];
+		NSRange fragmentRange = NSMakeRange(location, fragment->_length);
+		
+		if (range.length && fragmentRange.location >= NSMaxRange(range))
+		{
+			break;
+		}
+		
+		if (!_DTParagraphRangeIntersectsRange(fragmentRange, range))
+		{
+			location += fragment->_length;
+			index++;
+			
+			continue;
+		}
+		
+		if (!fragment->_HTML)
+		{
+			NSArray *ranges = _DTFragmentRangesInRange(attributedString, fragmentRange);
+			
+			if ([ranges count] > 1)
+			{
+				NSMutableArray *dirtyFragments = [NSMutableArray array];
+				
+				for (NSValue *value in ranges)
+				{
+					DTHTMLFragment *dirtyFragment = [[DTHTMLFragment alloc] init];
+					dirtyFragment->_length = [value rangeValue].length;
+					
+					[dirtyFragments addObject:dirtyFragment];
+				}
+				
+				// the loop continues with the first of those
+				[_fragments replaceObjectsInRange:NSMakeRange(index, 1) withObjectsFromArray:dirtyFragments];
+				
+				continue;
+			}
+		}
+		
+		if (firstIndex == NSNotFound)
+		{
+			firstIndex = index;
+			*firstLocation = location;
+		}
+		
+		location += fragment->_length;
+		index++;
+	}
+	
+	if (firstIndex == NSNotFound)
+	{
+		return NSMakeRange(index, 0);
+	}
+	
+	return NSMakeRange(firstIndex, index - firstIndex);
+}
+
+/*
+ DTHTMLWriter can only convert a whole attributed string. Its output for separately written parts only equals the output for the whole text if the markup it puts around every fragment is written once, and for documents the inline styles are replaced by the same style sheet.
+ 
+ The fragment wrapper is what the fragment of a paragraph has in addition to its HTML in the fragment of the same paragraph twice. The document format is taken from the document of that paragraph. If the document of the paragraph does not contain its converted HTML then documents are written as a whole.
+ */
+- (void)_calibrateWriter
+{
+	if (_writerCalibrated)
+	{
+		return;
+	}
+	
+	_writerCalibrated = YES;
+	
+	_fragmentPrefix = @"";
+	_fragmentSuffix = @"";
+	_documentHead = nil;
+	_documentStyleSheetEnd = nil;
+	_documentTail = nil;
+	
+	NSData *data = [@"<p><b>x</b></p>" dataUsingEncoding:NSUTF8StringEncoding];
+	NSMutableAttributedString *paragraph = [[[NSAttributedString alloc] initWithHTMLData:data documentAttributes:NULL] mutableCopy];
+	
+	if (![paragraph length])
+	{
+		return;
+	}
+	
+	if (![[paragraph string] hasSuffix:@"\n"])
+	{
+		NSDictionary *attributes = [paragraph attributesAtIndex:[paragraph length] - 1 effectiveRange:NULL];
+		[paragraph appendAttributedString:[[NSAttributedString alloc] initWithString:@"\n" attributes:attributes]];
+	}
+	
+	NSMutableAttributedString *paragraphs = [paragraph mutableCopy];
+	[paragraphs appendAttributedString:paragraph];
+	
+	DTHTMLWriter *writer = [[DTHTMLWriter alloc] initWithAttributedString:paragraph];
+	writer.textScale = _textScale;
+	
+	DTHTMLWriter *twiceWriter = [[DTHTMLWriter alloc] initWithAttributedString:paragraphs];
+	twiceWriter.textScale = _textScale;
+	
+	NSString *fragment = [writer HTMLFragment];
+	NSString *prefix = nil;
+	NSString *suffix = nil;
+	
+	if (!_DTWrapperOfHTMLFragments(fragment, [twiceWriter HTMLFragment], &prefix, &suffix))
+	{
+		// fragments are put together as they are
+		return;
+	}
+	
+	_fragmentPrefix = prefix;
+	_fragmentSuffix = suffix;
+	
+	NSString *document = [writer HTMLString];
+	NSString *styleSheet = nil;
+	NSString *body = [fragment substringWithRange:NSMakeRange([prefix length], [fragment length] - [prefix length] - [suffix length])];
+	NSString *documentBody = _DTHTMLByReplacingInlineStylesWithClasses(body, &styleSheet);
+	
+	NSRange bodyRange = [document rangeOfString:documentBody options:NSLiteralSearch | NSBackwardsSearch];
+	
+	if (![styleSheet length] || ![documentBody length] || bodyRange.location == NSNotFound)
+	{
+		return;
+	}
+	
+	NSRange styleSheetRange = [document rangeOfString:styleSheet options:NSLiteralSearch | NSBackwardsSearch range:NSMakeRange(0, bodyRange.location)];
+	
+	if (styleSheetRange.location == NSNotFound)
+	{
+		return;
+	}
+	
+	_documentHead = [document substringToIndex:styleSheetRange.location];
+	_documentStyleSheetEnd = [document substringWithRange:NSMakeRange(NSMaxRange(styleSheetRange), bodyRange.location - NSMaxRange(styleSheetRange))];
+	_documentTail = [document substringFromIndex:NSMaxRange(bodyRange)];
+}
+
+// the HTML of the paragraphs intersecting a range without the fragment wrapper, converts the dirty ones
+- (NSString *)_HTMLBodyForParagraphsInRange:(NSRange)range ofAttributedString:(NSAttributedString *)attributedString
+{
+	NSUInteger location = 0;
+	NSRange fragmentIndexes = [self _prepareFragmentsForParagraphsInRange:range ofAttributedString:attributedString location:&location];
+	
+	NSMutableString *HTML = [NSMutableString string];
+	
+	for (NSUInteger index=fragmentIndexes.location; index<NSMaxRange(fragmentIndexes); index++)
+	{
+		DTHTMLFragment *fragment = [_fragments objectAtIndex:index];
+		
+		[_metrics recordLookupInCache:DTRichTextEditorMetricsCacheHTMLFragments hit:(fragment->_HTML != nil)];
+		
+		if (!fragment->_HTML)
+		{
+			fragment->_HTML = _DTHTMLBodyOfParagraphs(attributedString, NSMakeRange(location, fragment->_length), _textScale, _fragmentPrefix, _fragmentSuffix);
+		}
+		
+		[HTML appendString:fragment->_HTML];
+		
+		location += fragment->_length;
+	}
+	
+	return HTML;
+}
+
+#pragma mark - Getting HTML
+
+- (NSArray *)rangesOfDirtyParagraphsInAttributedString:(NSAttributedString *)attributedString
+{
+	[self _synchronizeWithAttributedString:attributedString textScale:_textScale];
+	[self _extendDirtyFragmentsOfAttributedString:attributedString];
+	
+	NSMutableArray *ranges = [NSMutableArray array];
+	NSUInteger location = 0;
+	
+	for (DTHTMLFragment *fragment in _fragments)
+	{
+		if (!fragment->_HTML)
+		{
+			[ranges addObjectsFromArray:_DTFragmentRangesInRange(attributedString, NSMakeRange(location, fragment->_length))];
+		}
+		
+		location += fragment->_length;
+	}
+	
+	return ranges;
+}
+
+- (NSString *)HTMLFragmentForParagraphsInRange:(NSRange)range ofAttributedString:(NSAttributedString *)attributedString textScale:(CGFloat)textScale
+{
+	[self _synchronizeWithAttributedString:attributedString textScale:textScale];
+	[self _calibrateWriter];
+	
+	NSString *body = [self _HTMLBodyForParagraphsInRange:range ofAttributedString:attributedString];
+	
+	if (![body length])
+	{
+		return body;
+	}
+	
+	return [NSString stringWithFormat:@"%@%@%@", _fragmentPrefix, body, _fragmentSuffix];
+}
+
+- (NSString *)HTMLStringForAttributedString:(NSAttributedString *)attributedString textScale:(CGFloat)textScale
+{
+	[self _synchronizeWithAttributedString:attributedString textScale:textScale];
+	[self _calibrateWriter];
+	
+	if (_documentHead)
+	{
+		NSString *body = [self _HTMLBodyForParagraphsInRange:NSMakeRange(0, [attributedString length]) ofAttributedString:attributedString];
+		NSString *HTML = _DTHTMLDocumentWithBody(body, _documentHead, _documentStyleSheetEnd, _documentTail);
+		
+		if (HTML)
+		{
+			return HTML;
+		}
+	}
+	
+	DTHTMLWriter *writer = [[DTHTMLWriter alloc] initWithAttributedString:attributedString];
+	writer.textScale = textScale;  // the writer will divide font sizes by this value
+	
+	return [writer HTMLString];
+}
+
+- (void)HTMLStringForAttributedString:(NSAttributedString *)attributedString textScale:(CGFloat)textScale fragment:(BOOL)fragment completion:(void (^)(NSString *HTMLString))completion
+{
+	NSParameterAssert(completion);
+	
+	[self _synchronizeWithAttributedString:attributedString textScale:textScale];
+	[self _calibrateWriter];
+	
+	// a snapshot of the fragments, the dirty ones are written on the background queue
+	NSArray *fragments = nil;
+	NSMutableArray *bodies = [NSMutableArray array];
+	NSMutableArray *ranges = [NSMutableArray array];
+	
+	BOOL usesFragments = (fragment || _documentHead);
+	
+	if (usesFragments)
+	{
+		NSUInteger location = 0;
+		NSRange fragmentIndexes = [self _prepareFragmentsForParagraphsInRange:NSMakeRange(0, [attributedString length]) ofAttributedString:attributedString location:&location];
+		
+		fragments = [_fragments subarrayWithRange:fragmentIndexes];
+		
+		for (DTHTMLFragment *oneFragment in fragments)
+		{
+			[_metrics recordLookupInCache:DTRichTextEditorMetricsCacheHTMLFragments hit:(oneFragment->_HTML != nil)];
+			
+			[bodies addObject:oneFragment->_HTML ?: [NSNull null]];
+			[ranges addObject:[NSValue valueWithRange:NSMakeRange(location, oneFragment->_length)]];
+			
+			location += oneFragment->_length;
+		}
+	}
+	
+	NSString *prefix = _fragmentPrefix;
+	NSString *suffix = _fragmentSuffix;
+	NSString *documentHead = _documentHead;
+	NSString *documentStyleSheetEnd = _documentStyleSheetEnd;
+	NSString *documentTail = _documentTail;
+	
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		
+		NSString *HTML = nil;
+		
+		if (usesFragments)
+		{
+			NSMutableString *body = [NSMutableString string];
+			
+			for (NSUInteger index=0; index<[bodies count]; index++)
+			{
+				if ([bodies objectAtIndex:index] == [NSNull null])
+				{
+					NSRange range = [[ranges objectAtIndex:index] rangeValue];
+					[bodies replaceObjectAtIndex:index withObject:_DTHTMLBodyOfParagraphs(attributedString, range, textScale, prefix, suffix)];
+				}
+				
+				[body appendString:[bodies objectAtIndex:index]];
+			}
+			
+			if (fragment)
+			{
+				HTML = [body length] ? [NSString stringWithFormat:@"%@%@%@", prefix, body, suffix] : body;
+			}
+			else
+			{
+				HTML = _DTHTMLDocumentWithBody(body, documentHead, documentStyleSheetEnd, documentTail);
+			}
+		}
+		
+		if (!HTML)
+		{
+			DTHTMLWriter *writer = [[DTHTMLWriter alloc] initWithAttributedString:attributedString];
+			writer.textScale = textScale;  // the writer will divide font sizes by this value
+			
+			HTML = fragment ? [writer HTMLFragment] : [writer HTMLString];
+		}
+		
+		dispatch_async(dispatch_get_main_queue(), ^{
+			
+			// fragments that were modified in the meantime have been replaced
+			[fragments enumerateObjectsUsingBlock:^(DTHTMLFragment *oneFragment, NSUInteger idx, BOOL *stop) {
+				if (!oneFragment->_HTML && [_fragments indexOfObjectIdenticalTo:oneFragment] != NSNotFound)
+				{
+					oneFragment->_HTML = [bodies objectAtIndex:idx];
+				}
+			}];
+			
+			completion(HTML);
+		});
+	});
+}
+
+#pragma mark - DTCacheRegistryCache
+
+- (NSUInteger)cacheCost
+{
+	NSUInteger cost = 0;
+	
+	for (DTHTMLFragment *fragment in _fragments)
+	{
+		cost += [fragment->_HTML length] * sizeof(unichar);
+	}
+	
+	return cost;
+}
+
+- (void)purgeCache
+{
+	[self removeAllFragments];
+}
+
+@synthesize metrics = _metrics;
+
+@end
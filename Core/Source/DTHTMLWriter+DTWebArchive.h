@@ -21,4 +21,12 @@
  */
 - (DTWebArchive *)webArchive;
 
+/**
+ Writes a web archive of the writer's attributed string to a stream. This avoids the intermediate objects of <webArchive> and the copy made by serializing the archive into a data object, images are written with their original bytes if the attachment still has them.
+ @param stream An open output stream
+ @param error The error that occurred if writing failed
+ @returns `YES` if the archive was written
+ */
+- (BOOL)writeWebArchiveToStream:(NSOutputStream *)stream error:(NSError **)error;
+
 @end
@@ -7,6 +7,7 @@
 //
 
 #import "DTHTMLWriter+DTWebArchive.h"
+#import "DTRichTextImageAttachment.h"
 
 #import <DTWebArchive/DTWebArchive.h>
 #import <DTWebArchive/DTWebResource.h>
@@ -15,6 +16,50 @@
 
 @class DTWebArchive;
 
+// calls the block once per image URL with the data to put into the web archive
+static void _DTEnumerateImageResourcesInAttributedString(NSAttributedString *attributedString, void (^block)(NSData *data, NSURL *URL, NSString *MIMEType))
+{
+	NSArray *images = [attributedString textAttachmentsWithPredicate:nil class:[DTImageTextAttachment class]];
+	NSMutableSet *addedURLs = [NSMutableSet set];
+	
+	for (DTImageTextAttachment *oneAttachment in images)
+	{
+		// images without contentURL are represented as data URL in the HTML
+		if (!oneAttachment.contentURL || [addedURLs containsObject:oneAttachment.contentURL])
+		{
+			continue;
+		}
+		
+		NSData *data = nil;
+		NSString *MIMEType = nil;
+		
+		// reuse the original bytes, encoding as PNG is slow and usually makes JPEGs a lot larger
+		if ([oneAttachment isKindOfClass:[DTRichTextImageAttachment class]])
+		{
+			DTRichTextImageAttachment *imageAttachment = (DTRichTextImageAttachment *)oneAttachment;
+			
+			if (imageAttachment.imageData && imageAttachment.MIMEType)
+			{
+				data = imageAttachment.imageData;
+				MIMEType = imageAttachment.MIMEType;
+			}
+		}
+		
+		if (!data)
+		{
+			data = UIImagePNGRepresentation(oneAttachment.image);
+			MIMEType = @"image/png";
+		}
+		
+		if (data)
+		{
+			[addedURLs addObject:oneAttachment.contentURL];
+			
+			block(data, oneAttachment.contentURL, MIMEType);
+		}
+	}
+}
+
 @implementation DTHTMLWriter (DTWebArchive)
 
 - (DTWebArchive *)webArchive
@@ -22,38 +67,53 @@
 	// this string does the general generation and also includes optional text size scaling
 	NSString *htmlString = [self HTMLString];
 	
-	NSData *data = [htmlString dataUsingEncoding:NSUTF8StringEncoding];
+	NSData *htmlData = [htmlString dataUsingEncoding:NSUTF8StringEncoding];
+	
+	NSMutableArray *subresources = [NSMutableArray array];
 	
-	NSMutableArray *subresources = nil;
+	_DTEnumerateImageResourcesInAttributedString(self.attributedString, ^(NSData *data, NSURL *URL, NSString *MIMEType) {
+		
+		DTWebResource *resource = [[DTWebResource alloc] initWithData:data URL:URL MIMEType:MIMEType textEncodingName:nil frameName:nil];
+		[subresources addObject:resource];
+	});
 	
-	NSArray *images = [self.attributedString textAttachmentsWithPredicate:nil class:[DTImageTextAttachment class]];
+	DTWebResource *mainResource = [[DTWebResource alloc] initWithData:htmlData URL:nil MIMEType:@"text/html" textEncodingName:@"UTF8" frameName:nil];
+	DTWebArchive *newArchive = [[DTWebArchive alloc] initWithMainResource:mainResource subresources:[subresources count]?subresources:nil subframeArchives:nil];
 	
-	if ([images count])
+	return newArchive;
+}
+
+- (BOOL)writeWebArchiveToStream:(NSOutputStream *)stream error:(NSError **)error
+{
+	NSData *htmlData = [[self HTMLString] dataUsingEncoding:NSUTF8StringEncoding];
+	
+	NSDictionary *mainResource = @{@"WebResourceData": htmlData,
+		@"WebResourceMIMEType": @"text/html",
+		@"WebResourceTextEncodingName": @"UTF8",
+		@"WebResourceFrameName": @""};
+	
+	NSMutableArray *subresources = [NSMutableArray array];
+	
+	// the resource data is shared with the attachments, only the serialized archive is written
+	_DTEnumerateImageResourcesInAttributedString(self.attributedString, ^(NSData *data, NSURL *URL, NSString *MIMEType) {
+		
+		NSDictionary *resource = @{@"WebResourceData": data,
+			@"WebResourceURL": [URL absoluteString],
+			@"WebResourceMIMEType": MIMEType};
+		
+		[subresources addObject:resource];
+	});
+	
+	NSMutableDictionary *archive = [NSMutableDictionary dictionaryWithObject:mainResource forKey:@"WebMainResource"];
+	
+	if ([subresources count])
 	{
-		subresources = [NSMutableArray array];
-		for (DTImageTextAttachment *oneAttachment in images)
-		{
-			// only add web resources for images that are not data URLs and that have a contentURL
-			if (oneAttachment.image && !oneAttachment.contentURL)
-			{
-				// this is an image in a data URL, that's already represented in the HTML
-				continue;
-			}
-			
-			NSData *data = UIImagePNGRepresentation(oneAttachment.image);
-			
-			if (data)
-			{
-				DTWebResource *resource = [[DTWebResource alloc] initWithData:data URL:oneAttachment.contentURL MIMEType:@"image/png" textEncodingName:nil frameName:nil];
-				[subresources addObject:resource];
-			}
-		}
+		[archive setObject:subresources forKey:@"WebSubresources"];
 	}
 	
-	DTWebResource *mainResource = [[DTWebResource alloc] initWithData:data URL:nil MIMEType:@"text/html" textEncodingName:@"UTF8" frameName:nil];
-	DTWebArchive *newArchive = [[DTWebArchive alloc] initWithMainResource:mainResource subresources:subresources subframeArchives:nil];
+	NSInteger bytesWritten = [NSPropertyListSerialization writePropertyList:archive toStream:stream format:NSPropertyListBinaryFormat_v1_0 options:0 error:error];
 	
-	return newArchive;
+	return (bytesWritten > 0);
 }
 
 @end
@@ -8,10 +8,22 @@
 
 #import <DTCoreText/DTCoreTextLayoutFrame.h>
 
+#import "DTCacheRegistry.h"
+
+@class DTParagraphRasterCache;
+@class DTRichTextEditorMetrics;
+
+// posted on the main thread when the height of a lazily laid out frame changes because estimated paragraphs got laid out
+extern NSString * const DTMutableCoreTextLayoutFrameDidChangeHeightNotification;
+
 /**
  Mutable subclass of <DTCoreTextLayoutFrame> to allow editing
+
+ Lines are kept grouped by paragraph in a <DTParagraphLineTable>. An edit only relayouts the affected paragraphs, the lines of following paragraphs are moved to their new position lazily when they are accessed, for example when they become visible.
+
+ If <shouldLayoutLazily> is set then paragraphs are only laid out when they are drawn or a caret, selection or hit-testing query needs their lines. Until then they are represented by an estimated height.
  */
-@interface DTMutableCoreTextLayoutFrame : DTCoreTextLayoutFrame
+@interface DTMutableCoreTextLayoutFrame : DTCoreTextLayoutFrame <DTCacheRegistryCache>
 
 /**
  @name Creating Mutable Layout Frames
@@ -50,6 +62,141 @@
  */
 - (void)replaceTextInRange:(NSRange)range withText:(NSAttributedString *)text dirtyRect:(CGRect *)dirtyRect;
 
+/**
+ Replaces the attributed text in the given range with new text, but only lays out the lines of the paragraph starting with the line before the one containing the range. This is meant for modifications that are repeated while the user is composing text in a long paragraph, like marked text of an input method.
+ 
+ If the range or the text contain a paragraph break or the paragraph does not have its lines yet this falls back to <replaceTextInRange:withText:dirtyRect:>.
+ @param range The string range to replace
+ @param text The text to replace the range with
+ @param dirtyRect Output param to receive the dirtyRect or `NULL` if this is not required
+ */
+- (void)replaceTextInLinesOfRange:(NSRange)range withText:(NSAttributedString *)text dirtyRect:(CGRect *)dirtyRect;
+
+/**
+ Replaces the attributed text in the given range with new text. If <shouldLayoutAsynchronously> is set then the affected paragraphs are typeset on a background queue.
+ 
+ The string itself is modified right away, the paragraphs are represented by estimates until the finished lines are swapped in. Queries that need these lines before that, like caret or selection geometry, wait for the background layout.
+ @param range The string range to replace
+ @param text The text to replace the range with
+ @param completion The block to execute on the main thread after the new lines have been swapped in, receives the rectangle to redraw. Not executed if a later edit made the layout obsolete.
+ */
+- (void)replaceTextInRange:(NSRange)range withText:(NSAttributedString *)text completion:(void (^)(CGRect dirtyRect))completion;
+
+/**
+ Replaces the attributed text in the given range with new text, but does not typeset the affected paragraphs yet. They are represented by estimates until <layoutDeferredParagraphs> is called or a query needs their lines.
+ 
+ This allows several quick edits, like a burst of typed characters, to share a single layout pass.
+ @param range The string range to replace
+ @param text The text to replace the range with
+ */
+- (void)replaceTextInRange:(NSRange)range withTextDeferringLayout:(NSAttributedString *)text;
+
+/**
+ Typesets all paragraphs modified by <replaceTextInRange:withTextDeferringLayout:> since the last call.
+ @returns The rectangle that needs to be redrawn, `CGRectNull` if there was nothing to lay out
+ */
+- (CGRect)layoutDeferredParagraphs;
+
+/**
+ Whether there are modified paragraphs waiting for <layoutDeferredParagraphs>
+ */
+@property (nonatomic, readonly) BOOL hasDeferredLayout;
+
+/**
+ @name Releasing Memory
+ */
+
+/**
+ Releases all lines and cached geometry, keeping only the string and the height of every paragraph. Paragraphs are laid out again when their lines are needed, the height of the receiver does not change until then.
+ 
+ This is meant for text that is not on screen. The lines of other widths and the selection rectangles are also released by the shared <DTCacheRegistry> on memory pressure.
+ */
+- (void)discardLines;
+
+/**
+ @name Changing Attributes
+ */
+
+/**
+ Replaces the attributes in the given range if the change does not affect glyph metrics, like colors, highlights, underlines or links. Instead of laying out the paragraphs again the existing lines are recreated with the same string ranges and origins, all other lines stay untouched.
+ @param range The string range to modify
+ @param text The replacement text, it needs to have the same characters as the range
+ @param dirtyRect Output param to receive the rectangle covering the modified lines or `NULL` if this is not required
+ @returns `YES` if the attributes were replaced, `NO` if the change requires <replaceTextInRange:withText:dirtyRect:>
+ */
+- (BOOL)replaceAttributesInRange:(NSRange)range withText:(NSAttributedString *)text dirtyRect:(CGRect *)dirtyRect;
+
+/**
+ @name Getting Paragraph Ranges
+ */
+
+/**
+ These methods work like the ones of the `NSString (Paragraphs)` category of DTCoreText for the text of the receiver. They are answered from the paragraph index maintained by every replacement in O(log n) instead of scanning characters. If the index does not match the text, for example before the first layout, they fall back to the string methods.
+ */
+
+/**
+ The number of paragraphs in the text of the receiver
+ */
+@property (nonatomic, readonly) NSUInteger numberOfParagraphs;
+
+/**
+ Determines the range of the paragraph containing a string index.
+ @param index The string index
+ @returns The string range of the paragraph, including its paragraph break
+ */
+- (NSRange)rangeOfParagraphAtIndex:(NSUInteger)index;
+
+/**
+ Determines the range of the full paragraphs covered by a range.
+ @param range The string range
+ @param parBeginIndex Output param for the start of the first paragraph or `NULL`
+ @param parEndIndex Output param for the end of the last paragraph or `NULL`
+ @returns The string range of the paragraphs
+ */
+- (NSRange)rangeOfParagraphsContainingRange:(NSRange)range parBegIndex:(NSUInteger *)parBeginIndex parEndIndex:(NSUInteger *)parEndIndex;
+
+/**
+ Determines if a string index is the first index of a paragraph.
+ @param index The string index
+ @returns `YES` if a paragraph starts at the index
+ */
+- (BOOL)indexIsAtBeginningOfParagraph:(NSUInteger)index;
+
+/**
+ @name Getting Attachments
+ */
+
+/**
+ The text attachments in a string range. Mutable layout frames maintain an index of their attachments across edits, so that neither this method nor `textAttachments` requires the lines to be laid out.
+ @param range The string range
+ @returns The attachments in the order of their string location
+ */
+- (NSArray *)textAttachmentsInRange:(NSRange)range;
+
+/**
+ The text attachments in a string range that are of a class and match a predicate.
+ @param predicate The predicate the attachments are evaluated with or `nil` for all attachments
+ @param attachmentClass The class of the attachments or `Nil` for any class
+ @param range The string range
+ @returns The matching attachments in the order of their string location
+ */
+- (NSArray *)textAttachmentsWithPredicate:(NSPredicate *)predicate class:(Class)attachmentClass inRange:(NSRange)range;
+
+/**
+ The text attachments that show a content URL, looked up by the URL instead of evaluating every attachment.
+ @param contentURL The content URL
+ @returns The matching attachments in no particular order
+ */
+- (NSArray *)textAttachmentsWithContentURL:(NSURL *)contentURL;
+
+/**
+ Changes the content URL of all text attachments that show a URL, for example once an image was uploaded. Use this instead of setting the `contentURL` of the attachments so that <textAttachmentsWithContentURL:> finds them by the new URL.
+ @param contentURL The current content URL
+ @param newURL The new content URL
+ @returns The string indexes of the modified attachments
+ */
+- (NSIndexSet *)replaceContentURL:(NSURL *)contentURL withURL:(NSURL *)newURL;
+
 
 /**
  @name Properties
@@ -62,9 +209,41 @@
  */
 @property (nonatomic, assign) BOOL shouldRebuildLines;
 
+/**
+ Specifies that <relayoutText> should only estimate paragraph heights instead of laying out the entire text.
+
+ Paragraphs get laid out when they become visible or when their lines are needed for caret or selection geometry. Every time this changes the height of the receiver a `DTMutableCoreTextLayoutFrameDidChangeHeightNotification` is posted. Methods that need all lines, like accessing `lines`, still force layout of the entire text.
+
+ Defaults to `NO`
+ */
+@property (nonatomic, assign) BOOL shouldLayoutLazily;
+
+/**
+ Specifies that <replaceTextInRange:withText:completion:> should typeset changed paragraphs on a background queue.
+ 
+ Defaults to `NO`
+ */
+@property (nonatomic, assign) BOOL shouldLayoutAsynchronously;
+
+/**
+ If set then the receiver draws each paragraph from a bitmap in this cache, paragraphs that are not found are rasterized once and added to it. Scrolling then only needs to composite the cached bitmaps instead of drawing the text again.
+ 
+ Defaults to `nil`
+ */
+@property (nonatomic, strong) DTParagraphRasterCache *paragraphRasterCache;
+
+/**
+ If set then the receiver measures typesetting and line shifting of edits, counts the lines it laid out again and the hits of the <paragraphRasterCache>.
+ 
+ Defaults to `nil`
+ */
+@property (nonatomic, strong) DTRichTextEditorMetrics *metrics;
+
 /**
  Modifies the text frame of the receiver. 
  
+ If only the width changes then the lines of the previous width are kept, returning to one of the last two widths while the text was not modified restores their lines without typesetting. For a new width only the visible paragraphs are laid out right away; unless <shouldLayoutLazily> is set the remaining ones are laid out on a background queue.
+ 
  Set <shouldRebuildLines> to `NO` to avoid relayouting text on a frame change
  @param frame The new frame
  */
@@ -76,5 +255,17 @@
  */
 - (void)setAttributedString:(NSAttributedString *)attributedString;
 
+/**
+ Replaces the text contents of the receiver without copying the string, it is modified in place by all following edits.
+ @param attributedString The new attributed string, the receiver takes ownership of it
+ */
+- (void)adoptAttributedString:(NSMutableAttributedString *)attributedString;
+
+/**
+ Replaces the text contents of the receiver without copying the string and only estimates the paragraph heights, as if <shouldLayoutLazily> was set. Paragraphs are laid out once they are drawn or queried. If <shouldLayoutLazily> is not set the remaining paragraphs are laid out on a background queue afterwards.
+ @param attributedString The new attributed string, the receiver takes ownership of it
+ */
+- (void)adoptAttributedStringLayingOutLazily:(NSMutableAttributedString *)attributedString;
+
 
 @end
@@ -11,21 +11,222 @@
 #import "DTMutableCoreTextLayoutFrame.h"
 #import "DTRichTextCategories.h"
 #import "DTCoreTextLayoutFrame+DTRichText.h"
+#import "DTParagraphLineTable.h"
+#import "DTTextSelectionRect.h"
+#import "DTParagraphRasterCache.h"
+#import "DTRichTextImageAttachment.h"
+#import "DTTextAttachmentIndex.h"
+#import "DTRichTextEditorMetrics.h"
+
+NSString * const DTMutableCoreTextLayoutFrameDidChangeHeightNotification = @"DTMutableCoreTextLayoutFrameDidChangeHeightNotification";
+
+// the number of other layout widths whose lines are kept
+#define DTMaximumCachedWidthLayouts 2
+
+// estimated paragraphs laid out per block on the layout queue after a width change
+#define DTEstimatedParagraphsLayoutBatchSize 32
+
+// rough memory for the glyphs, positions and advances of typeset text and for selection rectangles
+#define DTEstimatedBytesPerTypesetCharacter 48
+#define DTEstimatedBytesPerSelectionRectangle 96
+
+// attributes that are only used for drawing and don't change the glyphs or their metrics
+static NSSet *_DTMetricNeutralAttributes(void)
+{
+	static NSSet *_metricNeutralAttributes = nil;
+	static dispatch_once_t onceToken;
+	
+	dispatch_once(&onceToken, ^{
+		NSMutableSet *attributes = [NSMutableSet setWithObjects:(id)kCTForegroundColorAttributeName, (id)kCTForegroundColorFromContextAttributeName, (id)kCTUnderlineStyleAttributeName, (id)kCTUnderlineColorAttributeName, DTBackgroundColorAttribute, DTStrikeOutAttribute, DTLinkAttribute, DTGUIDAttribute, nil];
+		
+		if (DTCoreTextModernAttributesPossible())
+		{
+			[attributes addObjectsFromArray:@[NSForegroundColorAttributeName, NSBackgroundColorAttributeName, NSUnderlineStyleAttributeName, NSStrikethroughStyleAttributeName]];
+		}
+		
+		_metricNeutralAttributes = [attributes copy];
+	});
+	
+	return _metricNeutralAttributes;
+}
+
+// determines if replacing the range with the text only changes drawing attributes
+static BOOL _DTReplacementChangesOnlyMetricNeutralAttributes(NSAttributedString *attributedString, NSRange range, NSAttributedString *text)
+{
+	if ([text length] != range.length || !range.length)
+	{
+		return NO;
+	}
+	
+	if ([[attributedString string] compare:[text string] options:NSLiteralSearch range:range] != NSOrderedSame)
+	{
+		return NO;
+	}
+	
+	NSSet *neutralAttributes = _DTMetricNeutralAttributes();
+	NSUInteger index = 0;
+	
+	while (index < range.length)
+	{
+		NSRange oldEffectiveRange;
+		NSRange newEffectiveRange;
+		
+		NSDictionary *oldAttributes = [attributedString attributesAtIndex:range.location + index effectiveRange:&oldEffectiveRange];
+		NSDictionary *newAttributes = [text attributesAtIndex:index effectiveRange:&newEffectiveRange];
+		
+		if (oldAttributes != newAttributes && ![oldAttributes isEqualToDictionary:newAttributes])
+		{
+			NSMutableSet *keys = [NSMutableSet setWithArray:[oldAttributes allKeys]];
+			[keys addObjectsFromArray:[newAttributes allKeys]];
+			
+			for (NSString *key in keys)
+			{
+				if ([neutralAttributes containsObject:key])
+				{
+					continue;
+				}
+				
+				id oldValue = [oldAttributes objectForKey:key];
+				id newValue = [newAttributes objectForKey:key];
+				
+				if (oldValue != newValue && ![oldValue isEqual:newValue])
+				{
+					return NO;
+				}
+			}
+		}
+		
+		NSUInteger segmentEnd = MIN(NSMaxRange(oldEffectiveRange) - range.location, NSMaxRange(newEffectiveRange));
+		index = MIN(segmentEnd, range.length);
+	}
+	
+	return YES;
+}
+
+// determines if the text contains images that would only draw their placeholder
+static BOOL _DTTextHasPendingImageAttachments(NSAttributedString *text, CGFloat scale)
+{
+	__block BOOL hasPendingImages = NO;
+	
+	[text enumerateAttribute:NSAttachmentAttributeName inRange:NSMakeRange(0, [text length]) options:0 usingBlock:^(id attachment, NSRange range, BOOL *stop) {
+		
+		if ([attachment isKindOfClass:[DTRichTextImageAttachment class]] && ![attachment hasDisplayImageForScale:scale])
+		{
+			hasPendingImages = YES;
+			*stop = YES;
+		}
+	}];
+	
+	return hasPendingImages;
+}
+
+// a paragraph layout running on the background layout queue
+@interface DTPendingParagraphLayout : NSObject
+
+@property (nonatomic, assign) NSUInteger location;
+@property (nonatomic, strong) NSAttributedString *text;
+@property (nonatomic, strong) NSArray *paragraphs;
+@property (nonatomic, assign) BOOL deferred; // typeset by layoutDeferredParagraphs instead of the layout queue
+@property (nonatomic, readonly) dispatch_group_t group;
+
+@end
+
+@implementation DTPendingParagraphLayout
+{
+	dispatch_group_t _group;
+}
+
+- (id)init
+{
+	self = [super init];
+	
+	if (self)
+	{
+		_group = dispatch_group_create();
+	}
+	
+	return self;
+}
+
+- (void)dealloc
+{
+#if !OS_OBJECT_USE_OBJC
+	dispatch_release(_group);
+#endif
+}
+
+- (dispatch_group_t)group
+{
+	return _group;
+}
+
+@end
+
+
+// the lines of a layout width that was used before, valid as long as the text was not modified
+@interface DTCachedWidthLayout : NSObject
+
+@property (nonatomic, assign) CGRect frame;
+@property (nonatomic, strong) DTParagraphLineTable *paragraphTable;
+@property (nonatomic, assign) NSUInteger textGeneration;
+
+@end
+
+@implementation DTCachedWidthLayout
+
+@end
+
+
+@interface DTMutableCoreTextLayoutFrame () <DTParagraphLineTableLayoutDelegate>
+
+@end
 
 @implementation DTMutableCoreTextLayoutFrame
 {
 	NSRange _cachedSelectionRectanglesRange;
 	NSArray *_cachedSelectionRectangles;
 	
+	// selection rects by line index, reused for lines whose geometry did not change
+	NSMutableArray *_selectionRectanglesByLine;
+	NSUInteger _selectionRectanglesFirstLineIndex;
+	NSRange _selectionRectanglesRange;
+	NSUInteger _selectionRectanglesGeneration;
+	
 	UIEdgeInsets _edgeInsets; // space between frame edges and text
 	BOOL shouldRebuildLines;
 	
 	// concurrent queue for syncing drawing and updates
 	dispatch_queue_t _syncQueue;
+	
+	// lines grouped by paragraph with offset-encoded positions
+	DTParagraphLineTable *_paragraphTable;
+	
+	BOOL _shouldLayoutLazily;
+	BOOL _heightChangeNotificationPending;
+	
+	// serial queue for typesetting changed paragraphs in the background
+	BOOL _shouldLayoutAsynchronously;
+	dispatch_queue_t _layoutQueue;
+	NSMutableArray *_pendingLayouts;
+	
+	DTParagraphRasterCache *_paragraphRasterCache;
+	
+	// attachments by string location, maintained across edits
+	DTTextAttachmentIndex *_attachmentIndex;
+	
+	// lines of previously used widths, most recent first
+	NSMutableArray *_cachedWidthLayouts;
+	NSUInteger _textGeneration;
+	
+	DTRichTextEditorMetrics *_metrics;
 }
 
 
 @synthesize shouldRebuildLines;
+@synthesize shouldLayoutLazily = _shouldLayoutLazily;
+@synthesize shouldLayoutAsynchronously = _shouldLayoutAsynchronously;
+@synthesize paragraphRasterCache = _paragraphRasterCache;
+@synthesize metrics = _metrics;
 
 - (id)initWithFrame:(CGRect)frame attributedString:(NSAttributedString *)attributedString
 {
@@ -47,6 +248,11 @@
 		}
 		
 		_syncQueue = dispatch_queue_create("DTMutableCoreTextLayoutFrame Sync Queue", DISPATCH_QUEUE_CONCURRENT);
+		_layoutQueue = dispatch_queue_create("DTMutableCoreTextLayoutFrame Layout Queue", DISPATCH_QUEUE_SERIAL);
+		_pendingLayouts = [[NSMutableArray alloc] init];
+		_cachedWidthLayouts = [[NSMutableArray alloc] init];
+		
+		[[DTCacheRegistry sharedRegistry] registerCache:self evictionOrder:DTCacheEvictionOrderLayout];
 		
 		// we don't need a layouter because we create a temporary one if we need it
 	}
@@ -58,6 +264,7 @@
 {
 #if !OS_OBJECT_USE_OBJC
 	dispatch_release(_syncQueue);
+	dispatch_release(_layoutQueue);
 #endif
 }
 
@@ -71,12 +278,54 @@
 	}
 }
 
+- (void)adoptAttributedString:(NSMutableAttributedString *)attributedString
+{
+	if (attributedString != _attributedStringFragment)
+	{
+		_attributedStringFragment = attributedString;
+		
+		[self relayoutText];
+	}
+}
+
+- (void)adoptAttributedStringLayingOutLazily:(NSMutableAttributedString *)attributedString
+{
+	if (attributedString != _attributedStringFragment)
+	{
+		_attributedStringFragment = attributedString;
+		
+		[self _relayoutTextLazily:YES];
+	}
+}
+
 - (void)relayoutText
+{
+	[self _relayoutTextLazily:_shouldLayoutLazily];
+}
+
+- (void)_relayoutTextLazily:(BOOL)lazily
 {
 	dispatch_barrier_sync(_syncQueue, ^{
 		
 		// next call needs new selection rectangles
-		_cachedSelectionRectangles = nil;
+		[self _invalidateSelectionRectangles];
+		
+		// lines kept for other widths are obsolete, too
+		_textGeneration++;
+		[_cachedWidthLayouts removeAllObjects];
+		
+		if (lazily)
+		{
+			[self _estimateParagraphs];
+			
+			if (!_shouldLayoutLazily)
+			{
+				// the rest follows in the background
+				[self _layoutEstimatedParagraphsOfTable:_paragraphTable fromIndex:0];
+			}
+			
+			return;
+		}
 		
 		// layout the new text
 		DTCoreTextLayouter *tmpLayouter = [[DTCoreTextLayouter alloc] initWithAttributedString:_attributedStringFragment];
@@ -85,232 +334,362 @@
 		NSRange allTextRange = NSMakeRange(0, 0);
 		DTCoreTextLayoutFrame *tmpFrame = [tmpLayouter layoutFrameWithRect:rect range:allTextRange];
 		
+		// background layouts are obsolete with a complete layout
+		[self _cancelPendingLayouts];
+		
 		// transfer the lines
 		_lines = [tmpFrame.lines copy];
+		_paragraphTable = [[DTParagraphLineTable alloc] initWithLines:_lines string:[_attributedStringFragment string]];
+		_paragraphRanges = nil;
 		
 		// correct the overall frame size
-		DTCoreTextLayoutLine *lastLine = [_lines lastObject];
-		_frame.size.height = ceilf((CGRectGetMaxY(lastLine.frame) - _frame.origin.y + 1.5));
+		_frame.size.height = ceilf((_paragraphTable.maxY - _frame.origin.y + 1.5));
 		
 		// some attachments might have been overwritten, so we force refresh of the attachments list
-		_textAttachments = nil;
+		_attachmentIndex = nil;
 	});
 }
 
-- (void)relayoutTextInRange:(NSRange)range
+// estimates the metrics for all paragraphs of the attributed string, the caller needs to free the returned arrays
+- (NSUInteger)_estimateParagraphsInAttributedString:(NSAttributedString *)attributedString lengths:(NSInteger **)outLengths ascents:(CGFloat **)outAscents descents:(CGFloat **)outDescents
 {
-	// that's the full paragraphs that are "dirty"
-	NSRange dirtyParagraphRange = [[_attributedStringFragment string] rangeOfParagraphsContainingRange:range parBegIndex:NULL parEndIndex:NULL];
-	
-	// layout the new paragraph text
-	DTCoreTextLayouter *tmpLayouter = [[DTCoreTextLayouter alloc] initWithAttributedString:_attributedStringFragment];
-	
-	// same rect as self, but open height
-	CGRect rect = self.frame;
-	rect.size.height = CGFLOAT_HEIGHT_UNKNOWN;
-	
-	DTCoreTextLayoutFrame *tmpFrame = [tmpLayouter layoutFrameWithRect:rect range:dirtyParagraphRange];
-	
-	NSArray *relayoutedLines = tmpFrame.lines;
+	NSString *string = [attributedString string];
+	NSUInteger stringLength = [string length];
 	
-	NSMutableArray *newLines = [[NSMutableArray alloc] init];
+	NSUInteger capacity = 64;
+	NSUInteger count = 0;
 	
-	NSMutableArray *suffixLines = [NSMutableArray array];
+	NSInteger *lengths = malloc(capacity * sizeof(NSInteger));
+	CGFloat *ascents = malloc(capacity * sizeof(CGFloat));
+	CGFloat *descents = malloc(capacity * sizeof(CGFloat));
 	
-	NSUInteger indexInOldLines = 0;
+	CGFloat availableWidth = MAX(_frame.size.width, 1.0f);
+	NSUInteger index = 0;
 	
-	// copy the unchanged head
-	for (DTCoreTextLayoutLine *oneLine in _lines)
+	while (index < stringLength)
 	{
-		NSUInteger startIndex = oneLine.stringRange.location;
-		if (startIndex < dirtyParagraphRange.location)
+		NSUInteger paragraphEnd;
+		[string getParagraphStart:NULL end:&paragraphEnd contentsEnd:NULL forRange:NSMakeRange(index, 0)];
+		
+		if (count == capacity)
 		{
-			[newLines addObject:oneLine];
-			indexInOldLines++;
+			capacity *= 2;
+			lengths = realloc(lengths, capacity * sizeof(NSInteger));
+			ascents = realloc(ascents, capacity * sizeof(CGFloat));
+			descents = realloc(descents, capacity * sizeof(CGFloat));
 		}
-		else if (startIndex>=NSMaxRange(dirtyParagraphRange))
+		
+		NSUInteger paragraphLength = paragraphEnd - index;
+		
+		// font and spacing of the first character are good enough for an estimate
+		CTFontRef font = (__bridge CTFontRef)[attributedString attribute:(id)kCTFontAttributeName atIndex:index effectiveRange:NULL];
+		CTParagraphStyleRef paragraphStyle = (__bridge CTParagraphStyleRef)[attributedString attribute:(id)kCTParagraphStyleAttributeName atIndex:index effectiveRange:NULL];
+		
+		CGFloat fontSize = 12.0f;
+		CGFloat ascent = 10.0f;
+		CGFloat lineHeight = 14.0f;
+		
+		if (font)
 		{
-			[suffixLines addObject:oneLine];
+			fontSize = CTFontGetSize(font);
+			ascent = CTFontGetAscent(font);
+			lineHeight = ascent + CTFontGetDescent(font) + CTFontGetLeading(font);
 		}
-	}
-	
-	DTCoreTextLayoutLine *previousLine = [newLines lastObject];
-	
-	// copy the changed lines
-	for (DTCoreTextLayoutLine *oneLine in relayoutedLines)
-	{
-		if (previousLine)
+		
+		CGFloat paragraphSpacing = 0;
+		
+		if (paragraphStyle)
 		{
-            oneLine.baselineOrigin = [self baselineOriginToPositionLine:(id)oneLine afterLine:(id)previousLine options:DTCoreTextLayoutFrameLinePositioningOptionAlgorithmWebKit];
-			[oneLine adjustStringRangeToStartAtIndex:NSMaxRange(previousLine.stringRange)];
+			CTParagraphStyleGetValueForSpecifier(paragraphStyle, kCTParagraphStyleSpecifierParagraphSpacing, sizeof(paragraphSpacing), &paragraphSpacing);
 		}
 		
-		[newLines addObject:oneLine];
-		
-		previousLine = oneLine;
-	}
-	
-	// copy the rest
-	for (DTCoreTextLayoutLine *oneLine in suffixLines)
-	{
-        oneLine.baselineOrigin = [self baselineOriginToPositionLine:(id)oneLine afterLine:(id)previousLine options:DTCoreTextLayoutFrameLinePositioningOptionAlgorithmWebKit];
-		[oneLine adjustStringRangeToStartAtIndex:NSMaxRange(previousLine.stringRange)];
+		// assume an average glyph width of half the font size
+		NSUInteger numberOfLines = MAX(1, (NSUInteger)ceilf(paragraphLength * fontSize * 0.5f / availableWidth));
 		
-		[newLines addObject:oneLine];
+		lengths[count] = paragraphLength;
+		ascents[count] = ascent;
+		descents[count] = numberOfLines * lineHeight - ascent + paragraphSpacing;
 		
-		previousLine = oneLine;
+		count++;
+		index = paragraphEnd;
 	}
 	
-	// save
-	_lines = newLines;
+	*outLengths = lengths;
+	*outAscents = ascents;
+	*outDescents = descents;
 	
-	previousLine = [_lines lastObject];
-	
-	// correct the overall frame size
-	_frame.size.height = ceilf((CGRectGetMaxY(previousLine.frame) - _frame.origin.y + 1.5));
-	
-	// some attachments might have been overwritten, so we force refresh of the attachments list
-	_textAttachments = nil;
+	return count;
 }
 
-
-- (CGRect)_frameCoveringLines:(NSArray *)array
+// creates a paragraph table with estimated heights, called inside the barrier
+- (void)_estimateParagraphs
 {
-	NSAssert([array count], @"cannot pass empty array");
+	NSInteger *lengths;
+	CGFloat *ascents;
+	CGFloat *descents;
 	
-	DTCoreTextLayoutLine *firstLine = [array objectAtIndex:0];
-	CGRect rect = firstLine.frame;
+	NSUInteger count = [self _estimateParagraphsInAttributedString:_attributedStringFragment lengths:&lengths ascents:&ascents descents:&descents];
 	
-	DTCoreTextLayoutLine *lastLine = [array lastObject];
+	_paragraphTable = [[DTParagraphLineTable alloc] initWithNumberOfEstimatedParagraphs:count lengths:lengths ascents:ascents descents:descents originY:_frame.origin.y];
+	_paragraphTable.layoutDelegate = self;
 	
-	if (firstLine != lastLine)
-	{
-		rect = CGRectUnion(rect, lastLine.frame);
-	}
+	free(lengths);
+	free(ascents);
+	free(descents);
 	
-	return CGRectIntegral(rect);
+	[self _cancelPendingLayouts];
+	
+	_lines = nil;
+	_paragraphRanges = nil;
+	
+	_frame.size.height = ceilf((_paragraphTable.maxY - _frame.origin.y + 1.5));
+	
+	// some attachments might have been overwritten, so we force refresh of the attachments list
+	_attachmentIndex = nil;
 }
 
-
-- (void)replaceTextInRange:(NSRange)range withText:(NSAttributedString *)text dirtyRect:(CGRect *)dirtyRect
+- (void)relayoutTextInRange:(NSRange)range
 {
-	dispatch_barrier_sync(_syncQueue, ^{
-		
-		NSString *plainText = [_attributedStringFragment string];
+	if (![self _paragraphTableMatchesString])
+	{
+		// nothing to update incrementally yet
+		[self relayoutText];
 		
-		// get beginning and end of paragraph containing the replaced range
-		NSUInteger parBeginIndex;
-		NSUInteger parEndIndex;
-		NSRange rangeForRedoneParagraphs;
+		return;
+	}
+	
+	dispatch_barrier_sync(_syncQueue, ^{
 		
-		// get the first and last index of the paragraphs containing this range
-		rangeForRedoneParagraphs = [plainText rangeOfParagraphsContainingRange:range parBegIndex:&parBeginIndex parEndIndex:&parEndIndex];
+		// that's the full paragraphs that are "dirty"
+		NSRange dirtyParagraphRange = [self rangeOfParagraphsContainingRange:range parBegIndex:NULL parEndIndex:NULL];
+		NSRange paragraphs = [self paragraphRangeContainingStringRange:dirtyParagraphRange];
 		
-		// if the range ends on a \n then we need to extend to include the following paragraph if it's actually a deletion
-		if (parEndIndex < [plainText length] && ![text length])
+		if (!paragraphs.length)
 		{
-			if ([plainText indexIsAtBeginningOfParagraph:parEndIndex])
-			{
-				NSRange extendedRange = range;
-				extendedRange.length += 1;
-				rangeForRedoneParagraphs = [plainText rangeOfParagraphsContainingRange:extendedRange parBegIndex:&parBeginIndex parEndIndex:&parEndIndex];
-			}
+			return;
 		}
 		
-		// text between begin of paragraph and insertion point is prefix
-		NSAttributedString *prefix = nil;
+		// background layouts for these paragraphs are obsolete
+		[self _updatePendingLayoutsForReplacementInParagraphRange:dirtyParagraphRange changeInLength:0];
 		
-		if (range.location > parBeginIndex)
-		{
-			NSRange prefixRange = NSMakeRange(parBeginIndex, range.location - parBeginIndex);
-			prefix = [_attributedStringFragment attributedSubstringFromRange:prefixRange];
-		}
+		// the lines of these paragraphs change, also those of other widths and their selection rectangles
+		_textGeneration++;
+		[_cachedWidthLayouts removeAllObjects];
+		[self _invalidateSelectionRectangles];
+		
+		// layout the paragraph text
+		DTCoreTextLayouter *tmpLayouter = [[DTCoreTextLayouter alloc] initWithAttributedString:[_attributedStringFragment attributedSubstringFromRange:dirtyParagraphRange]];
+		CGRect rect = _frame;
+		rect.size.height = CGFLOAT_HEIGHT_UNKNOWN;
+		DTCoreTextLayoutFrame *tmpFrame = [tmpLayouter layoutFrameWithRect:rect range:NSMakeRange(0, 0)];
+		
+		NSArray *relayoutedLines = tmpFrame.lines;
 		
-		// text between end of paragraph and end of insertion range is suffix
-		NSAttributedString *suffix = nil;
+		[_metrics recordRelaidOutLines:[relayoutedLines count]];
 		
-		NSInteger lastIndex = NSMaxRange(range);
+		DTCoreTextLayoutLine *previousLine = nil;
 		
-		if (lastIndex < parEndIndex)
+		if (paragraphs.location > 0)
 		{
-			NSRange suffixRange = NSMakeRange(lastIndex, parEndIndex - lastIndex);
-			suffix = [_attributedStringFragment attributedSubstringFromRange:suffixRange];
+			previousLine = [[_paragraphTable linesOfParagraphAtIndex:paragraphs.location-1] lastObject];
 		}
 		
-		NSAttributedString *modifiedParagraphText;
+		NSUInteger location = dirtyParagraphRange.location;
 		
-		// we need to append a prefix or suffix
-		if (prefix || suffix)
+		// position the new lines after the unchanged head
+		for (DTCoreTextLayoutLine *oneLine in relayoutedLines)
 		{
-			NSMutableAttributedString *tmpString = [[NSMutableAttributedString alloc] init];
-			
-			if (prefix)
+			if (previousLine)
 			{
-				[tmpString appendAttributedString:prefix];
+				oneLine.baselineOrigin = [self baselineOriginToPositionLine:(id)oneLine afterLine:(id)previousLine options:DTCoreTextLayoutFrameLinePositioningOptionAlgorithmWebKit];
 			}
 			
-			if (text)
-			{
-				[tmpString appendAttributedString:text];
-			}
-			
-			if (suffix)
-			{
-				[tmpString appendAttributedString:suffix];
-			}
+			[oneLine adjustStringRangeToStartAtIndex:location];
+			location = NSMaxRange(oneLine.stringRange);
 			
-			modifiedParagraphText = tmpString;
-		}
-		else
-		{
-			modifiedParagraphText = text;
-		}
-		
-		
-		// get affected paragraphs
-		NSRange paragraphs = [self paragraphRangeContainingStringRange:rangeForRedoneParagraphs];
-		
-		if (![self.paragraphRanges count])
-		{
-			return;
+			previousLine = oneLine;
 		}
 		
-		// make this replacement in our local copy
-		[(NSMutableAttributedString *)_attributedStringFragment replaceCharactersInRange:range withAttributedString:text];
-		
-		// layout the new paragraph text
-		DTCoreTextLayouter *tmpLayouter = [[DTCoreTextLayouter alloc] initWithAttributedString:modifiedParagraphText];
-		CGRect rect = self.frame;
-		rect.size.height = CGFLOAT_HEIGHT_UNKNOWN;
-		NSRange allTextRange = NSMakeRange(0, 0);
-		DTCoreTextLayoutFrame *tmpFrame = [tmpLayouter layoutFrameWithRect:rect range:allTextRange];
-		
-		NSArray *relayoutedLines = tmpFrame.lines;
+		// swap the paragraphs, the following lines are only moved once they are accessed
+		NSArray *newParagraphs = [DTParagraphLineTable paragraphsWithLines:relayoutedLines string:[_attributedStringFragment string]];
+		[_paragraphTable replaceParagraphsInRange:paragraphs withParagraphs:newParagraphs];
 		
-		NSUInteger insertionIndex = 0;
+		NSUInteger nextParagraphIndex = paragraphs.location + [newParagraphs count];
 		
-		if (paragraphs.location > 0)
+		if (previousLine && nextParagraphIndex < [_paragraphTable numberOfParagraphs])
 		{
-			NSArray *preParaLines = [self linesInParagraphAtIndex:paragraphs.location-1];
+			DTCoreTextLayoutLine *nextLine = [[_paragraphTable linesOfParagraphAtIndex:nextParagraphIndex] objectAtIndex:0];
+			CGPoint newBaselineOrigin = [self baselineOriginToPositionLine:(id)nextLine afterLine:(id)previousLine options:DTCoreTextLayoutFrameLinePositioningOptionAlgorithmWebKit];
 			
-			DTCoreTextLayoutLine *lineBefore = [preParaLines lastObject];
-			insertionIndex = [_lines indexOfObject:lineBefore] + 1;
+			[_paragraphTable setBaselineOriginY:newBaselineOrigin.y ofParagraphAtIndex:nextParagraphIndex];
 		}
 		
+		// flat line array is rebuilt on demand
+		_lines = nil;
+		_paragraphRanges = nil;
 		
-		// remove the changed lines
-		NSMutableArray *tmpArray = [self.lines mutableCopy];
-		NSMutableArray *replacedLines = [NSMutableArray array];
-		
-		for (NSInteger index=paragraphs.location; index < NSMaxRange(paragraphs); index++)
+		// correct the overall frame size
+		_frame.size.height = ceilf((_paragraphTable.maxY - _frame.origin.y + 1.5));
+	});
+}
+
+
+- (CGRect)_frameCoveringLines:(NSArray *)array
+{
+	NSAssert([array count], @"cannot pass empty array");
+	
+	DTCoreTextLayoutLine *firstLine = [array objectAtIndex:0];
+	CGRect rect = firstLine.frame;
+	
+	DTCoreTextLayoutLine *lastLine = [array lastObject];
+	
+	if (firstLine != lastLine)
+	{
+		rect = CGRectUnion(rect, lastLine.frame);
+	}
+	
+	return CGRectIntegral(rect);
+}
+
+
+// determines the full paragraphs affected by a replacement and returns their text after the replacement
+- (NSAttributedString *)_modifiedParagraphTextForReplacingRange:(NSRange)range withText:(NSAttributedString *)text paragraphStringRange:(NSRange *)paragraphStringRange
+{
+	NSString *plainText = [_attributedStringFragment string];
+	
+	// get beginning and end of paragraph containing the replaced range
+	NSUInteger parBeginIndex;
+	NSUInteger parEndIndex;
+	NSRange rangeForRedoneParagraphs;
+	
+	// get the first and last index of the paragraphs containing this range
+	rangeForRedoneParagraphs = [self rangeOfParagraphsContainingRange:range parBegIndex:&parBeginIndex parEndIndex:&parEndIndex];
+	
+	// if the range ends on a \n then we need to extend to include the following paragraph if it's actually a deletion
+	if (parEndIndex < [plainText length] && ![text length])
+	{
+		if ([self indexIsAtBeginningOfParagraph:parEndIndex])
 		{
-			NSArray *lines = [self linesInParagraphAtIndex:index];
-			[replacedLines addObjectsFromArray:lines];
-			[tmpArray removeObjectsInArray:lines];
+			NSRange extendedRange = range;
+			extendedRange.length += 1;
+			rangeForRedoneParagraphs = [self rangeOfParagraphsContainingRange:extendedRange parBegIndex:&parBeginIndex parEndIndex:&parEndIndex];
 		}
-		
+	}
+	
+	// text between begin of paragraph and insertion point is prefix
+	NSAttributedString *prefix = nil;
+	
+	if (range.location > parBeginIndex)
+	{
+		NSRange prefixRange = NSMakeRange(parBeginIndex, range.location - parBeginIndex);
+		prefix = [_attributedStringFragment attributedSubstringFromRange:prefixRange];
+	}
+	
+	// text between end of paragraph and end of insertion range is suffix
+	NSAttributedString *suffix = nil;
+	
+	NSInteger lastIndex = NSMaxRange(range);
+	
+	if (lastIndex < parEndIndex)
+	{
+		NSRange suffixRange = NSMakeRange(lastIndex, parEndIndex - lastIndex);
+		suffix = [_attributedStringFragment attributedSubstringFromRange:suffixRange];
+	}
+	
+	NSAttributedString *modifiedParagraphText;
+	
+	// we need to append a prefix or suffix
+	if (prefix || suffix)
+	{
+		NSMutableAttributedString *tmpString = [[NSMutableAttributedString alloc] init];
+		
+		if (prefix)
+		{
+			[tmpString appendAttributedString:prefix];
+		}
+		
+		if (text)
+		{
+			[tmpString appendAttributedString:text];
+		}
+		
+		if (suffix)
+		{
+			[tmpString appendAttributedString:suffix];
+		}
+		
+		modifiedParagraphText = tmpString;
+	}
+	else
+	{
+		modifiedParagraphText = text;
+	}
+	
+	*paragraphStringRange = rangeForRedoneParagraphs;
+	
+	return modifiedParagraphText;
+}
+
+- (void)replaceTextInRange:(NSRange)range withText:(NSAttributedString *)text dirtyRect:(CGRect *)dirtyRect
+{
+	dispatch_barrier_sync(_syncQueue, ^{
+		
+		NSRange rangeForRedoneParagraphs;
+		NSAttributedString *modifiedParagraphText = [self _modifiedParagraphTextForReplacingRange:range withText:text paragraphStringRange:&rangeForRedoneParagraphs];
+		
+		// get affected paragraphs
+		NSRange paragraphs = [self paragraphRangeContainingStringRange:rangeForRedoneParagraphs];
+		
+		if (![_paragraphTable numberOfParagraphs])
+		{
+			return;
+		}
+		
+		// background layouts for these paragraphs are obsolete, the ones after need to shift
+		[self _updatePendingLayoutsForReplacementInParagraphRange:rangeForRedoneParagraphs changeInLength:(NSInteger)[text length] - (NSInteger)range.length];
+		
+		// make this replacement in our local copy
+		[(NSMutableAttributedString *)_attributedStringFragment replaceCharactersInRange:range withAttributedString:text];
+		_textGeneration++;
+		
+		uint64_t typesettingToken = [_metrics beginInterval:DTRichTextEditorMetricsIntervalTypesetting];
+		
+		// layout the new paragraph text
+		DTCoreTextLayouter *tmpLayouter = [[DTCoreTextLayouter alloc] initWithAttributedString:modifiedParagraphText];
+		CGRect rect = self.frame;
+		rect.size.height = CGFLOAT_HEIGHT_UNKNOWN;
+		NSRange allTextRange = NSMakeRange(0, 0);
+		DTCoreTextLayoutFrame *tmpFrame = [tmpLayouter layoutFrameWithRect:rect range:allTextRange];
+		
+		NSArray *relayoutedLines = tmpFrame.lines;
+		
+		[_metrics endInterval:DTRichTextEditorMetricsIntervalTypesetting token:typesettingToken];
+		[_metrics recordRelaidOutLines:[relayoutedLines count]];
+		
+		// everything from here on only moves lines and updates cached geometry
+		uint64_t lineShiftingToken = [_metrics beginInterval:DTRichTextEditorMetricsIntervalLineShifting];
+		
 		// this rect is the place where lines where removed, to be relayouted
-		CGRect replacedLinesRect = [self _frameCoveringLines:replacedLines];
+		CGRect replacedLinesRect = CGRectNull;
+		
+		if (paragraphs.length)
+		{
+			// the table knows the extent of estimated paragraphs too, fetching their lines would lay them out just to throw them away
+			CGFloat top = [_paragraphTable topOfParagraphAtIndex:paragraphs.location];
+			CGFloat bottom = [_paragraphTable bottomOfParagraphAtIndex:NSMaxRange(paragraphs)-1];
+			
+			replacedLinesRect = CGRectIntegral(CGRectMake(_frame.origin.x, top, _frame.size.width, bottom - top));
+		}
+		
+		// remember the lines and position of what follows, to shift cached selection rects
+		NSUInteger firstReplacedLineIndex = [_paragraphTable indexOfFirstLineOfParagraphAtIndex:paragraphs.location];
+		NSUInteger numberOfReplacedLines = [_paragraphTable indexOfFirstLineOfParagraphAtIndex:NSMaxRange(paragraphs)] - firstReplacedLineIndex;
+		CGFloat oldNextBaselineOriginY = 0;
+		
+		if (NSMaxRange(paragraphs) < [_paragraphTable numberOfParagraphs])
+		{
+			oldNextBaselineOriginY = [_paragraphTable baselineOriginYOfParagraphAtIndex:NSMaxRange(paragraphs)];
+		}
 		
 		// remove paragraph ranges
 		_paragraphRanges = nil;
@@ -320,21 +699,24 @@
 		// the amount that the relayouted lines need to be shifted down
 		CGPoint insertedLinesBaselineOffset = CGPointZero;
 		
-		if (insertionIndex>0)
+		if (paragraphs.location > 0)
 		{
 			// if there is a line before this one we base ourselfs off that
-			previousLine = [tmpArray objectAtIndex:insertionIndex-1];
+			previousLine = [[_paragraphTable linesOfParagraphAtIndex:paragraphs.location-1] lastObject];
 			
-			DTCoreTextLayoutLine *firstNewLine = [relayoutedLines objectAtIndex:0];
-			
-			CGPoint oldBaselineOrigin = firstNewLine.baselineOrigin;
-			CGPoint newBaselineOrigin = [self baselineOriginToPositionLine:(id)firstNewLine afterLine:(id)previousLine options:DTCoreTextLayoutFrameLinePositioningOptionAlgorithmWebKit];
-			
-			insertedLinesBaselineOffset.y = newBaselineOrigin.y - oldBaselineOrigin.y;
+			if ([relayoutedLines count])
+			{
+				DTCoreTextLayoutLine *firstNewLine = [relayoutedLines objectAtIndex:0];
+				
+				CGPoint oldBaselineOrigin = firstNewLine.baselineOrigin;
+				CGPoint newBaselineOrigin = [self baselineOriginToPositionLine:(id)firstNewLine afterLine:(id)previousLine options:DTCoreTextLayoutFrameLinePositioningOptionAlgorithmWebKit];
+				
+				insertedLinesBaselineOffset.y = newBaselineOrigin.y - oldBaselineOrigin.y;
+			}
 		}
 		
 		// determine how much the range has to be shifted
-		for (DTCoreTextLayoutLine *oneLine in tmpFrame.lines)
+		for (DTCoreTextLayoutLine *oneLine in relayoutedLines)
 		{
 			// only shift down if there are lines before it
 			if (insertedLinesBaselineOffset.y!=0.0f)
@@ -344,10 +726,6 @@
 				oneLine.baselineOrigin = baselineOrigin;
 			}
 			
-			[tmpArray insertObject:oneLine atIndex:insertionIndex];
-			
-			insertionIndex++;
-			
 			// adjust string range
 			[oneLine adjustStringRangeToStartAtIndex:NSMaxRange(previousLine.stringRange)];
 			
@@ -355,52 +733,39 @@
 		}
 		
 		// this rect covers the freshly layouted replacement lines
-		CGRect relayoutedLinesRect = [self _frameCoveringLines:tmpFrame.lines];
+		CGRect relayoutedLinesRect = CGRectNull;
+		
+		if ([relayoutedLines count])
+		{
+			relayoutedLinesRect = [self _frameCoveringLines:relayoutedLines];
+		}
+		
+		// swap the paragraphs, the following lines are only moved once they are accessed
+		NSArray *newParagraphs = [DTParagraphLineTable paragraphsWithLines:relayoutedLines string:[_attributedStringFragment string]];
+		[_paragraphTable replaceParagraphsInRange:paragraphs withParagraphs:newParagraphs];
 		
-		BOOL firstLineAfterInsert = YES;
-		CGPoint linesAfterinsertedLinesBaselineOffset = CGPointZero;
+		NSUInteger nextParagraphIndex = paragraphs.location + [newParagraphs count];
 		
-		// move down lines after the re-layouted lines
-		while (insertionIndex<[tmpArray count])
+		if (previousLine && nextParagraphIndex < [_paragraphTable numberOfParagraphs])
 		{
-			DTCoreTextLayoutLine *oneLine = [tmpArray objectAtIndex:insertionIndex];
+			// first line after the re-layouted lines determines shift of all following paragraphs
+			DTCoreTextLayoutLine *nextLine = [[_paragraphTable linesOfParagraphAtIndex:nextParagraphIndex] objectAtIndex:0];
+			CGPoint newBaselineOrigin = [self baselineOriginToPositionLine:(id)nextLine afterLine:(id)previousLine options:DTCoreTextLayoutFrameLinePositioningOptionAlgorithmWebKit];
 			
-			// adjust string range
-			[oneLine adjustStringRangeToStartAtIndex:NSMaxRange(previousLine.stringRange)];
-			
-			if (firstLineAfterInsert)
-			{
-				// first line determines shift down
-				CGPoint oldBaselineOrigin = oneLine.baselineOrigin;
-				CGPoint newBaselineOrigin = [self baselineOriginToPositionLine:(id)oneLine afterLine:(id)previousLine options:DTCoreTextLayoutFrameLinePositioningOptionAlgorithmWebKit];
-				
-				
-				linesAfterinsertedLinesBaselineOffset.y = newBaselineOrigin.y - oldBaselineOrigin.y;
-				
-				// we got our offset now
-				firstLineAfterInsert = NO;
-			}
-			
-			CGPoint baselineOrigin =  oneLine.baselineOrigin;
-			baselineOrigin.y += linesAfterinsertedLinesBaselineOffset.y;
-			oneLine.baselineOrigin = baselineOrigin;
-			
-			previousLine = oneLine;
-			insertionIndex++;
+			[_paragraphTable setBaselineOriginY:newBaselineOrigin.y ofParagraphAtIndex:nextParagraphIndex];
 		}
 		
-		// save
-		_lines = [tmpArray copy];
+		// flat line array is rebuilt on demand
+		_lines = nil;
 		
 		// correct the overall frame size
-		DTCoreTextLayoutLine *lastLine = [_lines lastObject];
-		_frame.size.height = ceilf((CGRectGetMaxY(lastLine.frame) - _frame.origin.y + 1.5));
+		_frame.size.height = ceilf((_paragraphTable.maxY - _frame.origin.y + 1.5));
 		
 		if (dirtyRect)
 		{
 			CGRect redrawArea = CGRectUnion(replacedLinesRect, relayoutedLinesRect);
 			
-			if (replacedLinesRect.origin.y != relayoutedLinesRect.origin.y || replacedLinesRect.size.height != relayoutedLinesRect.size.height)
+			if (CGRectIsNull(replacedLinesRect) || CGRectIsNull(relayoutedLinesRect) || replacedLinesRect.origin.y != relayoutedLinesRect.origin.y || replacedLinesRect.size.height != relayoutedLinesRect.size.height)
 			{
 				// rest of document shifted up or down
 				redrawArea.size.height = MAX(_frame.size.height - redrawArea.origin.y, redrawArea.size.height);
@@ -411,50 +776,1743 @@
 			*dirtyRect = redrawArea;
 		}
 		
-		// some attachments might have been overwritten, so we force refresh of the attachments list
-		_textAttachments = nil;
+		// only the attachments of the replaced range change
+		[_attachmentIndex replaceAttachmentsInRange:range withAttachmentsOfText:text];
 		
-		// next call needs new selection rectangles
-		_cachedSelectionRectangles = nil;
+		// lines following the replaced ones keep their selection rects, only shifted
+		CGFloat linesAfterBaselineOffset = 0;
+		
+		if (nextParagraphIndex < [_paragraphTable numberOfParagraphs])
+		{
+			linesAfterBaselineOffset = [_paragraphTable baselineOriginYOfParagraphAtIndex:nextParagraphIndex] - oldNextBaselineOriginY;
+		}
+		
+		NSRange replacedLineRange = NSMakeRange(firstReplacedLineIndex, numberOfReplacedLines);
+		NSInteger changeInLength = (NSInteger)[text length] - (NSInteger)range.length;
+		
+		[self _updateSelectionRectanglesForReplacedLines:replacedLineRange withNumberOfLines:[relayoutedLines count] stringRange:rangeForRedoneParagraphs changeInLength:changeInLength linesAfterBaselineOffset:linesAfterBaselineOffset];
+		
+		[_metrics endInterval:DTRichTextEditorMetricsIntervalLineShifting token:lineShiftingToken];
 	});
 }
 
-- (NSArray *)selectionRectsForRange:(NSRange)range
+#pragma mark - Relayouting Lines
+
+// replaces text inside a single paragraph, the lines before the modified ones are kept. Returns NO if that is not possible without touching anything.
+- (BOOL)_replaceTextInLinesOfRange:(NSRange)range withText:(NSAttributedString *)text dirtyRect:(CGRect *)dirtyRect
 {
-	if (_cachedSelectionRectangles && NSEqualRanges(range, _cachedSelectionRectanglesRange))
+	NSString *plainText = [_attributedStringFragment string];
+	NSCharacterSet *newlineCharacterSet = [NSCharacterSet newlineCharacterSet];
+	
+	if (!_paragraphTable || NSMaxRange(range) >= [plainText length])
 	{
-		return _cachedSelectionRectangles;
+		return NO;
+	}
+	
+	// paragraph breaks change the paragraphs
+	if ([[text string] rangeOfCharacterFromSet:newlineCharacterSet].location != NSNotFound || [plainText rangeOfCharacterFromSet:newlineCharacterSet options:0 range:range].location != NSNotFound)
+	{
+		return NO;
+	}
+	
+	NSUInteger paragraphIndex = [_paragraphTable indexOfParagraphContainingStringIndex:range.location];
+	
+	if (paragraphIndex == NSNotFound || ![_paragraphTable isParagraphLaidOutAtIndex:paragraphIndex] || [self _pendingLayoutContainingLocation:range.location])
+	{
+		return NO;
+	}
+	
+	NSRange paragraphRange = [_paragraphTable stringRangeOfParagraphAtIndex:paragraphIndex];
+	NSArray *oldLines = [_paragraphTable linesOfParagraphAtIndex:paragraphIndex];
+	NSUInteger numberOfOldLines = [oldLines count];
+	
+	// the line containing the modification
+	NSUInteger modifiedLineIndex = 0;
+	
+	while (modifiedLineIndex+1 < numberOfOldLines && NSMaxRange([[oldLines objectAtIndex:modifiedLineIndex] stringRange]) <= range.location)
+	{
+		modifiedLineIndex++;
+	}
+	
+	// the previous line is done again too, the first word of the modified line might move up
+	if (modifiedLineIndex < 2)
+	{
+		return NO;
+	}
+	
+	NSUInteger firstRelayoutedLineIndex = modifiedLineIndex - 1;
+	NSArray *keptLines = [oldLines subarrayWithRange:NSMakeRange(0, firstRelayoutedLineIndex)];
+	NSArray *replacedLines = [oldLines subarrayWithRange:NSMakeRange(firstRelayoutedLineIndex, numberOfOldLines - firstRelayoutedLineIndex)];
+	DTCoreTextLayoutLine *lastKeptLine = [keptLines lastObject];
+	
+	// layout the rest of the modified paragraph, without the lines before it is not at the beginning of a paragraph
+	NSMutableAttributedString *modifiedParagraphText = [[_attributedStringFragment attributedSubstringFromRange:paragraphRange] mutableCopy];
+	[modifiedParagraphText replaceCharactersInRange:NSMakeRange(range.location - paragraphRange.location, range.length) withAttributedString:text];
+	
+	NSUInteger relayoutLocation = NSMaxRange(lastKeptLine.stringRange) - paragraphRange.location;
+	
+	uint64_t typesettingToken = [_metrics beginInterval:DTRichTextEditorMetricsIntervalTypesetting];
+	
+	DTCoreTextLayouter *tmpLayouter = [[DTCoreTextLayouter alloc] initWithAttributedString:modifiedParagraphText];
+	CGRect rect = self.frame;
+	rect.size.height = CGFLOAT_HEIGHT_UNKNOWN;
+	DTCoreTextLayoutFrame *tmpFrame = [tmpLayouter layoutFrameWithRect:rect range:NSMakeRange(relayoutLocation, [modifiedParagraphText length] - relayoutLocation)];
+	
+	NSArray *relayoutedLines = tmpFrame.lines;
+	
+	[_metrics endInterval:DTRichTextEditorMetricsIntervalTypesetting token:typesettingToken];
+	[_metrics recordRelaidOutLines:[relayoutedLines count]];
+	
+	if (![relayoutedLines count])
+	{
+		return NO;
+	}
+	
+	NSInteger changeInLength = (NSInteger)[text length] - (NSInteger)range.length;
+	
+	NSUInteger firstReplacedLineIndex = [_paragraphTable indexOfFirstLineOfParagraphAtIndex:paragraphIndex] + firstRelayoutedLineIndex;
+	CGRect replacedLinesRect = [self _frameCoveringLines:replacedLines];
+	CGFloat oldNextBaselineOriginY = 0;
+	
+	if (paragraphIndex+1 < [_paragraphTable numberOfParagraphs])
+	{
+		oldNextBaselineOriginY = [_paragraphTable baselineOriginYOfParagraphAtIndex:paragraphIndex+1];
+	}
+	
+	[self _updatePendingLayoutsForReplacementInParagraphRange:paragraphRange changeInLength:changeInLength];
+	
+	[(NSMutableAttributedString *)_attributedStringFragment replaceCharactersInRange:range withAttributedString:text];
+	_textGeneration++;
+	
+	// the new lines continue after the kept ones
+	DTCoreTextLayoutLine *firstNewLine = [relayoutedLines objectAtIndex:0];
+	CGPoint newBaselineOrigin = [self baselineOriginToPositionLine:(id)firstNewLine afterLine:(id)lastKeptLine options:DTCoreTextLayoutFrameLinePositioningOptionAlgorithmWebKit];
+	CGFloat baselineOffset = newBaselineOrigin.y - firstNewLine.baselineOrigin.y;
+	
+	DTCoreTextLayoutLine *previousLine = lastKeptLine;
+	
+	for (DTCoreTextLayoutLine *oneLine in relayoutedLines)
+	{
+		CGPoint baselineOrigin = oneLine.baselineOrigin;
+		baselineOrigin.y += baselineOffset;
+		oneLine.baselineOrigin = baselineOrigin;
+		
+		[oneLine adjustStringRangeToStartAtIndex:NSMaxRange(previousLine.stringRange)];
+		
+		previousLine = oneLine;
+	}
+	
+	CGRect relayoutedLinesRect = [self _frameCoveringLines:relayoutedLines];
+	
+	NSArray *newParagraphs = [DTParagraphLineTable paragraphsWithLines:[keptLines arrayByAddingObjectsFromArray:relayoutedLines] string:[_attributedStringFragment string]];
+	[_paragraphTable replaceParagraphsInRange:NSMakeRange(paragraphIndex, 1) withParagraphs:newParagraphs];
+	
+	NSUInteger nextParagraphIndex = paragraphIndex + [newParagraphs count];
+	
+	if (nextParagraphIndex < [_paragraphTable numberOfParagraphs])
+	{
+		DTCoreTextLayoutLine *nextLine = [[_paragraphTable linesOfParagraphAtIndex:nextParagraphIndex] objectAtIndex:0];
+		CGPoint nextBaselineOrigin = [self baselineOriginToPositionLine:(id)nextLine afterLine:(id)previousLine options:DTCoreTextLayoutFrameLinePositioningOptionAlgorithmWebKit];
+		
+		[_paragraphTable setBaselineOriginY:nextBaselineOrigin.y ofParagraphAtIndex:nextParagraphIndex];
+	}
+	
+	_paragraphRanges = nil;
+	_lines = nil;
+	
+	_frame.size.height = ceilf((_paragraphTable.maxY - _frame.origin.y + 1.5));
+	
+	if (dirtyRect)
+	{
+		CGRect redrawArea = CGRectUnion(replacedLinesRect, relayoutedLinesRect);
+		
+		if (replacedLinesRect.origin.y != relayoutedLinesRect.origin.y || replacedLinesRect.size.height != relayoutedLinesRect.size.height)
+		{
+			// rest of document shifted up or down
+			redrawArea.size.height = MAX(_frame.size.height - redrawArea.origin.y, redrawArea.size.height);
+			redrawArea.size.width = _frame.size.width;
+			redrawArea.origin.x = _frame.origin.x;
+		}
+		
+		*dirtyRect = redrawArea;
+	}
+	
+	[_attachmentIndex replaceAttachmentsInRange:range withAttachmentsOfText:text];
+	
+	CGFloat linesAfterBaselineOffset = 0;
+	
+	if (nextParagraphIndex < [_paragraphTable numberOfParagraphs])
+	{
+		linesAfterBaselineOffset = [_paragraphTable baselineOriginYOfParagraphAtIndex:nextParagraphIndex] - oldNextBaselineOriginY;
 	}
 	
-	_cachedSelectionRectangles = [super selectionRectsForRange:range];
-	_cachedSelectionRectanglesRange = range;
+	NSRange relayoutedStringRange = NSMakeRange(paragraphRange.location + relayoutLocation, NSMaxRange(paragraphRange) - paragraphRange.location - relayoutLocation);
 	
-	return _cachedSelectionRectangles;
+	[self _updateSelectionRectanglesForReplacedLines:NSMakeRange(firstReplacedLineIndex, [replacedLines count]) withNumberOfLines:[relayoutedLines count] stringRange:relayoutedStringRange changeInLength:changeInLength linesAfterBaselineOffset:linesAfterBaselineOffset];
+	
+	return YES;
 }
 
-- (void)drawInContext:(CGContextRef)context options:(DTCoreTextLayoutFrameDrawingOptions)options
+- (void)replaceTextInLinesOfRange:(NSRange)range withText:(NSAttributedString *)text dirtyRect:(CGRect *)dirtyRect
 {
-	dispatch_sync(_syncQueue, ^{
+	__block BOOL didReplace = NO;
+	
+	dispatch_barrier_sync(_syncQueue, ^{
 		
-		[super drawInContext:context options:options];
+		didReplace = [self _replaceTextInLinesOfRange:range withText:text dirtyRect:dirtyRect];
 	});
+	
+	if (!didReplace)
+	{
+		[self replaceTextInRange:range withText:text dirtyRect:dirtyRect];
+	}
 }
 
-#pragma mark - Properties
+#pragma mark - Background Layout
 
-- (void)setFrame:(CGRect)frame
+- (void)_cancelPendingLayouts
 {
-	if (CGPointEqualToPoint(_frame.origin, frame.origin) && _frame.size.width == frame.size.width)
+	@synchronized(_pendingLayouts)
 	{
-		return;
+		[_pendingLayouts removeAllObjects];
+	}
+}
+
+// background layouts overlapping an edit are discarded, those after it shift by the change in length
+- (void)_updatePendingLayoutsForReplacementInParagraphRange:(NSRange)paragraphRange changeInLength:(NSInteger)delta
+{
+	@synchronized(_pendingLayouts)
+	{
+		for (DTPendingParagraphLayout *pendingLayout in [_pendingLayouts copy])
+		{
+			NSRange pendingRange = NSMakeRange(pendingLayout.location, [pendingLayout.text length]);
+			
+			if (NSMaxRange(pendingRange) <= paragraphRange.location)
+			{
+				continue;
+			}
+			
+			if (pendingRange.location >= NSMaxRange(paragraphRange))
+			{
+				pendingLayout.location += delta;
+				continue;
+			}
+			
+			[_pendingLayouts removeObject:pendingLayout];
+		}
+	}
+}
+
+- (DTPendingParagraphLayout *)_pendingLayoutContainingLocation:(NSUInteger)location
+{
+	@synchronized(_pendingLayouts)
+	{
+		for (DTPendingParagraphLayout *pendingLayout in _pendingLayouts)
+		{
+			if (NSLocationInRange(location, NSMakeRange(pendingLayout.location, [pendingLayout.text length])))
+			{
+				return pendingLayout;
+			}
+		}
+		
+		return nil;
 	}
+}
+
+// waits for a background layout and returns the lines of the paragraph beginning at the location
+- (NSArray *)_linesFromPendingLayout:(DTPendingParagraphLayout *)pendingLayout forParagraphInRange:(NSRange)range
+{
+	dispatch_group_wait(pendingLayout.group, DISPATCH_TIME_FOREVER);
 	
-	_frame = frame;
+	NSUInteger location = pendingLayout.location;
 	
-	// next call needs new selection rectangles
-	_cachedSelectionRectangles = nil;
+	for (NSArray *lines in pendingLayout.paragraphs)
+	{
+		DTCoreTextLayoutLine *firstLine = [lines objectAtIndex:0];
+		DTCoreTextLayoutLine *lastLine = [lines lastObject];
+		NSUInteger length = NSMaxRange(lastLine.stringRange) - firstLine.stringRange.location;
+		
+		if (location == range.location)
+		{
+			if (length != range.length)
+			{
+				return nil;
+			}
+			
+			for (DTCoreTextLayoutLine *oneLine in lines)
+			{
+				[oneLine adjustStringRangeToStartAtIndex:location];
+				location = NSMaxRange(oneLine.stringRange);
+			}
+			
+			return lines;
+		}
+		
+		location += length;
+	}
+	
+	return nil;
+}
+
+// swaps the lines of a finished background layout into the paragraph table, called on the main thread
+- (CGRect)_finishPendingLayout:(DTPendingParagraphLayout *)pendingLayout
+{
+	__block CGRect dirtyRect = CGRectNull;
 	
-	if (shouldRebuildLines)
+	dispatch_barrier_sync(_syncQueue, ^{
+		
+		@synchronized(_pendingLayouts)
+		{
+			if (![_pendingLayouts containsObject:pendingLayout])
+			{
+				// cancelled by a later edit
+				return;
+			}
+			
+			[_pendingLayouts removeObject:pendingLayout];
+		}
+		
+		NSUInteger paragraphIndex = [_paragraphTable indexOfParagraphContainingStringIndex:pendingLayout.location];
+		
+		if (paragraphIndex == NSNotFound)
+		{
+			return;
+		}
+		
+		CGFloat oldHeight = _frame.size.height;
+		CGFloat top = [_paragraphTable topOfParagraphAtIndex:paragraphIndex];
+		CGFloat bottom = top;
+		
+		for (NSArray *lines in pendingLayout.paragraphs)
+		{
+			if (paragraphIndex >= [_paragraphTable numberOfParagraphs])
+			{
+				break;
+			}
+			
+			// might already be laid out if a caret query needed it
+			[_paragraphTable setLines:lines forEstimatedParagraphAtIndex:paragraphIndex];
+			
+			top = MIN(top, [_paragraphTable topOfParagraphAtIndex:paragraphIndex]);
+			bottom = [_paragraphTable bottomOfParagraphAtIndex:paragraphIndex];
+			
+			paragraphIndex++;
+		}
+		
+		_lines = nil;
+		_paragraphRanges = nil;
+		[self _invalidateSelectionRectangles];
+		
+		_frame.size.height = ceilf((_paragraphTable.maxY - _frame.origin.y + 1.5));
+		
+		dirtyRect = CGRectMake(_frame.origin.x, floorf(top), _frame.size.width, ceilf(bottom - top));
+		
+		if (oldHeight != _frame.size.height)
+		{
+			// rest of document shifted up or down
+			dirtyRect.size.height = MAX(_frame.size.height - dirtyRect.origin.y, dirtyRect.size.height);
+		}
+	});
+	
+	return dirtyRect;
+}
+
+// modifies the string right away and represents the affected paragraphs by estimates until the pending layout is finished, needs to be called inside a barrier
+- (void)_replaceTextWithEstimatedParagraphsInRange:(NSRange)range withText:(NSAttributedString *)text pendingLayout:(DTPendingParagraphLayout *)pendingLayout
+{
+	NSRange rangeForRedoneParagraphs;
+	NSAttributedString *modifiedParagraphText = [self _modifiedParagraphTextForReplacingRange:range withText:text paragraphStringRange:&rangeForRedoneParagraphs];
+	
+	NSRange paragraphs = [self paragraphRangeContainingStringRange:rangeForRedoneParagraphs];
+	
+	[self _updatePendingLayoutsForReplacementInParagraphRange:rangeForRedoneParagraphs changeInLength:(NSInteger)[text length] - (NSInteger)range.length];
+	
+	// the string is modified right away
+	[(NSMutableAttributedString *)_attributedStringFragment replaceCharactersInRange:range withAttributedString:text];
+	_textGeneration++;
+	[_attachmentIndex replaceAttachmentsInRange:range withAttachmentsOfText:text];
+	
+	// paragraphs are estimated until the layout is done
+	NSInteger *lengths;
+	CGFloat *ascents;
+	CGFloat *descents;
+	
+	NSUInteger count = [self _estimateParagraphsInAttributedString:modifiedParagraphText lengths:&lengths ascents:&ascents descents:&descents];
+	[_paragraphTable replaceParagraphsInRange:paragraphs withEstimatedParagraphLengths:lengths ascents:ascents descents:descents count:count];
+	
+	free(lengths);
+	free(ascents);
+	free(descents);
+	
+	pendingLayout.location = rangeForRedoneParagraphs.location;
+	pendingLayout.text = [modifiedParagraphText copy];
+	
+	@synchronized(_pendingLayouts)
+	{
+		[_pendingLayouts addObject:pendingLayout];
+	}
+	
+	_lines = nil;
+	_paragraphRanges = nil;
+	[self _invalidateSelectionRectangles];
+	
+	_frame.size.height = ceilf((_paragraphTable.maxY - _frame.origin.y + 1.5));
+}
+
+- (void)replaceTextInRange:(NSRange)range withText:(NSAttributedString *)text completion:(void (^)(CGRect dirtyRect))completion
+{
+	if (!_shouldLayoutAsynchronously || !_paragraphTable)
+	{
+		CGRect dirtyRect = CGRectNull;
+		[self replaceTextInRange:range withText:text dirtyRect:&dirtyRect];
+		
+		if (completion)
+		{
+			completion(dirtyRect);
+		}
+		
+		return;
+	}
+	
+	DTPendingParagraphLayout *pendingLayout = [[DTPendingParagraphLayout alloc] init];
+	
+	dispatch_barrier_sync(_syncQueue, ^{
+		
+		[self _replaceTextWithEstimatedParagraphsInRange:range withText:text pendingLayout:pendingLayout];
+	});
+	
+	CGRect rect = _frame;
+	rect.size.height = CGFLOAT_HEIGHT_UNKNOWN;
+	
+	// typesetting happens in the background
+	dispatch_group_async(pendingLayout.group, _layoutQueue, ^{
+		
+		DTCoreTextLayouter *tmpLayouter = [[DTCoreTextLayouter alloc] initWithAttributedString:pendingLayout.text];
+		DTCoreTextLayoutFrame *tmpFrame = [tmpLayouter layoutFrameWithRect:rect range:NSMakeRange(0, 0)];
+		
+		pendingLayout.paragraphs = [DTParagraphLineTable paragraphsWithLines:tmpFrame.lines string:[pendingLayout.text string]];
+	});
+	
+	// and the finished lines are swapped in on the main thread
+	dispatch_group_notify(pendingLayout.group, dispatch_get_main_queue(), ^{
+		
+		CGRect dirtyRect = [self _finishPendingLayout:pendingLayout];
+		
+		if (completion && !CGRectIsNull(dirtyRect))
+		{
+			completion(dirtyRect);
+		}
+	});
+}
+
+#pragma mark - Deferred Layout
+
+- (void)replaceTextInRange:(NSRange)range withTextDeferringLayout:(NSAttributedString *)text
+{
+	if (!_paragraphTable)
+	{
+		[self replaceTextInRange:range withText:text dirtyRect:NULL];
+		
+		return;
+	}
+	
+	DTPendingParagraphLayout *pendingLayout = [[DTPendingParagraphLayout alloc] init];
+	pendingLayout.deferred = YES;
+	
+	dispatch_barrier_sync(_syncQueue, ^{
+		
+		[self _replaceTextWithEstimatedParagraphsInRange:range withText:text pendingLayout:pendingLayout];
+	});
+}
+
+- (CGRect)layoutDeferredParagraphs
+{
+	NSMutableArray *deferredLayouts = [NSMutableArray array];
+	
+	@synchronized(_pendingLayouts)
+	{
+		for (DTPendingParagraphLayout *pendingLayout in _pendingLayouts)
+		{
+			if (pendingLayout.deferred)
+			{
+				[deferredLayouts addObject:pendingLayout];
+			}
+		}
+	}
+	
+	CGRect rect = _frame;
+	rect.size.height = CGFLOAT_HEIGHT_UNKNOWN;
+	
+	CGRect dirtyRect = CGRectNull;
+	
+	for (DTPendingParagraphLayout *pendingLayout in deferredLayouts)
+	{
+		DTCoreTextLayouter *tmpLayouter = [[DTCoreTextLayouter alloc] initWithAttributedString:pendingLayout.text];
+		DTCoreTextLayoutFrame *tmpFrame = [tmpLayouter layoutFrameWithRect:rect range:NSMakeRange(0, 0)];
+		
+		pendingLayout.paragraphs = [DTParagraphLineTable paragraphsWithLines:tmpFrame.lines string:[pendingLayout.text string]];
+		
+		dirtyRect = CGRectUnion(dirtyRect, [self _finishPendingLayout:pendingLayout]);
+	}
+	
+	return dirtyRect;
+}
+
+- (BOOL)hasDeferredLayout
+{
+	@synchronized(_pendingLayouts)
+	{
+		for (DTPendingParagraphLayout *pendingLayout in _pendingLayouts)
+		{
+			if (pendingLayout.deferred)
+			{
+				return YES;
+			}
+		}
+		
+		return NO;
+	}
+}
+
+#pragma mark - Changing Attributes
+
+- (BOOL)replaceAttributesInRange:(NSRange)range withText:(NSAttributedString *)text dirtyRect:(CGRect *)dirtyRect
+{
+	if (!_paragraphTable || !_DTReplacementChangesOnlyMetricNeutralAttributes(_attributedStringFragment, range, text))
+	{
+		return NO;
+	}
+	
+	@synchronized(_pendingLayouts)
+	{
+		// these are being typeset from the current attributes
+		if ([_pendingLayouts count])
+		{
+			return NO;
+		}
+	}
+	
+	__block BOOL didReplace = NO;
+	
+	dispatch_barrier_sync(_syncQueue, ^{
+		
+		NSRange paragraphs = [self paragraphRangeContainingStringRange:range];
+		
+		if (!paragraphs.length)
+		{
+			return;
+		}
+		
+		NSString *plainText = [_attributedStringFragment string];
+		
+		// lines that cannot simply be recreated from the typesetter need a full layout
+		for (NSUInteger index = paragraphs.location; index < NSMaxRange(paragraphs); index++)
+		{
+			if (![_paragraphTable isParagraphLaidOutAtIndex:index])
+			{
+				continue;
+			}
+			
+			NSRange paragraphRange = [_paragraphTable stringRangeOfParagraphAtIndex:index];
+			NSDictionary *paragraphAttributes = [_attributedStringFragment attributesAtIndex:paragraphRange.location effectiveRange:NULL];
+			
+			if ([[paragraphAttributes paragraphStyle] alignment] == kCTJustifiedTextAlignment)
+			{
+				return;
+			}
+			
+			for (DTCoreTextLayoutLine *oneLine in [_paragraphTable linesOfParagraphAtIndex:index])
+			{
+				NSRange lineRange = oneLine.stringRange;
+				
+				// hyphenated lines got a hyphen glyph added by the layouter
+				if (lineRange.length && [plainText characterAtIndex:NSMaxRange(lineRange)-1] == 0x00AD)
+				{
+					return;
+				}
+			}
+		}
+		
+		// same characters, so all string ranges and paragraph boundaries stay the same
+		[(NSMutableAttributedString *)_attributedStringFragment replaceCharactersInRange:range withAttributedString:text];
+		_textGeneration++;
+		
+		CGRect redrawArea = CGRectNull;
+		
+		for (NSUInteger index = paragraphs.location; index < NSMaxRange(paragraphs); index++)
+		{
+			// estimated paragraphs get laid out from the new attributes when needed
+			if (![_paragraphTable isParagraphLaidOutAtIndex:index])
+			{
+				continue;
+			}
+			
+			NSRange paragraphRange = [_paragraphTable stringRangeOfParagraphAtIndex:index];
+			NSArray *lines = [_paragraphTable linesOfParagraphAtIndex:index];
+			NSMutableArray *newLines = [NSMutableArray arrayWithCapacity:[lines count]];
+			
+			CTTypesetterRef typesetter = NULL;
+			
+			for (DTCoreTextLayoutLine *oneLine in lines)
+			{
+				NSRange lineRange = oneLine.stringRange;
+				
+				if (!NSIntersectionRange(lineRange, range).length)
+				{
+					[newLines addObject:oneLine];
+					
+					continue;
+				}
+				
+				if (!typesetter)
+				{
+					NSAttributedString *paragraphText = [_attributedStringFragment attributedSubstringFromRange:paragraphRange];
+					typesetter = CTTypesetterCreateWithAttributedString((__bridge CFAttributedStringRef)paragraphText);
+				}
+				
+				// no line breaking, the glyphs end up with the same metrics
+				CTLineRef line = CTTypesetterCreateLine(typesetter, CFRangeMake(lineRange.location - paragraphRange.location, lineRange.length));
+				
+				DTCoreTextLayoutLine *newLine = [[DTCoreTextLayoutLine alloc] initWithLine:line];
+				CFRelease(line);
+				
+				newLine.writingDirectionIsRightToLeft = oneLine.writingDirectionIsRightToLeft;
+				newLine.baselineOrigin = oneLine.baselineOrigin;
+				[newLine adjustStringRangeToStartAtIndex:lineRange.location];
+				
+				[newLines addObject:newLine];
+				
+				redrawArea = CGRectUnion(redrawArea, CGRectIntegral(oneLine.frame));
+			}
+			
+			if (typesetter)
+			{
+				CFRelease(typesetter);
+				
+				[_paragraphTable replaceParagraphsInRange:NSMakeRange(index, 1) withParagraphs:@[newLines]];
+			}
+		}
+		
+		// flat line array is rebuilt on demand
+		_lines = nil;
+		
+		if (dirtyRect)
+		{
+			*dirtyRect = redrawArea;
+		}
+		
+		didReplace = YES;
+	});
+	
+	return didReplace;
+}
+
+#pragma mark - Geometry
+
+- (NSArray *)selectionRectsForRange:(NSRange)range
+{
+	if (!_paragraphTable)
+	{
+		if (_cachedSelectionRectangles && NSEqualRanges(range, _cachedSelectionRectanglesRange))
+		{
+			return _cachedSelectionRectangles;
+		}
+		
+		_cachedSelectionRectangles = [super selectionRectsForRange:range];
+		_cachedSelectionRectanglesRange = range;
+		
+		return _cachedSelectionRectangles;
+	}
+	
+	@synchronized(self)
+	{
+		if (_cachedSelectionRectangles && NSEqualRanges(range, _cachedSelectionRectanglesRange))
+		{
+			return _cachedSelectionRectangles;
+		}
+	}
+	
+	// layout estimated paragraphs first, this changes line indexes
+	NSRange paragraphs = [self paragraphRangeContainingStringRange:NSMakeRange(range.location, range.length + 1)];
+	
+	for (NSUInteger index = paragraphs.location; index < NSMaxRange(paragraphs); index++)
+	{
+		if (![_paragraphTable isParagraphLaidOutAtIndex:index])
+		{
+			[_paragraphTable linesOfParagraphAtIndex:index];
+		}
+	}
+	
+	NSUInteger numberOfLines = [_paragraphTable numberOfLines];
+	
+	if (!numberOfLines)
+	{
+		return nil;
+	}
+	
+	NSUInteger firstLineIndex = [_paragraphTable indexOfLineContainingStringIndex:range.location];
+	
+	if (firstLineIndex == NSNotFound)
+	{
+		// range at the very end of the text
+		DTCoreTextLayoutLine *lastLine = [_paragraphTable lineAtIndex:numberOfLines-1];
+		
+		return [self selectionRectsForRange:range inLines:[NSArray arrayWithObject:lastLine]];
+	}
+	
+	// without a line containing the end the selection extends to the last line
+	NSUInteger endLineIndex = [_paragraphTable indexOfLineContainingStringIndex:NSMaxRange(range)];
+	NSUInteger lastLineIndex = (endLineIndex != NSNotFound) ? endLineIndex : numberOfLines-1;
+	
+	NSArray *knownRectangles;
+	NSUInteger knownFirstLineIndex;
+	NSRange knownRange;
+	NSUInteger generation;
+	
+	@synchronized(self)
+	{
+		knownRectangles = _selectionRectanglesByLine;
+		knownFirstLineIndex = _selectionRectanglesFirstLineIndex;
+		knownRange = _selectionRectanglesRange;
+		generation = _selectionRectanglesGeneration;
+	}
+	
+	NSMutableArray *rectangles = [NSMutableArray arrayWithCapacity:lastLineIndex - firstLineIndex + 1];
+	
+	for (NSUInteger lineIndex = firstLineIndex; lineIndex <= lastLineIndex; lineIndex++)
+	{
+		DTTextSelectionRect *selectionRect = nil;
+		
+		if (lineIndex >= knownFirstLineIndex && lineIndex - knownFirstLineIndex < [knownRectangles count])
+		{
+			id knownRect = [knownRectangles objectAtIndex:lineIndex - knownFirstLineIndex];
+			
+			if (knownRect != [NSNull null])
+			{
+				BOOL containsStart = (lineIndex == firstLineIndex);
+				BOOL containsEnd = (lineIndex == endLineIndex);
+				
+				// only the lines containing start or end depend on the range
+				if ([knownRect containsStart] == containsStart && [knownRect containsEnd] == containsEnd && (!containsStart || range.location == knownRange.location) && (!containsEnd || NSMaxRange(range) == NSMaxRange(knownRange)))
+				{
+					selectionRect = knownRect;
+				}
+			}
+		}
+		
+		if (!selectionRect)
+		{
+			selectionRect = [self selectionRectForRange:range inLine:[_paragraphTable lineAtIndex:lineIndex]];
+		}
+		
+		[rectangles addObject:selectionRect];
+	}
+	
+	@synchronized(self)
+	{
+		// lines might have moved in the meantime
+		if (generation == _selectionRectanglesGeneration)
+		{
+			_selectionRectanglesByLine = rectangles;
+			_selectionRectanglesFirstLineIndex = firstLineIndex;
+			_selectionRectanglesRange = range;
+			
+			_cachedSelectionRectangles = [rectangles copy];
+			_cachedSelectionRectanglesRange = range;
+		}
+	}
+	
+	return rectangles;
+}
+
+- (void)_invalidateSelectionRectangles
+{
+	@synchronized(self)
+	{
+		_cachedSelectionRectangles = nil;
+		_selectionRectanglesByLine = nil;
+		_selectionRectanglesGeneration++;
+	}
+}
+
+- (void)_updateSelectionRectanglesForReplacedLines:(NSRange)lineRange withNumberOfLines:(NSUInteger)numberOfLines stringRange:(NSRange)stringRange changeInLength:(NSInteger)delta linesAfterBaselineOffset:(CGFloat)baselineOffset
+{
+	@synchronized(self)
+	{
+		if (!_selectionRectanglesByLine)
+		{
+			return;
+		}
+		
+		NSUInteger knownCount = [_selectionRectanglesByLine count];
+		
+		if (_selectionRectanglesFirstLineIndex + knownCount <= lineRange.location)
+		{
+			// selection is above the modified lines, nothing changes
+			return;
+		}
+		
+		_selectionRectanglesGeneration++;
+		
+		NSMutableArray *tmpArray = [NSMutableArray arrayWithCapacity:knownCount - lineRange.length + numberOfLines];
+		NSUInteger firstLineIndex = MIN(_selectionRectanglesFirstLineIndex, lineRange.location);
+		
+		if (_selectionRectanglesFirstLineIndex > NSMaxRange(lineRange))
+		{
+			// selection is below the modified lines, the index moves with the line count
+			firstLineIndex = _selectionRectanglesFirstLineIndex + numberOfLines - lineRange.length;
+		}
+		
+		BOOL complete = YES;
+		
+		for (NSUInteger index = 0; index < knownCount; index++)
+		{
+			NSUInteger lineIndex = _selectionRectanglesFirstLineIndex + index;
+			
+			if (lineIndex < lineRange.location)
+			{
+				[tmpArray addObject:[_selectionRectanglesByLine objectAtIndex:index]];
+				
+				continue;
+			}
+			
+			if (lineIndex < NSMaxRange(lineRange))
+			{
+				continue;
+			}
+			
+			if (lineIndex == NSMaxRange(lineRange))
+			{
+				// the new lines still need to be measured
+				for (NSUInteger i=0; i<numberOfLines; i++)
+				{
+					[tmpArray addObject:[NSNull null]];
+				}
+			}
+			
+			id oneRect = [_selectionRectanglesByLine objectAtIndex:index];
+			
+			if (oneRect != [NSNull null] && baselineOffset != 0)
+			{
+				DTTextSelectionRect *shiftedRect = [DTTextSelectionRect textSelectionRectWithRect:CGRectOffset([oneRect rect], 0, baselineOffset)];
+				shiftedRect.containsStart = [oneRect containsStart];
+				shiftedRect.containsEnd = [oneRect containsEnd];
+				
+				oneRect = shiftedRect;
+			}
+			
+			[tmpArray addObject:oneRect];
+		}
+		
+		// drop leading and trailing lines that need to be measured again
+		while ([tmpArray count] && [tmpArray objectAtIndex:0] == [NSNull null])
+		{
+			[tmpArray removeObjectAtIndex:0];
+			firstLineIndex++;
+		}
+		
+		while ([tmpArray count] && [tmpArray lastObject] == [NSNull null])
+		{
+			[tmpArray removeLastObject];
+		}
+		
+		for (id oneRect in tmpArray)
+		{
+			if (oneRect == [NSNull null])
+			{
+				complete = NO;
+				break;
+			}
+		}
+		
+		// string indexes behind the modified paragraphs move by the change in length
+		NSRange knownRange = _selectionRectanglesRange;
+		
+		if (knownRange.location >= NSMaxRange(stringRange))
+		{
+			knownRange.location += delta;
+		}
+		else if (NSMaxRange(knownRange) >= NSMaxRange(stringRange))
+		{
+			knownRange.length += delta;
+		}
+		
+		_selectionRectanglesByLine = [tmpArray count] ? tmpArray : nil;
+		_selectionRectanglesFirstLineIndex = firstLineIndex;
+		_selectionRectanglesRange = knownRange;
+		
+		if (complete && [tmpArray count] == knownCount)
+		{
+			// the same selection is still fully known, just shifted
+			_cachedSelectionRectangles = [tmpArray copy];
+			_cachedSelectionRectanglesRange = knownRange;
+		}
+		else
+		{
+			_cachedSelectionRectangles = nil;
+		}
+	}
+}
+
+- (void)drawInContext:(CGContextRef)context options:(DTCoreTextLayoutFrameDrawingOptions)options
+{
+	DTParagraphRasterCache *rasterCache = _paragraphRasterCache;
+	
+	dispatch_sync(_syncQueue, ^{
+		
+		if (rasterCache && _paragraphTable)
+		{
+			[self _drawParagraphsFromRasterCache:rasterCache inContext:context options:options];
+		}
+		else
+		{
+			[super drawInContext:context options:options];
+		}
+	});
+}
+
+// draws each paragraph intersecting the clip rect from a cached bitmap, needs to be called on the sync queue
+- (void)_drawParagraphsFromRasterCache:(DTParagraphRasterCache *)rasterCache inContext:(CGContextRef)context options:(DTCoreTextLayoutFrameDrawingOptions)options
+{
+	CGRect clipRect = CGContextGetClipBoundingBox(context);
+	
+	NSUInteger index = [_paragraphTable indexOfParagraphAtVerticalPosition:CGRectGetMinY(clipRect)];
+	
+	if (index == NSNotFound)
+	{
+		return;
+	}
+	
+	// tiled layers draw with the scale of their zoom level
+	CGAffineTransform transform = CGContextGetCTM(context);
+	CGFloat scale = sqrtf(transform.a * transform.a + transform.b * transform.b);
+	
+	CGFloat width = _frame.size.width;
+	CGFloat drawingWidth = CGRectGetMaxX(_frame) + _frame.origin.x;
+	
+	NSUInteger numberOfParagraphs = [_paragraphTable numberOfParagraphs];
+	
+	UIGraphicsPushContext(context);
+	
+	for (; index < numberOfParagraphs; index++)
+	{
+		if ([_paragraphTable topOfParagraphAtIndex:index] >= CGRectGetMaxY(clipRect))
+		{
+			break;
+		}
+		
+		// lays out estimated paragraphs
+		NSArray *lines = [_paragraphTable linesOfParagraphAtIndex:index];
+		
+		if (![lines count])
+		{
+			continue;
+		}
+		
+		CGRect paragraphRect = [self _frameCoveringLines:lines];
+		paragraphRect.origin.x = 0;
+		paragraphRect.size.width = drawingWidth;
+		
+		if (!CGRectIntersectsRect(paragraphRect, clipRect))
+		{
+			continue;
+		}
+		
+		NSAttributedString *paragraphText = [_attributedStringFragment attributedSubstringFromRange:[_paragraphTable stringRangeOfParagraphAtIndex:index]];
+		
+		// paragraphs too large for the cache would be rasterized again on every draw, the bitmap must not capture the placeholder of an image that is still being decoded
+		if (![rasterCache canCacheImageOfSize:paragraphRect.size scale:scale] || _DTTextHasPendingImageAttachments(paragraphText, scale))
+		{
+			CGContextSaveGState(context);
+			CGContextClipToRect(context, paragraphRect);
+			[super drawInContext:context options:options];
+			CGContextRestoreGState(context);
+			
+			continue;
+		}
+		
+		UIImage *image = [rasterCache imageForParagraphText:paragraphText width:width scale:scale];
+		
+		[_metrics recordLookupInCache:DTRichTextEditorMetricsCacheParagraphRasters hit:(image != nil)];
+		
+		if (!image)
+		{
+			UIGraphicsBeginImageContextWithOptions(paragraphRect.size, NO, scale);
+			CGContextRef imageContext = UIGraphicsGetCurrentContext();
+			
+			// only the lines of this paragraph are inside the clip rect
+			CGContextTranslateCTM(imageContext, -paragraphRect.origin.x, -paragraphRect.origin.y);
+			CGContextClipToRect(imageContext, paragraphRect);
+			
+			[super drawInContext:imageContext options:options];
+			
+			image = UIGraphicsGetImageFromCurrentImageContext();
+			UIGraphicsEndImageContext();
+			
+			if (!image)
+			{
+				continue;
+			}
+			
+			[rasterCache setImage:image forParagraphText:paragraphText width:width scale:scale];
+		}
+		
+		[image drawInRect:paragraphRect];
+	}
+	
+	UIGraphicsPopContext();
+}
+
+#pragma mark - Paragraph Ranges
+
+// the table is updated together with the string, it only lags behind before the first layout
+- (BOOL)_paragraphTableMatchesString
+{
+	NSUInteger numberOfParagraphs = [_paragraphTable numberOfParagraphs];
+	
+	if (!numberOfParagraphs)
+	{
+		return NO;
+	}
+	
+	NSRange lastParagraphRange = [_paragraphTable stringRangeOfParagraphAtIndex:numberOfParagraphs-1];
+	
+	return (NSMaxRange(lastParagraphRange) == [_attributedStringFragment length]);
+}
+
+- (NSUInteger)numberOfParagraphs
+{
+	if (![self _paragraphTableMatchesString])
+	{
+		return [[_attributedStringFragment string] numberOfParagraphs];
+	}
+	
+	return [_paragraphTable numberOfParagraphs];
+}
+
+- (NSRange)rangeOfParagraphAtIndex:(NSUInteger)index
+{
+	return [self rangeOfParagraphsContainingRange:NSMakeRange(index, 0) parBegIndex:NULL parEndIndex:NULL];
+}
+
+- (NSRange)rangeOfParagraphsContainingRange:(NSRange)range parBegIndex:(NSUInteger *)parBeginIndex parEndIndex:(NSUInteger *)parEndIndex
+{
+	NSUInteger length = [_attributedStringFragment length];
+	
+	if (![self _paragraphTableMatchesString])
+	{
+		return [[_attributedStringFragment string] rangeOfParagraphsContainingRange:range parBegIndex:parBeginIndex parEndIndex:parEndIndex];
+	}
+	
+	NSRange paragraphsRange;
+	
+	if (range.location >= length)
+	{
+		// behind the last paragraph break
+		paragraphsRange = NSMakeRange(length, 0);
+	}
+	else
+	{
+		NSUInteger firstIndex = [_paragraphTable indexOfParagraphContainingStringIndex:range.location];
+		NSUInteger lastLocation = MIN(NSMaxRange(range), length);
+		
+		// a range ending after a paragraph break does not include the next paragraph
+		if (lastLocation > range.location)
+		{
+			lastLocation--;
+		}
+		
+		NSUInteger lastIndex = [_paragraphTable indexOfParagraphContainingStringIndex:lastLocation];
+		
+		NSUInteger begin = [_paragraphTable stringRangeOfParagraphAtIndex:firstIndex].location;
+		NSUInteger end = NSMaxRange([_paragraphTable stringRangeOfParagraphAtIndex:lastIndex]);
+		
+		paragraphsRange = NSMakeRange(begin, end - begin);
+	}
+	
+	if (parBeginIndex)
+	{
+		*parBeginIndex = paragraphsRange.location;
+	}
+	
+	if (parEndIndex)
+	{
+		*parEndIndex = NSMaxRange(paragraphsRange);
+	}
+	
+	return paragraphsRange;
+}
+
+- (BOOL)indexIsAtBeginningOfParagraph:(NSUInteger)index
+{
+	if (!index)
+	{
+		return YES;
+	}
+	
+	if (index >= [_attributedStringFragment length] || ![self _paragraphTableMatchesString])
+	{
+		return [[_attributedStringFragment string] indexIsAtBeginningOfParagraph:index];
+	}
+	
+	NSUInteger paragraphIndex = [_paragraphTable indexOfParagraphContainingStringIndex:index];
+	
+	return ([_paragraphTable stringRangeOfParagraphAtIndex:paragraphIndex].location == index);
+}
+
+#pragma mark - Attachments
+
+- (DTTextAttachmentIndex *)attachmentIndex
+{
+	@synchronized(self)
+	{
+		if (!_attachmentIndex)
+		{
+			_attachmentIndex = [[DTTextAttachmentIndex alloc] initWithAttributedString:_attributedStringFragment];
+		}
+		
+		return _attachmentIndex;
+	}
+}
+
+- (NSArray *)textAttachments
+{
+	// the index does not need the lines, which would force a complete layout of lazy frames
+	return [[self attachmentIndex] attachments];
+}
+
+- (NSArray *)textAttachmentsInRange:(NSRange)range
+{
+	return [[self attachmentIndex] attachmentsInRange:range];
+}
+
+- (NSArray *)textAttachmentsWithPredicate:(NSPredicate *)predicate class:(Class)attachmentClass inRange:(NSRange)range
+{
+	NSArray *attachments = [[self attachmentIndex] attachmentsOfClass:attachmentClass inRange:range];
+	
+	if (!predicate)
+	{
+		return attachments;
+	}
+	
+	return [attachments filteredArrayUsingPredicate:predicate];
+}
+
+- (NSArray *)textAttachmentsWithContentURL:(NSURL *)contentURL
+{
+	return [[self attachmentIndex] attachmentsWithContentURL:contentURL];
+}
+
+- (NSIndexSet *)replaceContentURL:(NSURL *)contentURL withURL:(NSURL *)newURL
+{
+	DTTextAttachmentIndex *attachmentIndex = [self attachmentIndex];
+	NSMutableIndexSet *locations = [NSMutableIndexSet indexSet];
+	
+	for (DTTextAttachment *attachment in [attachmentIndex replaceContentURL:contentURL withURL:newURL])
+	{
+		[locations addIndexes:[attachmentIndex locationsOfAttachment:attachment]];
+	}
+	
+	return locations;
+}
+
+#pragma mark - Lines and Paragraphs
+
+- (NSArray *)lines
+{
+	if (!_paragraphTable)
+	{
+		return [super lines];
+	}
+	
+	// moves all lines to their absolute position
+	NSArray *lines = [_paragraphTable allLines];
+	
+	@synchronized(self)
+	{
+		_lines = lines;
+	}
+	
+	return lines;
+}
+
+- (NSArray *)linesVisibleInRect:(CGRect)rect
+{
+	if (!_paragraphTable)
+	{
+		return [super linesVisibleInRect:rect];
+	}
+	
+	// only resolves the paragraphs that are actually visible
+	return [_paragraphTable linesVisibleInRect:rect];
+}
+
+- (NSArray *)paragraphRanges
+{
+	if (!_paragraphTable)
+	{
+		return [super paragraphRanges];
+	}
+	
+	@synchronized(self)
+	{
+		if (!_paragraphRanges)
+		{
+			NSUInteger numberOfParagraphs = [_paragraphTable numberOfParagraphs];
+			NSMutableArray *tmpArray = [NSMutableArray arrayWithCapacity:numberOfParagraphs];
+			
+			for (NSUInteger index=0; index<numberOfParagraphs; index++)
+			{
+				NSRange range = [_paragraphTable stringRangeOfParagraphAtIndex:index];
+				[tmpArray addObject:[NSValue valueWithRange:range]];
+			}
+			
+			_paragraphRanges = [tmpArray copy];
+		}
+		
+		return _paragraphRanges;
+	}
+}
+
+- (NSRange)paragraphRangeContainingStringRange:(NSRange)stringRange
+{
+	if (!_paragraphTable)
+	{
+		return [super paragraphRangeContainingStringRange:stringRange];
+	}
+	
+	NSUInteger numberOfParagraphs = [_paragraphTable numberOfParagraphs];
+	
+	if (!numberOfParagraphs)
+	{
+		return NSMakeRange(0, 0);
+	}
+	
+	NSRange lastParagraphRange = [_paragraphTable stringRangeOfParagraphAtIndex:numberOfParagraphs-1];
+	
+	if (stringRange.location >= NSMaxRange(lastParagraphRange))
+	{
+		// behind the last paragraph
+		return NSMakeRange(numberOfParagraphs, 0);
+	}
+	
+	NSUInteger firstParagraphIndex = [_paragraphTable indexOfParagraphContainingStringIndex:stringRange.location];
+	NSUInteger lastParagraphIndex = firstParagraphIndex;
+	
+	if (stringRange.length)
+	{
+		lastParagraphIndex = [_paragraphTable indexOfParagraphContainingStringIndex:NSMaxRange(stringRange)-1];
+	}
+	
+	return NSMakeRange(firstParagraphIndex, lastParagraphIndex - firstParagraphIndex + 1);
+}
+
+- (NSArray *)linesInParagraphAtIndex:(NSUInteger)index
+{
+	if (!_paragraphTable)
+	{
+		return [super linesInParagraphAtIndex:index];
+	}
+	
+	return [_paragraphTable linesOfParagraphAtIndex:index];
+}
+
+- (DTCoreTextLayoutLine *)lineContainingIndex:(NSUInteger)index
+{
+	if (!_paragraphTable)
+	{
+		return [super lineContainingIndex:index];
+	}
+	
+	// binary search in the paragraph table, only lays out the paragraph containing the index
+	return [_paragraphTable lineContainingStringIndex:index];
+}
+
+- (NSInteger)lineIndexForGlyphIndex:(NSInteger)index
+{
+	if (!_paragraphTable)
+	{
+		return [super lineIndexForGlyphIndex:index];
+	}
+	
+	if (index < 0)
+	{
+		return NSNotFound;
+	}
+	
+	return [_paragraphTable indexOfLineContainingStringIndex:index];
+}
+
+- (NSInteger)_indexForPositionFromIndex:(NSInteger)index lineOffset:(NSInteger)offset
+{
+	NSInteger lineIndex = [_paragraphTable indexOfLineContainingStringIndex:index];
+	NSInteger numberOfLines = [_paragraphTable numberOfLines];
+	
+	if (lineIndex == NSNotFound)
+	{
+		if (!numberOfLines || index <= 0)
+		{
+			return NSNotFound;
+		}
+		
+		// cursor behind the last character is on the last line
+		lineIndex = numberOfLines - 1;
+	}
+	
+	NSInteger newLineIndex = lineIndex + offset;
+	
+	if (newLineIndex < 0 || newLineIndex >= numberOfLines)
+	{
+		return NSNotFound;
+	}
+	
+	CGRect currentRect = [self cursorRectAtIndex:index];
+	
+	DTCoreTextLayoutLine *line = [_paragraphTable lineAtIndex:newLineIndex];
+	NSInteger closestIndex = [line stringIndexForPosition:CGPointMake(currentRect.origin.x, line.frame.origin.y)];
+	
+	// make sure that the index is inside the line
+	if (!NSLocationInRange(closestIndex, line.stringRange))
+	{
+		closestIndex = MAX(0,NSMaxRange(line.stringRange)-1);
+	}
+	
+	return closestIndex;
+}
+
+- (NSInteger)indexForPositionUpwardsFromIndex:(NSInteger)index offset:(NSInteger)offset
+{
+	if (!_paragraphTable)
+	{
+		return [super indexForPositionUpwardsFromIndex:index offset:offset];
+	}
+	
+	return [self _indexForPositionFromIndex:index lineOffset:-offset];
+}
+
+- (NSInteger)indexForPositionDownwardsFromIndex:(NSInteger)index offset:(NSInteger)offset
+{
+	if (!_paragraphTable)
+	{
+		return [super indexForPositionDownwardsFromIndex:index offset:offset];
+	}
+	
+	return [self _indexForPositionFromIndex:index lineOffset:offset];
+}
+
+- (NSInteger)closestCursorIndexToPoint:(CGPoint)point
+{
+	if (!_paragraphTable)
+	{
+		return [super closestCursorIndexToPoint:point];
+	}
+	
+	NSUInteger paragraphIndex = [_paragraphTable indexOfParagraphAtVerticalPosition:point.y];
+	
+	if (paragraphIndex == NSNotFound)
+	{
+		return NSNotFound;
+	}
+	
+	NSArray *lines = [_paragraphTable linesOfParagraphAtIndex:paragraphIndex];
+	
+	if (![lines count])
+	{
+		return NSNotFound;
+	}
+	
+	DTCoreTextLayoutLine *firstLine = [lines objectAtIndex:0];
+	
+	if (!paragraphIndex && point.y < CGRectGetMinY(firstLine.frame))
+	{
+		return 0;
+	}
+	
+	// find closest line in this paragraph
+	DTCoreTextLayoutLine *closestLine = nil;
+	CGFloat closestDistance = CGFLOAT_MAX;
+	
+	for (DTCoreTextLayoutLine *oneLine in lines)
+	{
+		CGRect lineFrame = oneLine.frame;
+		
+		if (CGRectGetMinY(lineFrame) <= point.y && CGRectGetMaxY(lineFrame) >= point.y)
+		{
+			closestLine = oneLine;
+			break;
+		}
+		
+		CGFloat distance = MIN(fabs(CGRectGetMinY(lineFrame) - point.y), fabs(CGRectGetMaxY(lineFrame) - point.y));
+		
+		if (distance < closestDistance)
+		{
+			closestDistance = distance;
+			closestLine = oneLine;
+		}
+	}
+	
+	NSInteger closestIndex = [closestLine stringIndexForPosition:point];
+	NSInteger maxIndex = NSMaxRange([closestLine stringRange])-1;
+	
+	if (closestIndex > maxIndex)
+	{
+		closestIndex = maxIndex;
+	}
+	
+	if (closestIndex >= 0)
+	{
+		return closestIndex;
+	}
+	
+	return NSNotFound;
+}
+
+#pragma mark - DTParagraphLineTableLayoutDelegate
+
+- (NSArray *)paragraphLineTable:(DTParagraphLineTable *)table linesForParagraphInRange:(NSRange)range
+{
+	DTPendingParagraphLayout *pendingLayout = [self _pendingLayoutContainingLocation:range.location];
+	
+	if (pendingLayout)
+	{
+		// the paragraph is being typeset in the background, waiting for it is cheaper than doing it again
+		NSArray *lines = [self _linesFromPendingLayout:pendingLayout forParagraphInRange:range];
+		
+		if (lines)
+		{
+			return lines;
+		}
+	}
+	
+	NSAttributedString *paragraphText = [_attributedStringFragment attributedSubstringFromRange:range];
+	
+	// layout the paragraph text
+	DTCoreTextLayouter *tmpLayouter = [[DTCoreTextLayouter alloc] initWithAttributedString:paragraphText];
+	CGRect rect = _frame;
+	rect.size.height = CGFLOAT_HEIGHT_UNKNOWN;
+	DTCoreTextLayoutFrame *tmpFrame = [tmpLayouter layoutFrameWithRect:rect range:NSMakeRange(0, 0)];
+	
+	NSArray *lines = tmpFrame.lines;
+	NSUInteger location = range.location;
+	
+	for (DTCoreTextLayoutLine *oneLine in lines)
+	{
+		[oneLine adjustStringRangeToStartAtIndex:location];
+		location = NSMaxRange(oneLine.stringRange);
+	}
+	
+	return lines;
+}
+
+- (CGFloat)paragraphLineTable:(DTParagraphLineTable *)table baselineOriginYForLine:(DTCoreTextLayoutLine *)line afterLine:(DTCoreTextLayoutLine *)previousLine
+{
+	return [self baselineOriginToPositionLine:(id)line afterLine:(id)previousLine options:DTCoreTextLayoutFrameLinePositioningOptionAlgorithmWebKit].y;
+}
+
+- (void)paragraphLineTableDidChangeHeight:(DTParagraphLineTable *)table
+{
+	// this might be called from several drawing threads, we only need a single update
+	@synchronized(self)
+	{
+		// flat line array contains the new lines next time
+		_lines = nil;
+		
+		// following lines moved
+		_cachedSelectionRectangles = nil;
+		_selectionRectanglesByLine = nil;
+		_selectionRectanglesGeneration++;
+		
+		if (_heightChangeNotificationPending)
+		{
+			return;
+		}
+		
+		_heightChangeNotificationPending = YES;
+	}
+	
+	dispatch_async(dispatch_get_main_queue(), ^{
+		
+		@synchronized(self)
+		{
+			_heightChangeNotificationPending = NO;
+		}
+		
+		__block BOOL didChangeHeight = NO;
+		
+		// drawing threads read the frame while holding the sync queue
+		dispatch_barrier_sync(_syncQueue, ^{
+			
+			CGFloat height = ceilf((_paragraphTable.maxY - _frame.origin.y + 1.5));
+			
+			if (height != _frame.size.height)
+			{
+				_frame.size.height = height;
+				didChangeHeight = YES;
+			}
+		});
+		
+		if (didChangeHeight)
+		{
+			[[NSNotificationCenter defaultCenter] postNotificationName:DTMutableCoreTextLayoutFrameDidChangeHeightNotification object:self];
+		}
+	});
+}
+
+#pragma mark - Releasing Memory
+
+- (void)discardLines
+{
+	dispatch_barrier_sync(_syncQueue, ^{
+		
+		NSUInteger count = [_paragraphTable numberOfParagraphs];
+		
+		if (!count || ![self _paragraphTableMatchesString])
+		{
+			return;
+		}
+		
+		@synchronized(_pendingLayouts)
+		{
+			// pending layouts swap their lines into the current table
+			if ([_pendingLayouts count])
+			{
+				return;
+			}
+		}
+		
+		NSInteger *lengths = malloc(count * sizeof(NSInteger));
+		CGFloat *ascents = malloc(count * sizeof(CGFloat));
+		CGFloat *descents = malloc(count * sizeof(CGFloat));
+		
+		// the summary reproduces the current paragraph positions exactly
+		CGFloat top = [_paragraphTable topOfParagraphAtIndex:0];
+		CGFloat originY = top;
+		
+		for (NSUInteger i=0; i<count; i++)
+		{
+			CGFloat baselineOriginY = [_paragraphTable baselineOriginYOfParagraphAtIndex:i];
+			CGFloat nextTop = (i+1<count) ? [_paragraphTable topOfParagraphAtIndex:i+1] : [_paragraphTable bottomOfParagraphAtIndex:i];
+			
+			lengths[i] = [_paragraphTable stringRangeOfParagraphAtIndex:i].length;
+			ascents[i] = baselineOriginY - top;
+			descents[i] = nextTop - baselineOriginY;
+			
+			top = nextTop;
+		}
+		
+		_paragraphTable = [[DTParagraphLineTable alloc] initWithNumberOfEstimatedParagraphs:count lengths:lengths ascents:ascents descents:descents originY:originY];
+		_paragraphTable.layoutDelegate = self;
+		
+		free(lengths);
+		free(ascents);
+		free(descents);
+		
+		[_cachedWidthLayouts removeAllObjects];
+		[self _invalidateSelectionRectangles];
+		
+		@synchronized(self)
+		{
+			_lines = nil;
+		}
+	});
+}
+
+#pragma mark - DTCacheRegistryCache
+
+- (NSUInteger)cacheCost
+{
+	__block NSUInteger numberOfLineSets;
+	__block NSUInteger numberOfSelectionRectangles;
+	
+	// the current lines are needed for drawing and not released by purgeCache, only the lines kept for other widths count
+	dispatch_sync(_syncQueue, ^{
+		numberOfLineSets = [_cachedWidthLayouts count];
+	});
+	
+	@synchronized(self)
+	{
+		numberOfSelectionRectangles = [_cachedSelectionRectangles count] + [_selectionRectanglesByLine count];
+	}
+	
+	return numberOfLineSets * [_attributedStringFragment length] * DTEstimatedBytesPerTypesetCharacter + numberOfSelectionRectangles * DTEstimatedBytesPerSelectionRectangle;
+}
+
+- (void)purgeCache
+{
+	// the current lines are still needed for drawing, only what can be derived from them or is kept for later goes
+	dispatch_barrier_sync(_syncQueue, ^{
+		[_cachedWidthLayouts removeAllObjects];
+	});
+	
+	[self _invalidateSelectionRectangles];
+	
+	@synchronized(self)
+	{
+		_lines = nil;
+	}
+}
+
+#pragma mark - Width Changes
+
+// keeps the current lines for returning to their width later, called inside the barrier
+- (void)_cacheParagraphTableForFrame:(CGRect)frame
+{
+	if (!_paragraphTable || ![self _paragraphTableMatchesString])
+	{
+		return;
+	}
+	
+	@synchronized(_pendingLayouts)
+	{
+		// estimated paragraphs of pending layouts are only resolved by the layout queue
+		if ([_pendingLayouts count])
+		{
+			return;
+		}
+	}
+	
+	for (DTCachedWidthLayout *cachedLayout in [_cachedWidthLayouts copy])
+	{
+		if (cachedLayout.textGeneration != _textGeneration || cachedLayout.frame.size.width == frame.size.width)
+		{
+			[_cachedWidthLayouts removeObject:cachedLayout];
+		}
+	}
+	
+	DTCachedWidthLayout *cachedLayout = [[DTCachedWidthLayout alloc] init];
+	cachedLayout.frame = frame;
+	cachedLayout.paragraphTable = _paragraphTable;
+	cachedLayout.textGeneration = _textGeneration;
+	
+	[_cachedWidthLayouts insertObject:cachedLayout atIndex:0];
+	
+	if ([_cachedWidthLayouts count] > DTMaximumCachedWidthLayouts)
+	{
+		[_cachedWidthLayouts removeLastObject];
+	}
+}
+
+- (DTCachedWidthLayout *)_cachedLayoutForFrame:(CGRect)frame
+{
+	for (DTCachedWidthLayout *cachedLayout in _cachedWidthLayouts)
+	{
+		if (cachedLayout.textGeneration == _textGeneration && cachedLayout.frame.size.width == frame.size.width && CGPointEqualToPoint(cachedLayout.frame.origin, frame.origin))
+		{
+			return cachedLayout;
+		}
+	}
+	
+	return nil;
+}
+
+// lays out the paragraphs of a table that still have estimated metrics, a few at a time so that edit layouts on the same queue are not held up
+- (void)_layoutEstimatedParagraphsOfTable:(DTParagraphLineTable *)paragraphTable fromIndex:(NSUInteger)index
+{
+	__weak DTMutableCoreTextLayoutFrame *weakSelf = self;
+	
+	dispatch_async(_layoutQueue, ^{
+		DTMutableCoreTextLayoutFrame *strongSelf = weakSelf;
+		
+		if (!strongSelf)
+		{
+			return;
+		}
+		
+		__block NSUInteger nextIndex = NSNotFound;
+		
+		dispatch_sync(strongSelf->_syncQueue, ^{
+			
+			// the table was replaced by a relayout or another width change
+			if (strongSelf->_paragraphTable != paragraphTable)
+			{
+				return;
+			}
+			
+			NSUInteger numberOfParagraphs = [paragraphTable numberOfParagraphs];
+			NSUInteger endIndex = MIN(index + DTEstimatedParagraphsLayoutBatchSize, numberOfParagraphs);
+			
+			for (NSUInteger i=index; i<endIndex; i++)
+			{
+				if (![paragraphTable isParagraphLaidOutAtIndex:i])
+				{
+					// the table lays out the paragraph via its layout delegate
+					[paragraphTable linesOfParagraphAtIndex:i];
+				}
+			}
+			
+			if (endIndex < numberOfParagraphs)
+			{
+				nextIndex = endIndex;
+			}
+		});
+		
+		if (nextIndex != NSNotFound)
+		{
+			[strongSelf _layoutEstimatedParagraphsOfTable:paragraphTable fromIndex:nextIndex];
+		}
+	});
+}
+
+- (void)_relayoutTextForWidthChangeFromFrame:(CGRect)previousFrame
+{
+	dispatch_barrier_sync(_syncQueue, ^{
+		
+		[self _cacheParagraphTableForFrame:previousFrame];
+		
+		DTCachedWidthLayout *cachedLayout = [self _cachedLayoutForFrame:_frame];
+		
+		if (cachedLayout)
+		{
+			// returning to a previous width, e.g. when rotating back
+			[_cachedWidthLayouts removeObject:cachedLayout];
+			[self _cancelPendingLayouts];
+			
+			_paragraphTable = cachedLayout.paragraphTable;
+			_lines = nil;
+			_paragraphRanges = nil;
+			
+			_frame.size.height = ceilf((_paragraphTable.maxY - _frame.origin.y + 1.5));
+		}
+		else
+		{
+			// visible paragraphs are laid out when they are drawn
+			[self _estimateParagraphs];
+		}
+		
+		if (!_shouldLayoutLazily)
+		{
+			// the rest follows in the background
+			[self _layoutEstimatedParagraphsOfTable:_paragraphTable fromIndex:0];
+		}
+	});
+}
+
+#pragma mark - Properties
+
+- (void)setFrame:(CGRect)frame
+{
+	if (CGPointEqualToPoint(_frame.origin, frame.origin) && _frame.size.width == frame.size.width)
+	{
+		return;
+	}
+	
+	CGRect previousFrame = _frame;
+	_frame = frame;
+	
+	// next call needs new selection rectangles
+	[self _invalidateSelectionRectangles];
+	
+	if (!shouldRebuildLines)
+	{
+		return;
+	}
+	
+	if (_paragraphTable && CGPointEqualToPoint(previousFrame.origin, frame.origin))
+	{
+		// only the width changed, lines of a previous width might be reused
+		[self _relayoutTextForWidthChangeFromFrame:previousFrame];
+	}
+	else
 	{
 		[self relayoutText];
 	}
@@ -0,0 +1,259 @@
+//
+//  DTParagraphLineTable.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+@class DTCoreTextLayoutLine, DTParagraphLineTable;
+
+/**
+ Protocol for the object that performs layout for paragraphs of a <DTParagraphLineTable> that only have estimated metrics so far.
+ */
+@protocol DTParagraphLineTableLayoutDelegate <NSObject>
+
+/**
+ Asks the delegate to layout the given string range.
+ @param table The paragraph line table
+ @param range The string range of the paragraph
+ @returns The layout lines, their string ranges need to start at the location of the range
+ */
+- (NSArray *)paragraphLineTable:(DTParagraphLineTable *)table linesForParagraphInRange:(NSRange)range;
+
+/**
+ Asks the delegate for the correct baseline position of a line following another line.
+ @param table The paragraph line table
+ @param line The line to position
+ @param previousLine The line preceding it
+ @returns The y coordinate of the baseline origin for the line
+ */
+- (CGFloat)paragraphLineTable:(DTParagraphLineTable *)table baselineOriginYForLine:(DTCoreTextLayoutLine *)line afterLine:(DTCoreTextLayoutLine *)previousLine;
+
+/**
+ Informs the delegate that laying out an estimated paragraph changed the total height. This might be called on a background thread.
+ @param table The paragraph line table
+ */
+- (void)paragraphLineTableDidChangeHeight:(DTParagraphLineTable *)table;
+
+@end
+
+/**
+ Line storage used by <DTMutableCoreTextLayoutFrame> that groups layout lines by paragraph.
+
+ Instead of absolute positions every paragraph only stores its string length, its number of lines and the vertical distance of its first baseline to the first baseline of the previous paragraph. Absolute string locations and baseline origins are prefix sums over these values. The paragraphs are kept in a balanced tree that stores these sums for every subtree, so they can be queried and modified in O(log n). Inserting or removing paragraphs is O(log n) as well, so a Return or joining two paragraphs costs no more than typing inside one.
+
+ The lines themselves are only moved to their absolute position when they are actually accessed. This way an edit in one paragraph does not have to touch the lines of all following paragraphs. Moving replaces the lines of a paragraph with repositioned copies, so lines that were returned earlier never change while they are being drawn.
+
+ Paragraphs can also be added with estimated metrics only. Those are laid out by the <layoutDelegate> the first time their lines are accessed, the estimate is then replaced with the real metrics.
+
+ Access to the table is synchronized because lines might be resolved from several drawing threads at the same time.
+ */
+@interface DTParagraphLineTable : NSObject
+
+/**
+ @name Creating a Paragraph Line Table
+ */
+
+/**
+ Creates a table from a flat array of absolutely positioned lines
+ @param lines The layout lines
+ @param string The string the lines were layouted from, used to find the paragraph boundaries
+ @returns An initialized paragraph line table
+ */
+- (instancetype)initWithLines:(NSArray *)lines string:(NSString *)string;
+
+/**
+ Creates a table of paragraphs that have not been laid out yet
+ @param count The number of paragraphs
+ @param lengths The string lengths of the paragraphs
+ @param ascents The estimated distance from the top of each paragraph to its first baseline
+ @param descents The estimated distance from the first baseline of each paragraph to the top of the next paragraph
+ @param originY The y coordinate of the top of the first paragraph
+ @returns An initialized paragraph line table
+ */
+- (instancetype)initWithNumberOfEstimatedParagraphs:(NSUInteger)count lengths:(const NSInteger *)lengths ascents:(const CGFloat *)ascents descents:(const CGFloat *)descents originY:(CGFloat)originY;
+
+/**
+ Groups a flat array of lines into an array of arrays, one for each paragraph contained in the string.
+ @param lines The layout lines
+ @param string The string the lines were layouted from. The line string ranges are relative to this string.
+ @returns An array of arrays of lines
+ */
++ (NSArray *)paragraphsWithLines:(NSArray *)lines string:(NSString *)string;
+
+/**
+ The object that lays out estimated paragraphs on demand
+ */
+@property (nonatomic, weak) id <DTParagraphLineTableLayoutDelegate> layoutDelegate;
+
+/**
+ @name Getting Information about Paragraphs
+ */
+
+/**
+ The number of paragraphs in the receiver
+ */
+@property (nonatomic, readonly) NSUInteger numberOfParagraphs;
+
+/**
+ The string range of the paragraph at the given index
+ @param index The paragraph index
+ @returns The string range covered by the paragraph
+ */
+- (NSRange)stringRangeOfParagraphAtIndex:(NSUInteger)index;
+
+/**
+ Determines the paragraph that contains the given string index. An index at the very end of the string is considered to be part of the last paragraph.
+ @param index The string index
+ @returns The paragraph index or `NSNotFound` if the receiver is empty
+ */
+- (NSUInteger)indexOfParagraphContainingStringIndex:(NSUInteger)index;
+
+/**
+ Determines the paragraph which vertically covers the given position
+ @param position The y coordinate
+ @returns The paragraph index or `NSNotFound` if the receiver is empty
+ */
+- (NSUInteger)indexOfParagraphAtVerticalPosition:(CGFloat)position;
+
+/**
+ Determines whether the paragraph at the given index has already been laid out or only has estimated metrics.
+ @param index The paragraph index
+ @returns `YES` if there are lines for this paragraph
+ */
+- (BOOL)isParagraphLaidOutAtIndex:(NSUInteger)index;
+
+/**
+ The absolute baseline origin of the first line of the paragraph at the given index
+ @param index The paragraph index
+ @returns The y coordinate of the first baseline
+ */
+- (CGFloat)baselineOriginYOfParagraphAtIndex:(NSUInteger)index;
+
+/**
+ The top of the paragraph at the given index, estimated if the paragraph has not been laid out yet
+ @param index The paragraph index
+ @returns The y coordinate of the top of the first line
+ */
+- (CGFloat)topOfParagraphAtIndex:(NSUInteger)index;
+
+/**
+ The bottom of the paragraph at the given index, estimated if the paragraph has not been laid out yet
+ @param index The paragraph index
+ @returns The y coordinate of the bottom of the last line
+ */
+- (CGFloat)bottomOfParagraphAtIndex:(NSUInteger)index;
+
+/**
+ The lowest point covered by the lines of the last paragraph
+ */
+@property (nonatomic, readonly) CGFloat maxY;
+
+/**
+ @name Accessing Lines
+ */
+
+/**
+ The lines of the paragraph at the given index, moved to their absolute position. If the paragraph only has estimated metrics it gets laid out.
+ @param index The paragraph index
+ @returns The lines of the paragraph
+ */
+- (NSArray *)linesOfParagraphAtIndex:(NSUInteger)index;
+
+/**
+ The total number of lines. Paragraphs that have not been laid out yet contribute an estimated number of lines.
+ */
+@property (nonatomic, readonly) NSUInteger numberOfLines;
+
+/**
+ The global index of the first line of the paragraph at the given index.
+ @param index The paragraph index, if this is the number of paragraphs the result is the number of lines
+ @returns The line index
+ */
+- (NSUInteger)indexOfFirstLineOfParagraphAtIndex:(NSUInteger)index;
+
+/**
+ Determines the global index of the line containing the given string index with a binary search.
+ @param index The string index
+ @returns The line index or `NSNotFound` if the index is outside of the text
+ */
+- (NSUInteger)indexOfLineContainingStringIndex:(NSUInteger)index;
+
+/**
+ Determines the line containing the given string index with a binary search.
+ @param index The string index
+ @returns The line or `nil` if the index is outside of the text
+ */
+- (DTCoreTextLayoutLine *)lineContainingStringIndex:(NSUInteger)index;
+
+/**
+ The line at the given global line index.
+ @param lineIndex The line index
+ @returns The line or `nil` if the index is out of bounds
+ */
+- (DTCoreTextLayoutLine *)lineAtIndex:(NSUInteger)lineIndex;
+
+/**
+ The lines from the one containing the start of the range to the one containing its end, inclusively.
+ @param range The string range
+ @returns The lines covering the range
+ */
+- (NSArray *)linesInStringRange:(NSRange)range;
+
+/**
+ All lines of the receiver, moved to their absolute position. This forces layout of all estimated paragraphs.
+
+ The flattened array is cached until the next modification.
+ @returns The lines of all paragraphs
+ */
+- (NSArray *)allLines;
+
+/**
+ The lines whose vertical extent intersects with the given rectangle. Only estimated paragraphs inside the rectangle get laid out.
+ @param rect The rectangle
+ @returns The lines that need to be drawn for this rectangle
+ */
+- (NSArray *)linesVisibleInRect:(CGRect)rect;
+
+/**
+ @name Modifying the Table
+ */
+
+/**
+ Replaces a range of paragraphs with new ones.
+
+ The new lines need to be absolutely positioned. Paragraphs following the modified range keep their distance relative to the last replaced paragraph, use <setBaselineOriginY:ofParagraphAtIndex:> to correct it.
+ @param range The range of paragraph indexes to replace
+ @param paragraphs An array of arrays of lines, one for each new paragraph
+ */
+- (void)replaceParagraphsInRange:(NSRange)range withParagraphs:(NSArray *)paragraphs;
+
+/**
+ Replaces a range of paragraphs with paragraphs that only have estimated metrics, to be laid out later.
+ 
+ If the number of paragraphs does not change then the metrics of the replaced paragraphs are kept as estimates and the ascents and descents parameters are ignored.
+ @param range The range of paragraph indexes to replace
+ @param lengths The string lengths of the new paragraphs
+ @param ascents The estimated distance from the top of each paragraph to its first baseline
+ @param descents The estimated distance from the first baseline of each paragraph to the top of the next paragraph
+ @param count The number of new paragraphs
+ */
+- (void)replaceParagraphsInRange:(NSRange)range withEstimatedParagraphLengths:(const NSInteger *)lengths ascents:(const CGFloat *)ascents descents:(const CGFloat *)descents count:(NSUInteger)count;
+
+/**
+ Provides the lines for a paragraph that only had estimated metrics so far, for example from a background layout.
+ @param lines The lines of the paragraph, string ranges are adjusted to the location of the paragraph
+ @param index The paragraph index
+ @returns `YES` if the lines were adopted, `NO` if the paragraph is already laid out or has a different length by now
+ */
+- (BOOL)setLines:(NSArray *)lines forEstimatedParagraphAtIndex:(NSUInteger)index;
+
+/**
+ Moves the paragraph at the given index to a new baseline origin, all following paragraphs are shifted by the same amount.
+ @param originY The new y coordinate of the first baseline of the paragraph
+ @param index The paragraph index
+ */
+- (void)setBaselineOriginY:(CGFloat)originY ofParagraphAtIndex:(NSUInteger)index;
+
+@end
@@ -0,0 +1,1328 @@
+//
+//  DTParagraphLineTable.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <DTCoreText/DTCoreText.h>
+
+#import "DTParagraphLineTable.h"
+#import "DTRichTextCategories.h"
+
+#pragma mark - Paragraph Tree
+
+// the paragraphs are the nodes of a treap ordered by their position in the text. Every node also keeps the sums over its subtree, so that absolute locations and positions are found in O(log n) and paragraphs can be inserted or removed in O(log n) without touching the others.
+
+typedef struct _DTParagraphNode
+{
+	struct _DTParagraphNode *left;
+	struct _DTParagraphNode *right;
+	uint32_t priority;
+	
+	CFTypeRef lines; // retained array of lines, NULL for paragraphs that only have estimated metrics
+	
+	NSInteger length; // string length of the paragraph
+	NSInteger lineCount; // number of lines, estimated for paragraphs not laid out yet
+	CGFloat advance; // distance of first baseline to the first baseline of the previous paragraph
+	CGFloat ascent; // distance from top of first line to first baseline
+	CGFloat descent; // distance from first baseline to bottom of last line
+	
+	// sums over the subtree
+	NSUInteger size;
+	NSInteger lengthSum;
+	NSInteger lineCountSum;
+	CGFloat advanceSum;
+} DTParagraphNode;
+
+static DTParagraphNode *_DTParagraphNodeCreate(void)
+{
+	DTParagraphNode *node = calloc(1, sizeof(DTParagraphNode));
+	node->priority = arc4random();
+	node->size = 1;
+	
+	return node;
+}
+
+static void _DTParagraphNodeSetLines(DTParagraphNode *node, NSArray *lines)
+{
+	if (node->lines)
+	{
+		CFRelease(node->lines);
+	}
+	
+	node->lines = lines ? CFBridgingRetain(lines) : NULL;
+}
+
+static NSArray *_DTParagraphNodeLines(const DTParagraphNode *node)
+{
+	return (__bridge NSArray *)node->lines;
+}
+
+static NSUInteger _DTParagraphTreeSize(const DTParagraphNode *node)
+{
+	return node ? node->size : 0;
+}
+
+static void _DTParagraphNodeUpdateSums(DTParagraphNode *node)
+{
+	node->size = 1;
+	node->lengthSum = node->length;
+	node->lineCountSum = node->lineCount;
+	node->advanceSum = node->advance;
+	
+	if (node->left)
+	{
+		node->size += node->left->size;
+		node->lengthSum += node->left->lengthSum;
+		node->lineCountSum += node->left->lineCountSum;
+		node->advanceSum += node->left->advanceSum;
+	}
+	
+	if (node->right)
+	{
+		node->size += node->right->size;
+		node->lengthSum += node->right->lengthSum;
+		node->lineCountSum += node->right->lineCountSum;
+		node->advanceSum += node->right->advanceSum;
+	}
+}
+
+static void _DTParagraphTreeUpdateAllSums(DTParagraphNode *node)
+{
+	if (!node)
+	{
+		return;
+	}
+	
+	_DTParagraphTreeUpdateAllSums(node->left);
+	_DTParagraphTreeUpdateAllSums(node->right);
+	
+	_DTParagraphNodeUpdateSums(node);
+}
+
+static void _DTParagraphTreeFree(DTParagraphNode *node)
+{
+	if (!node)
+	{
+		return;
+	}
+	
+	_DTParagraphTreeFree(node->left);
+	_DTParagraphTreeFree(node->right);
+	
+	_DTParagraphNodeSetLines(node, nil);
+	free(node);
+}
+
+// builds a tree from nodes in text order in O(n), the nodes must not have children yet
+static DTParagraphNode *_DTParagraphTreeBuild(DTParagraphNode **nodes, NSUInteger count)
+{
+	if (!count)
+	{
+		return NULL;
+	}
+	
+	// the right spine of the tree built so far
+	DTParagraphNode **spine = malloc(count * sizeof(DTParagraphNode *));
+	NSUInteger spineCount = 0;
+	
+	for (NSUInteger i=0; i<count; i++)
+	{
+		DTParagraphNode *node = nodes[i];
+		DTParagraphNode *lastPopped = NULL;
+		
+		while (spineCount && spine[spineCount-1]->priority < node->priority)
+		{
+			lastPopped = spine[--spineCount];
+		}
+		
+		node->left = lastPopped;
+		
+		if (spineCount)
+		{
+			spine[spineCount-1]->right = node;
+		}
+		
+		spine[spineCount++] = node;
+	}
+	
+	DTParagraphNode *root = spine[0];
+	free(spine);
+	
+	_DTParagraphTreeUpdateAllSums(root);
+	
+	return root;
+}
+
+// splits off the first n paragraphs
+static void _DTParagraphTreeSplit(DTParagraphNode *node, NSUInteger n, DTParagraphNode **outLeft, DTParagraphNode **outRight)
+{
+	if (!node)
+	{
+		*outLeft = NULL;
+		*outRight = NULL;
+		
+		return;
+	}
+	
+	NSUInteger leftSize = _DTParagraphTreeSize(node->left);
+	
+	if (n <= leftSize)
+	{
+		_DTParagraphTreeSplit(node->left, n, outLeft, &node->left);
+		*outRight = node;
+	}
+	else
+	{
+		_DTParagraphTreeSplit(node->right, n - leftSize - 1, &node->right, outRight);
+		*outLeft = node;
+	}
+	
+	_DTParagraphNodeUpdateSums(node);
+}
+
+static DTParagraphNode *_DTParagraphTreeMerge(DTParagraphNode *left, DTParagraphNode *right)
+{
+	if (!left)
+	{
+		return right;
+	}
+	
+	if (!right)
+	{
+		return left;
+	}
+	
+	if (left->priority > right->priority)
+	{
+		left->right = _DTParagraphTreeMerge(left->right, right);
+		_DTParagraphNodeUpdateSums(left);
+		
+		return left;
+	}
+	
+	right->left = _DTParagraphTreeMerge(left, right->left);
+	_DTParagraphNodeUpdateSums(right);
+	
+	return right;
+}
+
+static DTParagraphNode *_DTParagraphTreeNodeAtIndex(DTParagraphNode *node, NSUInteger index)
+{
+	while (node)
+	{
+		NSUInteger leftSize = _DTParagraphTreeSize(node->left);
+		
+		if (index < leftSize)
+		{
+			node = node->left;
+		}
+		else if (index == leftSize)
+		{
+			return node;
+		}
+		else
+		{
+			index -= leftSize + 1;
+			node = node->right;
+		}
+	}
+	
+	return NULL;
+}
+
+// sums over the first n paragraphs, any of the output parameters can be NULL
+static void _DTParagraphTreePrefixSums(const DTParagraphNode *node, NSUInteger n, NSInteger *outLength, NSInteger *outLineCount, CGFloat *outAdvance)
+{
+	NSInteger length = 0;
+	NSInteger lineCount = 0;
+	CGFloat advance = 0;
+	
+	while (node && n)
+	{
+		NSUInteger leftSize = _DTParagraphTreeSize(node->left);
+		
+		if (n <= leftSize)
+		{
+			node = node->left;
+			
+			continue;
+		}
+		
+		if (node->left)
+		{
+			length += node->left->lengthSum;
+			lineCount += node->left->lineCountSum;
+			advance += node->left->advanceSum;
+		}
+		
+		length += node->length;
+		lineCount += node->lineCount;
+		advance += node->advance;
+		
+		n -= leftSize + 1;
+		node = node->right;
+	}
+	
+	if (outLength)
+	{
+		*outLength = length;
+	}
+	
+	if (outLineCount)
+	{
+		*outLineCount = lineCount;
+	}
+	
+	if (outAdvance)
+	{
+		*outAdvance = advance;
+	}
+}
+
+// largest n for which the sum of the lengths or line counts of the first n paragraphs is not larger than value
+static NSUInteger _DTParagraphTreeSearchLengths(const DTParagraphNode *node, BOOL lineCounts, NSInteger value)
+{
+	NSUInteger position = 0;
+	
+	while (node)
+	{
+		NSInteger leftSum = 0;
+		
+		if (node->left)
+		{
+			leftSum = lineCounts ? node->left->lineCountSum : node->left->lengthSum;
+		}
+		
+		NSInteger ownValue = lineCounts ? node->lineCount : node->length;
+		
+		if (leftSum + ownValue <= value)
+		{
+			value -= leftSum + ownValue;
+			position += _DTParagraphTreeSize(node->left) + 1;
+			node = node->right;
+		}
+		else if (leftSum <= value)
+		{
+			return position + _DTParagraphTreeSize(node->left);
+		}
+		else
+		{
+			node = node->left;
+		}
+	}
+	
+	return position;
+}
+
+// largest n for which the sum of the advances of the first n paragraphs is not larger than value, requires non-negative advances
+static NSUInteger _DTParagraphTreeSearchAdvances(const DTParagraphNode *node, CGFloat value)
+{
+	NSUInteger position = 0;
+	
+	while (node)
+	{
+		CGFloat leftSum = node->left ? node->left->advanceSum : 0;
+		
+		if (leftSum + node->advance <= value)
+		{
+			value -= leftSum + node->advance;
+			position += _DTParagraphTreeSize(node->left) + 1;
+			node = node->right;
+		}
+		else if (leftSum <= value)
+		{
+			return position + _DTParagraphTreeSize(node->left);
+		}
+		else
+		{
+			node = node->left;
+		}
+	}
+	
+	return position;
+}
+
+// changes the values of one paragraph and the sums on the path to it
+static void _DTParagraphTreeAddToNodeAtIndex(DTParagraphNode *node, NSUInteger index, NSInteger lengthDelta, NSInteger lineCountDelta, CGFloat advanceDelta)
+{
+	while (node)
+	{
+		node->lengthSum += lengthDelta;
+		node->lineCountSum += lineCountDelta;
+		node->advanceSum += advanceDelta;
+		
+		NSUInteger leftSize = _DTParagraphTreeSize(node->left);
+		
+		if (index < leftSize)
+		{
+			node = node->left;
+		}
+		else if (index == leftSize)
+		{
+			node->length += lengthDelta;
+			node->lineCount += lineCountDelta;
+			node->advance += advanceDelta;
+			
+			return;
+		}
+		else
+		{
+			index -= leftSize + 1;
+			node = node->right;
+		}
+	}
+}
+
+// the paragraphs in text order, the caller needs to free the returned array
+static DTParagraphNode **_DTParagraphTreeCopyNodes(DTParagraphNode *root)
+{
+	NSUInteger count = _DTParagraphTreeSize(root);
+	
+	if (!count)
+	{
+		return NULL;
+	}
+	
+	DTParagraphNode **nodes = malloc(count * sizeof(DTParagraphNode *));
+	DTParagraphNode **stack = malloc(count * sizeof(DTParagraphNode *));
+	NSUInteger stackCount = 0;
+	NSUInteger index = 0;
+	DTParagraphNode *node = root;
+	
+	while (node || stackCount)
+	{
+		while (node)
+		{
+			stack[stackCount++] = node;
+			node = node->left;
+		}
+		
+		node = stack[--stackCount];
+		nodes[index++] = node;
+		node = node->right;
+	}
+	
+	free(stack);
+	
+	return nodes;
+}
+
+// replaces the paragraphs in the range with the given tree
+static DTParagraphNode *_DTParagraphTreeReplace(DTParagraphNode *root, NSRange range, DTParagraphNode *replacement)
+{
+	DTParagraphNode *head;
+	DTParagraphNode *rest;
+	DTParagraphNode *replaced;
+	DTParagraphNode *tail;
+	
+	_DTParagraphTreeSplit(root, range.location, &head, &rest);
+	_DTParagraphTreeSplit(rest, range.length, &replaced, &tail);
+	
+	_DTParagraphTreeFree(replaced);
+	
+	return _DTParagraphTreeMerge(_DTParagraphTreeMerge(head, replacement), tail);
+}
+
+#pragma mark - Line Search
+
+// binary search for the line containing the string index in an array of lines sorted by string location
+static NSUInteger _DTIndexOfLineContainingStringIndex(NSArray *lines, NSUInteger index)
+{
+	NSUInteger low = 0;
+	NSUInteger high = [lines count];
+	
+	while (low < high)
+	{
+		NSUInteger middle = low + (high - low) / 2;
+		NSRange lineRange = [[lines objectAtIndex:middle] stringRange];
+		
+		if (index < lineRange.location)
+		{
+			high = middle;
+		}
+		else if (index >= NSMaxRange(lineRange))
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			return middle;
+		}
+	}
+	
+	return NSNotFound;
+}
+
+
+#pragma mark - DTParagraphLineTable
+
+@implementation DTParagraphLineTable
+{
+	DTParagraphNode *_root;
+
+	NSArray *_allLines;
+}
+
++ (NSArray *)paragraphsWithLines:(NSArray *)lines string:(NSString *)string
+{
+	NSMutableArray *paragraphs = [NSMutableArray array];
+	NSMutableArray *currentParagraph = nil;
+	NSUInteger stringLength = [string length];
+
+	for (DTCoreTextLayoutLine *oneLine in lines)
+	{
+		if (!currentParagraph)
+		{
+			currentParagraph = [NSMutableArray array];
+			[paragraphs addObject:currentParagraph];
+		}
+
+		[currentParagraph addObject:oneLine];
+
+		NSUInteger lineEnd = NSMaxRange(oneLine.stringRange);
+
+		if (lineEnd > 0 && lineEnd <= stringLength)
+		{
+			unichar lastCharacter = [string characterAtIndex:lineEnd-1];
+
+			if (lastCharacter == '\n' || lastCharacter == 0x2029)
+			{
+				// next line starts a new paragraph
+				currentParagraph = nil;
+			}
+		}
+	}
+
+	return paragraphs;
+}
+
+- (instancetype)initWithLines:(NSArray *)lines string:(NSString *)string
+{
+	self = [super init];
+
+	if (self)
+	{
+		NSArray *paragraphs = [DTParagraphLineTable paragraphsWithLines:lines string:string];
+		[self replaceParagraphsInRange:NSMakeRange(0, 0) withParagraphs:paragraphs];
+	}
+
+	return self;
+}
+
+- (instancetype)initWithNumberOfEstimatedParagraphs:(NSUInteger)count lengths:(const NSInteger *)lengths ascents:(const CGFloat *)ascents descents:(const CGFloat *)descents originY:(CGFloat)originY
+{
+	self = [super init];
+	
+	if (self && count)
+	{
+		DTParagraphNode **nodes = malloc(count * sizeof(DTParagraphNode *));
+		
+		CGFloat previousDescent = originY;
+		
+		for (NSUInteger index=0; index<count; index++)
+		{
+			DTParagraphNode *node = _DTParagraphNodeCreate();
+			
+			node->length = lengths[index];
+			node->lineCount = 1;
+			node->ascent = ascents[index];
+			node->descent = descents[index];
+			node->advance = previousDescent + ascents[index];
+			
+			previousDescent = descents[index];
+			
+			nodes[index] = node;
+		}
+		
+		_root = _DTParagraphTreeBuild(nodes, count);
+		
+		free(nodes);
+	}
+	
+	return self;
+}
+
+- (void)dealloc
+{
+	_DTParagraphTreeFree(_root);
+}
+
+#pragma mark - Internal
+
+- (NSUInteger)_startLocationOfParagraphAtIndex:(NSUInteger)index
+{
+	NSInteger location;
+	_DTParagraphTreePrefixSums(_root, index, &location, NULL, NULL);
+	
+	return (NSUInteger)location;
+}
+
+- (CGFloat)_baselineOriginYOfParagraphAtIndex:(NSUInteger)index
+{
+	CGFloat originY;
+	_DTParagraphTreePrefixSums(_root, index+1, NULL, NULL, &originY);
+	
+	return originY;
+}
+
+- (NSUInteger)_indexOfFirstLineOfParagraphAtIndex:(NSUInteger)index
+{
+	NSInteger lineIndex;
+	_DTParagraphTreePrefixSums(_root, index, NULL, &lineIndex, NULL);
+	
+	return (NSUInteger)lineIndex;
+}
+
+// lays out a paragraph that only had estimated metrics so far
+- (NSArray *)_layoutEstimatedParagraphAtIndex:(NSUInteger)index location:(NSUInteger)location baselineOriginY:(CGFloat)originY
+{
+	DTParagraphNode *node = _DTParagraphTreeNodeAtIndex(_root, index);
+	
+	NSRange stringRange = NSMakeRange(location, node->length);
+	NSArray *lines = [_layoutDelegate paragraphLineTable:self linesForParagraphInRange:stringRange];
+	
+	if (![lines count])
+	{
+		return nil;
+	}
+	
+	[self _adoptLines:lines forEstimatedParagraphAtIndex:index location:location baselineOriginY:originY];
+	
+	return lines;
+}
+
+// replaces the estimate of a paragraph with real lines and corrects the position of the following paragraph
+- (void)_adoptLines:(NSArray *)lines forEstimatedParagraphAtIndex:(NSUInteger)index location:(NSUInteger)location baselineOriginY:(CGFloat)originY
+{
+	DTParagraphNode *node = _DTParagraphTreeNodeAtIndex(_root, index);
+	NSUInteger count = _DTParagraphTreeSize(_root);
+	
+	NSRange stringRange = NSMakeRange(location, node->length);
+	
+	DTCoreTextLayoutLine *firstLine = [lines objectAtIndex:0];
+	DTCoreTextLayoutLine *lastLine = [lines lastObject];
+	
+	NSAssert(NSMaxRange(lastLine.stringRange) - firstLine.stringRange.location == stringRange.length, @"lines for paragraph %@ have wrong string range", NSStringFromRange(stringRange));
+	
+	if (firstLine.stringRange.location != location)
+	{
+		NSUInteger lineLocation = location;
+		
+		for (DTCoreTextLayoutLine *oneLine in lines)
+		{
+			[oneLine adjustStringRangeToStartAtIndex:lineLocation];
+			lineLocation = NSMaxRange(oneLine.stringRange);
+		}
+	}
+	
+	CGFloat newOriginY = originY;
+	
+	if (index > 0)
+	{
+		DTParagraphNode *previousNode = _DTParagraphTreeNodeAtIndex(_root, index-1);
+		
+		if (previousNode->lines)
+		{
+			// previous paragraph has real lines, so we can position precisely after it
+			NSUInteger previousLocation = location - previousNode->length;
+			CGFloat previousOriginY = originY - node->advance;
+			
+			DTCoreTextLayoutLine *previousLine = [[self _resolvedLinesOfParagraphAtIndex:index-1 location:previousLocation baselineOriginY:previousOriginY] lastObject];
+			newOriginY = [_layoutDelegate paragraphLineTable:self baselineOriginYForLine:firstLine afterLine:previousLine];
+		}
+	}
+	
+	CGFloat deltaY = newOriginY - firstLine.baselineOrigin.y;
+	
+	for (DTCoreTextLayoutLine *oneLine in lines)
+	{
+		CGPoint baselineOrigin = oneLine.baselineOrigin;
+		baselineOrigin.y += deltaY;
+		oneLine.baselineOrigin = baselineOrigin;
+	}
+	
+	DTParagraphNode *nextNode = NULL;
+	CGFloat oldBottom = originY + node->descent;
+	CGFloat oldNextOriginY = 0;
+	
+	if (index+1 < count)
+	{
+		nextNode = _DTParagraphTreeNodeAtIndex(_root, index+1);
+		oldNextOriginY = originY + nextNode->advance;
+	}
+	
+	_DTParagraphNodeSetLines(node, lines);
+	
+	// replace the estimates with real metrics
+	CGFloat shift = newOriginY - originY;
+	NSInteger lineCount = [lines count];
+	
+	_DTParagraphTreeAddToNodeAtIndex(_root, index, 0, lineCount - node->lineCount, shift);
+	
+	node->ascent = newOriginY - CGRectGetMinY(firstLine.frame);
+	node->descent = CGRectGetMaxY(lastLine.frame) - newOriginY;
+	
+	if (nextNode)
+	{
+		// following paragraph already moved with us
+		CGFloat nextOriginY = oldNextOriginY + shift;
+		CGFloat newNextOriginY;
+		
+		if (nextNode->lines)
+		{
+			NSArray *nextLines = [self _resolvedLinesOfParagraphAtIndex:index+1 location:NSMaxRange(stringRange) baselineOriginY:nextOriginY];
+			newNextOriginY = [_layoutDelegate paragraphLineTable:self baselineOriginYForLine:[nextLines objectAtIndex:0] afterLine:lastLine];
+		}
+		else
+		{
+			// keep the estimated gap between the paragraphs
+			CGFloat newBottom = newOriginY + node->descent;
+			newNextOriginY = newBottom + (oldNextOriginY - oldBottom);
+		}
+		
+		_DTParagraphTreeAddToNodeAtIndex(_root, index+1, 0, 0, newNextOriginY - nextOriginY);
+	}
+	
+	_allLines = nil;
+	
+	[_layoutDelegate paragraphLineTableDidChangeHeight:self];
+}
+
+// moves the lines of a paragraph to the given absolute position if they are not there already
+- (NSArray *)_resolvedLinesOfParagraphAtIndex:(NSUInteger)index location:(NSUInteger)location baselineOriginY:(CGFloat)originY
+{
+	NSArray *lines = _DTParagraphNodeLines(_DTParagraphTreeNodeAtIndex(_root, index));
+	
+	if (!lines)
+	{
+		return [self _layoutEstimatedParagraphAtIndex:index location:location baselineOriginY:originY];
+	}
+	
+	DTCoreTextLayoutLine *firstLine = [lines objectAtIndex:0];
+
+	BOOL needsStringRangeAdjustment = (firstLine.stringRange.location != location);
+	CGFloat deltaY = originY - firstLine.baselineOrigin.y;
+
+	if (!needsStringRangeAdjustment && deltaY == 0.0f)
+	{
+		return lines;
+	}
+
+	// lines that were handed out might be drawn on another thread right now, so they are never moved in place but replaced by moved copies
+	NSMutableArray *movedLines = [NSMutableArray arrayWithCapacity:[lines count]];
+
+	for (DTCoreTextLayoutLine *oneLine in lines)
+	{
+		DTCoreTextLayoutLine *movedLine = [[DTCoreTextLayoutLine alloc] initWithLine:oneLine.line];
+		movedLine.writingDirectionIsRightToLeft = oneLine.writingDirectionIsRightToLeft;
+		
+		CGPoint baselineOrigin = oneLine.baselineOrigin;
+		baselineOrigin.y += deltaY;
+		movedLine.baselineOrigin = baselineOrigin;
+		
+		[movedLine adjustStringRangeToStartAtIndex:location];
+		location = NSMaxRange(movedLine.stringRange);
+		
+		[movedLines addObject:movedLine];
+	}
+
+	_DTParagraphNodeSetLines(_DTParagraphTreeNodeAtIndex(_root, index), movedLines);
+	_allLines = nil;
+
+	return movedLines;
+}
+
+- (NSUInteger)_indexOfParagraphAtVerticalPosition:(CGFloat)position
+{
+	NSUInteger count = _DTParagraphTreeSize(_root);
+	
+	if (!count)
+	{
+		return NSNotFound;
+	}
+
+	// number of paragraphs with their first baseline above the position
+	NSUInteger numberAbove = _DTParagraphTreeSearchAdvances(_root, position);
+
+	if (numberAbove < count)
+	{
+		CGFloat top = [self _baselineOriginYOfParagraphAtIndex:numberAbove] - _DTParagraphTreeNodeAtIndex(_root, numberAbove)->ascent;
+
+		if (top <= position || !numberAbove)
+		{
+			return numberAbove;
+		}
+	}
+
+	return numberAbove - 1;
+}
+
+#pragma mark - Getting Information about Paragraphs
+
+- (NSUInteger)numberOfParagraphs
+{
+	@synchronized(self)
+	{
+		return _DTParagraphTreeSize(_root);
+	}
+}
+
+- (NSRange)stringRangeOfParagraphAtIndex:(NSUInteger)index
+{
+	@synchronized(self)
+	{
+		NSAssert(index < _DTParagraphTreeSize(_root), @"paragraph index %lu out of bounds", (unsigned long)index);
+
+		return NSMakeRange([self _startLocationOfParagraphAtIndex:index], _DTParagraphTreeNodeAtIndex(_root, index)->length);
+	}
+}
+
+- (NSUInteger)indexOfParagraphContainingStringIndex:(NSUInteger)index
+{
+	@synchronized(self)
+	{
+		NSUInteger count = _DTParagraphTreeSize(_root);
+		
+		if (!count)
+		{
+			return NSNotFound;
+		}
+
+		NSUInteger numberBefore = _DTParagraphTreeSearchLengths(_root, NO, index);
+
+		return MIN(numberBefore, count-1);
+	}
+}
+
+- (NSUInteger)indexOfParagraphAtVerticalPosition:(CGFloat)position
+{
+	@synchronized(self)
+	{
+		return [self _indexOfParagraphAtVerticalPosition:position];
+	}
+}
+
+- (BOOL)isParagraphLaidOutAtIndex:(NSUInteger)index
+{
+	@synchronized(self)
+	{
+		NSAssert(index < _DTParagraphTreeSize(_root), @"paragraph index %lu out of bounds", (unsigned long)index);
+		
+		return (_DTParagraphTreeNodeAtIndex(_root, index)->lines != NULL);
+	}
+}
+
+- (CGFloat)baselineOriginYOfParagraphAtIndex:(NSUInteger)index
+{
+	@synchronized(self)
+	{
+		NSAssert(index < _DTParagraphTreeSize(_root), @"paragraph index %lu out of bounds", (unsigned long)index);
+
+		return [self _baselineOriginYOfParagraphAtIndex:index];
+	}
+}
+
+- (CGFloat)topOfParagraphAtIndex:(NSUInteger)index
+{
+	@synchronized(self)
+	{
+		NSAssert(index < _DTParagraphTreeSize(_root), @"paragraph index %lu out of bounds", (unsigned long)index);
+		
+		return [self _baselineOriginYOfParagraphAtIndex:index] - _DTParagraphTreeNodeAtIndex(_root, index)->ascent;
+	}
+}
+
+- (CGFloat)bottomOfParagraphAtIndex:(NSUInteger)index
+{
+	@synchronized(self)
+	{
+		NSAssert(index < _DTParagraphTreeSize(_root), @"paragraph index %lu out of bounds", (unsigned long)index);
+		
+		return [self _baselineOriginYOfParagraphAtIndex:index] + _DTParagraphTreeNodeAtIndex(_root, index)->descent;
+	}
+}
+
+- (CGFloat)maxY
+{
+	@synchronized(self)
+	{
+		NSUInteger count = _DTParagraphTreeSize(_root);
+		
+		if (!count)
+		{
+			return 0;
+		}
+
+		return _root->advanceSum + _DTParagraphTreeNodeAtIndex(_root, count-1)->descent;
+	}
+}
+
+#pragma mark - Accessing Lines
+
+- (NSArray *)linesOfParagraphAtIndex:(NSUInteger)index
+{
+	@synchronized(self)
+	{
+		if (index >= _DTParagraphTreeSize(_root))
+		{
+			return nil;
+		}
+
+		NSUInteger location = [self _startLocationOfParagraphAtIndex:index];
+		CGFloat originY = [self _baselineOriginYOfParagraphAtIndex:index];
+
+		return [self _resolvedLinesOfParagraphAtIndex:index location:location baselineOriginY:originY];
+	}
+}
+
+- (NSUInteger)numberOfLines
+{
+	@synchronized(self)
+	{
+		return _root ? (NSUInteger)_root->lineCountSum : 0;
+	}
+}
+
+- (NSUInteger)indexOfFirstLineOfParagraphAtIndex:(NSUInteger)index
+{
+	@synchronized(self)
+	{
+		NSAssert(index <= _DTParagraphTreeSize(_root), @"paragraph index %lu out of bounds", (unsigned long)index);
+		
+		return [self _indexOfFirstLineOfParagraphAtIndex:index];
+	}
+}
+
+- (NSUInteger)indexOfLineContainingStringIndex:(NSUInteger)index
+{
+	@synchronized(self)
+	{
+		if (!_root || index >= (NSUInteger)_root->lengthSum)
+		{
+			return NSNotFound;
+		}
+		
+		NSUInteger paragraphIndex = _DTParagraphTreeSearchLengths(_root, NO, index);
+		NSUInteger location = [self _startLocationOfParagraphAtIndex:paragraphIndex];
+		CGFloat originY = [self _baselineOriginYOfParagraphAtIndex:paragraphIndex];
+		
+		NSArray *lines = [self _resolvedLinesOfParagraphAtIndex:paragraphIndex location:location baselineOriginY:originY];
+		NSUInteger lineIndex = _DTIndexOfLineContainingStringIndex(lines, index);
+		
+		if (lineIndex == NSNotFound)
+		{
+			return NSNotFound;
+		}
+		
+		// the line count of the paragraph is correct now even if it was estimated
+		return [self _indexOfFirstLineOfParagraphAtIndex:paragraphIndex] + lineIndex;
+	}
+}
+
+- (DTCoreTextLayoutLine *)lineContainingStringIndex:(NSUInteger)index
+{
+	@synchronized(self)
+	{
+		if (!_root || index >= (NSUInteger)_root->lengthSum)
+		{
+			return nil;
+		}
+		
+		NSUInteger paragraphIndex = _DTParagraphTreeSearchLengths(_root, NO, index);
+		NSUInteger location = [self _startLocationOfParagraphAtIndex:paragraphIndex];
+		CGFloat originY = [self _baselineOriginYOfParagraphAtIndex:paragraphIndex];
+		
+		NSArray *lines = [self _resolvedLinesOfParagraphAtIndex:paragraphIndex location:location baselineOriginY:originY];
+		NSUInteger lineIndex = _DTIndexOfLineContainingStringIndex(lines, index);
+		
+		if (lineIndex == NSNotFound)
+		{
+			return nil;
+		}
+		
+		return [lines objectAtIndex:lineIndex];
+	}
+}
+
+- (DTCoreTextLayoutLine *)lineAtIndex:(NSUInteger)lineIndex
+{
+	@synchronized(self)
+	{
+		if (!_root || lineIndex >= (NSUInteger)_root->lineCountSum)
+		{
+			return nil;
+		}
+		
+		NSUInteger paragraphIndex = _DTParagraphTreeSearchLengths(_root, YES, lineIndex);
+		NSUInteger location = [self _startLocationOfParagraphAtIndex:paragraphIndex];
+		CGFloat originY = [self _baselineOriginYOfParagraphAtIndex:paragraphIndex];
+		
+		NSArray *lines = [self _resolvedLinesOfParagraphAtIndex:paragraphIndex location:location baselineOriginY:originY];
+		
+		// laying out an estimated paragraph can change its number of lines, but not where it starts
+		NSUInteger localIndex = lineIndex - [self _indexOfFirstLineOfParagraphAtIndex:paragraphIndex];
+		
+		return [lines objectAtIndex:MIN(localIndex, [lines count]-1)];
+	}
+}
+
+- (NSArray *)linesInStringRange:(NSRange)range
+{
+	@synchronized(self)
+	{
+		if (!_root)
+		{
+			return nil;
+		}
+		
+		NSUInteger totalLength = (NSUInteger)_root->lengthSum;
+		
+		if (range.location >= totalLength)
+		{
+			return nil;
+		}
+		
+		NSUInteger lastIndex = MIN(NSMaxRange(range), totalLength-1);
+		
+		NSUInteger firstParagraph = _DTParagraphTreeSearchLengths(_root, NO, range.location);
+		NSUInteger lastParagraph = _DTParagraphTreeSearchLengths(_root, NO, lastIndex);
+		
+		NSMutableArray *tmpArray = [NSMutableArray array];
+		
+		for (NSUInteger paragraphIndex = firstParagraph; paragraphIndex <= lastParagraph; paragraphIndex++)
+		{
+			NSUInteger location = [self _startLocationOfParagraphAtIndex:paragraphIndex];
+			CGFloat originY = [self _baselineOriginYOfParagraphAtIndex:paragraphIndex];
+			
+			NSArray *lines = [self _resolvedLinesOfParagraphAtIndex:paragraphIndex location:location baselineOriginY:originY];
+			
+			NSUInteger fromLine = 0;
+			NSUInteger toLine = [lines count];
+			
+			if (paragraphIndex == firstParagraph)
+			{
+				fromLine = MIN(_DTIndexOfLineContainingStringIndex(lines, range.location), toLine);
+			}
+			
+			if (paragraphIndex == lastParagraph)
+			{
+				NSUInteger lineIndex = _DTIndexOfLineContainingStringIndex(lines, lastIndex);
+				
+				if (lineIndex != NSNotFound)
+				{
+					toLine = lineIndex + 1;
+				}
+			}
+			
+			if (toLine > fromLine)
+			{
+				[tmpArray addObjectsFromArray:[lines subarrayWithRange:NSMakeRange(fromLine, toLine - fromLine)]];
+			}
+		}
+		
+		return tmpArray;
+	}
+}
+
+- (NSArray *)allLines
+{
+	@synchronized(self)
+	{
+		if (_allLines)
+		{
+			return _allLines;
+		}
+
+		NSMutableArray *tmpArray = [NSMutableArray array];
+		
+		NSUInteger count = _DTParagraphTreeSize(_root);
+		DTParagraphNode **nodes = _DTParagraphTreeCopyNodes(_root);
+
+		NSUInteger location = 0;
+		CGFloat originY = 0;
+
+		// running sums are cheaper than tree queries if we visit all paragraphs anyway, layout does not change the shape of the tree
+		for (NSUInteger index=0; index<count; index++)
+		{
+			originY += nodes[index]->advance;
+			
+			BOOL wasEstimated = (nodes[index]->lines == NULL);
+
+			NSArray *lines = [self _resolvedLinesOfParagraphAtIndex:index location:location baselineOriginY:originY];
+			[tmpArray addObjectsFromArray:lines];
+			
+			if (wasEstimated)
+			{
+				// layout moved this paragraph
+				originY = [self _baselineOriginYOfParagraphAtIndex:index];
+			}
+
+			location += nodes[index]->length;
+		}
+		
+		free(nodes);
+
+		_allLines = [tmpArray copy];
+
+		return _allLines;
+	}
+}
+
+- (NSArray *)linesVisibleInRect:(CGRect)rect
+{
+	@synchronized(self)
+	{
+		NSUInteger count = _DTParagraphTreeSize(_root);
+		
+		if (!count)
+		{
+			return nil;
+		}
+
+		CGFloat minY = CGRectGetMinY(rect);
+		CGFloat maxY = CGRectGetMaxY(rect);
+
+		NSUInteger index = [self _indexOfParagraphAtVerticalPosition:minY];
+
+		// previous paragraph might still reach into the rect
+		if (index > 0)
+		{
+			index--;
+		}
+
+		NSUInteger location = [self _startLocationOfParagraphAtIndex:index];
+		CGFloat originY = [self _baselineOriginYOfParagraphAtIndex:index];
+
+		NSMutableArray *tmpArray = [NSMutableArray array];
+
+		while (index < count)
+		{
+			DTParagraphNode *node = _DTParagraphTreeNodeAtIndex(_root, index);
+			
+			if (originY - node->ascent > maxY)
+			{
+				// paragraph starts below the rect
+				break;
+			}
+
+			NSArray *lines = [self _resolvedLinesOfParagraphAtIndex:index location:location baselineOriginY:originY];
+
+			for (DTCoreTextLayoutLine *oneLine in lines)
+			{
+				CGRect lineFrame = oneLine.frame;
+
+				if (CGRectGetMaxY(lineFrame) < minY)
+				{
+					continue;
+				}
+
+				if (lineFrame.origin.y > maxY)
+				{
+					break;
+				}
+
+				[tmpArray addObject:oneLine];
+			}
+
+			location += node->length;
+			index++;
+
+			if (index < count)
+			{
+				// laying out an estimated paragraph can move the following ones
+				originY = [self _baselineOriginYOfParagraphAtIndex:index];
+			}
+		}
+
+		return tmpArray;
+	}
+}
+
+#pragma mark - Modifying the Table
+
+- (void)replaceParagraphsInRange:(NSRange)range withParagraphs:(NSArray *)paragraphs
+{
+	@synchronized(self)
+	{
+		NSAssert(NSMaxRange(range) <= _DTParagraphTreeSize(_root), @"paragraph range %@ out of bounds", NSStringFromRange(range));
+
+		NSUInteger newCount = [paragraphs count];
+
+		// the first paragraph after the range keeps its advance, it is relative to the last replaced paragraph
+		CGFloat previousOriginY = 0;
+
+		if (range.location > 0)
+		{
+			previousOriginY = [self _baselineOriginYOfParagraphAtIndex:range.location-1];
+		}
+		
+		DTParagraphNode **nodes = malloc(MAX(newCount, 1) * sizeof(DTParagraphNode *));
+		NSUInteger index = 0;
+
+		for (NSArray *lines in paragraphs)
+		{
+			NSAssert([lines count], @"paragraphs need to have at least one line");
+
+			DTCoreTextLayoutLine *firstLine = [lines objectAtIndex:0];
+			DTCoreTextLayoutLine *lastLine = [lines lastObject];
+
+			CGFloat originY = firstLine.baselineOrigin.y;
+			
+			DTParagraphNode *node = _DTParagraphNodeCreate();
+			_DTParagraphNodeSetLines(node, lines);
+
+			node->length = NSMaxRange(lastLine.stringRange) - firstLine.stringRange.location;
+			node->lineCount = [lines count];
+			node->advance = originY - previousOriginY;
+			node->ascent = originY - CGRectGetMinY(firstLine.frame);
+			node->descent = CGRectGetMaxY(lastLine.frame) - originY;
+
+			nodes[index++] = node;
+			previousOriginY = originY;
+		}
+		
+		DTParagraphNode *replacement = _DTParagraphTreeBuild(nodes, newCount);
+		free(nodes);
+
+		_root = _DTParagraphTreeReplace(_root, range, replacement);
+
+		_allLines = nil;
+	}
+}
+
+- (void)replaceParagraphsInRange:(NSRange)range withEstimatedParagraphLengths:(const NSInteger *)lengths ascents:(const CGFloat *)ascents descents:(const CGFloat *)descents count:(NSUInteger)count
+{
+	@synchronized(self)
+	{
+		NSUInteger oldCount = _DTParagraphTreeSize(_root);
+		
+		NSAssert(NSMaxRange(range) <= oldCount, @"paragraph range %@ out of bounds", NSStringFromRange(range));
+		
+		if (count == range.length)
+		{
+			// same number of paragraphs, the old metrics are the best estimate there is
+			for (NSUInteger i=0; i<count; i++)
+			{
+				NSUInteger index = range.location + i;
+				DTParagraphNode *node = _DTParagraphTreeNodeAtIndex(_root, index);
+				
+				_DTParagraphTreeAddToNodeAtIndex(_root, index, lengths[i] - node->length, 0, 0);
+				_DTParagraphNodeSetLines(node, nil);
+			}
+			
+			_allLines = nil;
+			
+			return;
+		}
+		
+		BOOL hasTail = (NSMaxRange(range) < oldCount);
+		
+		// the distance of the first baseline from the previous paragraph's first baseline is the previous descent plus the own ascent
+		CGFloat previousDescent = 0;
+		
+		if (range.location > 0)
+		{
+			previousDescent = _DTParagraphTreeNodeAtIndex(_root, range.location-1)->descent;
+		}
+		else if (oldCount)
+		{
+			// keep the top of the first paragraph
+			previousDescent = [self _baselineOriginYOfParagraphAtIndex:0] - _DTParagraphTreeNodeAtIndex(_root, 0)->ascent;
+		}
+		
+		DTParagraphNode **nodes = malloc(MAX(count, 1) * sizeof(DTParagraphNode *));
+		
+		for (NSUInteger i=0; i<count; i++)
+		{
+			DTParagraphNode *node = _DTParagraphNodeCreate();
+			
+			node->length = lengths[i];
+			node->lineCount = 1;
+			node->ascent = ascents[i];
+			node->descent = descents[i];
+			node->advance = previousDescent + ascents[i];
+			
+			previousDescent = descents[i];
+			
+			nodes[i] = node;
+		}
+		
+		DTParagraphNode *replacement = _DTParagraphTreeBuild(nodes, count);
+		free(nodes);
+		
+		_root = _DTParagraphTreeReplace(_root, range, replacement);
+		
+		if (hasTail)
+		{
+			// first paragraph after the estimated ones follows the estimated gap
+			NSUInteger nextIndex = range.location + count;
+			DTParagraphNode *nextNode = _DTParagraphTreeNodeAtIndex(_root, nextIndex);
+			
+			_DTParagraphTreeAddToNodeAtIndex(_root, nextIndex, 0, 0, previousDescent + nextNode->ascent - nextNode->advance);
+		}
+		
+		_allLines = nil;
+	}
+}
+
+- (BOOL)setLines:(NSArray *)lines forEstimatedParagraphAtIndex:(NSUInteger)index
+{
+	@synchronized(self)
+	{
+		if (index >= _DTParagraphTreeSize(_root) || ![lines count])
+		{
+			return NO;
+		}
+		
+		DTParagraphNode *node = _DTParagraphTreeNodeAtIndex(_root, index);
+		
+		if (node->lines)
+		{
+			return NO;
+		}
+		
+		DTCoreTextLayoutLine *firstLine = [lines objectAtIndex:0];
+		DTCoreTextLayoutLine *lastLine = [lines lastObject];
+		
+		if (NSMaxRange(lastLine.stringRange) - firstLine.stringRange.location != node->length)
+		{
+			// paragraph was modified in the meantime
+			return NO;
+		}
+		
+		NSUInteger location = [self _startLocationOfParagraphAtIndex:index];
+		CGFloat originY = [self _baselineOriginYOfParagraphAtIndex:index];
+		
+		[self _adoptLines:lines forEstimatedParagraphAtIndex:index location:location baselineOriginY:originY];
+		
+		return YES;
+	}
+}
+
+- (void)setBaselineOriginY:(CGFloat)originY ofParagraphAtIndex:(NSUInteger)index
+{
+	@synchronized(self)
+	{
+		NSAssert(index < _DTParagraphTreeSize(_root), @"paragraph index %lu out of bounds", (unsigned long)index);
+
+		CGFloat delta = originY - [self _baselineOriginYOfParagraphAtIndex:index];
+
+		if (delta == 0.0f)
+		{
+			return;
+		}
+
+		_DTParagraphTreeAddToNodeAtIndex(_root, index, 0, 0, delta);
+
+		_allLines = nil;
+	}
+}
+
+#pragma mark - Properties
+
+@synthesize layoutDelegate = _layoutDelegate;
+
+@end
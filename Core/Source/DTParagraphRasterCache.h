@@ -0,0 +1,82 @@
+//
+//  DTParagraphRasterCache.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+
+#import "DTCacheRegistry.h"
+
+/**
+ Cache for paragraphs that have been rasterized into bitmaps by <DTMutableCoreTextLayoutFrame>.
+ 
+ Images are keyed by the attributed text of the paragraph, the layout width and the scale they were rendered with. Identical paragraphs share one image, a paragraph that is modified simply no longer finds its old image. If the images exceed the <memoryBudget> the least recently used ones are evicted, images larger than the whole budget are not cached at all.
+ 
+ Access to the cache is synchronized because tiles are drawn on several threads at the same time. The cache registers itself with the shared <DTCacheRegistry> as a rendering cache.
+ */
+@interface DTParagraphRasterCache : NSObject <DTCacheRegistryCache>
+
+/**
+ @name Creating a Cache
+ */
+
+/**
+ Creates a paragraph raster cache
+ @param memoryBudget The maximum number of bytes for all cached images
+ @returns An initialized cache
+ */
+- (instancetype)initWithMemoryBudget:(NSUInteger)memoryBudget;
+
+/**
+ @name Accessing Images
+ */
+
+/**
+ The cached image for a paragraph
+ @param text The attributed text of the paragraph
+ @param width The width the paragraph was laid out for
+ @param scale The scale the image was rendered with
+ @returns The image or `nil` if there is none
+ */
+- (UIImage *)imageForParagraphText:(NSAttributedString *)text width:(CGFloat)width scale:(CGFloat)scale;
+
+/**
+ Adds the image for a paragraph to the cache, evicting the least recently used images if necessary
+ @param image The rasterized paragraph
+ @param text The attributed text of the paragraph
+ @param width The width the paragraph was laid out for
+ @param scale The scale the image was rendered with
+ */
+- (void)setImage:(UIImage *)image forParagraphText:(NSAttributedString *)text width:(CGFloat)width scale:(CGFloat)scale;
+
+/**
+ Determines whether the image of a paragraph would fit into the <memoryBudget> at all. Paragraphs that don't fit should be drawn directly instead of being rasterized for nothing.
+ @param size The size of the paragraph in points
+ @param scale The scale the image would be rendered with
+ @returns `YES` if an image of this size can be cached
+ */
+- (BOOL)canCacheImageOfSize:(CGSize)size scale:(CGFloat)scale;
+
+/**
+ Removes all images from the cache
+ */
+- (void)removeAllImages;
+
+/**
+ @name Limiting Memory
+ */
+
+/**
+ The maximum number of bytes for all cached images. Reducing it evicts images right away.
+ */
+@property (nonatomic, assign) NSUInteger memoryBudget;
+
+/**
+ The number of bytes used by the cached images
+ */
+@property (nonatomic, readonly) NSUInteger totalCost;
+
+@end
@@ -0,0 +1,328 @@
+//
+//  DTParagraphRasterCache.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTParagraphRasterCache.h"
+
+// an image in the cache together with what it was rendered from
+@interface DTParagraphRasterCacheEntry : NSObject
+{
+@public
+	NSAttributedString *_text;
+	CGFloat _width;
+	CGFloat _scale;
+	NSUInteger _hash;
+	UIImage *_image;
+	NSUInteger _cost;
+	
+	// the list of entries in the order of use, the entries are owned by the hash buckets
+	__unsafe_unretained DTParagraphRasterCacheEntry *_previous;
+	__unsafe_unretained DTParagraphRasterCacheEntry *_next;
+}
+
+@end
+
+@implementation DTParagraphRasterCacheEntry
+
+@end
+
+
+// FNV-1a over the characters and run boundaries, attribute values are only compared on a hit
+static NSUInteger _DTParagraphRasterCacheHash(NSAttributedString *text, CGFloat width, CGFloat scale)
+{
+	NSString *string = [text string];
+	NSUInteger length = [string length];
+	
+	NSUInteger hash = 2166136261u;
+	
+	unichar buffer[128];
+	NSUInteger index = 0;
+	
+	while (index < length)
+	{
+		NSUInteger chunkLength = MIN(length - index, (NSUInteger)128);
+		[string getCharacters:buffer range:NSMakeRange(index, chunkLength)];
+		
+		for (NSUInteger i=0; i<chunkLength; i++)
+		{
+			hash = (hash ^ buffer[i]) * 16777619u;
+		}
+		
+		index += chunkLength;
+	}
+	
+	index = 0;
+	
+	while (index < length)
+	{
+		NSRange effectiveRange;
+		NSDictionary *attributes = [text attributesAtIndex:index effectiveRange:&effectiveRange];
+		
+		hash = (hash ^ NSMaxRange(effectiveRange)) * 16777619u;
+		hash = (hash ^ [attributes count]) * 16777619u;
+		
+		index = NSMaxRange(effectiveRange);
+	}
+	
+	hash = (hash ^ (NSUInteger)roundf(width * scale)) * 16777619u;
+	
+	return hash;
+}
+
+
+@implementation DTParagraphRasterCache
+{
+	// entries by hash, an array for each hash so that collisions are possible
+	NSMutableDictionary *_entriesByHash;
+	
+	// the ends of the list of entries, so that moving an entry on use and evicting are O(1)
+	__unsafe_unretained DTParagraphRasterCacheEntry *_leastRecentlyUsedEntry;
+	__unsafe_unretained DTParagraphRasterCacheEntry *_mostRecentlyUsedEntry;
+	
+	NSUInteger _memoryBudget;
+	NSUInteger _totalCost;
+}
+
+- (instancetype)initWithMemoryBudget:(NSUInteger)memoryBudget
+{
+	self = [super init];
+	
+	if (self)
+	{
+		_entriesByHash = [[NSMutableDictionary alloc] init];
+		_memoryBudget = memoryBudget;
+		
+		[[DTCacheRegistry sharedRegistry] registerCache:self evictionOrder:DTCacheEvictionOrderRendering];
+	}
+	
+	return self;
+}
+
+// needs to be called while synchronized
+- (void)_unlinkEntry:(DTParagraphRasterCacheEntry *)entry
+{
+	if (entry->_previous)
+	{
+		entry->_previous->_next = entry->_next;
+	}
+	else
+	{
+		_leastRecentlyUsedEntry = entry->_next;
+	}
+	
+	if (entry->_next)
+	{
+		entry->_next->_previous = entry->_previous;
+	}
+	else
+	{
+		_mostRecentlyUsedEntry = entry->_previous;
+	}
+	
+	entry->_previous = nil;
+	entry->_next = nil;
+}
+
+// needs to be called while synchronized
+- (void)_appendEntry:(DTParagraphRasterCacheEntry *)entry
+{
+	entry->_previous = _mostRecentlyUsedEntry;
+	entry->_next = nil;
+	
+	if (_mostRecentlyUsedEntry)
+	{
+		_mostRecentlyUsedEntry->_next = entry;
+	}
+	else
+	{
+		_leastRecentlyUsedEntry = entry;
+	}
+	
+	_mostRecentlyUsedEntry = entry;
+}
+
+- (DTParagraphRasterCacheEntry *)_entryForParagraphText:(NSAttributedString *)text width:(CGFloat)width scale:(CGFloat)scale hash:(NSUInteger)hash
+{
+	for (DTParagraphRasterCacheEntry *entry in [_entriesByHash objectForKey:@(hash)])
+	{
+		if (entry->_width == width && entry->_scale == scale && [entry->_text isEqualToAttributedString:text])
+		{
+			return entry;
+		}
+	}
+	
+	return nil;
+}
+
+- (UIImage *)imageForParagraphText:(NSAttributedString *)text width:(CGFloat)width scale:(CGFloat)scale
+{
+	NSUInteger hash = _DTParagraphRasterCacheHash(text, width, scale);
+	
+	@synchronized(self)
+	{
+		DTParagraphRasterCacheEntry *entry = [self _entryForParagraphText:text width:width scale:scale hash:hash];
+		
+		if (!entry)
+		{
+			return nil;
+		}
+		
+		// most recently used go to the end
+		if (_mostRecentlyUsedEntry != entry)
+		{
+			[self _unlinkEntry:entry];
+			[self _appendEntry:entry];
+		}
+		
+		return entry->_image;
+	}
+}
+
+- (void)setImage:(UIImage *)image forParagraphText:(NSAttributedString *)text width:(CGFloat)width scale:(CGFloat)scale
+{
+	NSParameterAssert(image);
+	NSParameterAssert(text);
+	
+	NSUInteger hash = _DTParagraphRasterCacheHash(text, width, scale);
+	
+	CGImageRef cgImage = image.CGImage;
+	NSUInteger cost = CGImageGetBytesPerRow(cgImage) * CGImageGetHeight(cgImage);
+	
+	@synchronized(self)
+	{
+		if (cost > _memoryBudget)
+		{
+			// would only evict everything else and then itself
+			return;
+		}
+		
+		DTParagraphRasterCacheEntry *entry = [self _entryForParagraphText:text width:width scale:scale hash:hash];
+		
+		if (entry)
+		{
+			// another tile was faster
+			return;
+		}
+		
+		entry = [[DTParagraphRasterCacheEntry alloc] init];
+		entry->_text = [text copy];
+		entry->_width = width;
+		entry->_scale = scale;
+		entry->_hash = hash;
+		entry->_image = image;
+		entry->_cost = cost;
+		
+		NSNumber *key = @(hash);
+		NSMutableArray *bucket = [_entriesByHash objectForKey:key];
+		
+		if (!bucket)
+		{
+			bucket = [[NSMutableArray alloc] init];
+			[_entriesByHash setObject:bucket forKey:key];
+		}
+		
+		[bucket addObject:entry];
+		[self _appendEntry:entry];
+		
+		_totalCost += cost;
+		
+		[self _evictEntriesExceedingBudget];
+	}
+}
+
+- (void)_removeEntry:(DTParagraphRasterCacheEntry *)entry
+{
+	// the bucket owns the entry
+	[self _unlinkEntry:entry];
+	
+	NSNumber *key = @(entry->_hash);
+	NSMutableArray *bucket = [_entriesByHash objectForKey:key];
+	
+	[bucket removeObjectIdenticalTo:entry];
+	
+	if (![bucket count])
+	{
+		[_entriesByHash removeObjectForKey:key];
+	}
+	
+	_totalCost -= entry->_cost;
+}
+
+// needs to be called while synchronized
+- (void)_evictEntriesExceedingBudget
+{
+	while (_totalCost > _memoryBudget && _leastRecentlyUsedEntry)
+	{
+		[self _removeEntry:_leastRecentlyUsedEntry];
+	}
+}
+
+- (BOOL)canCacheImageOfSize:(CGSize)size scale:(CGFloat)scale
+{
+	// 4 bytes per pixel, rows might be padded a little
+	NSUInteger cost = (NSUInteger)ceilf(size.width * scale) * 4 * (NSUInteger)ceilf(size.height * scale);
+	
+	return (cost <= self.memoryBudget);
+}
+
+- (void)removeAllImages
+{
+	@synchronized(self)
+	{
+		_leastRecentlyUsedEntry = nil;
+		_mostRecentlyUsedEntry = nil;
+		
+		[_entriesByHash removeAllObjects];
+		
+		_totalCost = 0;
+	}
+}
+
+#pragma mark - DTCacheRegistryCache
+
+- (NSUInteger)cacheCost
+{
+	return self.totalCost;
+}
+
+- (void)purgeCache
+{
+	[self removeAllImages];
+}
+
+#pragma mark - Properties
+
+- (void)setMemoryBudget:(NSUInteger)memoryBudget
+{
+	@synchronized(self)
+	{
+		_memoryBudget = memoryBudget;
+		
+		[self _evictEntriesExceedingBudget];
+	}
+}
+
+- (NSUInteger)memoryBudget
+{
+	@synchronized(self)
+	{
+		return _memoryBudget;
+	}
+}
+
+- (NSUInteger)totalCost
+{
+	@synchronized(self)
+	{
+		return _totalCost;
+	}
+}
+
+@synthesize memoryBudget = _memoryBudget;
+@synthesize totalCost = _totalCost;
+
+@end
@@ -0,0 +1,60 @@
+//
+//  DTParagraphStyleCache.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <CoreText/CoreText.h>
+
+@class DTCoreTextParagraphStyle;
+
+/**
+ Shared pool of interned paragraph styles. Every paragraph the editing categories modify used to get a new `CTParagraphStyle` even if the values were the same as the ones of its neighbours. Since attributed strings compare attribute values before merging runs, a document would end up with one run and one style object per paragraph.
+
+ Styles are interned by their values, so that paragraphs with the same values share an instance. Styles derived from another style by changing the paragraph spacing are additionally cached per original style because the list and spacing methods do this for many paragraphs with the same style.
+
+ The cache is thread-safe and evicts its contents under memory pressure.
+ */
+@interface DTParagraphStyleCache : NSObject
+
+/**
+ @name Getting the Shared Cache
+ */
+
+/**
+ The shared paragraph style cache
+ @returns The cache instance shared by the editing categories
+ */
++ (DTParagraphStyleCache *)sharedCache;
+
+/**
+ @name Getting Paragraph Styles
+ */
+
+/**
+ Returns the interned paragraph style for the values of a paragraph style.
+ @param paragraphStyle The paragraph style with the wanted values
+ @returns The interned paragraph style, the caller needs to release it
+ */
+- (CTParagraphStyleRef)newParagraphStyleWithParagraphStyle:(DTCoreTextParagraphStyle *)paragraphStyle;
+
+/**
+ Returns the interned paragraph style that has the values of an existing style, but a different paragraph spacing.
+ @param paragraphSpacing The paragraph spacing
+ @param paragraphStyle The original paragraph style
+ @returns The interned paragraph style, the caller needs to release it
+ */
+- (CTParagraphStyleRef)newParagraphStyleWithParagraphSpacing:(CGFloat)paragraphSpacing basedOnParagraphStyle:(CTParagraphStyleRef)paragraphStyle;
+
+/**
+ @name Managing the Cache
+ */
+
+/**
+ Removes all cached paragraph styles
+ */
+- (void)removeAllParagraphStyles;
+
+@end
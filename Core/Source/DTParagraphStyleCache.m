@@ -0,0 +1,290 @@
+//
+//  DTParagraphStyleCache.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTParagraphStyleCache.h"
+
+#import <DTCoreText/DTCoreText.h>
+
+#define DTParagraphStyleCacheFloatCount 12
+
+// the values of a paragraph style that determine its equality. NSArray hashes by count, so array keys would put all styles into the same bucket.
+@interface DTParagraphStyleCacheKey : NSObject <NSCopying>
+{
+@public
+	CGFloat _floatValues[DTParagraphStyleCacheFloatCount];
+	CTTextAlignment _alignment;
+	CTLineBreakMode _lineBreakMode;
+	CTWritingDirection _writingDirection;
+
+	// alternating location and alignment of each tab stop
+	NSArray *_tabStops;
+	NSUInteger _hash;
+}
+
+- (instancetype)initWithParagraphStyle:(CTParagraphStyleRef)paragraphStyle;
+
+@end
+
+@implementation DTParagraphStyleCacheKey
+
+- (instancetype)initWithParagraphStyle:(CTParagraphStyleRef)paragraphStyle
+{
+	self = [super init];
+
+	if (self)
+	{
+		static const CTParagraphStyleSpecifier floatSpecifiers[DTParagraphStyleCacheFloatCount] = {kCTParagraphStyleSpecifierFirstLineHeadIndent, kCTParagraphStyleSpecifierHeadIndent, kCTParagraphStyleSpecifierTailIndent, kCTParagraphStyleSpecifierDefaultTabInterval, kCTParagraphStyleSpecifierLineHeightMultiple, kCTParagraphStyleSpecifierMaximumLineHeight, kCTParagraphStyleSpecifierMinimumLineHeight, kCTParagraphStyleSpecifierParagraphSpacing, kCTParagraphStyleSpecifierParagraphSpacingBefore, kCTParagraphStyleSpecifierMaximumLineSpacing, kCTParagraphStyleSpecifierMinimumLineSpacing, kCTParagraphStyleSpecifierLineSpacingAdjustment};
+
+		NSUInteger hash = 0;
+
+		for (NSUInteger i=0; i<DTParagraphStyleCacheFloatCount; i++)
+		{
+			CGFloat value = 0;
+			CTParagraphStyleGetValueForSpecifier(paragraphStyle, floatSpecifiers[i], sizeof(value), &value);
+
+			_floatValues[i] = value;
+
+			// indents can be negative
+			hash = hash * 31 + (NSUInteger)(NSInteger)(value * 100.0f);
+		}
+
+		_alignment = kCTNaturalTextAlignment;
+		CTParagraphStyleGetValueForSpecifier(paragraphStyle, kCTParagraphStyleSpecifierAlignment, sizeof(_alignment), &_alignment);
+
+		_lineBreakMode = kCTLineBreakByWordWrapping;
+		CTParagraphStyleGetValueForSpecifier(paragraphStyle, kCTParagraphStyleSpecifierLineBreakMode, sizeof(_lineBreakMode), &_lineBreakMode);
+
+		_writingDirection = kCTWritingDirectionNatural;
+		CTParagraphStyleGetValueForSpecifier(paragraphStyle, kCTParagraphStyleSpecifierBaseWritingDirection, sizeof(_writingDirection), &_writingDirection);
+
+		hash = hash * 31 + _alignment;
+		hash = hash * 31 + _lineBreakMode;
+		hash = hash * 31 + (NSUInteger)(NSInteger)_writingDirection;
+
+		CFArrayRef tabStops = NULL;
+		CTParagraphStyleGetValueForSpecifier(paragraphStyle, kCTParagraphStyleSpecifierTabStops, sizeof(tabStops), &tabStops);
+
+		NSMutableArray *tabs = [NSMutableArray array];
+
+		for (id tab in (__bridge NSArray *)tabStops)
+		{
+			CTTextTabRef textTab = (__bridge CTTextTabRef)tab;
+
+			CGFloat location = CTTextTabGetLocation(textTab);
+			CTTextAlignment alignment = CTTextTabGetAlignment(textTab);
+
+			[tabs addObject:[NSNumber numberWithDouble:location]];
+			[tabs addObject:[NSNumber numberWithInt:alignment]];
+
+			hash = hash * 31 + (NSUInteger)(NSInteger)(location * 100.0f);
+			hash = hash * 31 + alignment;
+		}
+
+		_tabStops = [tabs copy];
+		_hash = hash;
+	}
+
+	return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+	// immutable
+	return self;
+}
+
+- (NSUInteger)hash
+{
+	return _hash;
+}
+
+- (BOOL)isEqual:(id)object
+{
+	if (object == self)
+	{
+		return YES;
+	}
+
+	if (![object isKindOfClass:[DTParagraphStyleCacheKey class]])
+	{
+		return NO;
+	}
+
+	DTParagraphStyleCacheKey *other = object;
+
+	if (other->_hash != _hash || other->_alignment != _alignment || other->_lineBreakMode != _lineBreakMode || other->_writingDirection != _writingDirection)
+	{
+		return NO;
+	}
+
+	for (NSUInteger i=0; i<DTParagraphStyleCacheFloatCount; i++)
+	{
+		if (other->_floatValues[i] != _floatValues[i])
+		{
+			return NO;
+		}
+	}
+
+	return [_tabStops isEqualToArray:other->_tabStops];
+}
+
+@end
+
+
+// a paragraph style together with a paragraph spacing to apply to it
+@interface DTParagraphSpacingCacheKey : NSObject <NSCopying>
+{
+@public
+	id _paragraphStyle;
+	CGFloat _paragraphSpacing;
+	NSUInteger _hash;
+}
+
+- (instancetype)initWithParagraphStyle:(CTParagraphStyleRef)paragraphStyle paragraphSpacing:(CGFloat)paragraphSpacing;
+
+@end
+
+@implementation DTParagraphSpacingCacheKey
+
+- (instancetype)initWithParagraphStyle:(CTParagraphStyleRef)paragraphStyle paragraphSpacing:(CGFloat)paragraphSpacing
+{
+	self = [super init];
+
+	if (self)
+	{
+		_paragraphStyle = (__bridge id)paragraphStyle;
+		_paragraphSpacing = paragraphSpacing;
+
+		// styles are interned, so their identity is good enough
+		_hash = [_paragraphStyle hash] * 31 + (NSUInteger)(NSInteger)(paragraphSpacing * 100.0f);
+	}
+
+	return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+	// immutable
+	return self;
+}
+
+- (NSUInteger)hash
+{
+	return _hash;
+}
+
+- (BOOL)isEqual:(id)object
+{
+	if (object == self)
+	{
+		return YES;
+	}
+
+	if (![object isKindOfClass:[DTParagraphSpacingCacheKey class]])
+	{
+		return NO;
+	}
+
+	DTParagraphSpacingCacheKey *other = object;
+
+	return (other->_hash == _hash && other->_paragraphSpacing == _paragraphSpacing && [_paragraphStyle isEqual:other->_paragraphStyle]);
+}
+
+@end
+
+
+@implementation DTParagraphStyleCache
+{
+	// interned styles, keyed by their values
+	NSCache *_internedStyles;
+
+	// keyed by the original style and the paragraph spacing
+	NSCache *_spacingCache;
+}
+
++ (DTParagraphStyleCache *)sharedCache
+{
+	static DTParagraphStyleCache *_sharedCache = nil;
+	static dispatch_once_t onceToken;
+
+	dispatch_once(&onceToken, ^{
+		_sharedCache = [[DTParagraphStyleCache alloc] init];
+	});
+
+	return _sharedCache;
+}
+
+- (instancetype)init
+{
+	self = [super init];
+
+	if (self)
+	{
+		_internedStyles = [[NSCache alloc] init];
+		_spacingCache = [[NSCache alloc] init];
+	}
+
+	return self;
+}
+
+// returns the interned instance for the values of a style, takes ownership of the passed style
+- (CTParagraphStyleRef)_internParagraphStyle:(CTParagraphStyleRef)paragraphStyle
+{
+	DTParagraphStyleCacheKey *key = [[DTParagraphStyleCacheKey alloc] initWithParagraphStyle:paragraphStyle];
+
+	// NSCache is thread-safe, a race only causes two instances with the same values
+	id internedStyle = [_internedStyles objectForKey:key];
+
+	if (internedStyle)
+	{
+		CFRelease(paragraphStyle);
+
+		return (CTParagraphStyleRef)CFBridgingRetain(internedStyle);
+	}
+
+	[_internedStyles setObject:(__bridge id)paragraphStyle forKey:key];
+
+	return paragraphStyle;
+}
+
+- (CTParagraphStyleRef)newParagraphStyleWithParagraphStyle:(DTCoreTextParagraphStyle *)paragraphStyle
+{
+	NSParameterAssert(paragraphStyle);
+
+	return [self _internParagraphStyle:[paragraphStyle createCTParagraphStyle]];
+}
+
+- (CTParagraphStyleRef)newParagraphStyleWithParagraphSpacing:(CGFloat)paragraphSpacing basedOnParagraphStyle:(CTParagraphStyleRef)paragraphStyle
+{
+	NSParameterAssert(paragraphStyle);
+
+	DTParagraphSpacingCacheKey *key = [[DTParagraphSpacingCacheKey alloc] initWithParagraphStyle:paragraphStyle paragraphSpacing:paragraphSpacing];
+	id cachedStyle = [_spacingCache objectForKey:key];
+
+	if (cachedStyle)
+	{
+		return (CTParagraphStyleRef)CFBridgingRetain(cachedStyle);
+	}
+
+	DTCoreTextParagraphStyle *tmpStyle = [DTCoreTextParagraphStyle paragraphStyleWithCTParagraphStyle:paragraphStyle];
+	tmpStyle.paragraphSpacing = paragraphSpacing;
+
+	CTParagraphStyleRef newStyle = [self newParagraphStyleWithParagraphStyle:tmpStyle];
+
+	[_spacingCache setObject:(__bridge id)newStyle forKey:key];
+
+	return newStyle;
+}
+
+- (void)removeAllParagraphStyles
+{
+	[_internedStyles removeAllObjects];
+	[_spacingCache removeAllObjects];
+}
+
+@end
@@ -8,10 +8,21 @@
 
 #import <DTCoreText/DTAttributedTextContentView.h>
 
+@class DTHTMLFragmentCache;
+@class DTWordBoundaryCache;
+@class DTTextSearchIndex;
+@class DTRichTextEditorMetrics;
+
 /**
  This class represents the content view of a DTRichTextEditorView which itself is a UIScrollView subclass.
  
  It adds mutability and incremental layouting to DTAttributedTextContentView.
+ 
+ When an edit shifts the rest of the document only the tiles near the visible area are redrawn right away, the others are marked as stale and redrawn once they scroll close to the visible area.
+ 
+ Custom views for links are only rebuilt for the paragraphs an edit modifies, the views of links after them are moved to their new position.
+ 
+ Custom views for attachments are only created for the visible lines. Once they move out of the visible area they are put into a reuse pool for the class of their attachment, the delegate can get them from there with <dequeueReusableViewForAttachmentClass:> instead of creating a new view.
  */
 @interface DTRichTextEditorContentView : DTAttributedTextContentView
 
@@ -25,10 +36,69 @@
  */
 - (void)relayoutTextInRange:(NSRange)range;
 
+/**
+ Specifies that paragraphs should only be laid out when they come near the visible area or when caret or selection geometry needs them. Off-screen paragraphs use an estimated height that gets corrected once they are laid out, the frame of the receiver is updated progressively.
+ 
+ This is recommended for very large documents. Defaults to `NO`
+ */
+@property (nonatomic, assign) BOOL shouldLayoutLazily;
+
+/**
+ Specifies that paragraphs modified by <replaceTextInRange:withText:> are typeset on a background queue. The receiver redraws the affected area once the new lines have been swapped in, caret and selection queries in the meantime wait for the lines they need.
+ 
+ Defaults to `NO`
+ */
+@property (nonatomic, assign) BOOL shouldLayoutAsynchronously;
+
+/**
+ Specifies that each paragraph is rasterized into a bitmap once and drawn from that bitmap afterwards. This speeds up scrolling through long documents at the expense of memory, the bitmaps are limited by <rasterizedParagraphsMemoryBudget>.
+ 
+ Defaults to `NO`
+ */
+@property (nonatomic, assign) BOOL shouldRasterizeParagraphs;
+
+/**
+ The maximum number of bytes used for paragraph bitmaps if <shouldRasterizeParagraphs> is set, the least recently drawn paragraphs are evicted first.
+ 
+ Defaults to 16 MB
+ */
+@property (nonatomic, assign) NSUInteger rasterizedParagraphsMemoryBudget;
+
+/**
+ @name Magnifying
+ */
+
+/**
+ Prepares the receiver for being magnified by the loupe while the user drags the cursor or a selection handle. The loupe renders the receiver for every move of the touch, so until <endMagnifying> the paragraphs are drawn from bitmaps that are rasterized once instead of being typeset again for each frame. If <shouldRasterizeParagraphs> is set its cache is used, otherwise a small temporary one.
+ */
+- (void)beginMagnifying;
+
+/**
+ Ends the magnification started with <beginMagnifying> and releases the temporary paragraph bitmaps.
+ */
+- (void)endMagnifying;
+
+/**
+ Whether the receiver is between <beginMagnifying> and <endMagnifying>
+ */
+@property (nonatomic, readonly, getter=isMagnifying) BOOL magnifying;
+
 /**
  @name Modifying the Content
  */
 
+/**
+ Sets the attributed string of the receiver without copying it, the layout frame uses it as its mutable text. Setting the same string via `attributedString` afterwards does nothing.
+ @param attributedString The new text, the receiver takes ownership of it and the caller must not modify it anymore
+ */
+- (void)adoptAttributedString:(NSMutableAttributedString *)attributedString;
+
+/**
+ Sets the attributed string of the receiver without copying it and only lays out the paragraphs near the visible area right away, the others get estimated heights. Unless <shouldLayoutLazily> is set they are laid out on a background queue afterwards.
+ @param attributedString The new text, the receiver takes ownership of it and the caller must not modify it anymore
+ */
+- (void)adoptAttributedStringLayingOutLazily:(NSMutableAttributedString *)attributedString;
+
 /**
  Replaces the attributed text in the given range.
  @param range The string range to replace
@@ -36,4 +106,119 @@
  */
 - (void)replaceTextInRange:(NSRange)range withText:(NSAttributedString *)text;
 
+/**
+ Replaces the attributed text in the given range, but only lays out and redraws the lines of the paragraph from the line before the range on. Used for marked text that changes with every key stroke.
+ @param range The string range to replace
+ @param text The replacement text
+ */
+- (void)replaceTextInLinesOfRange:(NSRange)range withText:(NSAttributedString *)text;
+
+/**
+ Replaces the attributed text in the given range without laying out and redrawing the affected paragraphs yet. Call <layoutDeferredText> to do that for all deferred replacements at once.
+ @param range The string range to replace
+ @param text The replacement text
+ */
+- (void)replaceTextInRange:(NSRange)range withTextDeferringLayout:(NSAttributedString *)text;
+
+/**
+ Lays out and redraws the paragraphs modified by <replaceTextInRange:withTextDeferringLayout:>.
+ */
+- (void)layoutDeferredText;
+
+/**
+ Replaces the attributes in the given range without laying out the text again, only the modified lines are redrawn. This only works for attributes that don't affect the glyph metrics, like colors, highlights, underlines or links.
+ @param range The string range to modify
+ @param text The replacement text, it needs to have the same characters as the range
+ @returns `YES` if the attributes were replaced, `NO` if the change requires <replaceTextInRange:withText:>
+ */
+- (BOOL)replaceAttributesInRange:(NSRange)range withText:(NSAttributedString *)text;
+
+/**
+ Informs the caches of the receiver that attributes in the given range were modified directly in the mutable attributed string of the layout frame. Neither layout nor display is updated.
+ @param range The string range whose attributes were modified
+ */
+- (void)attributesDidChangeInRange:(NSRange)range;
+
+/**
+ @name Taking Snapshots
+ */
+
+/**
+ Creates an immutable copy of the current text that can be used on a background queue, for example for saving or converting it to HTML while the user keeps typing. The paragraphs are kept between snapshots, only those modified since the previous one are copied again. Must be called on the main thread.
+ @returns The snapshot of the text
+ */
+- (NSAttributedString *)attributedStringSnapshot;
+
+/**
+ @name Reusing Attachment Views
+ */
+
+/**
+ Puts a view into the reuse pool for a class of attachments. The receiver does this for attachment views that moved out of the visible area, the pool is limited to a few views per class.
+ @param view The view that is no longer shown
+ @param attachmentClass The class of the attachment the view was showing
+ */
+- (void)enqueueReusableView:(UIView *)view forAttachmentClass:(Class)attachmentClass;
+
+/**
+ Takes a view out of the reuse pool. Call this from the `attributedTextContentView:viewForAttachment:frame:` delegate method and configure the view for the new attachment.
+ @param attachmentClass The class of the attachment that needs a view
+ @returns A view that was showing an attachment of the same class or `nil` if the pool is empty
+ */
+- (UIView *)dequeueReusableViewForAttachmentClass:(Class)attachmentClass;
+
+/**
+ @name Generating HTML
+ */
+
+/**
+ The cache for the HTML of the paragraphs, invalidated by all methods that modify the text of the receiver.
+ */
+@property (nonatomic, readonly) DTHTMLFragmentCache *HTMLFragmentCache;
+
+/**
+ @name Finding Words
+ */
+
+/**
+ The cache for the word ranges of the paragraphs used by the tokenizer of the editor, invalidated by all methods that modify the text of the receiver.
+ */
+@property (nonatomic, readonly) DTWordBoundaryCache *wordBoundaryCache;
+
+/**
+ @name Searching
+ */
+
+/**
+ The matches of the current search of the editor, invalidated by all methods that modify the text of the receiver. `nil` if there is no search.
+ */
+@property (nonatomic, strong) DTTextSearchIndex *searchIndex;
+
+/**
+ @name Dictation
+ */
+
+/**
+ The string index of the dictation placeholder attachment, moved by all methods that modify the text of the receiver. `NSNotFound` if there is no placeholder or a modification might have replaced it. The editor sets this when it inserts the placeholder and verifies that the attachment is still there before using it.
+ */
+@property (nonatomic, assign) NSUInteger dictationPlaceholderLocation;
+
+/**
+ @name Measuring Performance
+ */
+
+/**
+ The metrics of the editor, handed on to the layout frame and the caches of the receiver. Tile drawing is measured by the receiver itself.
+ */
+@property (nonatomic, strong) DTRichTextEditorMetrics *metrics;
+
+/**
+ @name Releasing Memory
+ */
+
+/**
+ Releases everything that can be recreated from the text, down to the string and the height of every paragraph: the lines of the layout frame, the rasterized paragraphs, the HTML fragments, the word ranges and the paragraphs kept for snapshots. Used by <DTRichTextEditorView> while it is not in a window.
+ */
+- (void)discardCachedLayoutAndRendering;
+
 @end
@@ -8,18 +8,93 @@
 
 #import "DTRichTextEditorContentView.h"
 #import "DTMutableCoreTextLayoutFrame.h"
+#import "DTParagraphRasterCache.h"
+#import "DTRichTextImageAttachment.h"
+#import "DTHTMLFragmentCache.h"
+#import "DTWordBoundaryCache.h"
+#import "DTAttributedStringSnapshotCache.h"
+#import "DTTextSearchIndex.h"
+#import "DTRichTextEditorMetrics.h"
 
 #import <DTCoreText/DTCoreTextLayoutFrame.h>
+#import <DTCoreText/DTCoreTextLayoutLine.h>
+#import <DTCoreText/DTCoreTextConstants.h>
 #import <DTFoundation/DTTiledLayerWithoutFade.h>
 
+#define DTRasterizedParagraphsDefaultMemoryBudget (16 * 1024 * 1024)
+#define DTReusableAttachmentViewsPerClass 16
+#define DTMagnificationRasterMemoryBudget (4 * 1024 * 1024)
+
+@interface DTAttributedTextContentView (private)
+
+// maintained by layoutSubviewsInRect:, link views are keyed by the string index of their first glyph run
+@property (nonatomic, strong) NSMutableSet *customViews;
+@property (nonatomic, strong) NSMutableDictionary *customViewsForLinksIndex;
+
+// attachment views are keyed by the hash of their attachment
+@property (nonatomic, strong) NSMutableDictionary *customViewsForAttachmentsIndex;
+
+- (void)removeSubviewsOutsideRect:(CGRect)rect;
+
+@end
+
 
 @implementation DTRichTextEditorContentView
+{
+	BOOL _shouldLayoutLazily;
+	BOOL _shouldLayoutAsynchronously;
+	
+	// tile rows that show outdated content, redrawn once they come close to the visible area
+	NSMutableIndexSet *_staleTileRows;
+	CGRect _visibleRect;
+	
+	BOOL _shouldRasterizeParagraphs;
+	NSUInteger _rasterizedParagraphsMemoryBudget;
+	DTParagraphRasterCache *_paragraphRasterCache;
+	
+	// paragraph bitmaps for the loupe if the paragraphs are not rasterized anyway
+	BOOL _magnifying;
+	DTParagraphRasterCache *_magnificationRasterCache;
+	
+	DTHTMLFragmentCache *_HTMLFragmentCache;
+	DTWordBoundaryCache *_wordBoundaryCache;
+	DTAttributedStringSnapshotCache *_snapshotCache;
+	DTTextSearchIndex *_searchIndex;
+	
+	// moved along with the text so that the placeholder can be found without searching for it
+	NSUInteger _dictationPlaceholderLocation;
+	
+	DTRichTextEditorMetrics *_metrics;
+	
+	// attachment views that scrolled out of the visible area, by class name of their attachment
+	NSMutableDictionary *_reusableAttachmentViews;
+	NSMapTable *_attachmentClassesByView;
+}
 
 + (Class)layerClass
 {
 	return [DTTiledLayerWithoutFade class];
 }
 
+- (id)initWithFrame:(CGRect)frame
+{
+	self = [super initWithFrame:frame];
+	
+	if (self)
+	{
+		_dictationPlaceholderLocation = NSNotFound;
+		
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(imageAttachmentDidDecodeImage:) name:DTRichTextImageAttachmentDidDecodeImageNotification object:nil];
+	}
+	
+	return self;
+}
+
+- (void)dealloc
+{
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
 - (void)_sendFinishLayoutNotification
 {
 	// trigger new layout
@@ -67,7 +142,15 @@
 			CGRect rect = UIEdgeInsetsInsetRect(self.bounds, _edgeInsets);
 			rect.size.height = CGFLOAT_HEIGHT_UNKNOWN; // necessary height set as soon as we know it.
 			
-			_layoutFrame = [[DTMutableCoreTextLayoutFrame alloc] initWithFrame:rect attributedString:_attributedString];
+			DTMutableCoreTextLayoutFrame *layoutFrame = [[DTMutableCoreTextLayoutFrame alloc] initWithFrame:rect attributedString:_attributedString];
+			layoutFrame.shouldLayoutLazily = _shouldLayoutLazily;
+			layoutFrame.shouldLayoutAsynchronously = _shouldLayoutAsynchronously;
+			layoutFrame.paragraphRasterCache = _paragraphRasterCache ? _paragraphRasterCache : _magnificationRasterCache;
+			layoutFrame.metrics = _metrics;
+			
+			_layoutFrame = layoutFrame;
+			
+			[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(layoutFrameDidChangeHeight:) name:DTMutableCoreTextLayoutFrameDidChangeHeightNotification object:layoutFrame];
 			
 			if (_attributedString)
 			{
@@ -96,6 +179,8 @@
 		// new layout invalidates all positions for custom views
 		[self removeAllCustomViews];
 		
+		[self _removeAllTextCaches];
+		
 		needsRelayout = YES;
 	}
 	
@@ -105,6 +190,56 @@
 	}
 }
 
+- (void)adoptAttributedString:(NSMutableAttributedString *)attributedString
+{
+	if (_attributedString == attributedString)
+	{
+		return;
+	}
+	
+	DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.layoutFrame;
+	
+	// lays out the new text already, relayoutText would lay it out a second time
+	[layoutFrame adoptAttributedString:attributedString];
+	
+	_attributedString = layoutFrame.attributedStringFragment;
+	
+	// new layout invalidates all positions for custom views
+	[self removeAllCustomViews];
+	
+	[self _removeAllTextCaches];
+	
+	[self _sendFinishLayoutNotification];
+	
+	[self setNeedsDisplay];
+	[self setNeedsLayout];
+}
+
+- (void)adoptAttributedStringLayingOutLazily:(NSMutableAttributedString *)attributedString
+{
+	if (_attributedString == attributedString)
+	{
+		return;
+	}
+	
+	DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.layoutFrame;
+	
+	// only estimates the paragraphs, relayoutText would lay them all out again
+	[layoutFrame adoptAttributedStringLayingOutLazily:attributedString];
+	
+	_attributedString = layoutFrame.attributedStringFragment;
+	
+	// new layout invalidates all positions for custom views
+	[self removeAllCustomViews];
+	
+	[self _removeAllTextCaches];
+	
+	[self _sendFinishLayoutNotification];
+	
+	[self setNeedsDisplay];
+	[self setNeedsLayout];
+}
+
 - (void)setFrame:(CGRect)frame
 {
 	[super setFrame:frame];
@@ -129,10 +264,12 @@
 	{
 		DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.layoutFrame;
 		
+		NSDictionary *shiftedLinkViews = [self _removeCustomViewsForLinksAffectedByReplacingRange:range];
+		
 		[layoutFrame relayoutTextInRange:range];
 		
-		// remove all link custom views
-		[self removeAllCustomViewsForLinks];
+		// the other link views might have moved
+		[self _updateCustomViewsForLinks:shiftedLinkViews afterReplacingRange:range replacementLength:range.length];
 		
 		// relayout / redraw
 		[self setNeedsDisplay];
@@ -141,29 +278,818 @@
 	}
 }
 
+// the caches of values derived from the text need to know about all modifications
+- (void)_invalidateTextCachesInRange:(NSRange)range replacementLength:(NSUInteger)length
+{
+	[_HTMLFragmentCache invalidateRange:range replacementLength:length];
+	[_wordBoundaryCache invalidateRange:range replacementLength:length];
+	[_snapshotCache invalidateRange:range replacementLength:length];
+	[_searchIndex invalidateRange:range replacementLength:length];
+	
+	if (_dictationPlaceholderLocation != NSNotFound)
+	{
+		if (NSMaxRange(range) <= _dictationPlaceholderLocation)
+		{
+			// text before the placeholder was replaced
+			_dictationPlaceholderLocation = _dictationPlaceholderLocation - range.length + length;
+		}
+		else if (range.location <= _dictationPlaceholderLocation && length != range.length)
+		{
+			// the placeholder itself might have been replaced, only attribute changes keep it in place
+			_dictationPlaceholderLocation = NSNotFound;
+		}
+	}
+}
+
+- (void)_removeAllTextCaches
+{
+	[_HTMLFragmentCache removeAllFragments];
+	[_wordBoundaryCache removeAllWordRanges];
+	[_snapshotCache removeAllChunks];
+	[_searchIndex invalidateAllMatches];
+	
+	_dictationPlaceholderLocation = NSNotFound;
+}
+
 - (void)replaceTextInRange:(NSRange)range withText:(NSAttributedString *)text
 {
+	[self _invalidateTextCachesInRange:range replacementLength:[text length]];
+	
+	if (_shouldLayoutAsynchronously)
+	{
+		DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.layoutFrame;
+		NSDictionary *shiftedLinkViews = [self _removeCustomViewsForLinksAffectedByReplacingRange:range];
+		
+		// the frame takes care of synchronization, the completion is called on the main thread
+		[layoutFrame replaceTextInRange:range withText:text completion:^(CGRect dirtyRect) {
+			
+			// a later edit cancels the completion, so all link views are moved, not just the ones of this edit
+			[self _moveCustomViewsForLinksWithKeys:[self.customViewsForLinksIndex allKeys]];
+			
+			// redraw
+			[self _setNeedsDisplayInDirtyRect:dirtyRect];
+			
+			[self _sendFinishLayoutNotification];
+		}];
+		
+		// the string is already modified, the keys have to match it even if the completion never runs
+		[self _rekeyCustomViewsForLinks:shiftedLinkViews afterReplacingRange:range replacementLength:[text length]];
+		
+		return;
+	}
+	
 	@synchronized(self)
 	{
 		DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.layoutFrame;
 		
 		__block CGRect dirtyRect = self.bounds;
 		
+		NSDictionary *shiftedLinkViews = [self _removeCustomViewsForLinksAffectedByReplacingRange:range];
+		
 		[layoutFrame replaceTextInRange:range withText:text dirtyRect:&dirtyRect];
 		
-		// remove all link custom views
-		[self removeAllCustomViewsForLinks];
+		// move the link views below the edit to their new lines
+		[self _updateCustomViewsForLinks:shiftedLinkViews afterReplacingRange:range replacementLength:[text length]];
 		
 		// relayout / redraw
-		[self setNeedsDisplayInRect:dirtyRect];
+		[self _setNeedsDisplayInDirtyRect:dirtyRect];
+		
+		[self _sendFinishLayoutNotification];
+	}
+}
+
+- (void)replaceTextInLinesOfRange:(NSRange)range withText:(NSAttributedString *)text
+{
+	[self _invalidateTextCachesInRange:range replacementLength:[text length]];
+	
+	@synchronized(self)
+	{
+		DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.layoutFrame;
+		
+		CGRect dirtyRect = self.bounds;
+		
+		NSDictionary *shiftedLinkViews = [self _removeCustomViewsForLinksAffectedByReplacingRange:range];
+		
+		[layoutFrame replaceTextInLinesOfRange:range withText:text dirtyRect:&dirtyRect];
+		
+		// move the link views below the edit to their new lines
+		[self _updateCustomViewsForLinks:shiftedLinkViews afterReplacingRange:range replacementLength:[text length]];
+		
+		// redraw only the modified lines unless the rest of the document moved
+		[self _setNeedsDisplayInDirtyRect:dirtyRect];
+		
+		[self _sendFinishLayoutNotification];
+	}
+}
+
+- (void)replaceTextInRange:(NSRange)range withTextDeferringLayout:(NSAttributedString *)text
+{
+	[self _invalidateTextCachesInRange:range replacementLength:[text length]];
+	
+	DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.layoutFrame;
+	NSDictionary *shiftedLinkViews = [self _removeCustomViewsForLinksAffectedByReplacingRange:range];
+	
+	// no redraw until the deferred paragraphs are laid out
+	[layoutFrame replaceTextInRange:range withTextDeferringLayout:text];
+	
+	// the link views are moved to their lines by layoutDeferredText
+	[self _rekeyCustomViewsForLinks:shiftedLinkViews afterReplacingRange:range replacementLength:[text length]];
+}
+
+- (void)layoutDeferredText
+{
+	@synchronized(self)
+	{
+		DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.layoutFrame;
+		
+		if (![layoutFrame hasDeferredLayout])
+		{
+			return;
+		}
+		
+		CGRect dirtyRect = [layoutFrame layoutDeferredParagraphs];
+		
+		// the link views in the modified paragraphs are already removed, the others might have moved
+		[self _moveCustomViewsForLinksWithKeys:[self.customViewsForLinksIndex allKeys]];
+		
+		if (!CGRectIsNull(dirtyRect))
+		{
+			// relayout / redraw
+			[self _setNeedsDisplayInDirtyRect:dirtyRect];
+		}
 		
 		[self _sendFinishLayoutNotification];
 	}
 }
 
+- (BOOL)replaceAttributesInRange:(NSRange)range withText:(NSAttributedString *)text
+{
+	@synchronized(self)
+	{
+		DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.layoutFrame;
+		
+		CGRect dirtyRect = CGRectNull;
+		
+		if (![layoutFrame replaceAttributesInRange:range withText:text dirtyRect:&dirtyRect])
+		{
+			return NO;
+		}
+		
+		[self _invalidateTextCachesInRange:range replacementLength:[text length]];
+		
+		// links might have been added or removed in the modified paragraphs, the lines did not move
+		[self _removeCustomViewsForLinksAffectedByReplacingRange:range];
+		
+		if (!CGRectIsNull(dirtyRect))
+		{
+			// size is unchanged, only redraw
+			[self _setNeedsDisplayInDirtyRect:dirtyRect];
+		}
+		
+		return YES;
+	}
+}
+
+- (void)attributesDidChangeInRange:(NSRange)range
+{
+	[self _invalidateTextCachesInRange:range replacementLength:range.length];
+}
+
+#pragma mark - Taking Snapshots
+
+- (NSAttributedString *)attributedStringSnapshot
+{
+	NSAssert([NSThread isMainThread], @"Snapshots can only be taken on the main thread");
+	
+	if (!_snapshotCache)
+	{
+		_snapshotCache = [[DTAttributedStringSnapshotCache alloc] init];
+	}
+	
+	return [_snapshotCache snapshotOfAttributedString:self.layoutFrame.attributedStringFragment];
+}
+
 - (void)setNeedsDisplay
 {
+	// everything gets redrawn anyway
+	[_staleTileRows removeAllIndexes];
+	
 	[super setNeedsDisplay];
 }
 
+- (void)layoutSubviewsInRect:(CGRect)rect
+{
+	if (!CGRectIsNull(rect) && !CGRectIsInfinite(rect))
+	{
+		_visibleRect = rect;
+		
+		[self _redrawStaleTilesNearRect:rect];
+	}
+	
+	[super layoutSubviewsInRect:rect];
+	
+	[self _recordAttachmentClassesOfViewsInRect:rect];
+}
+
+- (void)removeSubviewsOutsideRect:(CGRect)rect
+{
+	NSArray *attachmentViews = [self.customViewsForAttachmentsIndex allValues];
+	
+	[super removeSubviewsOutsideRect:rect];
+	
+	[self _enqueueRemovedAttachmentViews:attachmentViews];
+}
+
+- (void)removeAllCustomViews
+{
+	NSArray *attachmentViews = [self.customViewsForAttachmentsIndex allValues];
+	
+	[super removeAllCustomViews];
+	
+	[self _enqueueRemovedAttachmentViews:attachmentViews];
+}
+
+#pragma mark - Attachment Views
+
+// remembers which kind of attachment the visible attachment views show, so that they can be enqueued for it once they are removed
+- (void)_recordAttachmentClassesOfViewsInRect:(CGRect)rect
+{
+	NSDictionary *attachmentViewsIndex = self.customViewsForAttachmentsIndex;
+	
+	if (![attachmentViewsIndex count])
+	{
+		return;
+	}
+	
+	DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.layoutFrame;
+	
+	if (![layoutFrame isKindOfClass:[DTMutableCoreTextLayoutFrame class]])
+	{
+		return;
+	}
+	
+	NSArray *lines = [layoutFrame linesVisibleInRect:CGRectIsNull(rect) ? self.bounds : rect];
+	
+	if (![lines count])
+	{
+		return;
+	}
+	
+	NSUInteger location = [[lines objectAtIndex:0] stringRange].location;
+	NSRange visibleRange = NSMakeRange(location, NSMaxRange([[lines lastObject] stringRange]) - location);
+	
+	if (!_attachmentClassesByView)
+	{
+		_attachmentClassesByView = [NSMapTable weakToStrongObjectsMapTable];
+	}
+	
+	for (DTTextAttachment *attachment in [layoutFrame textAttachmentsInRange:visibleRange])
+	{
+		UIView *view = [attachmentViewsIndex objectForKey:[NSNumber numberWithUnsignedInteger:[attachment hash]]];
+		
+		if (view)
+		{
+			[_attachmentClassesByView setObject:NSStringFromClass([attachment class]) forKey:view];
+		}
+	}
+}
+
+- (void)_enqueueRemovedAttachmentViews:(NSArray *)attachmentViews
+{
+	for (UIView *view in attachmentViews)
+	{
+		// still visible
+		if (view.superview)
+		{
+			continue;
+		}
+		
+		NSString *className = [_attachmentClassesByView objectForKey:view];
+		
+		if (className)
+		{
+			[self enqueueReusableView:view forAttachmentClass:NSClassFromString(className)];
+			[_attachmentClassesByView removeObjectForKey:view];
+		}
+	}
+}
+
+- (void)enqueueReusableView:(UIView *)view forAttachmentClass:(Class)attachmentClass
+{
+	NSParameterAssert(view);
+	NSParameterAssert(attachmentClass);
+	
+	if (!_reusableAttachmentViews)
+	{
+		_reusableAttachmentViews = [[NSMutableDictionary alloc] init];
+	}
+	
+	NSString *className = NSStringFromClass(attachmentClass);
+	NSMutableSet *reusableViews = [_reusableAttachmentViews objectForKey:className];
+	
+	if (!reusableViews)
+	{
+		reusableViews = [[NSMutableSet alloc] init];
+		[_reusableAttachmentViews setObject:reusableViews forKey:className];
+	}
+	
+	// more views than fit on a screen are not worth keeping
+	if ([reusableViews count] >= DTReusableAttachmentViewsPerClass)
+	{
+		return;
+	}
+	
+	[reusableViews addObject:view];
+}
+
+- (UIView *)dequeueReusableViewForAttachmentClass:(Class)attachmentClass
+{
+	NSMutableSet *reusableViews = [_reusableAttachmentViews objectForKey:NSStringFromClass(attachmentClass)];
+	UIView *view = [reusableViews anyObject];
+	
+	if (view)
+	{
+		[reusableViews removeObject:view];
+	}
+	
+	return view;
+}
+
+#pragma mark - Link Views
+
+- (void)_removeCustomViewForLinkWithKey:(NSNumber *)key
+{
+	UIView *linkView = [self.customViewsForLinksIndex objectForKey:key];
+	
+	[linkView removeFromSuperview];
+	[self.customViews removeObject:linkView];
+	[self.customViewsForLinksIndex removeObjectForKey:key];
+}
+
+// removes the link views in the paragraphs that are modified by a replacement and returns the GUIDs of the links after them, keyed by their current index
+- (NSDictionary *)_removeCustomViewsForLinksAffectedByReplacingRange:(NSRange)range
+{
+	NSMutableDictionary *linkViewsIndex = self.customViewsForLinksIndex;
+	
+	if (![linkViewsIndex count])
+	{
+		return nil;
+	}
+	
+	DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.layoutFrame;
+	NSAttributedString *attributedString = layoutFrame.attributedStringFragment;
+	NSUInteger length = [attributedString length];
+	
+	// one more character, so that the paragraph a deleted paragraph break merges with is included
+	NSRange extendedRange = NSMakeRange(range.location, MIN(range.length + 1, length - MIN(range.location, length)));
+	NSRange affectedRange = [layoutFrame rangeOfParagraphsContainingRange:extendedRange parBegIndex:NULL parEndIndex:NULL];
+	
+	NSMutableDictionary *shiftedLinkViews = [NSMutableDictionary dictionary];
+	
+	for (NSNumber *key in [linkViewsIndex allKeys])
+	{
+		NSUInteger index = [key unsignedIntegerValue];
+		
+		if (index < affectedRange.location)
+		{
+			// not affected at all
+			continue;
+		}
+		
+		NSString *GUID = nil;
+		
+		if (index >= NSMaxRange(affectedRange) && index < length)
+		{
+			GUID = [attributedString attribute:DTGUIDAttribute atIndex:index effectiveRange:NULL];
+		}
+		
+		if (GUID)
+		{
+			[shiftedLinkViews setObject:GUID forKey:key];
+		}
+		else
+		{
+			// link might be split, merged or removed
+			[self _removeCustomViewForLinkWithKey:key];
+		}
+	}
+	
+	return shiftedLinkViews;
+}
+
+// re-keys the link views after the modified paragraphs by their new index, this only needs the modified string and not the lines
+- (NSArray *)_rekeyCustomViewsForLinks:(NSDictionary *)shiftedLinkViews afterReplacingRange:(NSRange)range replacementLength:(NSUInteger)replacementLength
+{
+	if (![shiftedLinkViews count])
+	{
+		return nil;
+	}
+	
+	NSMutableDictionary *linkViewsIndex = self.customViewsForLinksIndex;
+	NSAttributedString *attributedString = self.layoutFrame.attributedStringFragment;
+	NSInteger delta = (NSInteger)replacementLength - (NSInteger)range.length;
+	
+	NSMutableDictionary *movedLinkViews = [NSMutableDictionary dictionary];
+	
+	for (NSNumber *key in shiftedLinkViews)
+	{
+		UIView *linkView = [linkViewsIndex objectForKey:key];
+		
+		if (!linkView)
+		{
+			// removed by a layout pass in the meantime
+			continue;
+		}
+		
+		NSUInteger index = (NSUInteger)((NSInteger)[key unsignedIntegerValue] + delta);
+		NSString *GUID = [shiftedLinkViews objectForKey:key];
+		
+		[linkViewsIndex removeObjectForKey:key];
+		
+		if (index >= [attributedString length] || ![GUID isEqualToString:[attributedString attribute:DTGUIDAttribute atIndex:index effectiveRange:NULL]] || [attributedString attribute:NSAttachmentAttributeName atIndex:index effectiveRange:NULL])
+		{
+			[linkView removeFromSuperview];
+			[self.customViews removeObject:linkView];
+			
+			continue;
+		}
+		
+		[movedLinkViews setObject:linkView forKey:[NSNumber numberWithInteger:index]];
+	}
+	
+	[linkViewsIndex addEntriesFromDictionary:movedLinkViews];
+	
+	return [movedLinkViews allKeys];
+}
+
+// moves the link views with the given keys to the frame of their link, this needs the lines to be laid out
+- (void)_moveCustomViewsForLinksWithKeys:(NSArray *)keys
+{
+	NSMutableDictionary *linkViewsIndex = self.customViewsForLinksIndex;
+	DTCoreTextLayoutFrame *layoutFrame = self.layoutFrame;
+	NSAttributedString *attributedString = layoutFrame.attributedStringFragment;
+	CGPoint layoutOffset = self.layoutOffset;
+	
+	for (NSNumber *key in keys)
+	{
+		UIView *linkView = [linkViewsIndex objectForKey:key];
+		
+		if (!linkView)
+		{
+			continue;
+		}
+		
+		NSUInteger index = [key unsignedIntegerValue];
+		DTCoreTextLayoutLine *line = nil;
+		NSRange linkRange;
+		
+		if (index < [attributedString length])
+		{
+			line = [layoutFrame lineContainingIndex:index];
+		}
+		
+		if (!line || ![attributedString attribute:DTLinkAttribute atIndex:index longestEffectiveRange:&linkRange inRange:[line stringRange]])
+		{
+			[self _removeCustomViewForLinkWithKey:key];
+			
+			continue;
+		}
+		
+		// same geometry as layoutSubviewsInRect: uses, so that the view is reused there
+		CGRect frame = [line frameOfGlyphsWithRange:linkRange];
+		frame.origin.x += layoutOffset.x;
+		frame.origin.y += layoutOffset.y;
+		
+		frame.origin.x = floor(frame.origin.x);
+		frame.origin.y = ceil(frame.origin.y);
+		frame.size.width = round(frame.size.width);
+		frame.size.height = round(frame.size.height);
+		
+		linkView.frame = frame;
+	}
+}
+
+// re-keys the link views after the modified paragraphs and moves them to their new lines
+- (void)_updateCustomViewsForLinks:(NSDictionary *)shiftedLinkViews afterReplacingRange:(NSRange)range replacementLength:(NSUInteger)replacementLength
+{
+	NSArray *movedKeys = [self _rekeyCustomViewsForLinks:shiftedLinkViews afterReplacingRange:range replacementLength:replacementLength];
+	
+	[self _moveCustomViewsForLinksWithKeys:movedKeys];
+}
+
+#pragma mark - Tiles
+
+- (CGFloat)_tileHeight
+{
+	CATiledLayer *tiledLayer = (CATiledLayer *)self.layer;
+	CGFloat scale = tiledLayer.contentsScale;
+	
+	if (scale <= 0)
+	{
+		scale = 1.0;
+	}
+	
+	CGFloat tileHeight = tiledLayer.tileSize.height / scale;
+	
+	if (tileHeight <= 0)
+	{
+		// CATiledLayer default
+		tileHeight = 256.0;
+	}
+	
+	return tileHeight;
+}
+
+- (NSRange)_tileRowsInRect:(CGRect)rect
+{
+	CGFloat tileHeight = [self _tileHeight];
+	
+	CGFloat minY = MAX(0, CGRectGetMinY(rect));
+	CGFloat maxY = MAX(minY, CGRectGetMaxY(rect));
+	
+	NSUInteger firstRow = (NSUInteger)floorf(minY / tileHeight);
+	NSUInteger lastRow = (NSUInteger)ceilf(maxY / tileHeight);
+	
+	return NSMakeRange(firstRow, MAX(lastRow, firstRow+1) - firstRow);
+}
+
+// only redraws the parts of the dirty rect near the visible area, tiles further away are marked as stale
+- (void)_setNeedsDisplayInDirtyRect:(CGRect)dirtyRect
+{
+	if (CGRectIsNull(dirtyRect) || CGRectIsEmpty(dirtyRect))
+	{
+		return;
+	}
+	
+	if (CGRectIsEmpty(_visibleRect))
+	{
+		// not scrolled yet, we don't know what is visible
+		[self setNeedsDisplayInRect:dirtyRect];
+		
+		return;
+	}
+	
+	CGFloat tileHeight = [self _tileHeight];
+	
+	// one row of tiles ahead in each direction
+	CGRect displayRect = CGRectInset(_visibleRect, 0, -tileHeight);
+	CGRect displayedDirtyRect = CGRectIntersection(dirtyRect, displayRect);
+	
+	if (!CGRectIsNull(displayedDirtyRect))
+	{
+		[self setNeedsDisplayInRect:displayedDirtyRect];
+	}
+	
+	if (CGRectContainsRect(displayRect, dirtyRect))
+	{
+		return;
+	}
+	
+	if (!_staleTileRows)
+	{
+		_staleTileRows = [[NSMutableIndexSet alloc] init];
+	}
+	
+	[_staleTileRows addIndexesInRange:[self _tileRowsInRect:dirtyRect]];
+	
+	if (!CGRectIsNull(displayedDirtyRect))
+	{
+		[_staleTileRows removeIndexesInRange:[self _tileRowsInRect:displayedDirtyRect]];
+	}
+}
+
+- (void)_redrawStaleTilesNearRect:(CGRect)rect
+{
+	if (![_staleTileRows count])
+	{
+		return;
+	}
+	
+	CGFloat tileHeight = [self _tileHeight];
+	CGFloat width = self.bounds.size.width;
+	
+	NSRange rows = [self _tileRowsInRect:CGRectInset(rect, 0, -tileHeight)];
+	
+	[_staleTileRows enumerateRangesInRange:rows options:0 usingBlock:^(NSRange range, BOOL *stop) {
+		
+		CGRect staleRect = CGRectMake(0, range.location * tileHeight, width, range.length * tileHeight);
+		[self setNeedsDisplayInRect:staleRect];
+	}];
+	
+	[_staleTileRows removeIndexesInRange:rows];
+}
+
+// called on background threads by the tiled layer
+- (void)drawLayer:(CALayer *)layer inContext:(CGContextRef)ctx
+{
+	DTRichTextEditorMetrics *metrics = _metrics;
+	uint64_t token = [metrics beginInterval:DTRichTextEditorMetricsIntervalTileDrawing];
+
+	[super drawLayer:layer inContext:ctx];
+
+	if (token)
+	{
+		// 4 bytes per pixel of the tile
+		CGRect deviceRect = CGContextConvertRectToDeviceSpace(ctx, CGContextGetClipBoundingBox(ctx));
+		[metrics recordRedrawnBytes:(unsigned long long)(fabs(deviceRect.size.width) * fabs(deviceRect.size.height)) * 4];
+	}
+
+	[metrics endInterval:DTRichTextEditorMetricsIntervalTileDrawing token:token];
+}
+
+#pragma mark - Magnification
+
+- (void)beginMagnifying
+{
+	if (_magnifying)
+	{
+		return;
+	}
+	
+	_magnifying = YES;
+	
+	if (_paragraphRasterCache)
+	{
+		// already drawing from bitmaps
+		return;
+	}
+	
+	_magnificationRasterCache = [[DTParagraphRasterCache alloc] initWithMemoryBudget:DTMagnificationRasterMemoryBudget];
+	[(DTMutableCoreTextLayoutFrame *)_layoutFrame setParagraphRasterCache:_magnificationRasterCache];
+}
+
+- (void)endMagnifying
+{
+	if (!_magnifying)
+	{
+		return;
+	}
+	
+	_magnifying = NO;
+	
+	if (!_magnificationRasterCache)
+	{
+		return;
+	}
+	
+	_magnificationRasterCache = nil;
+	[(DTMutableCoreTextLayoutFrame *)_layoutFrame setParagraphRasterCache:_paragraphRasterCache];
+}
+
+#pragma mark - Releasing Memory
+
+- (void)discardCachedLayoutAndRendering
+{
+	[_paragraphRasterCache removeAllImages];
+	[_magnificationRasterCache removeAllImages];
+	
+	[self _removeAllTextCaches];
+	
+	if ([_layoutFrame isKindOfClass:[DTMutableCoreTextLayoutFrame class]])
+	{
+		[(DTMutableCoreTextLayoutFrame *)_layoutFrame discardLines];
+	}
+}
+
+#pragma mark - Notifications
+
+- (void)layoutFrameDidChangeHeight:(NSNotification *)notification
+{
+	// estimated paragraphs got laid out, the scroll view picks up the new size from the notification
+	[self _sendFinishLayoutNotification];
+}
+
+- (void)imageAttachmentDidDecodeImage:(NSNotification *)notification
+{
+	DTTextAttachment *attachment = [notification object];
+	
+	// attachments outside of the visible area get the decoded image when their tiles are drawn
+	CGRect visibleRect = CGRectIsEmpty(_visibleRect) ? self.bounds : CGRectInset(_visibleRect, 0, -[self _tileHeight]);
+	
+	for (DTCoreTextLayoutLine *line in [self.layoutFrame linesVisibleInRect:visibleRect])
+	{
+		for (DTCoreTextGlyphRun *run in line.glyphRuns)
+		{
+			if (run.attachment == attachment)
+			{
+				[self setNeedsDisplayInRect:run.frame];
+			}
+		}
+	}
+}
+
+#pragma mark - Properties
+
+- (void)setShouldLayoutLazily:(BOOL)shouldLayoutLazily
+{
+	if (_shouldLayoutLazily == shouldLayoutLazily)
+	{
+		return;
+	}
+	
+	_shouldLayoutLazily = shouldLayoutLazily;
+	
+	if (_layoutFrame)
+	{
+		[(DTMutableCoreTextLayoutFrame *)_layoutFrame setShouldLayoutLazily:shouldLayoutLazily];
+		
+		[self relayoutText];
+	}
+}
+
+- (void)setShouldLayoutAsynchronously:(BOOL)shouldLayoutAsynchronously
+{
+	_shouldLayoutAsynchronously = shouldLayoutAsynchronously;
+	
+	[(DTMutableCoreTextLayoutFrame *)_layoutFrame setShouldLayoutAsynchronously:shouldLayoutAsynchronously];
+}
+
+- (void)setShouldRasterizeParagraphs:(BOOL)shouldRasterizeParagraphs
+{
+	if (_shouldRasterizeParagraphs == shouldRasterizeParagraphs)
+	{
+		return;
+	}
+	
+	_shouldRasterizeParagraphs = shouldRasterizeParagraphs;
+	
+	if (shouldRasterizeParagraphs)
+	{
+		_paragraphRasterCache = [[DTParagraphRasterCache alloc] initWithMemoryBudget:self.rasterizedParagraphsMemoryBudget];
+	}
+	else
+	{
+		_paragraphRasterCache = nil;
+	}
+	
+	// the loupe uses the new cache too
+	_magnificationRasterCache = nil;
+	
+	if (_magnifying && !_paragraphRasterCache)
+	{
+		_magnificationRasterCache = [[DTParagraphRasterCache alloc] initWithMemoryBudget:DTMagnificationRasterMemoryBudget];
+	}
+	
+	[(DTMutableCoreTextLayoutFrame *)_layoutFrame setParagraphRasterCache:_paragraphRasterCache ? _paragraphRasterCache : _magnificationRasterCache];
+	
+	[self setNeedsDisplay];
+}
+
+- (NSUInteger)rasterizedParagraphsMemoryBudget
+{
+	if (!_rasterizedParagraphsMemoryBudget)
+	{
+		return DTRasterizedParagraphsDefaultMemoryBudget;
+	}
+	
+	return _rasterizedParagraphsMemoryBudget;
+}
+
+- (void)setRasterizedParagraphsMemoryBudget:(NSUInteger)rasterizedParagraphsMemoryBudget
+{
+	_rasterizedParagraphsMemoryBudget = rasterizedParagraphsMemoryBudget;
+	
+	_paragraphRasterCache.memoryBudget = self.rasterizedParagraphsMemoryBudget;
+}
+
+- (DTHTMLFragmentCache *)HTMLFragmentCache
+{
+	if (!_HTMLFragmentCache)
+	{
+		_HTMLFragmentCache = [[DTHTMLFragmentCache alloc] init];
+		_HTMLFragmentCache.metrics = _metrics;
+	}
+	
+	return _HTMLFragmentCache;
+}
+
+- (DTWordBoundaryCache *)wordBoundaryCache
+{
+	if (!_wordBoundaryCache)
+	{
+		_wordBoundaryCache = [[DTWordBoundaryCache alloc] init];
+		_wordBoundaryCache.metrics = _metrics;
+	}
+	
+	return _wordBoundaryCache;
+}
+
+- (void)setMetrics:(DTRichTextEditorMetrics *)metrics
+{
+	_metrics = metrics;
+	
+	[(DTMutableCoreTextLayoutFrame *)_layoutFrame setMetrics:metrics];
+	_HTMLFragmentCache.metrics = metrics;
+	_wordBoundaryCache.metrics = metrics;
+}
+
+@synthesize shouldLayoutLazily = _shouldLayoutLazily;
+@synthesize shouldLayoutAsynchronously = _shouldLayoutAsynchronously;
+@synthesize shouldRasterizeParagraphs = _shouldRasterizeParagraphs;
+@synthesize rasterizedParagraphsMemoryBudget = _rasterizedParagraphsMemoryBudget;
+@synthesize magnifying = _magnifying;
+@synthesize searchIndex = _searchIndex;
+@synthesize dictationPlaceholderLocation = _dictationPlaceholderLocation;
+@synthesize metrics = _metrics;
+
 @end
@@ -0,0 +1,201 @@
+//
+//  DTRichTextEditorMetrics.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ The stages of the editor that are measured as intervals
+ */
+typedef NS_ENUM(NSUInteger, DTRichTextEditorMetricsInterval)
+{
+	/**
+	 Replacing text in the editor view, from the undo registration to the renumbering of lists
+	 */
+	DTRichTextEditorMetricsIntervalReplaceText = 0,
+
+	/**
+	 Typesetting the modified paragraphs in the layout frame
+	 */
+	DTRichTextEditorMetricsIntervalTypesetting,
+
+	/**
+	 Moving the lines after the modified paragraphs and updating the cached geometry
+	 */
+	DTRichTextEditorMetricsIntervalLineShifting,
+
+	/**
+	 Updating the prefixes and numbering of lists
+	 */
+	DTRichTextEditorMetricsIntervalListUpdate,
+
+	/**
+	 Updating the cursor or the selection rectangles
+	 */
+	DTRichTextEditorMetricsIntervalCursorUpdate,
+
+	/**
+	 Drawing a tile of the content view, usually on a background thread
+	 */
+	DTRichTextEditorMetricsIntervalTileDrawing,
+
+	/**
+	 Creating the attributed text from HTML
+	 */
+	DTRichTextEditorMetricsIntervalHTMLImport,
+
+	/**
+	 Creating HTML from the attributed text
+	 */
+	DTRichTextEditorMetricsIntervalHTMLExport
+};
+
+/**
+ The caches whose hit rate is counted
+ */
+typedef NS_ENUM(NSUInteger, DTRichTextEditorMetricsCache)
+{
+	/**
+	 The HTML of the paragraphs in <DTHTMLFragmentCache>
+	 */
+	DTRichTextEditorMetricsCacheHTMLFragments = 0,
+
+	/**
+	 The word ranges of the paragraphs in <DTWordBoundaryCache>
+	 */
+	DTRichTextEditorMetricsCacheWordBoundaries,
+
+	/**
+	 The rasterized paragraphs in <DTParagraphRasterCache>
+	 */
+	DTRichTextEditorMetricsCacheParagraphRasters
+};
+
+/**
+ Optional instrumentation of the editor. Every <DTRichTextEditorView> has one, it is shared with its content view, layout frame and caches.
+
+ While <enabled> the main stages of the editor emit `os_signpost` intervals that show up in Instruments, and the metrics aggregate counters that can be sent to telemetry: the number of lines that were laid out again, the number of bytes drawn into tiles, the hit rates of the caches and a histogram of the latency of keystrokes. Signposts are only emitted on iOS 12 and later, the counters are available on all versions. If not enabled, which is the default, the methods for recording return right away.
+
+ All methods can be called from any thread.
+ */
+@interface DTRichTextEditorMetrics : NSObject
+
+/**
+ @name Enabling Metrics
+ */
+
+/**
+ Whether the receiver emits signposts and aggregates counters. Defaults to `NO`.
+ */
+@property (nonatomic, assign, getter=isEnabled) BOOL enabled;
+
+/**
+ The minimum time between two `editorView:didUpdateMetrics:` messages to the delegate of the editor. Defaults to 10 seconds.
+ */
+@property (nonatomic, assign) NSTimeInterval reportingInterval;
+
+/**
+ @name Recording Metrics
+ */
+
+/**
+ Begins measuring an interval of the editor and emits the beginning of a signpost interval.
+ @param interval The stage that begins
+ @returns The token to pass to <endInterval:token:>, 0 if the receiver is not enabled
+ */
+- (uint64_t)beginInterval:(DTRichTextEditorMetricsInterval)interval;
+
+/**
+ Ends measuring an interval, the duration is added to the total of the stage.
+ @param interval The stage that ends
+ @param token The token returned by <beginInterval:>, nothing is recorded for 0
+ */
+- (void)endInterval:(DTRichTextEditorMetricsInterval)interval token:(uint64_t)token;
+
+/**
+ Adds lines that were laid out again after a modification.
+ @param numberOfLines The number of new lines
+ */
+- (void)recordRelaidOutLines:(NSUInteger)numberOfLines;
+
+/**
+ Adds bytes that were drawn into tiles.
+ @param numberOfBytes The size of the drawn area in bytes
+ */
+- (void)recordRedrawnBytes:(unsigned long long)numberOfBytes;
+
+/**
+ Counts a lookup in one of the caches of the editor.
+ @param cache The cache that was asked
+ @param hit `YES` if the cache had the value
+ */
+- (void)recordLookupInCache:(DTRichTextEditorMetricsCache)cache hit:(BOOL)hit;
+
+/**
+ Adds the time from a keystroke until the cursor was updated to the latency histogram.
+ @param latency The latency in seconds
+ */
+- (void)recordKeystrokeLatency:(NSTimeInterval)latency;
+
+/**
+ @name Getting Metrics
+ */
+
+/**
+ The number of lines that were laid out again since the last reset
+ */
+@property (nonatomic, readonly) NSUInteger numberOfRelaidOutLines;
+
+/**
+ The number of bytes drawn into tiles since the last reset
+ */
+@property (nonatomic, readonly) unsigned long long numberOfRedrawnBytes;
+
+/**
+ The number of measured intervals of a stage
+ @param interval The stage
+ @returns The number of intervals since the last reset
+ */
+- (NSUInteger)numberOfIntervals:(DTRichTextEditorMetricsInterval)interval;
+
+/**
+ The total time spent in a stage
+ @param interval The stage
+ @returns The sum of the durations of the intervals since the last reset, in seconds
+ */
+- (NSTimeInterval)totalDurationOfInterval:(DTRichTextEditorMetricsInterval)interval;
+
+/**
+ The share of lookups in a cache that found a value
+ @param cache The cache
+ @returns The hit rate between 0 and 1, 0 if there were no lookups since the last reset
+ */
+- (double)hitRateOfCache:(DTRichTextEditorMetricsCache)cache;
+
+/**
+ The number of keystrokes per latency bucket since the last reset, the buckets are bounded by <keystrokeLatencyBucketBounds>
+ */
+@property (nonatomic, readonly) NSArray *keystrokeLatencyHistogram;
+
+/**
+ The upper bounds of the buckets of <keystrokeLatencyHistogram> in seconds. The last bucket has no upper bound and counts all slower keystrokes.
+ @returns An array of `NSNumber` with one element less than the histogram has buckets
+ */
++ (NSArray *)keystrokeLatencyBucketBounds;
+
+/**
+ All metrics in a form that can be serialized as JSON or property list, for sending them to telemetry
+ @returns A dictionary with the counters, the count and total duration of each interval, the hit rate of each cache and the latency histogram
+ */
+- (NSDictionary *)dictionaryRepresentation;
+
+/**
+ Sets all counters back to zero, for example after they were sent to telemetry
+ */
+- (void)reset;
+
+@end
@@ -0,0 +1,388 @@
+//
+//  DTRichTextEditorMetrics.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTRichTextEditorMetrics.h"
+
+#import <mach/mach_time.h>
+
+// signposts need the iOS 12 SDK, older SDKs only get the counters
+#if __has_include(<os/signpost.h>)
+#import <os/signpost.h>
+#define DT_USE_SIGNPOSTS 1
+#else
+#define DT_USE_SIGNPOSTS 0
+#endif
+
+#define DTRichTextEditorMetricsNumberOfIntervals 8
+#define DTRichTextEditorMetricsNumberOfCaches 3
+
+// one more bucket than there are bounds, for everything slower
+#define DTRichTextEditorMetricsNumberOfLatencyBucketBounds 6
+
+static const NSTimeInterval DTRichTextEditorMetricsLatencyBucketBounds[DTRichTextEditorMetricsNumberOfLatencyBucketBounds] = {0.004, 0.008, 0.016, 0.033, 0.05, 0.1};
+
+// keys for the dictionary representation, in the order of the enums
+static NSString * const DTRichTextEditorMetricsIntervalNames[DTRichTextEditorMetricsNumberOfIntervals] = {@"ReplaceText", @"Typesetting", @"LineShifting", @"ListUpdate", @"CursorUpdate", @"TileDrawing", @"HTMLImport", @"HTMLExport"};
+static NSString * const DTRichTextEditorMetricsCacheNames[DTRichTextEditorMetricsNumberOfCaches] = {@"HTMLFragments", @"WordBoundaries", @"ParagraphRasters"};
+
+// converts mach absolute time to seconds
+static NSTimeInterval _DTSecondsFromMachTime(uint64_t machTime)
+{
+	static mach_timebase_info_data_t timebase;
+	static dispatch_once_t onceToken;
+
+	dispatch_once(&onceToken, ^{
+		mach_timebase_info(&timebase);
+	});
+
+	return (NSTimeInterval)machTime * timebase.numer / timebase.denom / NSEC_PER_SEC;
+}
+
+#if DT_USE_SIGNPOSTS
+
+// the signpost name has to be a string literal
+#define DTSignpostInterval(log, identifier, begin, name) if (begin) { os_signpost_interval_begin(log, identifier, name); } else { os_signpost_interval_end(log, identifier, name); }
+
+static void _DTEmitSignpost(DTRichTextEditorMetricsInterval interval, uint64_t identifier, BOOL begin) API_AVAILABLE(ios(12.0))
+{
+	static os_log_t log;
+	static dispatch_once_t onceToken;
+
+	dispatch_once(&onceToken, ^{
+		log = os_log_create("com.cocoanetics.DTRichTextEditor", "Editing");
+	});
+
+	if (!os_signpost_enabled(log))
+	{
+		return;
+	}
+
+	switch (interval)
+	{
+		case DTRichTextEditorMetricsIntervalReplaceText:
+		{
+			DTSignpostInterval(log, identifier, begin, "Replace Text");
+			break;
+		}
+
+		case DTRichTextEditorMetricsIntervalTypesetting:
+		{
+			DTSignpostInterval(log, identifier, begin, "Typesetting");
+			break;
+		}
+
+		case DTRichTextEditorMetricsIntervalLineShifting:
+		{
+			DTSignpostInterval(log, identifier, begin, "Line Shifting");
+			break;
+		}
+
+		case DTRichTextEditorMetricsIntervalListUpdate:
+		{
+			DTSignpostInterval(log, identifier, begin, "List Update");
+			break;
+		}
+
+		case DTRichTextEditorMetricsIntervalCursorUpdate:
+		{
+			DTSignpostInterval(log, identifier, begin, "Cursor Update");
+			break;
+		}
+
+		case DTRichTextEditorMetricsIntervalTileDrawing:
+		{
+			DTSignpostInterval(log, identifier, begin, "Tile Drawing");
+			break;
+		}
+
+		case DTRichTextEditorMetricsIntervalHTMLImport:
+		{
+			DTSignpostInterval(log, identifier, begin, "HTML Import");
+			break;
+		}
+
+		case DTRichTextEditorMetricsIntervalHTMLExport:
+		{
+			DTSignpostInterval(log, identifier, begin, "HTML Export");
+			break;
+		}
+	}
+}
+
+#endif
+
+
+@implementation DTRichTextEditorMetrics
+{
+	BOOL _enabled;
+	NSTimeInterval _reportingInterval;
+
+	NSUInteger _numberOfRelaidOutLines;
+	unsigned long long _numberOfRedrawnBytes;
+
+	NSUInteger _intervalCounts[DTRichTextEditorMetricsNumberOfIntervals];
+	uint64_t _intervalMachTimes[DTRichTextEditorMetricsNumberOfIntervals];
+
+	NSUInteger _cacheHits[DTRichTextEditorMetricsNumberOfCaches];
+	NSUInteger _cacheLookups[DTRichTextEditorMetricsNumberOfCaches];
+
+	NSUInteger _latencyBuckets[DTRichTextEditorMetricsNumberOfLatencyBucketBounds + 1];
+}
+
++ (NSArray *)keystrokeLatencyBucketBounds
+{
+	NSMutableArray *bounds = [NSMutableArray arrayWithCapacity:DTRichTextEditorMetricsNumberOfLatencyBucketBounds];
+
+	for (NSUInteger i=0; i<DTRichTextEditorMetricsNumberOfLatencyBucketBounds; i++)
+	{
+		[bounds addObject:[NSNumber numberWithDouble:DTRichTextEditorMetricsLatencyBucketBounds[i]]];
+	}
+
+	return bounds;
+}
+
+- (id)init
+{
+	self = [super init];
+
+	if (self)
+	{
+		_reportingInterval = 10.0;
+	}
+
+	return self;
+}
+
+#pragma mark - Recording Metrics
+
+- (uint64_t)beginInterval:(DTRichTextEditorMetricsInterval)interval
+{
+	NSParameterAssert(interval < DTRichTextEditorMetricsNumberOfIntervals);
+
+	if (!_enabled)
+	{
+		return 0;
+	}
+
+	// the start time doubles as signpost identifier, it is never 0
+	uint64_t token = mach_absolute_time();
+
+#if DT_USE_SIGNPOSTS
+	if (@available(iOS 12.0, *))
+	{
+		_DTEmitSignpost(interval, token, YES);
+	}
+#endif
+
+	return token;
+}
+
+- (void)endInterval:(DTRichTextEditorMetricsInterval)interval token:(uint64_t)token
+{
+	NSParameterAssert(interval < DTRichTextEditorMetricsNumberOfIntervals);
+
+	if (!token)
+	{
+		// began while not enabled
+		return;
+	}
+
+	uint64_t duration = mach_absolute_time() - token;
+
+#if DT_USE_SIGNPOSTS
+	if (@available(iOS 12.0, *))
+	{
+		_DTEmitSignpost(interval, token, NO);
+	}
+#endif
+
+	@synchronized(self)
+	{
+		_intervalCounts[interval]++;
+		_intervalMachTimes[interval] += duration;
+	}
+}
+
+- (void)recordRelaidOutLines:(NSUInteger)numberOfLines
+{
+	if (!_enabled)
+	{
+		return;
+	}
+
+	@synchronized(self)
+	{
+		_numberOfRelaidOutLines += numberOfLines;
+	}
+}
+
+- (void)recordRedrawnBytes:(unsigned long long)numberOfBytes
+{
+	if (!_enabled)
+	{
+		return;
+	}
+
+	@synchronized(self)
+	{
+		_numberOfRedrawnBytes += numberOfBytes;
+	}
+}
+
+- (void)recordLookupInCache:(DTRichTextEditorMetricsCache)cache hit:(BOOL)hit
+{
+	NSParameterAssert(cache < DTRichTextEditorMetricsNumberOfCaches);
+
+	if (!_enabled)
+	{
+		return;
+	}
+
+	@synchronized(self)
+	{
+		_cacheLookups[cache]++;
+
+		if (hit)
+		{
+			_cacheHits[cache]++;
+		}
+	}
+}
+
+- (void)recordKeystrokeLatency:(NSTimeInterval)latency
+{
+	if (!_enabled)
+	{
+		return;
+	}
+
+	NSUInteger bucket = 0;
+
+	while (bucket < DTRichTextEditorMetricsNumberOfLatencyBucketBounds && latency >= DTRichTextEditorMetricsLatencyBucketBounds[bucket])
+	{
+		bucket++;
+	}
+
+	@synchronized(self)
+	{
+		_latencyBuckets[bucket]++;
+	}
+}
+
+#pragma mark - Getting Metrics
+
+- (NSUInteger)numberOfRelaidOutLines
+{
+	@synchronized(self)
+	{
+		return _numberOfRelaidOutLines;
+	}
+}
+
+- (unsigned long long)numberOfRedrawnBytes
+{
+	@synchronized(self)
+	{
+		return _numberOfRedrawnBytes;
+	}
+}
+
+- (NSUInteger)numberOfIntervals:(DTRichTextEditorMetricsInterval)interval
+{
+	NSParameterAssert(interval < DTRichTextEditorMetricsNumberOfIntervals);
+
+	@synchronized(self)
+	{
+		return _intervalCounts[interval];
+	}
+}
+
+- (NSTimeInterval)totalDurationOfInterval:(DTRichTextEditorMetricsInterval)interval
+{
+	NSParameterAssert(interval < DTRichTextEditorMetricsNumberOfIntervals);
+
+	@synchronized(self)
+	{
+		return _DTSecondsFromMachTime(_intervalMachTimes[interval]);
+	}
+}
+
+- (double)hitRateOfCache:(DTRichTextEditorMetricsCache)cache
+{
+	NSParameterAssert(cache < DTRichTextEditorMetricsNumberOfCaches);
+
+	@synchronized(self)
+	{
+		if (!_cacheLookups[cache])
+		{
+			return 0;
+		}
+
+		return (double)_cacheHits[cache] / (double)_cacheLookups[cache];
+	}
+}
+
+- (NSArray *)keystrokeLatencyHistogram
+{
+	NSMutableArray *histogram = [NSMutableArray arrayWithCapacity:DTRichTextEditorMetricsNumberOfLatencyBucketBounds + 1];
+
+	@synchronized(self)
+	{
+		for (NSUInteger i=0; i<=DTRichTextEditorMetricsNumberOfLatencyBucketBounds; i++)
+		{
+			[histogram addObject:[NSNumber numberWithUnsignedInteger:_latencyBuckets[i]]];
+		}
+	}
+
+	return histogram;
+}
+
+- (NSDictionary *)dictionaryRepresentation
+{
+	NSMutableDictionary *intervals = [NSMutableDictionary dictionary];
+
+	for (NSUInteger i=0; i<DTRichTextEditorMetricsNumberOfIntervals; i++)
+	{
+		NSDictionary *interval = @{@"Count": [NSNumber numberWithUnsignedInteger:[self numberOfIntervals:i]], @"TotalDuration": [NSNumber numberWithDouble:[self totalDurationOfInterval:i]]};
+		[intervals setObject:interval forKey:DTRichTextEditorMetricsIntervalNames[i]];
+	}
+
+	NSMutableDictionary *cacheHitRates = [NSMutableDictionary dictionary];
+
+	for (NSUInteger i=0; i<DTRichTextEditorMetricsNumberOfCaches; i++)
+	{
+		[cacheHitRates setObject:[NSNumber numberWithDouble:[self hitRateOfCache:i]] forKey:DTRichTextEditorMetricsCacheNames[i]];
+	}
+
+	return @{@"RelaidOutLines": [NSNumber numberWithUnsignedInteger:self.numberOfRelaidOutLines],
+			 @"RedrawnBytes": [NSNumber numberWithUnsignedLongLong:self.numberOfRedrawnBytes],
+			 @"Intervals": intervals,
+			 @"CacheHitRates": cacheHitRates,
+			 @"KeystrokeLatencyHistogram": self.keystrokeLatencyHistogram,
+			 @"KeystrokeLatencyBucketBounds": [[self class] keystrokeLatencyBucketBounds]};
+}
+
+- (void)reset
+{
+	@synchronized(self)
+	{
+		_numberOfRelaidOutLines = 0;
+		_numberOfRedrawnBytes = 0;
+
+		memset(_intervalCounts, 0, sizeof(_intervalCounts));
+		memset(_intervalMachTimes, 0, sizeof(_intervalMachTimes));
+		memset(_cacheHits, 0, sizeof(_cacheHits));
+		memset(_cacheLookups, 0, sizeof(_cacheLookups));
+		memset(_latencyBuckets, 0, sizeof(_latencyBuckets));
+	}
+}
+
+@synthesize enabled = _enabled;
+@synthesize reportingInterval = _reportingInterval;
+
+@end
@@ -12,6 +12,7 @@
 
 #import "DTTextPosition.h"
 #import "DTTextRange.h"
+#import "DTRichTextEditorContentView.h"
 
 @implementation DTRichTextEditorView (Attributes)
 
@@ -39,6 +40,7 @@
 	NSRange nsRange = [(DTTextRange *)range NSRangeValue];
 	
 	[(NSMutableAttributedString *)self.attributedTextContentView.layoutFrame.attributedStringFragment addHTMLAttribute:name value:value range:nsRange replaceExisting:replaceExisting];
+	[(DTRichTextEditorContentView *)self.attributedTextContentView attributesDidChangeInRange:nsRange];
 }
 
 - (void)removeHTMLAttribute:(NSString *)name range:(UITextRange *)range
@@ -46,6 +48,7 @@
 	NSRange nsRange = [(DTTextRange *)range NSRangeValue];
 	
 	[(NSMutableAttributedString *)self.attributedTextContentView.layoutFrame.attributedStringFragment removeHTMLAttribute:name range:nsRange];
+	[(DTRichTextEditorContentView *)self.attributedTextContentView attributesDidChangeInRange:nsRange];
 }
 
 @end
@@ -70,6 +70,10 @@
     // replace the selected text with the placeholder
     [self replaceRange:range withAttachment:attachment inParagraph:NO];
     
+    // the content view moves the location along with all following modifications
+    DTRichTextEditorContentView *contentView = (DTRichTextEditorContentView *)self.attributedTextContentView;
+    contentView.dictationPlaceholderLocation = [(DTTextRange *)range NSRangeValue].location;
+    
     [self.undoManager enableUndoRegistration];
     
     // this hides the selection until replaceRange:withText: inserts the result
@@ -107,9 +111,25 @@
 
 - (UITextRange *)textRangeOfDictationPlaceholder
 {
+    DTRichTextEditorContentView *contentView = (DTRichTextEditorContentView *)self.attributedTextContentView;
+    NSAttributedString *attributedText = self.attributedText;
+    NSUInteger location = contentView.dictationPlaceholderLocation;
+    
+    // the placeholder is usually still where the content view says it is
+    if (location != NSNotFound && location < [attributedText length])
+    {
+        id attachment = [attributedText attribute:NSAttachmentAttributeName atIndex:location effectiveRange:NULL];
+        
+        if ([attachment isKindOfClass:[DTDictationPlaceholderTextAttachment class]])
+        {
+            return [DTTextRange rangeWithNSRange:NSMakeRange(location, 1)];
+        }
+    }
+    
+    // a modification replaced the placeholder or moved it in an unforeseen way
     __block NSRange foundRange = NSMakeRange(0, 0);
     
-    [self.attributedText enumerateAttribute:NSAttachmentAttributeName inRange:NSMakeRange(0, [self.attributedText length]) options:0 usingBlock:^(DTTextAttachment *value, NSRange range, BOOL *stop) {
+    [attributedText enumerateAttribute:NSAttachmentAttributeName inRange:NSMakeRange(0, [attributedText length]) options:0 usingBlock:^(DTTextAttachment *value, NSRange range, BOOL *stop) {
         if ([value isKindOfClass:[DTDictationPlaceholderTextAttachment class]])
         {
             foundRange = range;
@@ -119,9 +139,12 @@
     
     if (!foundRange.length)
     {
+        contentView.dictationPlaceholderLocation = NSNotFound;
+        
         return nil;
     }
     
+    contentView.dictationPlaceholderLocation = foundRange.location;
     
     return [DTTextRange rangeWithNSRange:foundRange];
 }
@@ -8,6 +8,7 @@
 
 #import "DTRichTextEditor.h"
 #import "NSAttributedString+DTRichText.h"
+#import "DTMutableCoreTextLayoutFrame.h"
 
 #import <DTCoreText/DTCoreText.h>
 
@@ -22,6 +23,9 @@
 - (void)_inputDelegateTextWillChange;
 - (void)_inputDelegateTextDidChange;
 
+- (BOOL)_isDeferringEditUpdates;
+- (void)_setSelectedRange:(NSRange)range animated:(BOOL)animated;
+
 @property (nonatomic, retain) NSDictionary *overrideInsertionAttributes;
 @property (nonatomic, assign) BOOL userIsTyping;  // while user is typing there are no selection range updates to input delegate
 @property (nonatomic, assign) BOOL keepCurrentUndoGroup; // avoid closing of Undo Group for sub operations
@@ -63,7 +67,7 @@
 	
 	// get the full paragraph range of our selection
 	NSRange selectionRange = [(DTTextRange *)range NSRangeValue];
-	NSRange paragraphRange = [attributedText.string rangeOfParagraphsContainingRange:selectionRange parBegIndex:NULL parEndIndex:NULL];
+	NSRange paragraphRange = [(DTMutableCoreTextLayoutFrame *)self.attributedTextContentView.layoutFrame rangeOfParagraphsContainingRange:selectionRange parBegIndex:NULL parEndIndex:NULL];
 	
 	// check if there is a list at this index
 	NSUInteger index = [(DTTextPosition *)[range start] location];
@@ -213,7 +217,7 @@
 	[self.undoManager setActionName:NSLocalizedString(@"Toggle List", @"Action that toggles on or off a list")];
 	
 	// restore selection
-	self.selectedTextRange = [DTTextRange rangeWithNSRange:rangeToSelectAfterwards];
+	[self _setSelectedRange:rangeToSelectAfterwards animated:NO];
 	
 	// attachment positions might have changed
 	[self.attributedTextContentView layoutSubviewsInRect:self.bounds];
@@ -236,7 +240,7 @@
 	
 	NSRange selectionRange = [(DTTextRange *)range NSRangeValue];
 	NSAttributedString *attributedText = self.attributedText;
-	NSRange selectedParagraphRange = [attributedText.string rangeOfParagraphsContainingRange:selectionRange parBegIndex:NULL parEndIndex:NULL];
+	NSRange selectedParagraphRange = [(DTMutableCoreTextLayoutFrame *)self.attributedTextContentView.layoutFrame rangeOfParagraphsContainingRange:selectionRange parBegIndex:NULL parEndIndex:NULL];
 	
 	NSDictionary *attributes = [attributedText attributesAtIndex:selectedParagraphRange.location effectiveRange:NULL];
 	DTCSSListStyle *effectiveList = [[attributes objectForKey:DTTextListsAttribute] lastObject];
@@ -283,7 +287,10 @@
 		}
 	}
 	
-	NSRange totalRange = NSUnionRange(listRange, selectionRange);
+	// only the selected paragraphs are replaced, following items are renumbered by updateListsInRange: when the paragraph count changes
+	NSRange totalRange = selectedParagraphRange;
+	NSInteger itemNumber = effectiveList.startingItemNumber + [self _numberOfParagraphsInRange:NSMakeRange(listRange.location, totalRange.location - listRange.location) ofString:attributedText.string];
+	BOOL totalRangeIncludesEndOfList = (NSMaxRange(totalRange) >= NSMaxRange(listRange));
 	
 	// get a mutable substring for the total range
 	NSMutableAttributedString *mutableText = [[attributedText attributedSubstringFromRange:totalRange] mutableCopy];
@@ -292,11 +299,11 @@
 	NSRange partSelectionRange = selectionRange;
 	partSelectionRange.location -= totalRange.location;
 	
-	// mark the selection on first character after selection
-	[mutableText addMarkersForSelectionRange:NSMakeRange(NSMaxRange(partSelectionRange), 0)];
-	
 	[mutableText replaceCharactersInRange:partSelectionRange withAttributedString:newlineText];
 	
+	// mark the selection on first character after the inserted text, after the replacement so that the marker position stays known
+	[mutableText addMarkersForSelectionRange:NSMakeRange(partSelectionRange.location + [newlineText length], 0)];
+	
 	NSRange mutableRange = NSMakeRange(0, mutableText.length);
 	
     // get font size at beginning of last paragraph of list
@@ -304,11 +311,16 @@
     CTFontRef font = (__bridge CTFontRef)([mutableText attribute:(id)kCTFontAttributeName atIndex:lastParagraph.location effectiveRange:NULL]);
     CGFloat fontSize = CTFontGetSize(font) * self.textSizeMultiplier;
     
-    // get the paragraph spacing after the list
-    CGFloat paragraphSpacing = [self _paragraphSpacingAfterListOfStyle:effectiveList relativeToTextSize:fontSize];
+    // get the paragraph spacing after the list, only the last item has it
+    CGFloat paragraphSpacing = 0;
+	
+	if (totalRangeIncludesEndOfList)
+	{
+		paragraphSpacing = [self _paragraphSpacingAfterListOfStyle:effectiveList relativeToTextSize:fontSize];
+	}
     
-	// now update the entire list
-	[mutableText updateListStyle:effectiveList inRange:mutableRange numberFrom:effectiveList.startingItemNumber listIndent:[self listIndentForListStyle:effectiveList] spacingAfterList:paragraphSpacing  removeNonPrefixedParagraphsFromList:NO];
+	// now update the modified items
+	[mutableText updateListStyle:effectiveList inRange:mutableRange numberFrom:itemNumber listIndent:[self listIndentForListStyle:effectiveList] spacingAfterList:paragraphSpacing  removeNonPrefixedParagraphsFromList:NO];
 	
 	NSRange rangeToSelectAfterwards = [mutableText markedRangeRemove:YES];
 	rangeToSelectAfterwards.location += totalRange.location;
@@ -324,7 +336,7 @@
 	self.overrideInsertionAttributes = typingAttributes;
 	
 	// restore selection
-	self.selectedTextRange = [DTTextRange rangeWithNSRange:rangeToSelectAfterwards];
+	[self _setSelectedRange:rangeToSelectAfterwards animated:NO];
 	  
 	self.userIsTyping = NO;
 	  
@@ -380,11 +392,15 @@
 }
 
 - (NSRange)_findList:(DTCSSListStyle *)list inAttributedString:(NSAttributedString *)attributedString
+{
+	return [self _findList:list inAttributedString:attributedString range:NSMakeRange(0, [attributedString length])];
+}
+
+- (NSRange)_findList:(DTCSSListStyle *)list inAttributedString:(NSAttributedString *)attributedString range:(NSRange)searchRange
 {
 	__block NSRange foundRange = NSMakeRange(NSNotFound, 0);
 	
-	NSRange entireRange = NSMakeRange(0, [attributedString length]);
-	[attributedString enumerateAttribute:DTTextListsAttribute inRange:entireRange options:0 usingBlock:^(NSArray *lists, NSRange range, BOOL *stop) {
+	[attributedString enumerateAttribute:DTTextListsAttribute inRange:searchRange options:0 usingBlock:^(NSArray *lists, NSRange range, BOOL *stop) {
 		if ([lists containsObject:list])
 		{
 			foundRange = [attributedString rangeOfTextList:list atIndex:range.location];
@@ -396,10 +412,168 @@
 }
 
 
+- (NSUInteger)_numberOfParagraphsInRange:(NSRange)range ofString:(NSString *)string
+{
+	__block NSUInteger count = 0;
+	
+	[string enumerateSubstringsInRange:range options:NSStringEnumerationByParagraphs | NSStringEnumerationSubstringNotRequired usingBlock:^(NSString *substring, NSRange substringRange, NSRange enclosingRange, BOOL *stop) {
+		count++;
+	}];
+	
+	return count;
+}
+
+// paragraph spacing of the last list item, based on the font size at the beginning of the last paragraph like updateListStyle: expects it
+- (CGFloat)_paragraphSpacingAfterList:(DTCSSListStyle *)list inRange:(NSRange)listRange ofAttributedString:(NSAttributedString *)attributedString
+{
+	NSRange lastParagraph = [[attributedString string] rangeOfParagraphAtIndex:NSMaxRange(listRange)-1];
+	CTFontRef font = (__bridge CTFontRef)([attributedString attribute:(id)kCTFontAttributeName atIndex:lastParagraph.location effectiveRange:NULL]);
+	CGFloat fontSize = CTFontGetSize(font) * self.textSizeMultiplier;
+	
+	return [self _paragraphSpacingAfterListOfStyle:list relativeToTextSize:fontSize];
+}
+
+// determines the items of a list whose prefix or formatting is outdated and their replacement texts
+- (void)_collectChangesForList:(DTCSSListStyle *)list inRange:(NSRange)listRange ofAttributedString:(NSAttributedString *)attributedText removeNonPrefixedLinesFromLists:(BOOL)removeNonPrefixed changedRanges:(NSMutableArray *)changedRanges changedTexts:(NSMutableArray *)changedTexts
+{
+	NSString *string = [attributedText string];
+	
+	CGFloat spacingAfterList = [self _paragraphSpacingAfterList:list inRange:listRange ofAttributedString:attributedText];
+	CGFloat listIndent = [self listIndentForListStyle:list];
+	
+	__block NSInteger itemNumber = list.startingItemNumber;
+	
+	// the item index of each paragraph is its position in the list
+	[string enumerateSubstringsInRange:listRange options:NSStringEnumerationByParagraphs | NSStringEnumerationSubstringNotRequired usingBlock:^(NSString *substring, NSRange substringRange, NSRange enclosingRange, BOOL *stop) {
+		
+		BOOL isLastParagraph = (NSMaxRange(enclosingRange) >= NSMaxRange(listRange));
+		CGFloat expectedSpacing = isLastParagraph ? spacingAfterList : 0;
+		
+		NSDictionary *attributes = [attributedText attributesAtIndex:enclosingRange.location effectiveRange:NULL];
+		NSRange fieldRange = [attributedText rangeOfFieldAtIndex:enclosingRange.location];
+		BOOL hasPrefix = (fieldRange.location == enclosingRange.location && [[attributes objectForKey:DTFieldAttribute] isEqualToString:DTListPrefixField]);
+		
+		if (hasPrefix && [[attributes paragraphStyle] paragraphSpacing] == expectedSpacing)
+		{
+			// formatting is fine, only the number might have changed
+			NSMutableDictionary *prefixAttributes = [attributes mutableCopy];
+			[prefixAttributes updateParagraphSpacing:expectedSpacing];
+			
+			NSAttributedString *prefix = [NSAttributedString prefixForListItemWithCounter:itemNumber listStyle:list listIndent:listIndent attributes:prefixAttributes];
+			
+			if (![[prefix string] isEqualToString:[string substringWithRange:fieldRange]])
+			{
+				NSMutableAttributedString *newPrefix = [prefix mutableCopy];
+				
+				// the existing paragraph style has the preserved indents
+				id paragraphStyle = [attributes objectForKey:(id)kCTParagraphStyleAttributeName];
+				
+				if (paragraphStyle)
+				{
+					[newPrefix addAttribute:(id)kCTParagraphStyleAttributeName value:paragraphStyle range:NSMakeRange(0, [newPrefix length])];
+				}
+				
+				[changedRanges addObject:[NSValue valueWithRange:fieldRange]];
+				[changedTexts addObject:newPrefix];
+			}
+		}
+		else
+		{
+			// prefix missing or spacing changed, the whole paragraph needs an update
+			NSMutableAttributedString *paragraphText = [[attributedText attributedSubstringFromRange:enclosingRange] mutableCopy];
+			[paragraphText updateListStyle:list inRange:NSMakeRange(0, [paragraphText length]) numberFrom:itemNumber listIndent:listIndent spacingAfterList:expectedSpacing removeNonPrefixedParagraphsFromList:removeNonPrefixed];
+			
+			[changedRanges addObject:[NSValue valueWithRange:enclosingRange]];
+			[changedTexts addObject:paragraphText];
+		}
+		
+		itemNumber++;
+	}];
+}
+
+// replaces several non-overlapping ranges, sorted by location, in a single layout pass
+- (void)_replaceListItemTextInRanges:(NSArray *)ranges withTexts:(NSArray *)texts
+{
+	NSAttributedString *attributedText = self.attributedText;
+	
+	NSMutableArray *replacedRanges = [NSMutableArray arrayWithCapacity:[ranges count]];
+	NSMutableArray *replacedTexts = [NSMutableArray arrayWithCapacity:[ranges count]];
+	
+	NSRange selectedRange = [(DTTextRange *)self.selectedTextRange NSRangeValue];
+	NSRange rangeToSelectAfterwards = selectedRange;
+	NSInteger delta = 0;
+	
+	for (NSUInteger i=0; i<[ranges count]; i++)
+	{
+		NSRange range = [[ranges objectAtIndex:i] rangeValue];
+		NSAttributedString *text = [texts objectAtIndex:i];
+		
+		// this is the range the text will have after all replacements
+		[replacedRanges addObject:[NSValue valueWithRange:NSMakeRange(range.location + delta, [text length])]];
+		[replacedTexts addObject:[attributedText attributedSubstringFromRange:range]];
+		
+		NSInteger changeInLength = (NSInteger)[text length] - (NSInteger)range.length;
+		
+		// selection moves with replacements before it
+		if (NSMaxRange(range) <= selectedRange.location)
+		{
+			rangeToSelectAfterwards.location += changeInLength;
+		}
+		else if (NSMaxRange(range) <= NSMaxRange(selectedRange))
+		{
+			rangeToSelectAfterwards.length += changeInLength;
+		}
+		
+		delta += changeInLength;
+	}
+	
+	// undo restores the previous texts in the new ranges
+	NSUndoManager *undoManager = self.undoManager;
+	[undoManager beginUndoGrouping];
+	[[undoManager prepareWithInvocationTarget:self] _replaceListItemTextInRanges:replacedRanges withTexts:replacedTexts];
+	[undoManager endUndoGrouping];
+	
+	DTRichTextEditorContentView *contentView = (DTRichTextEditorContentView *)self.attributedTextContentView;
+	
+	[self _inputDelegateTextWillChange];
+	
+	// back to front so that the ranges stay valid, the affected paragraphs are laid out together afterwards
+	for (NSInteger i=[ranges count]-1; i>=0; i--)
+	{
+		[contentView replaceTextInRange:[[ranges objectAtIndex:i] rangeValue] withTextDeferringLayout:[texts objectAtIndex:i]];
+	}
+	
+	[self _inputDelegateTextDidChange];
+	
+	if (![self _isDeferringEditUpdates])
+	{
+		// otherwise done when the edit transaction is flushed
+		[contentView layoutDeferredText];
+		
+		self.contentSize = contentView.frame.size;
+		[self setNeedsLayout];
+	}
+	
+	// restore selection
+	[self _setSelectedRange:rangeToSelectAfterwards animated:NO];
+}
+
 - (void)updateListsInRange:(UITextRange *)range removeNonPrefixedLinesFromLists:(BOOL)removeNonPrefixed
 {
+	DTRichTextEditorMetrics *metrics = self.metrics;
+	uint64_t metricsToken = [metrics beginInterval:DTRichTextEditorMetricsIntervalListUpdate];
+	
+	[self _updateListsInRange:range removeNonPrefixedLinesFromLists:removeNonPrefixed];
+	
+	[metrics endInterval:DTRichTextEditorMetricsIntervalListUpdate token:metricsToken];
+}
+
+- (void)_updateListsInRange:(UITextRange *)range removeNonPrefixedLinesFromLists:(BOOL)removeNonPrefixed
+{
+	NSAttributedString *attributedText = self.attributedText;
+	
 	NSRange selectionRange = [(DTTextRange *)range NSRangeValue];
-	NSRange selectedParagraphRange = [self.attributedText.string rangeOfParagraphsContainingRange:selectionRange parBegIndex:NULL parEndIndex:NULL];
+	NSRange selectedParagraphRange = [(DTMutableCoreTextLayoutFrame *)self.attributedTextContentView.layoutFrame rangeOfParagraphsContainingRange:selectionRange parBegIndex:NULL parEndIndex:NULL];
 	
 	NSRange rangeOfAllLists;
 	NSSet *listsInRange = [self _listsInRange:selectedParagraphRange effectiveRange:&rangeOfAllLists];
@@ -409,7 +583,47 @@
 		// nothing to do
 		return;
 	}
+	
+	if ([listsInRange count] > 1)
+	{
+		// nested lists affect each other, these are updated as a whole
+		[self _updateListsByReplacingRange:selectedParagraphRange selectionRange:selectionRange listsInRange:listsInRange rangeOfAllLists:rangeOfAllLists removeNonPrefixedLinesFromLists:removeNonPrefixed];
+		
+		return;
+	}
+	
+	DTCSSListStyle *list = [listsInRange anyObject];
+	NSRange listRange = [self _findList:list inAttributedString:attributedText range:rangeOfAllLists];
+	
+	if (listRange.location == NSNotFound)
+	{
+		NSLog(@"Warning: range of list %@ not found even though earlier it was returned by listsInRange", list);
+		
+		return;
+	}
+	
+	// only rewrite the items whose number or formatting actually changed
+	NSMutableArray *changedRanges = [NSMutableArray array];
+	NSMutableArray *changedTexts = [NSMutableArray array];
+	
+	[self _collectChangesForList:list inRange:listRange ofAttributedString:attributedText removeNonPrefixedLinesFromLists:removeNonPrefixed changedRanges:changedRanges changedTexts:changedTexts];
+	
+	if (![changedRanges count])
+	{
+		return;
+	}
+	
+	[self _replaceListItemTextInRanges:changedRanges withTexts:changedTexts];
+	
+	// attachment positions might have changed
+	[self.attributedTextContentView layoutSubviewsInRect:self.bounds];
+	
+	// cursor positions might have changed
+	[self updateCursorAnimated:NO];
+}
 
+- (void)_updateListsByReplacingRange:(NSRange)selectedParagraphRange selectionRange:(NSRange)selectionRange listsInRange:(NSSet *)listsInRange rangeOfAllLists:(NSRange)rangeOfAllLists removeNonPrefixedLinesFromLists:(BOOL)removeNonPrefixed
+{
 	NSRange totalRange = NSUnionRange(selectedParagraphRange, rangeOfAllLists);
 	NSRange partSelectionRange = selectionRange;
 	partSelectionRange.location -= totalRange.location;
@@ -433,13 +647,8 @@
             continue;
         }
         
-        // get font size at beginning of last paragraph of list
-        NSRange lastParagraph = [[mutableText string] rangeOfParagraphAtIndex:NSMaxRange(listRange)-1];
-        CTFontRef font = (__bridge CTFontRef)([mutableText attribute:(id)kCTFontAttributeName atIndex:lastParagraph.location effectiveRange:NULL]);
-        CGFloat fontSize = CTFontGetSize(font) * self.textSizeMultiplier;
-        
         // get the paragraph spacing after the list
-        CGFloat paragraphSpacing = [self _paragraphSpacingAfterListOfStyle:oneList relativeToTextSize:fontSize];
+        CGFloat paragraphSpacing = [self _paragraphSpacingAfterList:oneList inRange:listRange ofAttributedString:mutableText];
         
         [mutableText updateListStyle:oneList inRange:listRange numberFrom:oneList.startingItemNumber listIndent:[self listIndentForListStyle:oneList] spacingAfterList:paragraphSpacing removeNonPrefixedParagraphsFromList:removeNonPrefixed];
 	}
@@ -453,7 +662,7 @@
 	[self _inputDelegateTextDidChange];
 	
 	// restore selection
-	self.selectedTextRange = [DTTextRange rangeWithNSRange:rangeToSelectAfterwards];
+	[self _setSelectedRange:rangeToSelectAfterwards animated:NO];
 	
 	// attachment positions might have changed
 	[self.attributedTextContentView layoutSubviewsInRect:self.bounds];
@@ -27,8 +27,24 @@ typedef NS_ENUM(NSUInteger, DTHTMLWriterOption)
 	DTHTMLWriterOptionFragment = 1 << 0
 };
 
+/**
+ Options for applying attribute edits
+ */
+typedef NS_ENUM(NSUInteger, DTAttributeEditOption)
+{
+	/**
+	 The edits are undoable like other changes of the text (default)
+	 */
+	DTAttributeEditOptionNone = 0,
+	
+	/**
+	 The edits are decorations like spelling marks, search hits or the cursors of collaborators. They are not registered with the undo manager and don't close the current typing undo group.
+	 */
+	DTAttributeEditOptionDecoration = 1 << 0
+};
+
 
-@class DTTextRange, DTTextPosition, DTCSSListStyle, DTCoreTextFontDescriptor;
+@class DTTextRange, DTTextPosition, DTCSSListStyle, DTCoreTextFontDescriptor, DTAttributeEdit;
 
 /**
  The **Manipulation** category enhances DTRichTextEditorView with useful text format manipulation methods.
@@ -81,10 +97,27 @@ typedef NS_ENUM(NSUInteger, DTHTMLWriterOption)
  */
 - (void)setHTMLString:(NSString *)string;
 
+/**
+ Converts the given string to an `NSAttributedString` on a background queue and sets it on the receiver once it is ready. The main thread stays responsive while large documents are parsed. Setting the text in any other way, like calling <setHTMLString:>, `attributedText` or `adoptAttributedText:`, or calling this method again cancels the previous conversion, and so does modifying the text with `replaceRange:withText:`.
+ 
+ While the rest of the document is still being parsed the receiver can show the first paragraphs. The preview cannot be edited, the receiver resigns first responder while it is shown. Both the preview and the final document are laid out lazily, only the paragraphs near the visible area are laid out right away and the others follow in the background. With the `shouldLayoutLazily` option of the DTRichTextEditorContentView they are only laid out when they are needed.
+ @param string The string containing HTML text to convert to an attributed string and set as content of the receiver
+ @param numberOfPreviewParagraphs The number of top level paragraphs to show while the remainder is still being parsed, 0 to show nothing until parsing has finished
+ @param completion The block to execute on the main thread once the content has been set, `finished` is `NO` if the conversion was cancelled
+ */
+- (void)setHTMLString:(NSString *)string numberOfPreviewParagraphs:(NSUInteger)numberOfPreviewParagraphs completion:(void (^)(BOOL finished))completion;
+
+/**
+ Cancels the background conversion started by <setHTMLString:numberOfPreviewParagraphs:completion:>. The receiver keeps its current content, which might be the preview paragraphs. These can be edited after cancelling.
+ */
+- (void)cancelSettingHTMLString;
+
 /**
  Converts the current attributed string contents of the receiver to an HTML string.
  
  This uses DTHTMLWriter and uses the currently set textScale to reverse font scale changes. This allows for HTML with a small font size to be displayed at a larger font size, but the generated HTML will still have the original font size.
+
+ Only the paragraphs that were modified since their HTML was last generated are converted again, the result is the same as converting the whole text.
  
  Valid options are:
  
@@ -96,6 +129,28 @@ typedef NS_ENUM(NSUInteger, DTHTMLWriterOption)
  */
 - (NSString *)HTMLStringWithOptions:(DTHTMLWriterOption)options;
 
+/**
+ Converts a snapshot of the current contents of the receiver to an HTML string on a background queue, the user can continue typing in the meantime. The options are the same as for <HTMLStringWithOptions:>, the paragraphs modified since their HTML was last generated are converted on the background queue.
+ @param options The options to apply for the conversion.
+ @param completion The block to execute on the main thread with the generated HTML
+ */
+- (void)HTMLStringWithOptions:(DTHTMLWriterOption)options completion:(void (^)(NSString *HTMLString))completion;
+
+/**
+ Converts the paragraphs intersecting the given range to an HTML fragment with inline styles.
+ 
+ The HTML of each paragraph is cached, only paragraphs that were modified since their HTML was last generated are converted again. The cache is shared with <HTMLStringWithOptions:>. A list is treated as one paragraph because it is converted as a whole.
+ @param range The string range
+ @returns An `NSString` with the HTML of the paragraphs
+ */
+- (NSString *)HTMLFragmentForParagraphsInRange:(NSRange)range;
+
+/**
+ Determines the paragraphs that were modified since their HTML was last generated by <HTMLFragmentForParagraphsInRange:> or <HTMLStringWithOptions:>. This allows sending only the modified paragraphs to a server, generating their HTML marks them as unmodified.
+ @returns An array of `NSValue` ranges of the modified paragraphs
+ */
+- (NSArray *)rangesOfParagraphsWithModifiedHTML;
+
 /**
  @name Changing Paragraph Styles
  */
@@ -189,6 +244,20 @@ typedef NS_ENUM(NSUInteger, DTHTMLWriterOption)
  */
 - (void)toggleHyperlinkInRange:(UITextRange *)range URL:(NSURL *)URL;
 
+/**
+ @name Applying Attributes to Multiple Ranges
+ */
+
+/**
+ Applies many attribute changes to disjoint ranges at once, for example for spelling marks or search hits. The edits are applied to the paragraphs containing them in one pass: paragraphs whose glyph metrics are unchanged are only redrawn, all others are laid out together once, and attachments and the cursor are updated once at the end. Inside an edit transaction the layout is deferred until the transaction ends.
+ 
+ Unless the edits are decorations, all of them are undone together with a single undo action.
+ @param edits An array of DTAttributeEdit objects, the order does not matter. Edits for the same characters are applied in array order.
+ @param options The options how to apply the edits
+ @param actionName The name of the undo action, ignored for decorations
+ */
+- (void)applyAttributeEdits:(NSArray *)edits options:(DTAttributeEditOption)options actionName:(NSString *)actionName;
+
 
 /**
  @name Working with Fonts
@@ -235,6 +304,28 @@ typedef NS_ENUM(NSUInteger, DTHTMLWriterOption)
  */
 - (NSArray *)textAttachmentsWithPredicate:(NSPredicate *)predicate;
 
+/**
+ Retrieving the attachments in a text range that match a predicate. Only the attachments in the range are evaluated, they are found from an index of the attachments that is maintained by all edits.
+ @param predicate The `NSPredicate` that will be used to check the DTTextAttachment key values against or `nil` for all attachments
+ @param range The text range
+ @returns An array of matching attachments in the order of their position
+ */
+- (NSArray *)textAttachmentsWithPredicate:(NSPredicate *)predicate inRange:(UITextRange *)range;
+
+/**
+ Retrieving the attachments showing a content URL. This is looked up by the URL without evaluating all attachments of the document, which matters if it is done for many images, for example when each finished upload replaces the local URL of its image.
+ @param contentURL The content URL
+ @returns An array of the matching attachments in no particular order
+ */
+- (NSArray *)textAttachmentsWithContentURL:(NSURL *)contentURL;
+
+/**
+ Changes the content URL of all attachments showing a URL. Use this instead of setting the `contentURL` of the attachments directly so that <textAttachmentsWithContentURL:> finds them by the new URL and the HTML of their paragraphs is regenerated.
+ @param contentURL The current content URL
+ @param newURL The new content URL
+ */
+- (void)replaceContentURL:(NSURL *)contentURL withURL:(NSURL *)newURL;
+
  
 /**
  @name Interacting With The Pasteboard
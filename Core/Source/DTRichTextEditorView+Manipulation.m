@@ -8,6 +8,11 @@
 
 #import "DTRichTextEditor.h"
 #import "DTUndoManager.h"
+#import "DTUndoDelta.h"
+#import "DTHTMLFragmentCache.h"
+#import "DTTypingAttributesCache.h"
+#import "DTMutableCoreTextLayoutFrame.h"
+#import "DTAttributeEdit.h"
 
 #import <DTCoreText/DTCoreText.h>
 #import <DTWebArchive/UIPasteboard+DTWebArchive.h>
@@ -15,8 +20,11 @@
 @interface DTRichTextEditorView (private)
 
 - (void)updateCursorAnimated:(BOOL)animated;
+- (BOOL)_isDeferringEditUpdates;
 - (void)hideContextMenu;
 - (void)_closeTypingUndoGroupIfNecessary;
+- (void)_undoDelta:(DTUndoDelta *)delta;
+- (void)_adoptAttributedText:(NSMutableAttributedString *)attributedText layingOutLazily:(BOOL)layingOutLazily;
 
 - (void)_inputDelegateSelectionWillChange;
 - (void)_inputDelegateSelectionDidChange;
@@ -24,6 +32,9 @@
 - (void)_inputDelegateTextDidChange;
 
 @property (nonatomic, assign) BOOL keepCurrentUndoGroup; // avoid closing of Undo Group for sub operations
+@property (nonatomic, retain) DTHTMLAttributedStringBuilder *HTMLStringBuilder;
+@property (nonatomic, assign) BOOL showingHTMLPreview;
+@property (nonatomic, readonly) DTTypingAttributesCache *typingAttributesCache;
 
 @end
 
@@ -58,26 +69,189 @@
 
 - (void)setHTMLString:(NSString *)string
 {
+	// the synchronous result must not be replaced by a background parse still running
+	[self cancelSettingHTMLString];
+	
 	NSData *data = [string dataUsingEncoding:NSUTF8StringEncoding];
 	
+	uint64_t metricsToken = [self.metrics beginInterval:DTRichTextEditorMetricsIntervalHTMLImport];
+	
 	NSAttributedString *attributedString = [[NSAttributedString alloc] initWithHTMLData:data options:[self textDefaults] documentAttributes:NULL];
+	attributedString = [DTRichTextImageAttachment attributedStringByReplacingImageAttachmentsInAttributedString:attributedString];
+	
+	[self.metrics endInterval:DTRichTextEditorMetricsIntervalHTMLImport token:metricsToken];
 	
 	[self setAttributedText:attributedString];
 	
 	[self.undoManager removeAllActions];
 }
 
+- (void)setHTMLString:(NSString *)string numberOfPreviewParagraphs:(NSUInteger)numberOfPreviewParagraphs completion:(void (^)(BOOL finished))completion
+{
+	[self cancelSettingHTMLString];
+	
+	NSData *data = [string dataUsingEncoding:NSUTF8StringEncoding];
+	
+	DTHTMLAttributedStringBuilder *builder = [[DTHTMLAttributedStringBuilder alloc] initWithHTML:data options:[self textDefaults] documentAttributes:NULL];
+	self.HTMLStringBuilder = builder;
+	
+	__weak DTRichTextEditorView *weakSelf = self;
+	__weak DTHTMLAttributedStringBuilder *weakBuilder = builder;
+	
+	if (numberOfPreviewParagraphs)
+	{
+		NSMutableAttributedString *previewString = [[NSMutableAttributedString alloc] init];
+		__block NSUInteger numberOfPreviewElements = 0;
+		
+		// called on the parsing queue for each top level block, those for the preview are converted a second time
+		builder.willFlushCallback = ^(DTHTMLElement *element) {
+			
+			if (numberOfPreviewElements >= numberOfPreviewParagraphs)
+			{
+				return;
+			}
+			
+			[previewString appendAttributedString:[element attributedString]];
+			numberOfPreviewElements++;
+			
+			if (numberOfPreviewElements < numberOfPreviewParagraphs || ![previewString length])
+			{
+				return;
+			}
+			
+			NSAttributedString *preview = [DTRichTextImageAttachment attributedStringByReplacingImageAttachmentsInAttributedString:[previewString copy]];
+			
+			dispatch_async(dispatch_get_main_queue(), ^{
+				
+				DTRichTextEditorView *strongSelf = weakSelf;
+				
+				// only if parsing is still going on
+				if (strongSelf && weakBuilder && strongSelf.HTMLStringBuilder == weakBuilder)
+				{
+					// the final text replaces the preview, so it cannot be edited until then
+					strongSelf.showingHTMLPreview = YES;
+					
+					[strongSelf _adoptAttributedText:[preview mutableCopy] layingOutLazily:YES];
+				}
+			});
+		};
+	}
+	
+	DTRichTextEditorMetrics *metrics = self.metrics;
+	
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		
+		uint64_t metricsToken = [metrics beginInterval:DTRichTextEditorMetricsIntervalHTMLImport];
+		
+		NSAttributedString *attributedString = [builder generatedAttributedString];
+		attributedString = [DTRichTextImageAttachment attributedStringByReplacingImageAttachmentsInAttributedString:attributedString];
+		
+		[metrics endInterval:DTRichTextEditorMetricsIntervalHTMLImport token:metricsToken];
+		
+		dispatch_async(dispatch_get_main_queue(), ^{
+			
+			DTRichTextEditorView *strongSelf = weakSelf;
+			
+			// cancelled or replaced by another call
+			if (!strongSelf || strongSelf.HTMLStringBuilder != builder)
+			{
+				if (completion)
+				{
+					completion(NO);
+				}
+				
+				return;
+			}
+			
+			strongSelf.HTMLStringBuilder = nil;
+			strongSelf.showingHTMLPreview = NO;
+			
+			// large documents only get the visible paragraphs laid out right away
+			[strongSelf _adoptAttributedText:[attributedString mutableCopy] layingOutLazily:YES];
+			[strongSelf.undoManager removeAllActions];
+			
+			if (completion)
+			{
+				completion(YES);
+			}
+		});
+	});
+}
+
+- (void)cancelSettingHTMLString
+{
+	DTHTMLAttributedStringBuilder *builder = self.HTMLStringBuilder;
+	
+	if (!builder)
+	{
+		return;
+	}
+	
+	self.HTMLStringBuilder = nil;
+	
+	// the preview stays and can be edited now
+	self.showingHTMLPreview = NO;
+	
+	// the completion handler gets called once the builder has stopped
+	[builder abortParsing];
+}
+
 - (NSString *)HTMLStringWithOptions:(DTHTMLWriterOption)options
 {
-	DTHTMLWriter *writer = [[DTHTMLWriter alloc] initWithAttributedString:self.attributedText];
-	writer.textScale = self.textSizeMultiplier;  // the writer will divide font sizes by this value
+	uint64_t metricsToken = [self.metrics beginInterval:DTRichTextEditorMetricsIntervalHTMLExport];
 	
+	// only the modified paragraphs are converted again
+	DTHTMLFragmentCache *cache = [(DTRichTextEditorContentView *)self.attributedTextContentView HTMLFragmentCache];
+	NSAttributedString *attributedText = self.attributedText;
+	
+	NSString *HTMLString;
+	
+	// the writer will divide font sizes by the text scale
 	if (options & DTHTMLWriterOptionFragment)
 	{
-		return [writer HTMLFragment];
+		HTMLString = [cache HTMLFragmentForParagraphsInRange:NSMakeRange(0, [attributedText length]) ofAttributedString:attributedText textScale:self.textSizeMultiplier];
+	}
+	else
+	{
+		HTMLString = [cache HTMLStringForAttributedString:attributedText textScale:self.textSizeMultiplier];
 	}
+	
+	[self.metrics endInterval:DTRichTextEditorMetricsIntervalHTMLExport token:metricsToken];
+	
+	return HTMLString;
+}
+
+- (void)HTMLStringWithOptions:(DTHTMLWriterOption)options completion:(void (^)(NSString *HTMLString))completion
+{
+	NSParameterAssert(completion);
+	
+	DTRichTextEditorMetrics *metrics = self.metrics;
+	uint64_t metricsToken = [metrics beginInterval:DTRichTextEditorMetricsIntervalHTMLExport];
+	
+	// the modified paragraphs are converted from the snapshot while the user continues typing
+	DTHTMLFragmentCache *cache = [(DTRichTextEditorContentView *)self.attributedTextContentView HTMLFragmentCache];
+	
+	[cache HTMLStringForAttributedString:[self attributedTextSnapshot] textScale:self.textSizeMultiplier fragment:(options & DTHTMLWriterOptionFragment) != 0 completion:^(NSString *HTMLString) {
+		
+		[metrics endInterval:DTRichTextEditorMetricsIntervalHTMLExport token:metricsToken];
+		
+		completion(HTMLString);
+	}];
+}
+
+- (NSString *)HTMLFragmentForParagraphsInRange:(NSRange)range
+{
+	DTHTMLFragmentCache *cache = [(DTRichTextEditorContentView *)self.attributedTextContentView HTMLFragmentCache];
+	
+	// the writer will divide font sizes by the text scale
+	return [cache HTMLFragmentForParagraphsInRange:range ofAttributedString:self.attributedText textScale:self.textSizeMultiplier];
+}
 
-	return [writer HTMLString];
+- (NSArray *)rangesOfParagraphsWithModifiedHTML
+{
+	DTHTMLFragmentCache *cache = [(DTRichTextEditorContentView *)self.attributedTextContentView HTMLFragmentCache];
+	
+	return [cache rangesOfDirtyParagraphsInAttributedString:self.attributedText];
 }
 
 - (NSString *)plainTextForRange:(UITextRange *)range
@@ -98,13 +272,20 @@
 
 - (NSDictionary *)typingAttributesForRange:(DTTextRange *)range
 {
-	NSDictionary *attributes = [self.attributedTextContentView.layoutFrame.attributedStringFragment typingAttributesForRange:[range NSRangeValue]];
+	NSAttributedString *attributedString = self.attributedTextContentView.layoutFrame.attributedStringFragment;
+	NSUInteger index = [attributedString indexOfTypingAttributesForRange:[range NSRangeValue]];
 	
-	CTFontRef font = (__bridge CTFontRef)[attributes objectForKey:(id)kCTFontAttributeName];
-	CTParagraphStyleRef paragraphStyle = (__bridge CTParagraphStyleRef)[attributes objectForKey:(id)kCTParagraphStyleAttributeName];
+	if (index == NSNotFound)
+	{
+		return nil;
+	}
+	
+	// the run dictionary identifies the attribute run, the typing attributes are resolved once per run
+	NSDictionary *runAttributes = [attributedString attributesAtIndex:index effectiveRange:NULL];
+	BOOL atEndOfLink = NO;
 	
 	// typing attributes contain a hyperlink
-	if ([attributes objectForKey:DTLinkAttribute])
+	if ([runAttributes objectForKey:DTLinkAttribute])
 	{
 		DTTextPosition *start = (DTTextPosition *)[range start];
 		DTTextPosition *endOfDocument = (DTTextPosition *)[self endOfDocument];
@@ -113,61 +294,94 @@
 		
 		if ([start compare:endOfDocument] == NSOrderedAscending)
 		{
-			followingAttributes = [self.attributedTextContentView.layoutFrame.attributedStringFragment attributesAtIndex:start.location+1 effectiveRange:NULL];
+			followingAttributes = [attributedString attributesAtIndex:start.location+1 effectiveRange:NULL];
 		}
 		
-		if (![followingAttributes objectForKey:DTLinkAttribute])
+		// no link in character after it = we are typing at end of hyperlink and don't want that to continue
+		atEndOfLink = ([followingAttributes objectForKey:DTLinkAttribute] == nil);
+	}
+	
+	DTTypingAttributesCache *cache = self.typingAttributesCache;
+	NSDictionary *attributes = [cache typingAttributesForRunAttributes:runAttributes atEndOfLink:atEndOfLink];
+	
+	if (attributes)
+	{
+		return attributes;
+	}
+	
+	attributes = [attributedString typingAttributesForRange:[range NSRangeValue]];
+	
+	if (atEndOfLink)
+	{
+		NSDictionary *defaultAttributes = [self attributedStringAttributesForTextDefaults];
+		
+		NSMutableDictionary *tmpAttributes = [attributes mutableCopy];
+		
+		// remove the link meta info
+		[tmpAttributes removeObjectForKey:DTLinkAttribute];
+		[tmpAttributes removeObjectForKey:DTGUIDAttribute];
+		
+		id underlineStyle = [defaultAttributes objectForKey:(id)kCTUnderlineStyleAttributeName];
+		
+		// transfer default underline style
+		if (underlineStyle)
+		{
+			[tmpAttributes setObject:underlineStyle forKey:(id)kCTUnderlineStyleAttributeName];
+		}
+		else
 		{
-			// no link in character after it = we are typing at end of hyperlink and don't want that to continue
-			
-			NSDictionary *defaultAttributes = [self attributedStringAttributesForTextDefaults];
-			
-			NSMutableDictionary *tmpAttributes = [attributes mutableCopy];
-			
-			// remove the link meta info
-			[tmpAttributes removeObjectForKey:DTLinkAttribute];
-			[tmpAttributes removeObjectForKey:DTGUIDAttribute];
-			
-			id underlineStyle = [defaultAttributes objectForKey:(id)kCTUnderlineStyleAttributeName];
-			
-			// transfer default underline style
-			if (underlineStyle)
-			{
-				[tmpAttributes setObject:underlineStyle forKey:(id)kCTUnderlineStyleAttributeName];
-			}
-			else
-			{
-				[tmpAttributes removeObjectForKey:(id)kCTUnderlineStyleAttributeName];
-			}
-			
 			[tmpAttributes removeObjectForKey:(id)kCTUnderlineStyleAttributeName];
-			
-			// transfer default foreground color
-			id foregroundColor = [defaultAttributes objectForKey:(id)kCTForegroundColorAttributeName];
-			
-			if (foregroundColor)
-			{
-				[tmpAttributes setObject:foregroundColor forKey:(id)kCTForegroundColorAttributeName];
-			}
-			else
-			{
-				[tmpAttributes removeObjectForKey:(id)kCTForegroundColorAttributeName];
-			}
-			
-			attributes = [tmpAttributes copy];
 		}
+		
+		[tmpAttributes removeObjectForKey:(id)kCTUnderlineStyleAttributeName];
+		
+		// transfer default foreground color
+		id foregroundColor = [defaultAttributes objectForKey:(id)kCTForegroundColorAttributeName];
+		
+		if (foregroundColor)
+		{
+			[tmpAttributes setObject:foregroundColor forKey:(id)kCTForegroundColorAttributeName];
+		}
+		else
+		{
+			[tmpAttributes removeObjectForKey:(id)kCTForegroundColorAttributeName];
+		}
+		
+		attributes = [tmpAttributes copy];
 	}
 	
-	if (font&&paragraphStyle)
+	CTFontRef font = (__bridge CTFontRef)[attributes objectForKey:(id)kCTFontAttributeName];
+	CTParagraphStyleRef paragraphStyle = (__bridge CTParagraphStyleRef)[attributes objectForKey:(id)kCTParagraphStyleAttributeName];
+	
+	if (!font || !paragraphStyle)
 	{
-		return attributes;
+		// otherwise we need to add missing things
+		NSMutableDictionary *tmpAttributes = [attributes mutableCopy];
+		
+		// if there's no font, then substitute it from our defaults
+		if (!font)
+		{
+			[tmpAttributes setObject:(__bridge id)[self _defaultTypingFont] forKey:(id)kCTFontAttributeName];
+		}
+		
+		if (!paragraphStyle)
+		{
+			[tmpAttributes setObject:(__bridge id)[self _defaultTypingParagraphStyle] forKey:(id)kCTParagraphStyleAttributeName];
+		}
+		
+		attributes = tmpAttributes;
 	}
 	
-	// otherwise we need to add missing things
+	[cache setTypingAttributes:attributes forRunAttributes:runAttributes atEndOfLink:atEndOfLink];
 	
+	return [cache typingAttributesForRunAttributes:runAttributes atEndOfLink:atEndOfLink];
+}
+
+// the multiplied default font size, 12 if there is no default
+- (CGFloat)_defaultTypingFontSize
+{
 	NSDictionary *defaults = [self textDefaults];
-	NSString *fontFamily = [defaults objectForKey:DTDefaultFontFamily];
-    NSNumber *fontSize = [defaults objectForKey:DTDefaultFontSize];
+	NSNumber *fontSize = [defaults objectForKey:DTDefaultFontSize];
 	
 	CGFloat multiplier = [[defaults objectForKey:NSTextSizeMultiplierDocumentOption] floatValue];
 	
@@ -176,35 +390,46 @@
 		multiplier = 1.0;
 	}
 	
-	NSMutableDictionary *tmpAttributes = [attributes mutableCopy];
+	return [fontSize floatValue] * multiplier;
+}
+
+- (CTFontRef)_defaultTypingFont
+{
+	DTTypingAttributesCache *cache = self.typingAttributesCache;
 	
-	// if there's no font, then substitute it from our defaults
-	if (!font)
+	if (!cache.defaultFont)
 	{
 		DTCoreTextFontDescriptor *desc = [[DTCoreTextFontDescriptor alloc] init];
-		desc.fontFamily = fontFamily;
-        desc.pointSize = [fontSize floatValue] * multiplier;
+		desc.fontFamily = [[self textDefaults] objectForKey:DTDefaultFontFamily];
+		desc.pointSize = [self _defaultTypingFontSize];
 		
 		CTFontRef defaultFont = [desc newMatchingFont];
 		
-		[tmpAttributes setObject:(__bridge id)defaultFont forKey:(id)kCTFontAttributeName];
+		cache.defaultFont = defaultFont;
 		
 		CFRelease(defaultFont);
 	}
 	
-	if (!paragraphStyle)
+	return cache.defaultFont;
+}
+
+- (CTParagraphStyleRef)_defaultTypingParagraphStyle
+{
+	DTTypingAttributesCache *cache = self.typingAttributesCache;
+	
+	if (!cache.defaultParagraphStyle)
 	{
 		DTCoreTextParagraphStyle *defaultStyle = [DTCoreTextParagraphStyle defaultParagraphStyle];
-		defaultStyle.paragraphSpacing = [fontSize floatValue]  * multiplier;
+		defaultStyle.paragraphSpacing = [self _defaultTypingFontSize];
 		
-		paragraphStyle = [defaultStyle createCTParagraphStyle];
+		CTParagraphStyleRef paragraphStyle = [defaultStyle createCTParagraphStyle];
 		
-		[tmpAttributes setObject:(__bridge id)paragraphStyle forKey:(id)kCTParagraphStyleAttributeName];
+		cache.defaultParagraphStyle = paragraphStyle;
 		
 		CFRelease(paragraphStyle);
 	}
 	
-	return tmpAttributes;
+	return cache.defaultParagraphStyle;
 }
 
 @dynamic overrideInsertionAttributes; // provided by DTRichTextEditorView main implementation
@@ -248,22 +473,39 @@
 
 	DTUndoManager *undoManager = (DTUndoManager *)self.undoManager;
 	
-	NSAttributedString *replacedString = [self.attributedTextContentView.attributedString attributedSubstringFromRange:range];
+	NSAttributedString *attributedText = self.attributedTextContentView.attributedString;
+	
+	// only the changed attribute runs need to be kept
+	DTUndoDelta *delta = [DTUndoDelta deltaForChangingAttributesInRange:range ofAttributedString:attributedText toAttributedString:attributedString];
+	
+	if (!delta)
+	{
+		// characters differ, e.g. list prefixes, so the whole substring has to be restored
+		delta = [DTUndoDelta deltaForReplacingRange:range withCharactersInRange:range ofAttributedString:attributedText];
+	}
+	
+	delta.actionName = actionName;
 	
 	if (!undoManager.numberOfOpenGroups)
 	{
 		[undoManager beginUndoGrouping];
 	}
 	
-	[[undoManager prepareWithInvocationTarget:self] _updateSubstringInRange:range withAttributedString:replacedString actionName:actionName];
+	[undoManager registerUndoDelta:delta withTarget:self selector:@selector(_undoDelta:)];
 	
 	if (actionName)
 	{
 		[undoManager setActionName:actionName];
 	}
 	
-	// replace
-	[(DTRichTextEditorContentView *)self.attributedTextContentView replaceTextInRange:range withText:attributedString];
+	DTRichTextEditorContentView *contentView = (DTRichTextEditorContentView *)self.attributedTextContentView;
+	
+	// colors, highlights and links don't need a new layout
+	if (![delta changesAttributesOnly] || ![contentView replaceAttributesInRange:range withText:attributedString])
+	{
+		// replace
+		[contentView replaceTextInRange:range withText:attributedString];
+	}
 	
 	// attachment positions might have changed
 	[self.attributedTextContentView layoutSubviewsInRect:self.bounds];
@@ -561,6 +803,154 @@
 	[self hideContextMenu];
 }
 
+#pragma mark - Applying Attributes to Multiple Ranges
+
+- (void)applyAttributeEdits:(NSArray *)edits options:(DTAttributeEditOption)options actionName:(NSString *)actionName
+{
+	NSAttributedString *attributedText = self.attributedText;
+	NSString *string = [attributedText string];
+	NSUInteger length = [attributedText length];
+	
+	NSMutableArray *validEdits = [NSMutableArray arrayWithCapacity:[edits count]];
+	
+	for (DTAttributeEdit *edit in edits)
+	{
+		NSAssert(NSMaxRange(edit.range) <= length, @"%@ is outside of the text", edit);
+		
+		if (edit.range.length && NSMaxRange(edit.range) <= length)
+		{
+			[validEdits addObject:edit];
+		}
+	}
+	
+	if (![validEdits count])
+	{
+		return;
+	}
+	
+	// the sort is stable, so edits for the same characters keep their order
+	NSArray *sortedEdits = [validEdits sortedArrayWithOptions:NSSortStable usingComparator:^NSComparisonResult(DTAttributeEdit *edit1, DTAttributeEdit *edit2) {
+		
+		if (edit1.range.location < edit2.range.location)
+		{
+			return NSOrderedAscending;
+		}
+		
+		if (edit1.range.location > edit2.range.location)
+		{
+			return NSOrderedDescending;
+		}
+		
+		return NSOrderedSame;
+	}];
+	
+	// edits in the same or adjacent paragraphs are applied together
+	NSMutableArray *groupRanges = [NSMutableArray array];
+	NSMutableArray *groupEdits = [NSMutableArray array];
+	
+	NSRange groupRange = NSMakeRange(NSNotFound, 0);
+	
+	for (DTAttributeEdit *edit in sortedEdits)
+	{
+		NSRange paragraphRange = [string paragraphRangeForRange:edit.range];
+		
+		if (groupRange.location != NSNotFound && paragraphRange.location <= NSMaxRange(groupRange))
+		{
+			groupRange = NSUnionRange(groupRange, paragraphRange);
+			[[groupEdits lastObject] addObject:edit];
+			
+			continue;
+		}
+		
+		if (groupRange.location != NSNotFound)
+		{
+			[groupRanges addObject:[NSValue valueWithRange:groupRange]];
+		}
+		
+		groupRange = paragraphRange;
+		[groupEdits addObject:[NSMutableArray arrayWithObject:edit]];
+	}
+	
+	[groupRanges addObject:[NSValue valueWithRange:groupRange]];
+	
+	BOOL isDecoration = ((options & DTAttributeEditOptionDecoration) != 0);
+	DTUndoManager *undoManager = (DTUndoManager *)self.undoManager;
+	
+	if (!isDecoration)
+	{
+		// close off typing group, this is a new operations
+		[self _closeTypingUndoGroupIfNecessary];
+		
+		if (!undoManager.numberOfOpenGroups)
+		{
+			[undoManager beginUndoGrouping];
+		}
+	}
+	
+	DTRichTextEditorContentView *contentView = (DTRichTextEditorContentView *)self.attributedTextContentView;
+	BOOL needsLayout = NO;
+	
+	for (NSUInteger i=0; i<[groupRanges count]; i++)
+	{
+		NSRange range = [[groupRanges objectAtIndex:i] rangeValue];
+		
+		NSMutableAttributedString *fragment = [[attributedText attributedSubstringFromRange:range] mutableCopy];
+		
+		[fragment beginEditing];
+		
+		for (DTAttributeEdit *edit in [groupEdits objectAtIndex:i])
+		{
+			NSRange editRange = NSMakeRange(edit.range.location - range.location, edit.range.length);
+			
+			for (NSString *name in edit.removedAttributeNames)
+			{
+				[fragment removeAttribute:name range:editRange];
+			}
+			
+			if (edit.addedAttributes)
+			{
+				[fragment addAttributes:edit.addedAttributes range:editRange];
+			}
+		}
+		
+		[fragment endEditing];
+		
+		if (!isDecoration)
+		{
+			DTUndoDelta *delta = [DTUndoDelta deltaForChangingAttributesInRange:range ofAttributedString:attributedText toAttributedString:fragment];
+			delta.actionName = actionName;
+			
+			[undoManager registerUndoDelta:delta withTarget:self selector:@selector(_undoDelta:)];
+		}
+		
+		// colors, highlights and links only need a redraw, the others are laid out together below
+		if (![contentView replaceAttributesInRange:range withText:fragment])
+		{
+			[contentView replaceTextInRange:range withTextDeferringLayout:fragment];
+			needsLayout = YES;
+		}
+	}
+	
+	if (!isDecoration && actionName)
+	{
+		[undoManager setActionName:actionName];
+	}
+	
+	// an edit transaction lays out the deferred paragraphs when it is flushed
+	if (needsLayout && ![self _isDeferringEditUpdates])
+	{
+		[contentView layoutDeferredText];
+		
+		self.contentSize = contentView.frame.size;
+	}
+	
+	// attachment positions might have changed
+	[contentView layoutSubviewsInRect:self.bounds];
+	
+	// cursor positions might have changed
+	[self updateCursorAnimated:NO];
+}
+
 #pragma mark - Working with Fonts
 
 - (void)updateFontInRange:(UITextRange *)range withFontFamilyName:(NSString *)fontFamilyName pointSize:(CGFloat)pointSize
@@ -897,4 +1287,36 @@
 	return [self.attributedTextContentView.layoutFrame textAttachmentsWithPredicate:predicate];
 }
 
+- (NSArray *)textAttachmentsWithPredicate:(NSPredicate *)predicate inRange:(UITextRange *)range
+{
+	if (!range)
+	{
+		return nil;
+	}
+	
+	DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.attributedTextContentView.layoutFrame;
+	
+	return [layoutFrame textAttachmentsWithPredicate:predicate class:Nil inRange:[(DTTextRange *)range NSRangeValue]];
+}
+
+- (NSArray *)textAttachmentsWithContentURL:(NSURL *)contentURL
+{
+	DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.attributedTextContentView.layoutFrame;
+	
+	return [layoutFrame textAttachmentsWithContentURL:contentURL];
+}
+
+- (void)replaceContentURL:(NSURL *)contentURL withURL:(NSURL *)newURL
+{
+	DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.attributedTextContentView.layoutFrame;
+	NSIndexSet *locations = [layoutFrame replaceContentURL:contentURL withURL:newURL];
+	
+	// the paragraphs of these attachments have different HTML now
+	DTHTMLFragmentCache *cache = [(DTRichTextEditorContentView *)self.attributedTextContentView HTMLFragmentCache];
+	
+	[locations enumerateIndexesUsingBlock:^(NSUInteger idx, BOOL *stop) {
+		[cache invalidateRange:NSMakeRange(idx, 1) replacementLength:1];
+	}];
+}
+
 @end
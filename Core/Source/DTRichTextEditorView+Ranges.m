@@ -7,6 +7,8 @@
 //
 
 #import "DTRichTextEditorView+Ranges.h"
+#import "DTMutableCoreTextLayoutFrame.h"
+#import "DTTextInputTokenizer.h"
 
 #import <DTCoreText/DTAttributedTextContentView.h>
 #import <DTCoreText/NSString+Paragraphs.h>
@@ -16,74 +18,57 @@
 #pragma mark - Working with Ranges
 - (UITextRange *)textRangeOfWordAtPosition:(UITextPosition *)position
 {
-	DTTextRange *forRange = (id)[[self tokenizer] rangeEnclosingPosition:position withGranularity:UITextGranularityWord inDirection:UITextStorageDirectionForward];
-	DTTextRange *backRange = (id)[[self tokenizer] rangeEnclosingPosition:position withGranularity:UITextGranularityWord inDirection:UITextStorageDirectionBackward];
+	DTTextInputTokenizer *wordTokenizer = (DTTextInputTokenizer *)[self tokenizer];
+	DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.attributedTextContentView.layoutFrame;
+	NSString *string = [layoutFrame.attributedStringFragment string];
 	
-	if (forRange && backRange)
-	{
-		DTTextRange *newRange = [DTTextRange textRangeFromStart:[backRange start] toEnd:[backRange end]];
-		return newRange;
-	}
-	else if (forRange)
+	NSUInteger index = [(DTTextPosition *)position location];
+	
+	// backward range wins, it is the same word if both exist
+	NSRange wordRange = [wordTokenizer rangeOfWordEnclosingIndex:index inDirection:UITextStorageDirectionBackward];
+	
+	if (wordRange.location == NSNotFound)
 	{
-		return forRange;
+		wordRange = [wordTokenizer rangeOfWordEnclosingIndex:index inDirection:UITextStorageDirectionForward];
 	}
-	else if (backRange)
+	
+	if (wordRange.location != NSNotFound)
 	{
-		return backRange;
+		return [DTTextRange rangeWithNSRange:wordRange];
 	}
 	
 	// treat image as word, left side of image selects it
-	UITextPosition *plusOnePosition = [self positionFromPosition:position offset:1];
-	UITextRange *imageRange = [self textRangeFromPosition:position toPosition:plusOnePosition];
-	
-	NSAttributedString *characterString = [self attributedSubstringForRange:imageRange];
-	
-    // only check for attachment attribute if the string is not empty
-    if ([characterString length])
-    {
-        if ([[characterString attributesAtIndex:0 effectiveRange:NULL] objectForKey:NSAttachmentAttributeName])
-        {
-            return imageRange;
-        }
-    }
+	if (index < [string length] && [[layoutFrame textAttachmentsInRange:NSMakeRange(index, 1)] count])
+	{
+		return [DTTextRange rangeWithNSRange:NSMakeRange(index, 1)];
+	}
 	
 	// we did not get a forward or backward range, like Word!|
-	DTTextPosition *previousPosition = (id)([self.tokenizer positionFromPosition:position
-                                                                      toBoundary:UITextGranularityCharacter
-                                                                     inDirection:UITextStorageDirectionBackward]);
-	
-	// treat image as word, right side of image selects it
-	characterString = [self.attributedTextContentView.layoutFrame.attributedStringFragment attributedSubstringFromRange:NSMakeRange(previousPosition.location, 1)];
-	
-	if ([[characterString attributesAtIndex:0 effectiveRange:NULL] objectForKey:NSAttachmentAttributeName])
+	if (!index || index > [string length])
 	{
-		return [DTTextRange textRangeFromStart:previousPosition toEnd:[previousPosition textPositionWithOffset:1]];
+		return nil;
 	}
 	
-	forRange = (id)[[self tokenizer] rangeEnclosingPosition:previousPosition withGranularity:UITextGranularityWord inDirection:UITextStorageDirectionForward];
-	backRange = (id)[[self tokenizer] rangeEnclosingPosition:previousPosition withGranularity:UITextGranularityWord inDirection:UITextStorageDirectionBackward];
+	NSUInteger previousIndex = [string rangeOfComposedCharacterSequenceAtIndex:index-1].location;
 	
-	UITextRange *retRange = nil;
-	
-	if (forRange && backRange)
-	{
-		retRange = [DTTextRange textRangeFromStart:[backRange start] toEnd:[backRange end]];
-	}
-	else if (forRange)
+	// treat image as word, right side of image selects it
+	if ([[layoutFrame textAttachmentsInRange:NSMakeRange(previousIndex, 1)] count])
 	{
-		retRange = forRange;
+		return [DTTextRange rangeWithNSRange:NSMakeRange(previousIndex, 1)];
 	}
-	else if (backRange)
+	
+	wordRange = [wordTokenizer rangeOfWordEnclosingIndex:previousIndex inDirection:UITextStorageDirectionBackward];
+	
+	if (wordRange.location == NSNotFound)
 	{
-		retRange = backRange;
+		wordRange = [wordTokenizer rangeOfWordEnclosingIndex:previousIndex inDirection:UITextStorageDirectionForward];
 	}
 	
 	// need to extend to include the previous position
-	if (retRange)
+	if (wordRange.location != NSNotFound)
 	{
 		// extend this range to go up to current position
-		return [DTTextRange textRangeFromStart:[retRange start] toEnd:position];
+		return [DTTextRange rangeWithNSRange:NSMakeRange(wordRange.location, index - wordRange.location)];
 	}
 	
 	return nil;
@@ -115,10 +100,9 @@
 // returns the text range containing a given string index
 - (UITextRange *)textRangeOfParagraphContainingPosition:(UITextPosition *)position
 {
-	NSAttributedString *attributedString = self.attributedText;
-	NSString *string = [attributedString string];
+	DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.attributedTextContentView.layoutFrame;
 	
-    NSRange range = [string rangeOfParagraphAtIndex:[(DTTextPosition *)position location]];
+    NSRange range = [layoutFrame rangeOfParagraphAtIndex:[(DTTextPosition *)position location]];
     
 	DTTextRange *retRange = [DTTextRange rangeWithNSRange:range];
     
@@ -131,14 +115,12 @@
     myRange.length ++;
 	
 	// get range containing all selected paragraphs
-	NSAttributedString *attributedString = self.attributedText;
-	
-	NSString *string = [attributedString string];
+	DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.attributedTextContentView.layoutFrame;
 	
 	NSUInteger begIndex;
 	NSUInteger endIndex;
 	
-	[string rangeOfParagraphsContainingRange:myRange parBegIndex:&begIndex parEndIndex:&endIndex];
+	[layoutFrame rangeOfParagraphsContainingRange:myRange parBegIndex:&begIndex parEndIndex:&endIndex];
 	myRange = NSMakeRange(begIndex, endIndex - begIndex); // now extended to full paragraphs
 	
 	DTTextRange *retRange = [DTTextRange rangeWithNSRange:myRange];
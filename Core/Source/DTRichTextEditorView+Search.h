@@ -0,0 +1,76 @@
+//
+//  DTRichTextEditorView+Search.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTRichTextEditorView.h"
+
+/**
+ The **Search** category enhances DTRichTextEditorView with finding and replacing text.
+ 
+ The matches of the current search string are found once and then kept up to date while the text is edited, only the modified paragraphs are searched again. A DTTextSearchIndex of the content view holds them.
+ */
+@interface DTRichTextEditorView (Search)
+
+/**
+ @name Searching
+ */
+
+/**
+ Starts a new search, replacing the current one.
+ @param searchString The string to search for, `nil` or an empty string ends searching
+ @param options The compare options, `NSCaseInsensitiveSearch` and `NSDiacriticInsensitiveSearch` are the useful ones
+ */
+- (void)setSearchString:(NSString *)searchString options:(NSStringCompareOptions)options;
+
+/**
+ The string of the current search or `nil` if there is none
+ */
+@property (nonatomic, readonly) NSString *searchString;
+
+/**
+ The number of matches of the current search in the text
+ */
+@property (nonatomic, readonly) NSUInteger numberOfSearchMatches;
+
+/**
+ @name Getting Search Matches
+ */
+
+/**
+ The ranges of the matches of the current search that intersect a range
+ @param range The text range or `nil` for the entire text
+ @returns An array of `NSValue` ranges in ascending order
+ */
+- (NSArray *)rangesOfSearchMatchesInRange:(UITextRange *)range;
+
+/**
+ Finds the next or previous match of the current search, wrapping around at the end or beginning of the text.
+ @param position The position to search from, usually the start or end of the selection
+ @param direction `UITextStorageDirectionForward` for the first match starting at or after the position, `UITextStorageDirectionBackward` for the last match ending at or before it
+ @returns The text range of the match or `nil` if there is none
+ */
+- (UITextRange *)textRangeOfSearchMatchFromPosition:(UITextPosition *)position inDirection:(UITextStorageDirection)direction;
+
+/**
+ Determines the selection rectangles for highlighting the matches visible in a rectangle, using <selectionRectsForRange:>. Only the lines in the rectangle are looked at.
+ @param rect The rectangle in the coordinates of the content view, usually the visible area
+ @returns An array of DTTextSelectionRect objects
+ */
+- (NSArray *)selectionRectsForSearchMatchesInRect:(CGRect)rect;
+
+/**
+ @name Replacing Search Matches
+ */
+
+/**
+ Replaces all matches of the current search. The text is modified in one pass, the modified paragraphs are laid out together once, and the replacement can be undone as a single step. The replacement text takes the attributes of the first character of every match.
+ @param replacement The replacement string
+ @returns The number of replaced matches
+ */
+- (NSUInteger)replaceAllSearchMatchesWithString:(NSString *)replacement;
+
+@end
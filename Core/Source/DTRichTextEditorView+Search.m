@@ -0,0 +1,287 @@
+//
+//  DTRichTextEditorView+Search.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTRichTextEditor.h"
+#import "DTRichTextEditorView+Search.h"
+#import "DTMutableCoreTextLayoutFrame.h"
+#import "DTTextSearchIndex.h"
+
+#import <DTCoreText/DTCoreText.h>
+
+@interface DTRichTextEditorView (private)
+
+- (void)updateCursorAnimated:(BOOL)animated;
+
+- (void)_inputDelegateTextWillChange;
+- (void)_inputDelegateTextDidChange;
+- (void)_editorViewDelegateDidChange;
+- (void)_undoDelta:(DTUndoDelta *)delta;
+
+- (BOOL)_isDeferringEditUpdates;
+- (void)_setSelectedRange:(NSRange)range animated:(BOOL)animated;
+
+@end
+
+
+@implementation DTRichTextEditorView (Search)
+
+#pragma mark - Searching
+
+- (DTRichTextEditorContentView *)_searchContentView
+{
+	return (DTRichTextEditorContentView *)self.attributedTextContentView;
+}
+
+- (void)setSearchString:(NSString *)searchString options:(NSStringCompareOptions)options
+{
+	DTRichTextEditorContentView *contentView = [self _searchContentView];
+
+	if (![searchString length])
+	{
+		contentView.searchIndex = nil;
+		return;
+	}
+
+	DTTextSearchIndex *searchIndex = contentView.searchIndex;
+
+	if ([searchIndex.searchString isEqualToString:searchString] && searchIndex.options == options)
+	{
+		// the matches are still valid
+		return;
+	}
+
+	contentView.searchIndex = [[DTTextSearchIndex alloc] initWithSearchString:searchString options:options];
+}
+
+- (NSString *)searchString
+{
+	return [self _searchContentView].searchIndex.searchString;
+}
+
+- (NSUInteger)numberOfSearchMatches
+{
+	return [[self _searchContentView].searchIndex numberOfMatchesInString:[self.attributedText string]];
+}
+
+#pragma mark - Getting Search Matches
+
+- (NSArray *)rangesOfSearchMatchesInRange:(UITextRange *)range
+{
+	DTTextSearchIndex *searchIndex = [self _searchContentView].searchIndex;
+
+	if (!searchIndex)
+	{
+		return [NSArray array];
+	}
+
+	NSString *string = [self.attributedText string];
+	NSRange searchRange = range ? [(DTTextRange *)range NSRangeValue] : NSMakeRange(0, [string length]);
+
+	return [searchIndex rangesOfMatchesInRange:searchRange ofString:string];
+}
+
+- (UITextRange *)textRangeOfSearchMatchFromPosition:(UITextPosition *)position inDirection:(UITextStorageDirection)direction
+{
+	DTTextSearchIndex *searchIndex = [self _searchContentView].searchIndex;
+
+	if (!searchIndex)
+	{
+		return nil;
+	}
+
+	NSString *string = [self.attributedText string];
+	NSUInteger index = position ? [(DTTextPosition *)position location] : 0;
+	NSRange match;
+
+	if (direction == UITextStorageDirectionBackward)
+	{
+		match = [searchIndex rangeOfMatchAtOrBeforeIndex:index ofString:string];
+
+		if (match.location == NSNotFound)
+		{
+			// wrap around to the last match
+			match = [searchIndex rangeOfMatchAtOrBeforeIndex:[string length] ofString:string];
+		}
+	}
+	else
+	{
+		match = [searchIndex rangeOfMatchAtOrAfterIndex:index ofString:string];
+
+		if (match.location == NSNotFound)
+		{
+			// wrap around to the first match
+			match = [searchIndex rangeOfMatchAtOrAfterIndex:0 ofString:string];
+		}
+	}
+
+	if (match.location == NSNotFound)
+	{
+		return nil;
+	}
+
+	return [DTTextRange rangeWithNSRange:match];
+}
+
+- (NSArray *)selectionRectsForSearchMatchesInRect:(CGRect)rect
+{
+	DTTextSearchIndex *searchIndex = [self _searchContentView].searchIndex;
+
+	if (!searchIndex)
+	{
+		return [NSArray array];
+	}
+
+	DTCoreTextLayoutFrame *layoutFrame = self.attributedTextContentView.layoutFrame;
+	NSArray *lines = [layoutFrame linesVisibleInRect:rect];
+
+	if (![lines count])
+	{
+		return [NSArray array];
+	}
+
+	NSRange visibleRange = NSUnionRange([[lines objectAtIndex:0] stringRange], [[lines lastObject] stringRange]);
+
+	NSMutableArray *selectionRects = [NSMutableArray array];
+
+	for (NSValue *value in [searchIndex rangesOfMatchesInRange:visibleRange ofString:[self.attributedText string]])
+	{
+		[selectionRects addObjectsFromArray:[self selectionRectsForRange:[DTTextRange rangeWithNSRange:[value rangeValue]]]];
+	}
+
+	return selectionRects;
+}
+
+#pragma mark - Replacing Search Matches
+
+- (NSUInteger)replaceAllSearchMatchesWithString:(NSString *)replacement
+{
+	DTRichTextEditorContentView *contentView = [self _searchContentView];
+	DTTextSearchIndex *searchIndex = contentView.searchIndex;
+
+	NSAttributedString *attributedText = self.attributedText;
+	NSString *string = [attributedText string];
+
+	NSArray *matches = [searchIndex rangesOfMatchesInRange:NSMakeRange(0, [string length]) ofString:string];
+	NSUInteger numberOfMatches = [matches count];
+
+	if (!numberOfMatches)
+	{
+		return 0;
+	}
+
+	if (!replacement)
+	{
+		replacement = @"";
+	}
+
+	// matches in the same or adjacent paragraphs are replaced together
+	NSMutableArray *groupRanges = [NSMutableArray array];
+	NSMutableArray *groupMatches = [NSMutableArray array];
+
+	NSRange groupRange = NSMakeRange(NSNotFound, 0);
+	NSInteger delta = 0;
+
+	for (NSValue *value in matches)
+	{
+		NSRange match = [value rangeValue];
+		NSRange paragraphRange = [string paragraphRangeForRange:match];
+
+		delta += (NSInteger)[replacement length] - (NSInteger)match.length;
+
+		if (groupRange.location != NSNotFound && paragraphRange.location <= NSMaxRange(groupRange))
+		{
+			groupRange = NSUnionRange(groupRange, paragraphRange);
+			[[groupMatches lastObject] addObject:value];
+
+			continue;
+		}
+
+		if (groupRange.location != NSNotFound)
+		{
+			[groupRanges addObject:[NSValue valueWithRange:groupRange]];
+		}
+
+		groupRange = paragraphRange;
+		[groupMatches addObject:[NSMutableArray arrayWithObject:value]];
+	}
+
+	[groupRanges addObject:[NSValue valueWithRange:groupRange]];
+
+	// a single undo step restores everything from the first to the last match
+	NSRange replacedRange = NSUnionRange([[matches objectAtIndex:0] rangeValue], [[matches lastObject] rangeValue]);
+	NSRange insertedRange = NSMakeRange(replacedRange.location, (NSUInteger)((NSInteger)replacedRange.length + delta));
+
+	DTUndoManager *undoManager = (DTUndoManager *)self.undoManager;
+	[undoManager closeAllOpenGroups];
+	[undoManager beginUndoGrouping];
+
+	DTUndoDelta *undoDelta = [DTUndoDelta deltaForReplacingRange:insertedRange withCharactersInRange:replacedRange ofAttributedString:attributedText];
+
+	if (self.selectedTextRange)
+	{
+		undoDelta.selectedRange = [(DTTextRange *)self.selectedTextRange NSRangeValue];
+	}
+
+	[self _inputDelegateTextWillChange];
+
+	// from the back so that the ranges of the groups before stay valid
+	for (NSInteger i=[groupRanges count]-1; i>=0; i--)
+	{
+		NSRange range = [[groupRanges objectAtIndex:i] rangeValue];
+		NSMutableAttributedString *fragment = [[attributedText attributedSubstringFromRange:range] mutableCopy];
+
+		for (NSValue *value in [[groupMatches objectAtIndex:i] reverseObjectEnumerator])
+		{
+			NSRange match = [value rangeValue];
+			NSRange fragmentRange = NSMakeRange(match.location - range.location, match.length);
+
+			NSDictionary *attributes = [fragment attributesAtIndex:fragmentRange.location effectiveRange:NULL];
+			NSAttributedString *replacementText = [[NSAttributedString alloc] initWithString:replacement attributes:attributes];
+
+			[fragment replaceCharactersInRange:fragmentRange withAttributedString:replacementText];
+		}
+
+		[contentView replaceTextInRange:range withTextDeferringLayout:fragment];
+	}
+
+	// an edit transaction lays out the deferred paragraphs when it is flushed
+	if (![self _isDeferringEditUpdates])
+	{
+		[contentView layoutDeferredText];
+
+		self.contentSize = contentView.frame.size;
+	}
+
+	[undoManager registerUndoDelta:undoDelta withTarget:self selector:@selector(_undoDelta:)];
+	[undoManager setActionName:NSLocalizedString(@"Replace All", @"Undo Action that replaces all search matches")];
+	[undoManager endUndoGrouping];
+
+	[self _inputDelegateTextDidChange];
+
+	if (self.isEditing)
+	{
+		// cursor goes behind the last replacement
+		[self _setSelectedRange:NSMakeRange(NSMaxRange(insertedRange), 0) animated:NO];
+	}
+	else
+	{
+		self.selectedTextRange = nil;
+	}
+
+	// attachment positions might have changed
+	[contentView layoutSubviewsInRect:self.bounds];
+
+	// cursor positions might have changed
+	[self updateCursorAnimated:NO];
+
+	[self _editorViewDelegateDidChange];
+
+	return numberOfMatches;
+}
+
+@end
@@ -43,7 +43,7 @@
 /**
  Retrieves the list indent from the leading margin to apply for a given list style
  
- This value is determined by parsing a single character HTML with the appropriate list HTML and takes the textDefaults into consideration.
+ This value is determined by parsing a single character HTML with the appropriate list HTML and takes the textDefaults into consideration. The result is cached until the textDefaults change.
  @param listStyle The CSS list style to determine the list indentation for
  @returns The indent or 0 if listStyle is `nil`
  */
@@ -7,18 +7,39 @@
 //
 
 #import "DTRichTextEditorView+Styles.h"
+#import "DTTypingAttributesCache.h"
 
 #import <DTCoreText/NSAttributedString+HTML.h>
 #import <DTCoreText/NSDictionary+DTCoreText.h>
 
+@interface DTRichTextEditorView (private)
+
+@property (nonatomic, readonly) DTTypingAttributesCache *typingAttributesCache;
+
+@end
+
+
 @implementation DTRichTextEditorView (Styles)
 
+// the snippet describes tag, class, identifier and text size, so it is the key for the style table
 - (NSDictionary *)_attributesForHTMLStringUsingTextDefaults:(NSString *)HTMLString
 {
-    NSData *data = [HTMLString dataUsingEncoding:NSUTF8StringEncoding];
+	DTTypingAttributesCache *cache = self.typingAttributesCache;
+	NSDictionary *attributes = [cache styleAttributesForHTMLString:HTMLString];
+	
+	if (attributes)
+	{
+		return attributes;
+	}
+	
+	// parsing HTML is expensive, the result only changes with the text defaults
+	NSData *data = [HTMLString dataUsingEncoding:NSUTF8StringEncoding];
 	NSAttributedString *attributedString = [[NSAttributedString alloc] initWithHTMLData:data options:[self textDefaults] documentAttributes:NULL];
 	
-	return [attributedString attributesAtIndex:0 effectiveRange:NULL];
+	attributes = [attributedString attributesAtIndex:0 effectiveRange:NULL];
+	[cache setStyleAttributes:attributes forHTMLString:HTMLString];
+	
+	return attributes;
 }
 
 - (NSDictionary *)attributesForTagName:(NSString *)tagName tagClass:(NSString *)tagClass tagIdentifier:(NSString *)tagIdentifier relativeToTextSize:(CGFloat)textSize
@@ -45,6 +45,7 @@ extern NSString * const DTRichTextEditorTextDidEndEditingNotification;
 @class DTLoupeView;
 @class DTTextSelectionView;
 @class DTCSSListStyle;
+@class DTRichTextEditorMetrics;
 
 @protocol DTRichTextEditorViewDelegate;
 
@@ -149,13 +150,49 @@ extern NSString * const DTRichTextEditorTextDidEndEditingNotification;
  */
 - (void)replaceRange:(UITextRange *)range withText:(id)text;
 
+/**
+ Begins an edit transaction. Text replacements inside a transaction modify the text right away, but relayout, redrawing, cursor updates, scrolling and change notifications are deferred until the transaction ends. They are then performed once on the next display refresh.
+ 
+ Transactions can be nested, the deferred work is done after the outermost transaction was ended. Bursts of typed text that arrive faster than the display refresh are coalesced this way automatically.
+ */
+- (void)beginEditTransaction;
+
+/**
+ Ends an edit transaction started with <beginEditTransaction>.
+ */
+- (void)endEditTransaction;
+
+/**
+ Sets the content of the receiver like <attributedText> but without making a copy of the string. A trailing paragraph break is appended in place if necessary.
+ 
+ This avoids having several copies of a large document in memory at the same time while loading it.
+ @param attributedText The new content, the receiver takes ownership of it and the caller must not modify it anymore
+ */
+- (void)adoptAttributedText:(NSMutableAttributedString *)attributedText;
+
+/**
+ @name Pasting Large Content
+ */
+
+/**
+ Whether a large paste is in progress. Large HTML or web archive content on the pasteboard is parsed in the background and long text is inserted a few paragraphs per run loop turn while a progress bar is shown at the top of the receiver. The complete paste is undone as one action.
+ 
+ Tapping the receiver or calling <cancelPasting> cancels the paste, other modifications of the text finish it with the part that has been inserted so far.
+ */
+@property (nonatomic, readonly, getter = isPasting) BOOL pasting;
+
+/**
+ Cancels a large paste that is in progress and restores the text it replaced. Does nothing if no paste is in progress.
+ */
+- (void)cancelPasting;
+
 
 /**
  @name Cursor and Selection
  */
 
 /**
- Scrolls the receiver's content view so that the cursor is visible.
+ Scrolls the receiver's content view so that the cursor is visible. Like the cursor and selection display this is done once with the next display refresh, no matter how often it is requested until then.
  @param animated If `YES` then the view is scrolled animated. If `NO` it jumps to the scroll position
  */
 - (void)scrollCursorVisibleAnimated:(BOOL)animated;
@@ -210,6 +247,34 @@ extern NSString * const DTRichTextEditorTextDidEndEditingNotification;
  */
 @property (nonatomic, copy) NSAttributedString *attributedText;
 
+/**
+ Creates an immutable copy of the current <attributedText> that is safe to use on a background queue, for example for autosaving, generating HTML or indexing for search while the user keeps typing. <attributedText> itself is the mutable text of the receiver and must not be used off the main thread.
+
+ Only the paragraphs that were modified since the previous snapshot are copied, so taking a snapshot after every change is cheap. The values of the attributes, like text attachments, are shared and not copied. Must be called on the main thread.
+ @returns The snapshot of the text
+ */
+- (NSAttributedString *)attributedTextSnapshot;
+
+/**
+ @name Limiting Memory
+ */
+
+/**
+ The number of bytes that the layout, rendering and text caches of all editors together should not exceed, this is the memory budget of the shared <DTCacheRegistry>. On memory warnings and when the app enters the background the caches are purged down to half of it, starting with the ones that are cheapest to recreate.
+ 
+ While the receiver is not in a window it keeps only the string and the height of every paragraph.
+ */
+@property (nonatomic, assign) NSUInteger cacheMemoryBudget;
+
+/**
+ @name Measuring Performance
+ */
+
+/**
+ The instrumentation of the receiver, shared with its content view. Set `enabled` to emit signposts for the main stages of editing and to aggregate counters. The delegate receives them periodically via `editorView:didUpdateMetrics:`, they can also be read at any time.
+ */
+@property (nonatomic, readonly) DTRichTextEditorMetrics *metrics;
+
 @end
 
 
@@ -322,4 +387,16 @@ extern NSString * const DTRichTextEditorTextDidEndEditingNotification;
  */
 - (BOOL)editorView:(DTRichTextEditorView *)editorView canPerformAction:(SEL)action withSender:(id)sender;
 
+/**
+ @name Measuring Performance
+ */
+
+/**
+ Tells the delegate about the current metrics of the editor view, for sending them to telemetry. Only sent while the metrics are enabled, after a change of the text and at most once per `reportingInterval` of the metrics. The counters keep growing until they are reset.
+ 
+ @param editorView The editor view that is measured.
+ @param metrics The metrics of the editor view.
+ */
+- (void)editorView:(DTRichTextEditorView *)editorView didUpdateMetrics:(DTRichTextEditorMetrics *)metrics;
+
 @end
@@ -33,7 +33,12 @@
 #import "DTRichTextEditorContentView.h"
 #import "DTRichTextEditorView+Manipulation.h"
 #import "DTUndoManager.h"
+#import "DTUndoDelta.h"
 #import "DTHTMLWriter+DTWebArchive.h"
+#import "DTRichTextImageAttachment.h"
+#import "DTTypingAttributesCache.h"
+#import "DTTextInputTokenizer.h"
+#import "DTCacheRegistry.h"
 
 
 // defines for renamed attribute names, deprecated in iOS SDK 8
@@ -55,6 +60,48 @@ NSString * const DTRichTextEditorTextDidBeginEditingNotification = @"DTRichTextE
 NSString * const DTRichTextEditorTextDidChangeNotification = @"DTRichTextEditorTextDidChangeNotification";
 NSString * const DTRichTextEditorTextDidEndEditingNotification = @"DTRichTextEditorTextDidEndEditingNotification";
 
+// typed text arriving faster than this is coalesced into edit transactions
+#define DTEditTransactionCoalescingInterval (1.0/60.0)
+
+// pasteboard HTML larger than this is parsed in the background
+#define DTPasteBackgroundParsingMinimumLength 32768
+
+// pasted text longer than this is inserted in chunks of paragraphs
+#define DTPasteChunkedInsertionMinimumLength 16384
+
+// time spent inserting chunks per run loop turn, the rest is left for drawing and touches
+#define DTPasteChunkInsertionInterval (1.0/120.0)
+
+// copied text is converted with a writer, the attributed string is not modified, so this can be done on any queue
+static DTHTMLWriter *_DTHTMLWriterForCopiedText(NSAttributedString *attributedString, CGFloat textScale)
+{
+	DTHTMLWriter *writer = [[DTHTMLWriter alloc] initWithAttributedString:attributedString];
+	writer.textScale = textScale;
+	
+	return writer;
+}
+
+static NSData *_DTWebArchiveDataForCopiedText(NSAttributedString *attributedString, CGFloat textScale, NSError **error)
+{
+	DTHTMLWriter *writer = _DTHTMLWriterForCopiedText(attributedString, textScale);
+	
+	// the pasteboard needs data, but this still avoids the intermediate web archive objects
+	NSOutputStream *stream = [NSOutputStream outputStreamToMemory];
+	[stream open];
+	
+	if (![writer writeWebArchiveToStream:stream error:error])
+	{
+		[stream close];
+		
+		return nil;
+	}
+	
+	NSData *data = [stream propertyForKey:NSStreamDataWrittenToMemoryStreamKey];
+	[stream close];
+	
+	return data;
+}
+
 // the modes that can be dragged in
 typedef enum
 {
@@ -86,6 +133,9 @@ typedef enum
 
 @property (nonatomic, retain, readonly) NSArray *editorMenuItems;
 @property (nonatomic, retain) UIPopoverController *definePopoverController; // used for presenting definitions of a selected term on the iPad
+@property (nonatomic, retain) DTHTMLAttributedStringBuilder *HTMLStringBuilder; // parsing for setHTMLString:numberOfPreviewParagraphs:completion:
+@property (nonatomic, assign) BOOL showingHTMLPreview; // the preview cannot be edited because the final text replaces it
+@property (nonatomic, readonly) DTTypingAttributesCache *typingAttributesCache; // attributes resolved for the caret and from the text defaults
 
 - (void)setDefaultText;
 - (void)showContextMenuFromSelection;
@@ -95,6 +145,11 @@ typedef enum
 - (BOOL)selectionIsVisible;
 - (void)relayoutText;
 
+- (void)_updateSubstringInRange:(NSRange)range withAttributedString:(NSAttributedString *)attributedString actionName:(NSString *)actionName;
+
+- (NSUInteger)_endOfDocumentLocation;
+- (void)_setSelectedRange:(NSRange)range animated:(BOOL)animated;
+
 @end
 
 @implementation DTRichTextEditorView
@@ -194,12 +249,62 @@ typedef enum
         // Editing Menu Items
         unsigned int delegateMenuItems:1;
         unsigned int delegateCanPerformActionsWithSender:1;
+        
+        // Measuring Performance
+        unsigned int delegateDidUpdateMetrics:1;
     } _editorViewDelegateFlags;
     
     // Use to disallow canPerformAction: to proceed up the responder chain (-nextResponder)
     BOOL _stopResponderChain;
 	
 	UIView *_autocorrectionPromptView;
+	
+	// updates resolved once per frame by the display link
+	CADisplayLink *_updateDisplayLink;
+	BOOL _needsCursorUpdate;
+	BOOL _needsAnimatedCursorUpdate;
+	BOOL _needsScrollCursorVisible;
+	BOOL _needsAnimatedScrollCursorVisible;
+	
+	// edit transactions
+	NSUInteger _editTransactionDepth;
+	BOOL _editTransactionNeedsFlush;
+	BOOL _editTransactionNeedsListUpdate;
+	NSRange _editTransactionListRange;
+	BOOL _editTransactionNeedsChangeNotification;
+	CFTimeInterval _lastInsertTextTimestamp;
+	
+	// instrumentation, the keystroke latency is measured until the next cursor update
+	DTRichTextEditorMetrics *_metrics;
+	CFTimeInterval _keystrokeTimestamp;
+	CFTimeInterval _lastMetricsReportTimestamp;
+	
+	// background HTML parsing
+	DTHTMLAttributedStringBuilder *_HTMLStringBuilder;
+	BOOL _showingHTMLPreview;
+	
+	// resolved typing attributes and text styling
+	DTTypingAttributesCache *_typingAttributesCache;
+	
+	// reused while the length of the text does not change
+	DTTextPosition *_endOfDocumentPosition;
+	
+	// multi-stage input, the composition is only registered for undo once it ends
+	NSAttributedString *_markedTextOriginalText;
+	NSRange _markedTextOriginalSelectedRange;
+	NSDictionary *_markedTextAttributes;
+	
+	// large pastes are parsed in the background and inserted paragraph by paragraph
+	BOOL _pasting;
+	NSUInteger _pasteGeneration;
+	DTHTMLAttributedStringBuilder *_pasteHTMLStringBuilder;
+	NSAttributedString *_pastingText;
+	NSUInteger _pastingTextIndex;
+	NSRange _pasteInsertedRange;
+	NSAttributedString *_pasteReplacedText;
+	NSRange _pasteOriginalSelectedRange;
+	BOOL _isInsertingPastedChunk;
+	UIProgressView *_pasteProgressView;
 }
 
 #pragma mark -
@@ -259,6 +364,14 @@ typedef enum
 	self.userInteractionEnabled = YES; 	// for autocorrection candidate view
 	self.attributedTextContentView.edgeInsets = UIEdgeInsetsMake(10, 10, 10, 10);
 	
+	// --- instrumentation, disabled until the app enables it
+	if (!_metrics)
+	{
+		_metrics = [[DTRichTextEditorMetrics alloc] init];
+	}
+	
+	[(DTRichTextEditorContentView *)self.attributedTextContentView setMetrics:_metrics];
+	
 	// --- gestures
     if (!tripleTapGesture)
     {
@@ -305,7 +418,6 @@ typedef enum
 	// --- notifications
 	
 	NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
-	[center addObserver:self selector:@selector(cursorDidBlink:) name:DTCursorViewDidBlink object:nil];
 	[center addObserver:self selector:@selector(menuDidHide:) name:UIMenuControllerDidHideMenuNotification object:nil];
 	[center addObserver:self selector:@selector(loupeDidHide:) name:DTLoupeDidHide object:nil];
 	[center addObserver:self selector:@selector(keyboardDidShow:) name:UIKeyboardDidShowNotification object:nil];
@@ -330,6 +442,8 @@ typedef enum
 - (void)dealloc
 {
     self.editorViewDelegate = nil;
+	
+	[_updateDisplayLink invalidate];
     
 	[[NSNotificationCenter defaultCenter] removeObserver:self];
 }
@@ -343,6 +457,17 @@ typedef enum
     [self setDefaults];
 }
 
+- (void)didMoveToWindow
+{
+	[super didMoveToWindow];
+	
+	if (!self.window)
+	{
+		// nobody is looking at the text, it is laid out again when needed
+		[(DTRichTextEditorContentView *)self.attributedTextContentView discardCachedLayoutAndRendering];
+	}
+}
+
 - (void)layoutSubviews
 {
 	if (![self.attributedTextContentView.layoutFrame.attributedStringFragment length])
@@ -355,6 +480,11 @@ typedef enum
     
     [_selectionView layoutSubviewsInRect:self.bounds];
 	
+	if (_pasteProgressView)
+	{
+		[self _layoutPasteProgressView];
+	}
+	
 	if (self.isDragging || self.decelerating)
 	{
 		DTLoupeView *loupe = [DTLoupeView sharedLoupe];
@@ -447,8 +577,20 @@ typedef enum
 	}
 }
 
+// the cursor stays static while the loupe is showing or dictation is pending
+- (void)_resumeCursorBlinking
+{
+	if (!_waitingForDictationResult)
+	{
+		_cursor.state = DTCursorStateBlinking;
+	}
+}
+
 - (void)loupeDidHide:(NSNotification *)notification
 {
+	[(DTRichTextEditorContentView *)self.attributedTextContentView endMagnifying];
+	[self _resumeCursorBlinking];
+	
 	if (_shouldShowContextMenuAfterLoupeHide)
 	{
 		_shouldShowContextMenuAfterLoupeHide = NO;
@@ -508,6 +650,18 @@ typedef enum
     if (!self.isEditing)
         return;
 	
+	// done once with the next display refresh, an animated request wins
+	_needsScrollCursorVisible = YES;
+	_needsAnimatedScrollCursorVisible |= animated;
+	
+	[self _setNeedsDisplayLinkUpdate];
+}
+
+- (void)_scrollCursorVisibleAnimated:(BOOL)animated
+{
+    if (!self.isEditing)
+        return;
+	
 	CGRect cursorFrame = [self caretRectForPosition:self.selectedTextRange.start];
     cursorFrame.size.width = 3.0;
 	
@@ -515,6 +669,15 @@ typedef enum
 }
 
 - (void)updateCursorAnimated:(BOOL)animated
+{
+	// mutations and selection changes only mark the cursor as dirty, it is updated once with the next display refresh
+	_needsCursorUpdate = YES;
+	_needsAnimatedCursorUpdate |= animated;
+	
+	[self _setNeedsDisplayLinkUpdate];
+}
+
+- (void)_updateCursorAnimated:(BOOL)animated
 {
 	// no selection
     if ((self.selectedTextRange == nil) || (self.isEditable && !self.isEditing) || !self.isFirstResponder)
@@ -552,7 +715,7 @@ typedef enum
 			[self addSubview:_cursor];
 		}
 		
-		[self scrollCursorVisibleAnimated:YES];
+		[self _scrollCursorVisibleAnimated:YES];
 	}
 	else
 	{
@@ -648,6 +811,12 @@ typedef enum
 	DTLoupeView *loupe = [DTLoupeView sharedLoupe];
 	loupe.targetView = self.attributedTextContentView;
 	
+	// the loupe renders the content view for every move, it should only blit paragraph bitmaps
+	[(DTRichTextEditorContentView *)self.attributedTextContentView beginMagnifying];
+	
+	// the loupe only picks up the cursor when it redraws, a blinking cursor would be captured in a random phase
+	_cursor.state = DTCursorStateStatic;
+	
 	if (_selectionView.dragHandlesVisible)
 	{
 		if (CGRectContainsPoint(_selectionView.dragHandleLeft.frame, touchPoint))
@@ -683,6 +852,9 @@ typedef enum
         // avoid presenting if there is no selection
         if (CGRectIsNull(rect))
         {
+            [(DTRichTextEditorContentView *)self.attributedTextContentView endMagnifying];
+            [self _resumeCursorBlinking];
+            
             return;
         }
         
@@ -707,6 +879,9 @@ typedef enum
         // avoid presenting if there is no selection
         if (CGRectIsNull(rect))
         {
+            [(DTRichTextEditorContentView *)self.attributedTextContentView endMagnifying];
+            [self _resumeCursorBlinking];
+            
             return;
         }
 		
@@ -728,6 +903,8 @@ typedef enum
 		loupe.style = DTLoupeStyleRectangleWithArrow;
 		loupe.magnification = 0.5;
 		
+		[self _updateCursorIfNeeded];
+		
 		CGPoint loupeStartPoint = DTCGRectCenter(_cursor.frame);
 		
 		loupe.touchPoint = loupeStartPoint;
@@ -796,6 +973,7 @@ typedef enum
 	if (_dragMode == DTDragModeCursorInsideMarking)
 	{
 		[self moveCursorToPositionClosestToLocation:touchPoint];
+		[self _updateCursorIfNeeded];
 		
 		loupe.touchPoint = DTCGRectCenter(_cursor.frame);
 		loupe.seeThroughMode = NO;
@@ -959,6 +1137,8 @@ typedef enum
 {
 	CGRect targetRect = CGRectZero;
 	
+	[self _updateCursorIfNeeded];
+	
 	if ([_selectedTextRange length])
 	{
 		targetRect = [_selectionView selectionEnvelope];
@@ -985,17 +1165,6 @@ typedef enum
 
 #pragma mark Notifications
 
-- (void)cursorDidBlink:(NSNotification *)notification
-{
-	DTLoupeView *loupe = [DTLoupeView sharedLoupe];
-	
-	// update loupe magnified image to show changed cursor
-	if ([loupe isShowing])
-	{
-		[loupe setNeedsDisplay];
-	}
-}
-
 // determine height of editor view that is covered by the keyboard
 // NOTE: on iOS 8 the input view might cover part of the view even though the keyboard is hidden
 - (void)_updateContentInsetForKeyboardNotification:(NSNotification *)notification
@@ -1111,6 +1280,13 @@ typedef enum
 		return;
 	}
 	
+	// tapping while a large paste is in progress cancels it
+	if (_pasting)
+	{
+		[self cancelPasting];
+		return;
+	}
+	
 	// If not editable, simple resign first responder (hides context menu, cursors, and selections if showing)
 	if (!self.isEditable)
 	{
@@ -1526,10 +1702,27 @@ typedef enum
     _editorViewDelegateFlags.delegateDidChangeSelection = [editorViewDelegate respondsToSelector:@selector(editorViewDidChangeSelection:)];
     _editorViewDelegateFlags.delegateMenuItems = [editorViewDelegate respondsToSelector:@selector(menuItems)];
     _editorViewDelegateFlags.delegateCanPerformActionsWithSender = [editorViewDelegate respondsToSelector:@selector(editorView:canPerformAction:withSender:)];
+    _editorViewDelegateFlags.delegateDidUpdateMetrics = [editorViewDelegate respondsToSelector:@selector(editorView:didUpdateMetrics:)];
 }
 
 #pragma mark - Editing State
 
+- (void)setShowingHTMLPreview:(BOOL)showingHTMLPreview
+{
+    if (_showingHTMLPreview == showingHTMLPreview)
+        return;
+    
+    _showingHTMLPreview = showingHTMLPreview;
+    
+    if (showingHTMLPreview && self.isFirstResponder)
+    {
+        // edits of the preview would be lost once the final text replaces it
+        self.overrideEditorViewDelegate = YES;
+        [self resignFirstResponder];
+        self.overrideEditorViewDelegate = NO;
+    }
+}
+
 @synthesize editable = _editable;
 
 - (void)setEditable:(BOOL)editable
@@ -1599,6 +1792,12 @@ typedef enum
 
 - (BOOL)canBecomeFirstResponder
 {
+    if (_showingHTMLPreview)
+    {
+        // edits would be lost once the final text replaces the preview
+        return NO;
+    }
+    
     if (self.isEditable && _editorViewDelegateFlags.delegateShouldBeginEditing && !self.overrideEditorViewDelegate && !_isChangingInputView)
     {
         return [self.editorViewDelegate editorViewShouldBeginEditing:self];
@@ -1880,37 +2079,106 @@ typedef enum
 		selectedRange.length ++;
 	}
 	
+	// a copy, so that following edits don't change what is on the pasteboard
 	NSAttributedString *attributedString = [self.attributedTextContentView.layoutFrame.attributedStringFragment attributedSubstringFromRange:selectedRange];
 	
+	// set text scale if set
+	CGFloat textScale = 1.0f;
+	NSNumber *scale = [[self textDefaults] objectForKey:NSTextSizeMultiplierDocumentOption];
+	
+	if (scale)
+	{
+		textScale = [scale floatValue];
+	}
+	
+#if defined(__IPHONE_11_0) && __IPHONE_OS_VERSION_MAX_ALLOWED >= __IPHONE_11_0
+	if ([pasteboard respondsToSelector:@selector(setItemProviders:localOnly:expirationDate:)])
+	{
+		// the representations are only generated once a consumer asks for them
+		[pasteboard setItemProviders:[NSArray arrayWithObject:[self _itemProviderForCopiedText:attributedString textScale:textScale]] localOnly:NO expirationDate:nil];
+		
+		return;
+	}
+#endif
+	
 	// plain text omits attachments and format
 	NSString *plainText = [attributedString plainTextString];
 	
-	// all HTML generation goes via a writer
-	DTHTMLWriter *writer = [[DTHTMLWriter alloc] initWithAttributedString:attributedString];
+	NSError *error = nil;
+	NSData *data = _DTWebArchiveDataForCopiedText(attributedString, textScale, &error);
 	
-	// set text scale if set
-	NSDictionary *defaults = [self textDefaults];
-	NSNumber *scale = [defaults objectForKey:NSTextSizeMultiplierDocumentOption];
-	if (scale)
+	if (!data)
 	{
-		writer.textScale = [scale floatValue];
+		NSLog(@"Unable to write web archive for copy: %@", [error localizedDescription]);
+		
+		return;
 	}
 	
-	// create a web archive
-	DTWebArchive *webArchive = [writer webArchive];
-	NSData *data = [webArchive data];
-	
 	// set multiple formats at the same time
 	NSArray *items = [NSArray arrayWithObjects:[NSDictionary dictionaryWithObjectsAndKeys:data, WebArchivePboardType, plainText, @"public.utf8-plain-text", nil], nil];
 	[pasteboard setItems:items];
 }
 
+#if defined(__IPHONE_11_0) && __IPHONE_OS_VERSION_MAX_ALLOWED >= __IPHONE_11_0
+// provides the formats of copied text on demand on a background queue, in order of decreasing fidelity
+- (NSItemProvider *)_itemProviderForCopiedText:(NSAttributedString *)attributedString textScale:(CGFloat)textScale API_AVAILABLE(ios(11.0))
+{
+	NSItemProvider *itemProvider = [[NSItemProvider alloc] init];
+	dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+	
+	[itemProvider registerDataRepresentationForTypeIdentifier:WebArchivePboardType visibility:NSItemProviderRepresentationVisibilityAll loadHandler:^NSProgress *(void (^completionHandler)(NSData *data, NSError *error)) {
+		
+		dispatch_async(queue, ^{
+			NSError *error = nil;
+			NSData *data = _DTWebArchiveDataForCopiedText(attributedString, textScale, &error);
+			
+			if (!data)
+			{
+				NSLog(@"Unable to write web archive for copy: %@", [error localizedDescription]);
+			}
+			
+			completionHandler(data, error);
+		});
+		
+		return nil;
+	}];
+	
+	[itemProvider registerDataRepresentationForTypeIdentifier:@"public.html" visibility:NSItemProviderRepresentationVisibilityAll loadHandler:^NSProgress *(void (^completionHandler)(NSData *data, NSError *error)) {
+		
+		dispatch_async(queue, ^{
+			NSString *HTMLString = [_DTHTMLWriterForCopiedText(attributedString, textScale) HTMLString];
+			
+			completionHandler([HTMLString dataUsingEncoding:NSUTF8StringEncoding], nil);
+		});
+		
+		return nil;
+	}];
+	
+	[itemProvider registerDataRepresentationForTypeIdentifier:@"public.utf8-plain-text" visibility:NSItemProviderRepresentationVisibilityAll loadHandler:^NSProgress *(void (^completionHandler)(NSData *data, NSError *error)) {
+		
+		dispatch_async(queue, ^{
+			// plain text omits attachments and format
+			NSString *plainText = [attributedString plainTextString];
+			
+			completionHandler([plainText dataUsingEncoding:NSUTF8StringEncoding], nil);
+		});
+		
+		return nil;
+	}];
+	
+	return itemProvider;
+}
+#endif
+
 - (void)paste:(id)sender
 {
 	if (!_selectedTextRange)
 	{
 		return;
 	}
+	
+	// a new paste replaces one that is still in progress
+	[self _finishPasting];
     
 	UIPasteboard *pasteboard = [UIPasteboard generalPasteboard];
 	
@@ -1920,18 +2188,45 @@ typedef enum
 	{
         Class ImageAttachmentClass = [DTTextAttachment registeredClassForTagName:@"img"];
         NSAssert([ImageAttachmentClass isSubclassOfClass:[DTImageTextAttachment class]], @"DTRichTextEditor requires DTImageTextAttachment or a subclass of it be registered for 'img' tags.");
+		
+		// draws the image downsampled in the background, unless the app registered its own attachment class
+		if (ImageAttachmentClass == [DTImageTextAttachment class])
+		{
+			ImageAttachmentClass = [DTRichTextImageAttachment class];
+		}
         
         DTImageTextAttachment *attachment = [[ImageAttachmentClass alloc] initWithElement:nil options:nil];
         attachment.contentURL = [pasteboard URL];
-		attachment.image = image;
-		attachment.originalSize = [image size];
 		
-		CGSize displaySize = image.size;
+		if ([attachment isKindOfClass:[DTRichTextImageAttachment class]])
+		{
+			// keep the encoded image, the attachment only decodes a downsampled bitmap for display
+			for (NSString *type in UIPasteboardTypeListImage)
+			{
+				NSData *imageData = [pasteboard dataForPasteboardType:type];
+				
+				if (imageData)
+				{
+					[(DTRichTextImageAttachment *)attachment setImageData:imageData MIMEType:nil];
+					break;
+				}
+			}
+		}
+		
+		if (CGSizeEqualToSize(attachment.originalSize, CGSizeZero))
+		{
+			attachment.image = image;
+			attachment.originalSize = [image size];
+		}
+		
+		CGSize imageSize = attachment.originalSize;
+		
+		CGSize displaySize = imageSize;
 		if (!CGSizeEqualToSize(_maxImageDisplaySize, CGSizeZero))
 		{
-			if (_maxImageDisplaySize.width < image.size.width || _maxImageDisplaySize.height < image.size.height)
+			if (_maxImageDisplaySize.width < imageSize.width || _maxImageDisplaySize.height < imageSize.height)
 			{
-				displaySize = DTCGSizeThatFitsKeepingAspectRatio(image.size,_maxImageDisplaySize);
+				displaySize = DTCGSizeThatFitsKeepingAspectRatio(imageSize,_maxImageDisplaySize);
 			}
 		}
         
@@ -1957,6 +2252,17 @@ typedef enum
 	
 	if (webArchive)
 	{
+		if ([webArchive.mainResource.data length] > DTPasteBackgroundParsingMinimumLength && [webArchive.mainResource.MIMEType isEqualToString:@"text/html"])
+		{
+			NSDictionary *options = [self textDefaults];
+			
+			[self _pasteAttributedStringParsedInBackground:^NSAttributedString *{
+				return [[NSAttributedString alloc] initWithWebArchive:webArchive options:options documentAttributes:NULL];
+			}];
+			
+			return;
+		}
+		
 		NSAttributedString *attributedText = [[NSAttributedString alloc] initWithWebArchive:webArchive options:[self textDefaults] documentAttributes:NULL];
 		
 		if (attributedText)
@@ -1972,7 +2278,21 @@ typedef enum
     
     if (HTMLdata)
     {
+		if ([HTMLdata length] > DTPasteBackgroundParsingMinimumLength)
+		{
+			// the builder can be aborted if the paste is cancelled while parsing
+			DTHTMLAttributedStringBuilder *builder = [[DTHTMLAttributedStringBuilder alloc] initWithHTML:HTMLdata options:[self textDefaults] documentAttributes:NULL];
+			_pasteHTMLStringBuilder = builder;
+			
+			[self _pasteAttributedStringParsedInBackground:^NSAttributedString *{
+				return [DTRichTextImageAttachment attributedStringByReplacingImageAttachmentsInAttributedString:[builder generatedAttributedString]];
+			}];
+			
+			return;
+		}
+		
 		NSAttributedString *attributedText = [[NSAttributedString alloc] initWithHTMLData:HTMLdata options:[self textDefaults] documentAttributes:NULL];
+		attributedText = [DTRichTextImageAttachment attributedStringByReplacingImageAttachmentsInAttributedString:attributedText];
         [self _pasteAttributedString:attributedText inRange:_selectedTextRange];
 		
 		return;
@@ -2015,6 +2335,13 @@ typedef enum
     
     DTUndoManager *undoManager = (DTUndoManager *)self.undoManager;
 	[undoManager closeAllOpenGroups];
+	
+	if ([attributedStringToPaste length] > DTPasteChunkedInsertionMinimumLength)
+	{
+		[self _beginInsertingPastedText:attributedStringToPaste inRange:[textRange NSRangeValue]];
+		
+		return;
+	}
     
     [self _inputDelegateTextWillChange];
     [self replaceRange:textRange withText:attributedStringToPaste];
@@ -2024,97 +2351,328 @@ typedef enum
     [self _editorViewDelegateDidChange];
 }
 
-- (void)select:(id)sender
+#pragma mark - Pasting Large Content
+
+- (BOOL)isPasting
 {
-	UITextPosition *currentPosition = (DTTextPosition *)[_selectedTextRange start];
-	UITextRange *wordRange = [self textRangeOfWordAtPosition:currentPosition];
-	
-	if (wordRange)
-	{
-		_shouldReshowContextMenuAfterHide = YES;
-		self.selectionView.dragHandlesVisible = YES;
-		
-		self.selectedTextRange = wordRange;
-	}
+	return _pasting;
 }
 
-- (void)selectAll:(id)sender
+// parses the pasted content on a background queue, the result is pasted into the selection at the time parsing finishes
+- (void)_pasteAttributedStringParsedInBackground:(NSAttributedString *(^)(void))parseBlock
 {
-	_shouldReshowContextMenuAfterHide = YES;
-    self.selectionView.dragHandlesVisible = YES;
+	_pasting = YES;
+	NSUInteger generation = _pasteGeneration;
 	
-	self.selectedTextRange = [DTTextRange textRangeFromStart:self.beginningOfDocument toEnd:self.endOfDocument];
+	[self _showPasteProgress];
+	
+	__weak DTRichTextEditorView *weakSelf = self;
+	
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		NSAttributedString *attributedText = parseBlock();
+		
+		dispatch_async(dispatch_get_main_queue(), ^{
+			DTRichTextEditorView *strongSelf = weakSelf;
+			
+			// the paste was cancelled or replaced by another one
+			if (!strongSelf || strongSelf->_pasteGeneration != generation)
+			{
+				return;
+			}
+			
+			strongSelf->_pasteHTMLStringBuilder = nil;
+			
+			if (![attributedText length] || !strongSelf->_selectedTextRange)
+			{
+				[strongSelf _endPasting];
+				
+				return;
+			}
+			
+			[strongSelf _pasteAttributedString:attributedText inRange:strongSelf->_selectedTextRange];
+			
+			if (!strongSelf->_pastingText)
+			{
+				// the delegate refused it or it was inserted right away
+				[strongSelf _endPasting];
+			}
+		});
+	});
 }
 
-- (void)define:(id)sender
+- (void)_beginInsertingPastedText:(NSAttributedString *)attributedText inRange:(NSRange)range
 {
-    if (![UIReferenceLibraryViewController class])
-        return;
-    
-    if (!self.selectedTextRange || [self.selectedTextRange isEmpty])
-        return;
-    
-    NSString *selectedTerm = [self textInRange:self.selectedTextRange];
-    
-    if (![UIReferenceLibraryViewController dictionaryHasDefinitionForTerm:selectedTerm])
-        return;
-    
-    UIReferenceLibraryViewController *dictionaryViewController = [[UIReferenceLibraryViewController alloc] initWithTerm:selectedTerm];
-    
-    if (UI_USER_INTERFACE_IDIOM() == UIUserInterfaceIdiomPhone)
-    {
-        UIApplication *application = [UIApplication sharedApplication];
-        UIWindow *window = [application keyWindow];
-        [window.rootViewController presentViewController:dictionaryViewController animated:YES completion:nil];
-    }
-    else // iPad
-    {
-        CGRect targetRect = [self visibleBoundsOfCurrentSelection];
-        
-        if (CGRectIsNull(targetRect))
-            return;
-        
-        UIPopoverController *popover = [[UIPopoverController alloc] initWithContentViewController:dictionaryViewController];
-        popover.delegate = self;
-        [popover presentPopoverFromRect:targetRect
-                                 inView:self
-               permittedArrowDirections:UIPopoverArrowDirectionAny
-                               animated:YES];
-        
-        self.definePopoverController = popover;
-    }
+	_pasting = YES;
+	_pastingText = attributedText;
+	_pastingTextIndex = 0;
+	_pasteInsertedRange = NSMakeRange(range.location, 0);
+	_pasteReplacedText = [self.attributedText attributedSubstringFromRange:range];
+	_pasteOriginalSelectedRange = [_selectedTextRange NSRangeValue];
+	
+	[self _showPasteProgress];
+	[self _insertNextPastedChunks];
 }
 
-// creates an undo manager lazily in response to a shake gesture or first edit action
-- (DTUndoManager *)undoManager
+// inserts paragraphs of the pasted text until the time for this run loop turn is used up
+- (void)_insertNextPastedChunks
 {
-    if (_undoManager == nil)
-    {
-        _undoManager = [[DTUndoManager alloc] init];
-    }
+	NSString *string = [_pastingText string];
+	NSUInteger length = [string length];
+	CFTimeInterval startTime = CACurrentMediaTime();
 	
-	return _undoManager;
-}
-
-
-#pragma mark - UIKeyInput Protocol
-
-- (BOOL)hasText
-{
-	// there should always be a \n with the default format
+	DTUndoManager *undoManager = self.undoManager;
 	
-	NSAttributedString *currentContent = self.attributedTextContentView.layoutFrame.attributedStringFragment;
+	// the whole paste is registered for undo once it is finished
+	[undoManager disableUndoRegistration];
 	
-	// has to have text
-	if ([currentContent length]>1)
+	[self _inputDelegateTextWillChange];
+	[self beginEditTransaction];
+	
+	_isInsertingPastedChunk = YES;
+	
+	while (_pastingTextIndex < length && (CACurrentMediaTime() - startTime) < DTPasteChunkInsertionInterval)
 	{
-		return YES;
+		NSRange paragraphRange = [string paragraphRangeForRange:NSMakeRange(_pastingTextIndex, 0)];
+		NSAttributedString *chunk = [_pastingText attributedSubstringFromRange:paragraphRange];
+		
+		// the first chunk replaces the selection, the following ones are appended to it
+		NSRange range = NSMakeRange(NSMaxRange(_pasteInsertedRange), _pastingTextIndex ? 0 : [_pasteReplacedText length]);
+		
+		[self replaceRange:[DTTextRange rangeWithNSRange:range] withText:chunk];
+		
+		_pasteInsertedRange.length += paragraphRange.length;
+		_pastingTextIndex = NSMaxRange(paragraphRange);
 	}
 	
-	// only a paragraph break = no text
-	if ([[currentContent string] isEqualToString:@"\n"])
+	_isInsertingPastedChunk = NO;
+	
+	[self endEditTransaction];
+	[self _inputDelegateTextDidChange];
+	
+	[undoManager enableUndoRegistration];
+	
+	if (_pastingTextIndex >= length)
 	{
-		return NO;
+		[self _finishPasting];
+		
+		return;
+	}
+	
+	_pasteProgressView.progress = (float)_pastingTextIndex / (float)length;
+	
+	// continue after drawing and touch handling had their turn
+	NSUInteger generation = _pasteGeneration;
+	__weak DTRichTextEditorView *weakSelf = self;
+	
+	dispatch_async(dispatch_get_main_queue(), ^{
+		DTRichTextEditorView *strongSelf = weakSelf;
+		
+		if (strongSelf && strongSelf->_pasteGeneration == generation && strongSelf->_pastingText)
+		{
+			[strongSelf _insertNextPastedChunks];
+		}
+	});
+}
+
+// ends a paste, the text inserted so far is kept and becomes a single undoable replacement
+- (void)_finishPasting
+{
+	if (!_pasting)
+	{
+		return;
+	}
+	
+	BOOL didInsert = (_pastingText != nil);
+	NSAttributedString *replacedText = _pasteReplacedText;
+	NSRange insertedRange = _pasteInsertedRange;
+	NSRange originalSelectedRange = _pasteOriginalSelectedRange;
+	
+	[self _endPasting];
+	
+	if (!didInsert || (!insertedRange.length && ![replacedText length]))
+	{
+		return;
+	}
+	
+	DTUndoManager *undoManager = self.undoManager;
+	[undoManager closeAllOpenGroups];
+	[undoManager beginUndoGrouping];
+	
+	DTUndoDelta *delta = [DTUndoDelta deltaForReplacingRange:insertedRange withCharactersInRange:NSMakeRange(0, [replacedText length]) ofAttributedString:replacedText];
+	delta.selectedRange = originalSelectedRange;
+	
+	[undoManager registerUndoDelta:delta withTarget:self selector:@selector(_undoDelta:)];
+	[undoManager setActionName:NSLocalizedString(@"Paste", @"Undo Action that pastes text")];
+	
+	[undoManager endUndoGrouping];
+	
+	[self _editorViewDelegateDidChange];
+}
+
+- (void)cancelPasting
+{
+	if (!_pasting)
+	{
+		return;
+	}
+	
+	BOOL didInsert = (_pastingText != nil);
+	NSAttributedString *replacedText = _pasteReplacedText;
+	NSRange insertedRange = _pasteInsertedRange;
+	NSRange originalSelectedRange = _pasteOriginalSelectedRange;
+	
+	[self _endPasting];
+	
+	if (!didInsert)
+	{
+		return;
+	}
+	
+	// restore the text the paste replaced, nothing of it remains to be undone
+	DTUndoManager *undoManager = self.undoManager;
+	[undoManager disableUndoRegistration];
+	
+	[self _inputDelegateTextWillChange];
+	[self replaceRange:[DTTextRange rangeWithNSRange:insertedRange] withText:replacedText];
+	[self _setSelectedRange:originalSelectedRange animated:NO];
+	[self _inputDelegateTextDidChange];
+	
+	[undoManager enableUndoRegistration];
+	
+	[self _editorViewDelegateDidChange];
+}
+
+// discards the paste state without modifying the text
+- (void)_endPasting
+{
+	_pasting = NO;
+	_pasteGeneration++;
+	
+	[_pasteHTMLStringBuilder abortParsing];
+	_pasteHTMLStringBuilder = nil;
+	_pastingText = nil;
+	_pasteReplacedText = nil;
+	
+	[_pasteProgressView removeFromSuperview];
+	_pasteProgressView = nil;
+}
+
+- (void)_showPasteProgress
+{
+	if (!_pasteProgressView)
+	{
+		_pasteProgressView = [[UIProgressView alloc] initWithProgressViewStyle:UIProgressViewStyleBar];
+		_pasteProgressView.autoresizingMask = UIViewAutoresizingFlexibleWidth;
+		[self addSubview:_pasteProgressView];
+	}
+	
+	_pasteProgressView.progress = 0;
+	
+	[self _layoutPasteProgressView];
+}
+
+// the progress stays at the top of the visible area while scrolling
+- (void)_layoutPasteProgressView
+{
+	CGRect visibleRect = UIEdgeInsetsInsetRect(self.bounds, self.contentInset);
+	CGFloat height = _pasteProgressView.frame.size.height;
+	
+	_pasteProgressView.frame = CGRectMake(visibleRect.origin.x, visibleRect.origin.y, visibleRect.size.width, height);
+	
+	[self bringSubviewToFront:_pasteProgressView];
+}
+
+- (void)select:(id)sender
+{
+	UITextPosition *currentPosition = (DTTextPosition *)[_selectedTextRange start];
+	UITextRange *wordRange = [self textRangeOfWordAtPosition:currentPosition];
+	
+	if (wordRange)
+	{
+		_shouldReshowContextMenuAfterHide = YES;
+		self.selectionView.dragHandlesVisible = YES;
+		
+		self.selectedTextRange = wordRange;
+	}
+}
+
+- (void)selectAll:(id)sender
+{
+	_shouldReshowContextMenuAfterHide = YES;
+    self.selectionView.dragHandlesVisible = YES;
+	
+	self.selectedTextRange = [DTTextRange textRangeFromStart:self.beginningOfDocument toEnd:self.endOfDocument];
+}
+
+- (void)define:(id)sender
+{
+    if (![UIReferenceLibraryViewController class])
+        return;
+    
+    if (!self.selectedTextRange || [self.selectedTextRange isEmpty])
+        return;
+    
+    NSString *selectedTerm = [self textInRange:self.selectedTextRange];
+    
+    if (![UIReferenceLibraryViewController dictionaryHasDefinitionForTerm:selectedTerm])
+        return;
+    
+    UIReferenceLibraryViewController *dictionaryViewController = [[UIReferenceLibraryViewController alloc] initWithTerm:selectedTerm];
+    
+    if (UI_USER_INTERFACE_IDIOM() == UIUserInterfaceIdiomPhone)
+    {
+        UIApplication *application = [UIApplication sharedApplication];
+        UIWindow *window = [application keyWindow];
+        [window.rootViewController presentViewController:dictionaryViewController animated:YES completion:nil];
+    }
+    else // iPad
+    {
+        CGRect targetRect = [self visibleBoundsOfCurrentSelection];
+        
+        if (CGRectIsNull(targetRect))
+            return;
+        
+        UIPopoverController *popover = [[UIPopoverController alloc] initWithContentViewController:dictionaryViewController];
+        popover.delegate = self;
+        [popover presentPopoverFromRect:targetRect
+                                 inView:self
+               permittedArrowDirections:UIPopoverArrowDirectionAny
+                               animated:YES];
+        
+        self.definePopoverController = popover;
+    }
+}
+
+// creates an undo manager lazily in response to a shake gesture or first edit action
+- (DTUndoManager *)undoManager
+{
+    if (_undoManager == nil)
+    {
+        _undoManager = [[DTUndoManager alloc] init];
+    }
+	
+	return _undoManager;
+}
+
+
+#pragma mark - UIKeyInput Protocol
+
+- (BOOL)hasText
+{
+	// there should always be a \n with the default format
+	
+	NSAttributedString *currentContent = self.attributedTextContentView.layoutFrame.attributedStringFragment;
+	
+	// has to have text
+	if ([currentContent length]>1)
+	{
+		return YES;
+	}
+	
+	// only a paragraph break = no text
+	if ([[currentContent string] isEqualToString:@"\n"])
+	{
+		return NO;
 	}
 	
 	// all other scenarios: no text
@@ -2133,6 +2691,33 @@ typedef enum
             return;
     }
 	
+	// coalesce bursts of input, e.g. from hardware keyboards, into one layout pass per display refresh
+	CFTimeInterval timestamp = CACurrentMediaTime();
+	
+	if (_metrics.enabled && !_keystrokeTimestamp)
+	{
+		// coalesced keystrokes are measured from the first one
+		_keystrokeTimestamp = timestamp;
+	}
+	
+	BOOL shouldCoalesce = (timestamp - _lastInsertTextTimestamp < DTEditTransactionCoalescingInterval) || _editTransactionNeedsFlush;
+	_lastInsertTextTimestamp = timestamp;
+	
+	if (shouldCoalesce)
+	{
+		[self beginEditTransaction];
+	}
+	
+	[self _insertText:text];
+	
+	if (shouldCoalesce)
+	{
+		[self endEditTransaction];
+	}
+}
+
+- (void)_insertText:(NSString *)text
+{
 	DTUndoManager *undoManager = (DTUndoManager *)self.undoManager;
 	if (!undoManager.numberOfOpenGroups)
 	{
@@ -2149,12 +2734,17 @@ typedef enum
 		text = @"";
 	}
 	
-	if (self.markedTextRange)
+	if (_markedTextOriginalText)
 	{
+		NSRange markedRange = [_markedTextRange NSRangeValue];
+		
         self.userIsTyping = YES;
-		[self replaceRange:self.markedTextRange withText:text];
+		[self _replaceMarkedTextInRange:markedRange withText:text];
+		self.markedTextRange = [DTTextRange rangeWithNSRange:NSMakeRange(markedRange.location, [text length])];
+		[self _setSelectedRange:NSMakeRange(markedRange.location + [text length], 0) animated:NO];
         self.userIsTyping = NO;
         
+		// registers the final text for undo
 		[self unmarkText];
 	}
 	else
@@ -2179,7 +2769,7 @@ typedef enum
 	[self hideContextMenu];
     
     // Notify editor delegate of change
-    [self _editorViewDelegateDidChange];
+    [self _editorViewDelegateDidChangeCoalescingInTransaction];
 }
 
 - (void)deleteBackward
@@ -2261,8 +2851,26 @@ typedef enum
 - (void)replaceRange:(DTTextRange *)range withText:(id)text
 {
 	NSParameterAssert(range);
-    
-    NSAttributedString *attributedStringBeingReplaced = nil;
+	
+	uint64_t metricsToken = [_metrics beginInterval:DTRichTextEditorMetricsIntervalReplaceText];
+	
+	if (_markedTextOriginalText)
+	{
+		// replacing text during multi-stage input, what has been composed so far needs to be undoable first
+		[self _commitMarkedText];
+	}
+	
+	if (_pastingText && !_isInsertingPastedChunk)
+	{
+		// other modifications end a large paste, what has been inserted so far stays
+		[self _finishPasting];
+	}
+	
+	if (_HTMLStringBuilder)
+	{
+		// the modified text must not be replaced by the result of a background conversion
+		[self cancelSettingHTMLString];
+	}
     
 	NSAttributedString *attributedText = self.attributedText;
 	NSString *string = [attributedText string];
@@ -2322,27 +2930,35 @@ typedef enum
 	
 	// ---
 	
-	NSUndoManager *undoManager = self.undoManager;
+	DTUndoManager *undoManager = self.undoManager;
 	[undoManager beginUndoGrouping];
 	
-	// restore selection/cursor together with the previous text
-	// the replaceRange:withText: also modifies the selection so we need to restore this first
-	[[undoManager prepareWithInvocationTarget:self] setSelectedTextRange:textRangeBeforeChange];
-	
-	// this is the string to restore if we undo
-    if (!attributedStringBeingReplaced)
-    {
-        attributedStringBeingReplaced = [attributedText attributedSubstringFromRange:myRange];
-    }
+	// the characters to restore if we undo
+	NSString *stringBeingReplaced = [string substringWithRange:myRange];
 	
 	// the range that the replacement will have afterwards
 	NSRange replacedRange = NSMakeRange(myRange.location, [text length]);
-	DTTextRange *replacedTextRange = [DTTextRange rangeWithNSRange:replacedRange];
 	
-	[[undoManager prepareWithInvocationTarget:self] replaceRange:replacedTextRange withText:(id)attributedStringBeingReplaced];
+	// the delta only stores plain characters and the attribute runs of the replaced text
+	DTUndoDelta *delta = [DTUndoDelta deltaForReplacingRange:replacedRange withCharactersInRange:myRange ofAttributedString:attributedText];
 	
-	// do the actual replacement
-	[(DTRichTextEditorContentView *)self.attributedTextContentView replaceTextInRange:myRange withText:text];
+	// restore selection/cursor together with the previous text
+	if (textRangeBeforeChange)
+	{
+		delta.selectedRange = [(DTTextRange *)textRangeBeforeChange NSRangeValue];
+	}
+	
+	[undoManager registerUndoDelta:delta withTarget:self selector:@selector(_undoDelta:)];
+	
+	// do the actual replacement, layout is done once for the whole transaction
+	if (_editTransactionDepth)
+	{
+		[(DTRichTextEditorContentView *)self.attributedTextContentView replaceTextInRange:myRange withTextDeferringLayout:text];
+	}
+	else
+	{
+		[(DTRichTextEditorContentView *)self.attributedTextContentView replaceTextInRange:myRange withText:text];
+	}
 	
 	if (![undoManager isUndoing] && ![undoManager isRedoing] && [undoManager isUndoRegistrationEnabled])
 	{
@@ -2358,50 +2974,234 @@ typedef enum
 	
 	[undoManager endUndoGrouping];
 	
-	// ----
+	// ----
+	
+	BOOL isDeferringUpdates = [self _isDeferringEditUpdates];
+	
+	if (!isDeferringUpdates)
+	{
+		self.contentSize = self.attributedTextContentView.frame.size;
+	}
+	
+    // if it's just one character remaining then set text defaults on this
+    if ([[self.attributedTextContentView.layoutFrame.attributedStringFragment string] isEqualToString:@"\n"])
+    {
+        NSDictionary *typingDefaults = [self attributedStringAttributesForTextDefaults];
+        
+        [(NSMutableAttributedString *)self.attributedTextContentView.layoutFrame.attributedStringFragment setAttributes:typingDefaults range:NSMakeRange(0, 1)];
+        [(DTRichTextEditorContentView *)self.attributedTextContentView attributesDidChangeInRange:NSMakeRange(0, 1)];
+    }
+	
+    // need to call extra because we control layouting
+    [self setNeedsLayout];
+	
+	if (self.isEditing)
+	{
+		[self _setSelectedRange:rangeToSelectAfterReplace animated:NO];
+        
+        // changing the selected text range resets the override attributes, so we need to these if the user hit enter
+        if (newlineEntered && [_selectedTextRange isEmpty])
+        {
+            // without this it takes the typing attributes of the following line, losing e.g. boldness
+            self.overrideInsertionAttributes = typingAttributes;
+        }
+	}
+	else
+	{
+		self.selectedTextRange = nil;
+	}
+	
+	[self updateCursorAnimated:NO];
+	[self scrollCursorVisibleAnimated:YES];
+    
+    self.waitingForDictionationResult = NO;
+	
+	
+	// if the number of paragraphs change we might have to renumber something
+	NSUInteger paragraphsBeforeReplacement = [stringBeingReplaced numberOfParagraphs];
+	NSUInteger paragraphsAfterReplacement = [[text string] numberOfParagraphs];
+	
+	if (paragraphsAfterReplacement != paragraphsBeforeReplacement)
+	{
+		if (isDeferringUpdates)
+		{
+			// lists are renumbered once when the transaction is flushed
+			NSRange selectedRange = [_selectedTextRange NSRangeValue];
+			_editTransactionListRange = _editTransactionNeedsListUpdate ? NSUnionRange(_editTransactionListRange, selectedRange) : selectedRange;
+			_editTransactionNeedsListUpdate = YES;
+		}
+		else
+		{
+			[self updateListsInRange:_selectedTextRange removeNonPrefixedLinesFromLists:YES];
+		}
+	}
+	
+	[_metrics endInterval:DTRichTextEditorMetricsIntervalReplaceText token:metricsToken];
+}
+
+// called by the undo manager to undo a delta, the modification registers the inverse delta for redo
+- (void)_undoDelta:(DTUndoDelta *)delta
+{
+	NSRange range = delta.range;
+	
+	if (delta.changesAttributesOnly)
+	{
+		NSMutableAttributedString *fragment = [[self.attributedText attributedSubstringFromRange:range] mutableCopy];
+		[delta revertAttributesInAttributedString:fragment];
+		
+		[self _updateSubstringInRange:range withAttributedString:fragment actionName:delta.actionName];
+	}
+	else
+	{
+		[self replaceRange:[DTTextRange rangeWithNSRange:range] withText:[delta attributedString]];
+	}
+	
+	NSRange selectedRange = delta.selectedRange;
+	
+	if (selectedRange.location != NSNotFound)
+	{
+		[self _setSelectedRange:selectedRange animated:NO];
+	}
+	else if (!delta.changesAttributesOnly)
+	{
+		self.selectedTextRange = nil;
+	}
+}
+
+#pragma mark - Edit Transactions
+
+- (void)beginEditTransaction
+{
+	_editTransactionDepth++;
+}
+
+- (void)endEditTransaction
+{
+	NSAssert(_editTransactionDepth, @"%s called without matching beginEditTransaction", __PRETTY_FUNCTION__);
+	
+	if (!_editTransactionDepth)
+	{
+		return;
+	}
+	
+	_editTransactionDepth--;
+	
+	if (_editTransactionDepth)
+	{
+		return;
+	}
+	
+	// flush with the next display refresh, later transactions until then are flushed together
+	_editTransactionNeedsFlush = YES;
+	
+	[self _setNeedsDisplayLinkUpdate];
+}
+
+- (BOOL)_isDeferringEditUpdates
+{
+	return (_editTransactionDepth || _editTransactionNeedsFlush);
+}
+
+- (void)_flushEditTransaction
+{
+	_editTransactionNeedsFlush = NO;
+	
+	[(DTRichTextEditorContentView *)self.attributedTextContentView layoutDeferredText];
+	
+	self.contentSize = self.attributedTextContentView.frame.size;
+	
+	// need to call extra because we control layouting
+	[self setNeedsLayout];
+	
+	if (_editTransactionNeedsListUpdate)
+	{
+		_editTransactionNeedsListUpdate = NO;
+		
+		[self updateListsInRange:[DTTextRange rangeWithNSRange:_editTransactionListRange] removeNonPrefixedLinesFromLists:YES];
+	}
+	
+	[self updateCursorAnimated:NO];
+	[self scrollCursorVisibleAnimated:YES];
+	
+	if (_editTransactionNeedsChangeNotification)
+	{
+		_editTransactionNeedsChangeNotification = NO;
+		
+		[self _editorViewDelegateDidChange];
+	}
+}
+
+#pragma mark - Display Link Updates
+
+// resolves a pending cursor update right away, for code that needs the current cursor or selection geometry
+- (void)_updateCursorIfNeeded
+{
+	if (!_needsCursorUpdate || [self _isDeferringEditUpdates])
+	{
+		return;
+	}
+	
+	BOOL animated = _needsAnimatedCursorUpdate;
+	
+	_needsCursorUpdate = NO;
+	_needsAnimatedCursorUpdate = NO;
+	
+	uint64_t metricsToken = [_metrics beginInterval:DTRichTextEditorMetricsIntervalCursorUpdate];
 	
-	self.contentSize = self.attributedTextContentView.frame.size;
+	[self _updateCursorAnimated:animated];
 	
-    // if it's just one character remaining then set text defaults on this
-    if ([[self.attributedTextContentView.layoutFrame.attributedStringFragment string] isEqualToString:@"\n"])
-    {
-        NSDictionary *typingDefaults = [self attributedStringAttributesForTextDefaults];
-        
-        [(NSMutableAttributedString *)self.attributedTextContentView.layoutFrame.attributedStringFragment setAttributes:typingDefaults range:NSMakeRange(0, 1)];
-    }
+	[_metrics endInterval:DTRichTextEditorMetricsIntervalCursorUpdate token:metricsToken];
+}
+
+- (void)_setNeedsDisplayLinkUpdate
+{
+	if (_updateDisplayLink)
+	{
+		return;
+	}
 	
-    // need to call extra because we control layouting
-    [self setNeedsLayout];
+	_updateDisplayLink = [CADisplayLink displayLinkWithTarget:self selector:@selector(_displayLinkDidFire:)];
+	[_updateDisplayLink addToRunLoop:[NSRunLoop mainRunLoop] forMode:NSRunLoopCommonModes];
+}
+
+- (void)_displayLinkDidFire:(CADisplayLink *)displayLink
+{
+	// the display link retains us, so we only keep it until it fired
+	[_updateDisplayLink invalidate];
+	_updateDisplayLink = nil;
 	
-	if (self.isEditing)
+	// still inside a transaction, ending it schedules the update again
+	if (_editTransactionDepth)
 	{
-		self.selectedTextRange = [DTTextRange rangeWithNSRange:rangeToSelectAfterReplace];
-        
-        // changing the selected text range resets the override attributes, so we need to these if the user hit enter
-        if (newlineEntered && [_selectedTextRange isEmpty])
-        {
-            // without this it takes the typing attributes of the following line, losing e.g. boldness
-            self.overrideInsertionAttributes = typingAttributes;
-        }
+		return;
 	}
-	else
+	
+	if (_editTransactionNeedsFlush)
 	{
-		self.selectedTextRange = nil;
+		[self _flushEditTransaction];
 	}
 	
-	[self updateCursorAnimated:NO];
-	[self scrollCursorVisibleAnimated:YES];
-    
-    self.waitingForDictionationResult = NO;
+	// flushing marks these as dirty again, but they are resolved right away
+	[_updateDisplayLink invalidate];
+	_updateDisplayLink = nil;
 	
+	[self _updateCursorIfNeeded];
 	
-	// if the number of paragraphs change we might have to renumber something
-	NSUInteger paragraphsBeforeReplacement = [[attributedStringBeingReplaced string] numberOfParagraphs];
-	NSUInteger paragraphsAfterReplacement = [[text string] numberOfParagraphs];
+	if (_keystrokeTimestamp && !_needsCursorUpdate)
+	{
+		// the keystrokes since the last update are visible now
+		[_metrics recordKeystrokeLatency:CACurrentMediaTime() - _keystrokeTimestamp];
+		_keystrokeTimestamp = 0;
+	}
 	
-	if (paragraphsAfterReplacement != paragraphsBeforeReplacement)
+	if (_needsScrollCursorVisible)
 	{
-		[self updateListsInRange:_selectedTextRange removeNonPrefixedLinesFromLists:YES];
+		BOOL animated = _needsAnimatedScrollCursorVisible;
+		
+		_needsScrollCursorVisible = NO;
+		_needsAnimatedScrollCursorVisible = NO;
+		
+		[self _scrollCursorVisibleAnimated:animated];
 	}
 }
 
@@ -2413,28 +3213,25 @@ typedef enum
 
 - (void)setSelectedTextRange:(DTTextRange *)selectedTextRange animated:(BOOL)animated
 {
-	UITextRange *newTextRange = selectedTextRange;
+	DTTextRange *newTextRange = selectedTextRange;
 	
 	if (selectedTextRange != nil)
 	{
-		// check if the selected range fits with the attributed text
-		DTTextPosition *start = (DTTextPosition *)newTextRange.start;
-		DTTextPosition *end = (DTTextPosition *)newTextRange.end;
-		
-		if ([end compare:(DTTextPosition *)[self endOfDocument]] == NSOrderedDescending)
-		{
-			end = (DTTextPosition *)[self endOfDocument];
-		}
+		// check if the selected range fits with the attributed text, only create a new range if it does not
+		NSUInteger start = selectedTextRange.start.location;
+		NSUInteger end = selectedTextRange.end.location;
+		NSUInteger endOfDocument = [self _endOfDocumentLocation];
 		
-		if ([start compare:end] == NSOrderedDescending)
+		if (end > endOfDocument || start > endOfDocument)
 		{
-			start = end;
+			end = MIN(end, endOfDocument);
+			start = MIN(start, end);
+			
+			newTextRange = [DTTextRange rangeWithNSRange:NSMakeRange(start, end - start)];
 		}
-		
-		newTextRange = [DTTextRange textRangeFromStart:start toEnd:end];
 	}
 	
-	if (_selectedTextRange && [_selectedTextRange isEqual:selectedTextRange])
+	if (_selectedTextRange && [_selectedTextRange isEqual:newTextRange])
 	{
 		// no change
 		return;
@@ -2442,6 +3239,7 @@ typedef enum
 	
 	[self willChangeValueForKey:@"selectedTextRange"];
 	
+	// ranges are immutable, this does not copy
 	_selectedTextRange = [newTextRange copy];
 	
 	[self didChangeValueForKey:@"selectedTextRange"];
@@ -2463,6 +3261,17 @@ typedef enum
 	[self setSelectedTextRange:newTextRange animated:NO];
 }
 
+// internal variant that does not create a text range if the selection does not change
+- (void)_setSelectedRange:(NSRange)range animated:(BOOL)animated
+{
+	if (_selectedTextRange && NSEqualRanges([_selectedTextRange NSRangeValue], range))
+	{
+		return;
+	}
+	
+	[self setSelectedTextRange:[DTTextRange rangeWithNSRange:range] animated:animated];
+}
+
 - (UITextRange *)markedTextRange
 {
 	// must return nil, otherwise backspacing acts weird
@@ -2476,45 +3285,103 @@ typedef enum
 
 - (void)setMarkedText:(NSString *)markedText selectedRange:(NSRange)selectedRange
 {
-    // Calculate ranges
-    DTTextRange *selectedTextRange = (DTTextRange *)self.selectedTextRange;
-    DTTextRange *markedTextRange = (DTTextRange *)self.markedTextRange;
-    DTTextRange *replaceRange = (markedTextRange) ? markedTextRange : selectedTextRange;
-    
-    DTTextPosition *markedTextRangeStart = (DTTextPosition *)replaceRange.start;
-    DTTextRange *newMarkedTextRange = [DTTextRange rangeWithNSRange:NSMakeRange(markedTextRangeStart.location, [markedText length])];
-    
-    NSRange newSelectedRange = NSMakeRange(markedTextRangeStart.location + selectedRange.location, selectedRange.length);
-    DTTextRange *newSelectedTextRange = [DTTextRange rangeWithNSRange:newSelectedRange];
-    
-    
-    // Update the text storage (We capture undo for the replacement and selectedTextRange, but calling undo will cancel multi-stage input and remove markings)
-    NSUndoManager *undoManager = self.undoManager;
-    
-    if (markedTextRange == nil)
-        [undoManager beginUndoGrouping]; // Overall marked session group began
-    
-    [undoManager beginUndoGrouping];
+	if (!markedText)
+	{
+		markedText = @"";
+	}
 	
-    [[undoManager prepareWithInvocationTarget:self.inputDelegate] textDidChange:self];
-    [[undoManager prepareWithInvocationTarget:self] setSelectedTextRange:selectedTextRange];
+	// the marked text replaces the previous marked text or the selection
+	NSRange replaceRange = _markedTextOriginalText ? [_markedTextRange NSRangeValue] : [_selectedTextRange NSRangeValue];
 	
-    self.markedTextRange = newMarkedTextRange;
-    [self replaceRange:replaceRange withText:markedText]; // Registers undo for the text replacement
-    self.selectedTextRange = newSelectedTextRange;
-    
-    [[undoManager prepareWithInvocationTarget:self] setMarkedTextRange:nil];
-    [[undoManager prepareWithInvocationTarget:self.inputDelegate] textWillChange:self];
+	if (!_markedTextOriginalText)
+	{
+		// begin multi-stage input, remember what to restore on undo once it ends
+		_markedTextOriginalText = [self.attributedText attributedSubstringFromRange:replaceRange];
+		_markedTextOriginalSelectedRange = replaceRange;
+		
+		NSDictionary *typingAttributes = self.overrideInsertionAttributes;
+		
+		if (!typingAttributes)
+		{
+			typingAttributes = [self typingAttributesForRange:_selectedTextRange];
+		}
+		
+		_markedTextAttributes = typingAttributes;
+	}
+	
+	// no undo registration and no list updates while composing, only the lines around the marked text are laid out
+	[self _replaceMarkedTextInRange:replaceRange withText:markedText];
+	
+	self.markedTextRange = [DTTextRange rangeWithNSRange:NSMakeRange(replaceRange.location, [markedText length])];
+	[self _setSelectedRange:NSMakeRange(replaceRange.location + selectedRange.location, selectedRange.length) animated:NO];
+	
+	[self updateCursorAnimated:NO];
+	[self scrollCursorVisibleAnimated:YES];
 	
-    [undoManager endUndoGrouping];
-    
-    if (markedText.length == 0)
-        [undoManager endUndoGrouping]; // Overall marked session group ended
-    
     // Notify delegate
     [self _editorViewDelegateDidChange];
 }
 
+// replaces marked text without undo registration
+- (void)_replaceMarkedTextInRange:(NSRange)range withText:(NSString *)text
+{
+	if (_replaceParagraphsWithLineFeeds)
+	{
+		text = [text stringByReplacingOccurrencesOfString:@"\n" withString:UNICODE_LINE_FEED];
+	}
+	
+	NSAttributedString *attributedText = [[NSAttributedString alloc] initWithString:text attributes:_markedTextAttributes];
+	DTRichTextEditorContentView *contentView = (DTRichTextEditorContentView *)self.attributedTextContentView;
+	
+	if (_editTransactionDepth)
+	{
+		[contentView replaceTextInRange:range withTextDeferringLayout:attributedText];
+	}
+	else
+	{
+		[contentView replaceTextInLinesOfRange:range withText:attributedText];
+	}
+	
+	if (![self _isDeferringEditUpdates])
+	{
+		self.contentSize = self.attributedTextContentView.frame.size;
+	}
+	
+    // need to call extra because we control layouting
+	[self setNeedsLayout];
+}
+
+// ends multi-stage input, the composed text becomes a single undoable replacement
+- (void)_commitMarkedText
+{
+	NSAttributedString *originalText = _markedTextOriginalText;
+	NSRange markedRange = [_markedTextRange NSRangeValue];
+	
+	_markedTextOriginalText = nil;
+	_markedTextAttributes = nil;
+	
+	if (![originalText length] && !markedRange.length)
+	{
+		// composition was cancelled
+		return;
+	}
+	
+	DTUndoManager *undoManager = self.undoManager;
+	[undoManager beginUndoGrouping];
+	
+	DTUndoDelta *delta = [DTUndoDelta deltaForReplacingRange:markedRange withCharactersInRange:NSMakeRange(0, [originalText length]) ofAttributedString:originalText];
+	delta.selectedRange = _markedTextOriginalSelectedRange;
+	
+	[undoManager registerUndoDelta:delta withTarget:self selector:@selector(_undoDelta:)];
+	
+	if (![undoManager isUndoing] && ![undoManager isRedoing] && [undoManager isUndoRegistrationEnabled])
+	{
+		[undoManager setActionName:NSLocalizedString(@"Typing", @"Undo Action when text is entered")];
+	}
+	
+	[undoManager endUndoGrouping];
+}
+
 - (void)unmarkText
 {
 	if (!_markedTextRange)
@@ -2535,47 +3402,26 @@ typedef enum
 
 - (UITextPosition *)positionFromPosition:(DTTextPosition *)position offset:(NSInteger)offset
 {
-	DTTextPosition *begin = (id)[self beginningOfDocument];
-	DTTextPosition *end = (id)[self endOfDocument];
-    
-	if (offset<0)
+	if (!offset)
 	{
-		if (([begin compare:position] == NSOrderedAscending))
-		{
-			NSInteger newLocation = position.location+offset;
-			
-			// position.location is unsigned, so we need to be careful to not underflow
-			if (newLocation>(NSInteger)begin.location)
-			{
-				return [DTTextPosition textPositionWithLocation:newLocation];
-			}
-			else
-			{
-				return begin;
-			}
-		}
-		else
-		{
-			return begin;
-		}
+		return position;
 	}
 	
-	if (offset>0)
+	// position.location is unsigned, so we need to be careful to not underflow
+	NSInteger newLocation = (NSInteger)position.location + offset;
+	NSInteger endLocation = (NSInteger)[self _endOfDocumentLocation];
+	
+	if (newLocation <= 0)
 	{
-        DTTextPosition *newPosition = [DTTextPosition textPositionWithLocation:position.location+offset];
-        
-        // return new position if it is before the document end, otherwise return end
-		if (([newPosition compare:end] == NSOrderedAscending))
-		{
-			return newPosition;
-		}
-		else
-		{
-			return end;
-		}
+		return [self beginningOfDocument];
 	}
 	
-	return position;
+	if (newLocation >= endLocation)
+	{
+		return [self endOfDocument];
+	}
+	
+	return [DTTextPosition textPositionWithLocation:newLocation];
 }
 
 
@@ -2728,13 +3574,27 @@ typedef enum
 }
 
 - (UITextPosition *)endOfDocument
+{
+	NSUInteger location = [self _endOfDocumentLocation];
+	
+	// asked for all the time, e.g. when limiting positions, so it is only created when the length changes
+	if (_endOfDocumentPosition.location != location || !_endOfDocumentPosition)
+	{
+		_endOfDocumentPosition = [DTTextPosition textPositionWithLocation:location];
+	}
+	
+	return _endOfDocumentPosition;
+}
+
+// the location of endOfDocument without creating a position
+- (NSUInteger)_endOfDocumentLocation
 {
 	if ([self hasText])
 	{
-		return [DTTextPosition textPositionWithLocation:[self.attributedTextContentView.layoutFrame.attributedStringFragment length]-1];
+		return [self.attributedTextContentView.layoutFrame.attributedStringFragment length]-1;
 	}
 	
-	return [self beginningOfDocument];
+	return 0;
 }
 
 #pragma mark Evaluating Text Positions
@@ -2812,17 +3672,27 @@ typedef enum
 
 - (UITextPosition *)closestPositionToPoint:(CGPoint)point
 {
-	NSInteger newIndex = [self.attributedTextContentView.layoutFrame closestCursorIndexToPoint:point];
+	// the line is found by binary search over the paragraphs
+	DTMutableCoreTextLayoutFrame *layoutFrame = (DTMutableCoreTextLayoutFrame *)self.attributedTextContentView.layoutFrame;
+	NSInteger newIndex = [layoutFrame closestCursorIndexToPoint:point];
     
+	if (newIndex == NSNotFound)
+	{
+		return [DTTextPosition textPositionWithLocation:newIndex];
+	}
+	
     // move cursor out of a list prefix, we don't want those
     NSAttributedString *attributedString = self.attributedText;
     
-    NSRange listPrefixRange = [attributedString rangeOfFieldAtIndex:newIndex];
-    
-    if (listPrefixRange.location != NSNotFound)
-    {
-        newIndex = NSMaxRange(listPrefixRange);
-    }
+	// this is called for every move of the loupe, so only look for the extent of a field if there is one
+	if ((NSUInteger)newIndex < [attributedString length] && [attributedString attribute:DTFieldAttribute atIndex:newIndex effectiveRange:NULL])
+	{
+		// prefixes don't extend beyond their paragraph
+		NSRange listPrefixRange;
+		[attributedString attribute:DTFieldAttribute atIndex:newIndex longestEffectiveRange:&listPrefixRange inRange:[layoutFrame rangeOfParagraphAtIndex:newIndex]];
+		
+		newIndex = NSMaxRange(listPrefixRange);
+	}
 	
 	return [DTTextPosition textPositionWithLocation:newIndex];
 }
@@ -2852,10 +3722,8 @@ typedef enum
 {
 	NSInteger index = [self.attributedTextContentView.layoutFrame closestCursorIndexToPoint:point];
 	
-	DTTextPosition *position = [DTTextPosition textPositionWithLocation:index];
-	DTTextRange *range = [DTTextRange textRangeFromStart:position toEnd:position];
-	
-	return range;
+	// an empty range only has a single position
+	return [DTTextRange rangeWithNSRange:NSMakeRange(index, 0)];
 }
 
 #pragma mark Text Input Delegate and Text Input Tokenizer
@@ -2865,7 +3733,7 @@ typedef enum
 {
 	if (!tokenizer)
 	{
-		tokenizer = [[UITextInputStringTokenizer alloc] initWithTextInput:self];
+		tokenizer = [[DTTextInputTokenizer alloc] initWithEditorView:self];
 	}
 	
 	return tokenizer;
@@ -2879,7 +3747,7 @@ typedef enum
 		return nil;
 	}
 	
-	if ([position isEqual:(id)[self endOfDocument]])
+	if (position.location == [self _endOfDocumentLocation])
 	{
 		direction = UITextStorageDirectionBackward;
 	}
@@ -2899,6 +3767,16 @@ typedef enum
 		ctStyles = [self.attributedTextContentView.layoutFrame.attributedStringFragment attributesAtIndex:position.location effectiveRange:NULL];
 	}
 	
+	// UIKit asks for the styling often, it only changes with the attribute run
+	DTTypingAttributesCache *cache = self.typingAttributesCache;
+	UIColor *backgroundColor = self.backgroundColor;
+	NSDictionary *cachedStyles = [cache textStylingForRunAttributes:ctStyles backgroundColor:backgroundColor];
+	
+	if (cachedStyles)
+	{
+		return cachedStyles;
+	}
+	
 	/* TODO: Return typingAttributes, if position is the same as the insertion point? */
 	
 	NSMutableDictionary *uiStyles = [ctStyles mutableCopy];
@@ -2919,11 +3797,13 @@ typedef enum
 		[uiStyles setObject:[UIColor colorWithCGColor:cgColor] forKey:DTTextInputTextColorKey];
 	}
 	
-	if (self.backgroundColor)
+	if (backgroundColor)
 	{
-		[uiStyles setObject:self.backgroundColor forKey:DTTextInputTextBackgroundColorKey];
+		[uiStyles setObject:backgroundColor forKey:DTTextInputTextBackgroundColorKey];
 	}
 	
+	[cache setTextStyling:uiStyles forRunAttributes:ctStyles backgroundColor:backgroundColor];
+	
 	return uiStyles;
 }
 
@@ -3012,6 +3892,8 @@ typedef enum
 	if (_textDefaults != textDefaults)
 	{
 		_textDefaults = textDefaults;
+		
+		[_typingAttributesCache removeAllObjects];
         
         // extract values
         
@@ -3052,6 +3934,51 @@ typedef enum
 	}
 }
 
+- (void)setMaxImageDisplaySize:(CGSize)maxImageDisplaySize
+{
+	_maxImageDisplaySize = maxImageDisplaySize;
+	
+	[_typingAttributesCache removeAllObjects];
+}
+
+- (void)setDefaultFontFamily:(NSString *)defaultFontFamily
+{
+	_defaultFontFamily = [defaultFontFamily copy];
+	
+	[_typingAttributesCache removeAllObjects];
+}
+
+- (void)setDefaultFontSize:(CGFloat)defaultFontSize
+{
+	_defaultFontSize = defaultFontSize;
+	
+	[_typingAttributesCache removeAllObjects];
+}
+
+- (void)setBaseURL:(NSURL *)baseURL
+{
+	_baseURL = [baseURL copy];
+	
+	[_typingAttributesCache removeAllObjects];
+}
+
+- (void)setTextSizeMultiplier:(CGFloat)textSizeMultiplier
+{
+	_textSizeMultiplier = textSizeMultiplier;
+	
+	[_typingAttributesCache removeAllObjects];
+}
+
+- (DTTypingAttributesCache *)typingAttributesCache
+{
+	if (!_typingAttributesCache)
+	{
+		_typingAttributesCache = [[DTTypingAttributesCache alloc] init];
+	}
+	
+	return _typingAttributesCache;
+}
+
 // helper method for wrapping a text attachment, optionally in its own paragraph
 - (NSAttributedString *)attributedStringForTextRange:(DTTextRange *)textRange wrappingAttachment:(DTTextAttachment *)attachment inParagraph:(BOOL)inParagraph
 {
@@ -3174,6 +4101,19 @@ typedef enum
     }
 }
 
+// defers the change notification to the flush of a running edit transaction
+- (void)_editorViewDelegateDidChangeCoalescingInTransaction
+{
+	if ([self _isDeferringEditUpdates])
+	{
+		_editTransactionNeedsChangeNotification = YES;
+		
+		return;
+	}
+	
+	[self _editorViewDelegateDidChange];
+}
+
 - (void)_editorViewDelegateDidChange
 {
     // Notify delegate
@@ -3184,6 +4124,28 @@ typedef enum
     
     // Post DTRichTextEditorTextDidChangeNotification
     [[NSNotificationCenter defaultCenter] postNotificationName:DTRichTextEditorTextDidChangeNotification object:self];
+    
+    [self _editorViewDelegateDidUpdateMetricsIfNeeded];
+}
+
+// reports the metrics to the delegate at most once per reporting interval
+- (void)_editorViewDelegateDidUpdateMetricsIfNeeded
+{
+    if (!_metrics.enabled || !_editorViewDelegateFlags.delegateDidUpdateMetrics)
+    {
+        return;
+    }
+    
+    CFTimeInterval timestamp = CACurrentMediaTime();
+    
+    if (_lastMetricsReportTimestamp && timestamp - _lastMetricsReportTimestamp < _metrics.reportingInterval)
+    {
+        return;
+    }
+    
+    _lastMetricsReportTimestamp = timestamp;
+    
+    [self.editorViewDelegate editorView:self didUpdateMetrics:_metrics];
 }
 
 #pragma mark - UIPopoverControllerDelegate
@@ -3202,14 +4164,8 @@ typedef enum
 {
 	if (newAttributedText && newAttributedText.length > 0)
 	{
-		NSMutableAttributedString *tmpString = [newAttributedText mutableCopy];
-		
-		if (![[tmpString string] hasSuffix:@"\n"])
-		{
-			[tmpString appendString:@"\n"];
-		}
-		
-		[self _setAttributedText:tmpString];
+		// the only copy, the layout frame adopts it
+		[self adoptAttributedText:[newAttributedText mutableCopy]];
 	}
 	else
 	{
@@ -3218,13 +4174,56 @@ typedef enum
 	}
 }
 
-- (void)_setAttributedText:(NSAttributedString *)newAttributedText
+- (void)adoptAttributedText:(NSMutableAttributedString *)attributedText
+{
+	// the new text must not be replaced by the result of a background conversion
+	[self cancelSettingHTMLString];
+	
+	[self _adoptAttributedText:attributedText layingOutLazily:NO];
+}
+
+// the preview and result of setHTMLString:numberOfPreviewParagraphs:completion: don't cancel their own conversion
+- (void)_adoptAttributedText:(NSMutableAttributedString *)attributedText layingOutLazily:(BOOL)layingOutLazily
+{
+	// a paste into the previous text cannot continue
+	[self _endPasting];
+	
+	if (![attributedText length])
+	{
+		[self setDefaultText];
+		
+		return;
+	}
+	
+	if (![[attributedText string] hasSuffix:@"\n"])
+	{
+		[attributedText appendString:@"\n"];
+	}
+	
+	[self _setAttributedText:attributedText layingOutLazily:layingOutLazily];
+}
+
+- (void)_setAttributedText:(NSMutableAttributedString *)newAttributedText layingOutLazily:(BOOL)layingOutLazily
 {
     // setting new text should remove all selections
 	[self unmarkText];
     
     [self _inputDelegateTextWillChange];
+	
+	DTRichTextEditorContentView *contentView = (DTRichTextEditorContentView *)self.attributedTextContentView;
+	
+	// loads the string without copying, the super call then finds it already set
+	if (layingOutLazily)
+	{
+		[contentView adoptAttributedStringLayingOutLazily:newAttributedText];
+	}
+	else
+	{
+		[contentView adoptAttributedString:newAttributedText];
+	}
+	
     [super setAttributedString:newAttributedText];
+	
     [self _inputDelegateTextDidChange];
     
     [self setNeedsLayout];
@@ -3247,6 +4246,11 @@ typedef enum
 	return self.attributedTextContentView.layoutFrame.attributedStringFragment;
 }
 
+- (NSAttributedString *)attributedTextSnapshot
+{
+	return [(DTRichTextEditorContentView *)self.attributedTextContentView attributedStringSnapshot];
+}
+
 - (NSAttributedString *)attributedString
 {
     return [super attributedString];
@@ -3254,6 +4258,12 @@ typedef enum
 
 - (void)setMarkedTextRange:(UITextRange *)markedTextRange
 {
+	if (!markedTextRange && _markedTextOriginalText)
+	{
+		// multi-stage input ends, e.g. by unmarkText or a tap
+		[self _commitMarkedText];
+	}
+	
 	if (markedTextRange != _markedTextRange)
 	{
 		[self willChangeValueForKey:@"markedTextRange"];
@@ -3433,6 +4443,16 @@ typedef enum
 	[super setFrame:frame];
 }
 
+- (void)setCacheMemoryBudget:(NSUInteger)cacheMemoryBudget
+{
+	[DTCacheRegistry sharedRegistry].memoryBudget = cacheMemoryBudget;
+}
+
+- (NSUInteger)cacheMemoryBudget
+{
+	return [DTCacheRegistry sharedRegistry].memoryBudget;
+}
+
 - (void)setWaitingForDictionationResult:(BOOL)waitingForDictionationResult
 {
     if (_waitingForDictationResult != waitingForDictionationResult)
@@ -3485,6 +4505,9 @@ typedef enum
 
 @synthesize userIsTyping = _userIsTyping;
 @synthesize keepCurrentUndoGroup = _keepCurrentUndoGroup;
+@synthesize HTMLStringBuilder = _HTMLStringBuilder;
+@synthesize showingHTMLPreview = _showingHTMLPreview;
+@synthesize metrics = _metrics;
 
 @end
 
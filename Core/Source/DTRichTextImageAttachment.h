@@ -0,0 +1,82 @@
+//
+//  DTRichTextImageAttachment.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <DTCoreText/DTImageTextAttachment.h>
+
+/**
+ Posted on the main thread when an image attachment finished decoding the bitmap it displays. The object of the notification is the attachment.
+ */
+extern NSString * const DTRichTextImageAttachmentDidDecodeImageNotification;
+
+/**
+ Image attachment that never draws the full resolution image. Instead it decodes and downsamples the image to its `displaySize` multiplied by the scale it is drawn with on a background queue. A placeholder is drawn until the downsampled bitmap is ready, <DTRichTextImageAttachmentDidDecodeImageNotification> tells the content view to redraw the attachment.
+
+ Only the downsampled bitmap stays in memory, it is kept in a shared cache that gets purged under memory pressure. The attachment keeps the encoded <imageData> as source and decodes again the next time it is drawn. The `image` property returns a new image decoded from the data each time, so that exporting the attachment continues to work.
+
+ The editor does not register this class for `img` tags, parsing in the rest of the app is not affected. Instead the editor converts the plain DTImageTextAttachment instances of the HTML and web archives it parses itself with <attributedStringByReplacingImageAttachmentsInAttributedString:>. Subclasses of DTImageTextAttachment that the app registered are kept.
+ */
+@interface DTRichTextImageAttachment : DTImageTextAttachment
+
+/**
+ @name Converting Attachments
+ */
+
+/**
+ Replaces the plain DTImageTextAttachment instances of an attributed string with instances of the receiver that show the same image at the same size. Attachments of other classes, including subclasses of DTImageTextAttachment, are not changed.
+ @param attributedString The attributed string, usually straight out of the HTML parser
+ @returns A copy with the replaced attachments, or the attributed string itself if it contains no plain image attachments
+ */
++ (NSAttributedString *)attributedStringByReplacingImageAttachmentsInAttributedString:(NSAttributedString *)attributedString;
+
+/**
+ @name Setting the Image Source
+ */
+
+/**
+ Sets the encoded image the receiver displays, for example the data of a pasted image or of a web archive resource. The original size is determined from the image header without decoding the image.
+ 
+ The original bytes are also used when the receiver is exported to HTML or a web archive, the image is not encoded again.
+ @param data The encoded image data
+ @param MIMEType The MIME type of the data, if `nil` it is determined from the data
+ */
+- (void)setImageData:(NSData *)data MIMEType:(NSString *)MIMEType;
+
+/**
+ The encoded image data, `nil` if the image was set directly.
+ */
+@property (nonatomic, readonly) NSData *imageData;
+
+/**
+ The MIME type of <imageData>, `nil` if the image was set directly or the type is unknown.
+ */
+@property (nonatomic, readonly) NSString *MIMEType;
+
+/**
+ @name Decoding
+ */
+
+/**
+ Determines whether the downsampled bitmap for drawing the receiver with a given scale is available. Attachments that are still being decoded draw a placeholder.
+ @param scale The scale of the drawing context
+ @returns `YES` if the receiver can be drawn without waiting for the decoding queue
+ */
+- (BOOL)hasDisplayImageForScale:(CGFloat)scale;
+
+/**
+ The downsampled bitmap for displaying the receiver with a given scale, for example in a custom attachment view. If there is none for this scale yet then decoding is started and <DTRichTextImageAttachmentDidDecodeImageNotification> is posted once it is done.
+ @param scale The scale of the screen or drawing context
+ @returns The best bitmap available right now, it might be one for a lower scale, or `nil` if the receiver is still being decoded
+ */
+- (UIImage *)displayImageForScale:(CGFloat)scale;
+
+/**
+ Removes the downsampled bitmap of the receiver, it is decoded again the next time the receiver is drawn.
+ */
+- (void)discardDisplayImage;
+
+@end
@@ -0,0 +1,541 @@
+//
+//  DTRichTextImageAttachment.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTRichTextImageAttachment.h"
+#import "DTCacheRegistry.h"
+
+#import <ImageIO/ImageIO.h>
+#import <DTCoreText/DTCoreText.h>
+#import <DTFoundation/DTBase64Coding.h>
+
+NSString * const DTRichTextImageAttachmentDidDecodeImageNotification = @"DTRichTextImageAttachmentDidDecodeImageNotification";
+
+// the downsampled bitmaps of all attachments share this limit
+#define DTRichTextImageAttachmentDisplayImagesCostLimit (32 * 1024 * 1024)
+
+// NSCache does not tell its total cost, so it is tracked for the cache registry
+@interface DTDisplayImageCache : NSCache <DTCacheRegistryCache, NSCacheDelegate>
+
+@end
+
+@implementation DTDisplayImageCache
+{
+	NSUInteger _cacheCost;
+}
+
+- (id)init
+{
+	self = [super init];
+
+	if (self)
+	{
+		self.delegate = self;
+	}
+
+	return self;
+}
+
+- (void)setObject:(id)obj forKey:(id)key cost:(NSUInteger)cost
+{
+	// replacing an image evicts the previous one
+	[self removeObjectForKey:key];
+
+	@synchronized(self)
+	{
+		_cacheCost += cost;
+	}
+
+	[super setObject:obj forKey:key cost:cost];
+}
+
+- (void)cache:(NSCache *)cache willEvictObject:(id)obj
+{
+	CGImageRef image = [(UIImage *)obj CGImage];
+	NSUInteger cost = CGImageGetBytesPerRow(image) * CGImageGetHeight(image);
+
+	@synchronized(self)
+	{
+		_cacheCost -= MIN(cost, _cacheCost);
+	}
+}
+
+- (NSUInteger)cacheCost
+{
+	@synchronized(self)
+	{
+		return _cacheCost;
+	}
+}
+
+- (void)purgeCache
+{
+	[self removeAllObjects];
+}
+
+@end
+
+
+static NSCache *_DTDisplayImageCache(void)
+{
+	static DTDisplayImageCache *cache = nil;
+	static dispatch_once_t onceToken;
+
+	dispatch_once(&onceToken, ^{
+		cache = [[DTDisplayImageCache alloc] init];
+		cache.name = @"DTRichTextImageAttachment Display Images";
+		cache.totalCostLimit = DTRichTextImageAttachmentDisplayImagesCostLimit;
+
+		[[DTCacheRegistry sharedRegistry] registerCache:cache evictionOrder:DTCacheEvictionOrderRendering];
+	});
+
+	return cache;
+}
+
+// serial, so that only one full size image is being decoded at any time
+static dispatch_queue_t _DTImageDecodingQueue(void)
+{
+	static dispatch_queue_t queue = NULL;
+	static dispatch_once_t onceToken;
+
+	dispatch_once(&onceToken, ^{
+		queue = dispatch_queue_create("DTRichTextImageAttachment Decoding Queue", DISPATCH_QUEUE_SERIAL);
+	});
+
+	return queue;
+}
+
+// lets ImageIO decode only as many pixels as needed, this also applies the EXIF orientation
+static CGImageRef _DTCreateDownsampledImageWithData(NSData *data, CGFloat maxPixelSize)
+{
+	CGImageSourceRef source = CGImageSourceCreateWithData((__bridge CFDataRef)data, NULL);
+
+	if (!source)
+	{
+		return NULL;
+	}
+
+	NSDictionary *options = @{(__bridge id)kCGImageSourceCreateThumbnailFromImageAlways: @YES,
+		(__bridge id)kCGImageSourceCreateThumbnailWithTransform: @YES,
+		(__bridge id)kCGImageSourceThumbnailMaxPixelSize: @(maxPixelSize)};
+
+	CGImageRef image = CGImageSourceCreateThumbnailAtIndex(source, 0, (__bridge CFDictionaryRef)options);
+	CFRelease(source);
+
+	return image;
+}
+
+// images without data source have to be drawn at the reduced size
+static CGImageRef _DTCreateDownsampledImageWithImage(UIImage *image, CGFloat maxPixelSize)
+{
+	CGSize pixelSize = CGSizeMake(image.size.width * image.scale, image.size.height * image.scale);
+	CGFloat factor = MIN(1.0f, maxPixelSize / MAX(pixelSize.width, pixelSize.height));
+	CGSize size = CGSizeMake(ceilf(pixelSize.width * factor), ceilf(pixelSize.height * factor));
+
+	if (size.width < 1.0f || size.height < 1.0f)
+	{
+		return NULL;
+	}
+
+	UIGraphicsBeginImageContextWithOptions(size, NO, 1.0f);
+	[image drawInRect:CGRectMake(0, 0, size.width, size.height)];
+	CGImageRef downsampledImage = CGImageRetain(UIGraphicsGetImageFromCurrentImageContext().CGImage);
+	UIGraphicsEndImageContext();
+
+	return downsampledImage;
+}
+
+// forces decompression, otherwise the first draw of the result would do that on a drawing thread
+static UIImage *_DTDecompressedImage(CGImageRef image, CGFloat scale)
+{
+	size_t width = CGImageGetWidth(image);
+	size_t height = CGImageGetHeight(image);
+
+	CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+	CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little);
+	CGColorSpaceRelease(colorSpace);
+
+	if (!context)
+	{
+		return nil;
+	}
+
+	CGContextDrawImage(context, CGRectMake(0, 0, width, height), image);
+	CGImageRef decompressedImage = CGBitmapContextCreateImage(context);
+	CGContextRelease(context);
+
+	UIImage *result = [UIImage imageWithCGImage:decompressedImage scale:scale orientation:UIImageOrientationUp];
+	CGImageRelease(decompressedImage);
+
+	return result;
+}
+
+
+// the types ImageIO reads that have an official MIME type
+static NSString *_DTMIMETypeForImageType(NSString *type)
+{
+	static NSDictionary *MIMETypes = nil;
+	static dispatch_once_t onceToken;
+
+	dispatch_once(&onceToken, ^{
+		MIMETypes = @{@"public.jpeg": @"image/jpeg",
+			@"public.png": @"image/png",
+			@"com.compuserve.gif": @"image/gif",
+			@"public.tiff": @"image/tiff",
+			@"com.microsoft.bmp": @"image/bmp"};
+	});
+
+	return [MIMETypes objectForKey:type];
+}
+
+
+@implementation DTRichTextImageAttachment
+{
+	NSData *_imageData;
+	NSString *_MIMEType;
+
+	// the scale currently being decoded for, 0 if not decoding
+	CGFloat _decodingScale;
+}
+
+- (void)dealloc
+{
+	[_DTDisplayImageCache() removeObjectForKey:[self _displayImageCacheKey]];
+}
+
+#pragma mark - Converting Attachments
+
+// takes over what the parser determined for the attachment
+- (instancetype)_initWithImageAttachment:(DTImageTextAttachment *)attachment
+{
+	self = [super initWithElement:nil options:nil];
+	
+	if (self)
+	{
+		self.contentURL = attachment.contentURL;
+		self.hyperLinkURL = attachment.hyperLinkURL;
+		self.hyperLinkGUID = attachment.hyperLinkGUID;
+		self.attributes = attachment.attributes;
+		self.verticalAlignment = attachment.verticalAlignment;
+		self.originalSize = attachment.originalSize;
+		self.displaySize = attachment.displaySize;
+		
+		NSURL *contentURL = attachment.contentURL;
+		
+		// local and embedded images are decoded from their URL when drawn, only others have to keep the image
+		if (![contentURL isFileURL] && ![[contentURL scheme] isEqualToString:@"data"])
+		{
+			[super setImage:attachment.image];
+		}
+	}
+	
+	return self;
+}
+
++ (NSAttributedString *)attributedStringByReplacingImageAttachmentsInAttributedString:(NSAttributedString *)attributedString
+{
+	NSRange entireRange = NSMakeRange(0, [attributedString length]);
+	NSMutableArray *ranges = [NSMutableArray array];
+	
+	[attributedString enumerateAttribute:NSAttachmentAttributeName inRange:entireRange options:0 usingBlock:^(id attachment, NSRange range, BOOL *stop) {
+		
+		// subclasses were registered by the app and are kept
+		if ([attachment class] == [DTImageTextAttachment class])
+		{
+			[ranges addObject:[NSValue valueWithRange:range]];
+		}
+	}];
+	
+	if (![ranges count])
+	{
+		return attributedString;
+	}
+	
+	NSMutableAttributedString *mutableAttributedString = [attributedString mutableCopy];
+	
+	for (NSValue *value in ranges)
+	{
+		NSRange range = [value rangeValue];
+		
+		DTImageTextAttachment *attachment = [mutableAttributedString attribute:NSAttachmentAttributeName atIndex:range.location effectiveRange:NULL];
+		DTRichTextImageAttachment *imageAttachment = [[self alloc] _initWithImageAttachment:attachment];
+		
+		// the run delegate sizes the attachment and refers to it as well
+		CTRunDelegateRef embeddedObjectRunDelegate = createEmbeddedObjectRunDelegate((id)imageAttachment);
+		[mutableAttributedString addAttribute:(id)kCTRunDelegateAttributeName value:(__bridge id)embeddedObjectRunDelegate range:range];
+		CFRelease(embeddedObjectRunDelegate);
+		
+		[mutableAttributedString addAttribute:NSAttachmentAttributeName value:imageAttachment range:range];
+		
+		CTFontRef font = (__bridge CTFontRef)[mutableAttributedString attribute:(id)kCTFontAttributeName atIndex:range.location effectiveRange:NULL];
+		
+		if (font)
+		{
+			[imageAttachment adjustVerticalAlignmentForFont:font];
+		}
+	}
+	
+	return mutableAttributedString;
+}
+
+#pragma mark - Drawing
+
+- (void)drawInRect:(CGRect)rect context:(CGContextRef)context
+{
+	// tiled layers draw with the scale of their zoom level
+	CGAffineTransform transform = CGContextGetCTM(context);
+	CGFloat scale = sqrtf(transform.a * transform.a + transform.b * transform.b);
+
+	UIImage *displayImage = [self displayImageForScale:scale];
+
+	// a bitmap decoded for a lower zoom level is still better than the placeholder
+	if (displayImage)
+	{
+		CGContextDrawImage(context, rect, displayImage.CGImage);
+
+		return;
+	}
+
+	CGContextSaveGState(context);
+	CGContextSetFillColorWithColor(context, [UIColor colorWithWhite:0.9f alpha:1.0f].CGColor);
+	CGContextFillRect(context, rect);
+	CGContextRestoreGState(context);
+}
+
+#pragma mark - Decoding
+
+- (id)_displayImageCacheKey
+{
+	// the cache entry is removed in dealloc, so the address cannot be reused while it exists
+	return [NSValue valueWithNonretainedObject:self];
+}
+
+- (BOOL)hasDisplayImageForScale:(CGFloat)scale
+{
+	UIImage *displayImage = [_DTDisplayImageCache() objectForKey:[self _displayImageCacheKey]];
+
+	return (displayImage && displayImage.scale >= scale);
+}
+
+- (UIImage *)displayImageForScale:(CGFloat)scale
+{
+	UIImage *displayImage = [_DTDisplayImageCache() objectForKey:[self _displayImageCacheKey]];
+
+	if (!displayImage || displayImage.scale < scale)
+	{
+		[self _decodeDisplayImageWithScale:scale];
+	}
+
+	return displayImage;
+}
+
+- (void)discardDisplayImage
+{
+	[_DTDisplayImageCache() removeObjectForKey:[self _displayImageCacheKey]];
+}
+
+- (void)_decodeDisplayImageWithScale:(CGFloat)scale
+{
+	CGSize size = self.displaySize;
+
+	if (CGSizeEqualToSize(size, CGSizeZero))
+	{
+		size = self.originalSize;
+	}
+
+	CGFloat maxPixelSize = ceilf(MAX(size.width, size.height) * scale);
+
+	if (maxPixelSize < 1.0f)
+	{
+		return;
+	}
+
+	@synchronized(self)
+	{
+		if (_decodingScale >= scale)
+		{
+			return;
+		}
+
+		_decodingScale = scale;
+	}
+
+	// the source is only read on the decoding queue, the file or data URL is not kept in memory
+	NSData *data = _imageData;
+	NSURL *URL = nil;
+	UIImage *image = nil;
+
+	if (!data)
+	{
+		NSURL *contentURL = self.contentURL;
+
+		if ([contentURL isFileURL] || [[contentURL scheme] isEqualToString:@"data"])
+		{
+			URL = contentURL;
+		}
+		else
+		{
+			image = [super image];
+		}
+	}
+
+	NSCache *cache = _DTDisplayImageCache();
+	id cacheKey = [self _displayImageCacheKey];
+
+	dispatch_async(_DTImageDecodingQueue(), ^{
+
+		CGImageRef downsampledImage = NULL;
+
+		NSData *sourceData = data;
+
+		if (!sourceData && URL)
+		{
+			sourceData = [NSData dataWithContentsOfURL:URL options:NSDataReadingMappedIfSafe error:NULL];
+		}
+
+		if (sourceData)
+		{
+			downsampledImage = _DTCreateDownsampledImageWithData(sourceData, maxPixelSize);
+		}
+		else if (image)
+		{
+			downsampledImage = _DTCreateDownsampledImageWithImage(image, maxPixelSize);
+		}
+
+		UIImage *displayImage = nil;
+
+		if (downsampledImage)
+		{
+			displayImage = _DTDecompressedImage(downsampledImage, scale);
+			CGImageRelease(downsampledImage);
+		}
+
+		if (displayImage)
+		{
+			NSUInteger cost = CGImageGetBytesPerRow(displayImage.CGImage) * CGImageGetHeight(displayImage.CGImage);
+			[cache setObject:displayImage forKey:cacheKey cost:cost];
+		}
+		else
+		{
+			NSLog(@"Unable to decode image for attachment %@", self);
+		}
+
+		dispatch_async(dispatch_get_main_queue(), ^{
+
+			@synchronized(self)
+			{
+				_decodingScale = 0;
+			}
+
+			if (displayImage)
+			{
+				[[NSNotificationCenter defaultCenter] postNotificationName:DTRichTextImageAttachmentDidDecodeImageNotification object:self];
+			}
+		});
+	});
+}
+
+#pragma mark - HTML Export
+
+- (NSString *)dataURLRepresentation
+{
+	if (!_imageData || !_MIMEType)
+	{
+		return [super dataURLRepresentation];
+	}
+
+	// embeds the original bytes instead of encoding the image as PNG
+	NSString *encodedData = [DTBase64Coding stringByEncodingData:_imageData];
+
+	return [NSString stringWithFormat:@"data:%@;base64,%@", _MIMEType, encodedData];
+}
+
+#pragma mark - Properties
+
+- (void)setImageData:(NSData *)data MIMEType:(NSString *)MIMEType
+{
+	[super setImage:nil];
+	[self discardDisplayImage];
+
+	_imageData = data;
+	_MIMEType = [MIMEType copy];
+
+	if (!data)
+	{
+		return;
+	}
+
+	// the header is enough to get the size
+	CGImageSourceRef source = CGImageSourceCreateWithData((__bridge CFDataRef)data, NULL);
+
+	if (!source)
+	{
+		NSLog(@"Unable to read image data for attachment %@", self);
+		return;
+	}
+
+	if (!_MIMEType)
+	{
+		_MIMEType = _DTMIMETypeForImageType((__bridge NSString *)CGImageSourceGetType(source));
+	}
+
+	NSDictionary *properties = CFBridgingRelease(CGImageSourceCopyPropertiesAtIndex(source, 0, NULL));
+	CFRelease(source);
+
+	CGFloat width = [[properties objectForKey:(__bridge id)kCGImagePropertyPixelWidth] floatValue];
+	CGFloat height = [[properties objectForKey:(__bridge id)kCGImagePropertyPixelHeight] floatValue];
+
+	// EXIF orientations 5 to 8 are rotated by 90 degrees
+	if ([[properties objectForKey:(__bridge id)kCGImagePropertyOrientation] integerValue] >= 5)
+	{
+		CGFloat swap = width;
+		width = height;
+		height = swap;
+	}
+
+	self.originalSize = CGSizeMake(width, height);
+
+	if (CGSizeEqualToSize(self.displaySize, CGSizeZero))
+	{
+		self.displaySize = self.originalSize;
+	}
+}
+
+- (void)setImage:(UIImage *)image
+{
+	_imageData = nil;
+	_MIMEType = nil;
+	[self discardDisplayImage];
+
+	[super setImage:image];
+}
+
+- (UIImage *)image
+{
+	if (_imageData)
+	{
+		// not retained, the decoded bitmap goes away with the image
+		return [UIImage imageWithData:_imageData];
+	}
+
+	return [super image];
+}
+
+- (void)setDisplaySize:(CGSize)displaySize
+{
+	if (!CGSizeEqualToSize(displaySize, self.displaySize))
+	{
+		[self discardDisplayImage];
+	}
+
+	[super setDisplaySize:displaySize];
+}
+
+@synthesize imageData = _imageData;
+@synthesize MIMEType = _MIMEType;
+
+@end
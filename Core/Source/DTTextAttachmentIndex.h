@@ -0,0 +1,88 @@
+//
+//  DTTextAttachmentIndex.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+@class DTTextAttachment;
+
+/**
+ Index of the text attachments of an attributed string used by <DTMutableCoreTextLayoutFrame>, ordered by string location.
+
+ The index is built once from the attachment attribute runs of the string and updated from the replaced range on every edit. This way finding the attachments does not require the layout lines, which might not be laid out yet. Range queries use binary search over the locations, content URL queries a dictionary keyed by the URL.
+
+ Access to the index is synchronized because it is queried from the main thread while edits modify it on the sync queue of the layout frame.
+ */
+@interface DTTextAttachmentIndex : NSObject
+
+/**
+ @name Creating an Attachment Index
+ */
+
+/**
+ Creates an index containing the attachments of an attributed string.
+ @param attributedString The attributed string
+ @returns The initialized index
+ */
+- (instancetype)initWithAttributedString:(NSAttributedString *)attributedString;
+
+/**
+ @name Updating the Index
+ */
+
+/**
+ Updates the index for replacing a range of the indexed string. The attachments in the range are removed, the ones of the replacement text are inserted and the ones after the range are shifted.
+ @param range The string range that is replaced
+ @param text The replacement text
+ */
+- (void)replaceAttachmentsInRange:(NSRange)range withAttachmentsOfText:(NSAttributedString *)text;
+
+/**
+ Changes the content URL of all attachments showing a URL and updates the URL index for it. Changing the `contentURL` of an attachment directly is noticed by lookups for the old URL, but lookups for the new URL only find it after the next rebuild of the index.
+ @param contentURL The current content URL
+ @param newURL The new content URL
+ @returns The attachments that were modified
+ */
+- (NSArray *)replaceContentURL:(NSURL *)contentURL withURL:(NSURL *)newURL;
+
+/**
+ @name Getting Attachments
+ */
+
+/**
+ All attachments in the order of their string location
+ */
+@property (nonatomic, readonly) NSArray *attachments;
+
+/**
+ The attachments located within a string range, determined by binary search.
+ @param range The string range
+ @returns The attachments in the order of their string location
+ */
+- (NSArray *)attachmentsInRange:(NSRange)range;
+
+/**
+ The attachments of a class located within a string range.
+ @param attachmentClass The class of the attachments or `Nil` for all attachments
+ @param range The string range
+ @returns The attachments in the order of their string location
+ */
+- (NSArray *)attachmentsOfClass:(Class)attachmentClass inRange:(NSRange)range;
+
+/**
+ The attachments showing a content URL. The lookup is answered from an index of the URLs that is built on first use, only attachments which still have this URL are returned.
+ @param contentURL The content URL
+ @returns The matching attachments in no particular order, each attachment only once
+ */
+- (NSArray *)attachmentsWithContentURL:(NSURL *)contentURL;
+
+/**
+ The string locations of an attachment, the same attachment object can be referenced by several placeholder characters.
+ @param attachment The attachment
+ @returns The string indexes of the attachment, empty if it is not part of the indexed string
+ */
+- (NSIndexSet *)locationsOfAttachment:(DTTextAttachment *)attachment;
+
+@end
@@ -0,0 +1,354 @@
+//
+//  DTTextAttachmentIndex.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTTextAttachmentIndex.h"
+
+#import <DTCoreText/DTCoreText.h>
+
+@implementation DTTextAttachmentIndex
+{
+	// parallel arrays, sorted by location
+	NSMutableArray *_attachments;
+	NSUInteger *_locations;
+	NSUInteger _capacity;
+	
+	// attachments by absolute string of their content URL, built on the first query
+	NSMutableDictionary *_attachmentsByURL;
+}
+
+- (instancetype)initWithAttributedString:(NSAttributedString *)attributedString
+{
+	self = [super init];
+
+	if (self)
+	{
+		_attachments = [[NSMutableArray alloc] init];
+
+		[self _insertAttachmentsOfText:attributedString atIndex:0 location:0];
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	free(_locations);
+}
+
+#pragma mark - Storage
+
+- (void)_ensureCapacity:(NSUInteger)capacity
+{
+	if (capacity <= _capacity)
+	{
+		return;
+	}
+
+	NSUInteger newCapacity = MAX(capacity, MAX(16, _capacity * 2));
+	_locations = realloc(_locations, newCapacity * sizeof(NSUInteger));
+	_capacity = newCapacity;
+}
+
+// the array index of the first attachment at or after a string location
+- (NSUInteger)_indexOfFirstAttachmentAtOrAfterLocation:(NSUInteger)location
+{
+	NSUInteger low = 0;
+	NSUInteger high = [_attachments count];
+
+	while (low < high)
+	{
+		NSUInteger mid = low + (high - low) / 2;
+
+		if (_locations[mid] < location)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+// inserts the attachments of a text at an array index, their locations are relative to the given location
+- (NSUInteger)_insertAttachmentsOfText:(NSAttributedString *)text atIndex:(NSUInteger)index location:(NSUInteger)location
+{
+	NSMutableArray *attachments = [NSMutableArray array];
+	NSMutableArray *locations = [NSMutableArray array];
+
+	[text enumerateAttribute:NSAttachmentAttributeName inRange:NSMakeRange(0, [text length]) options:0 usingBlock:^(id value, NSRange range, BOOL *stop) {
+
+		if (!value)
+		{
+			return;
+		}
+
+		// every placeholder character is an attachment of its own, even if neighbours share the object
+		for (NSUInteger i=0; i<range.length; i++)
+		{
+			[attachments addObject:value];
+			[locations addObject:[NSNumber numberWithUnsignedInteger:location + range.location + i]];
+		}
+	}];
+
+	NSUInteger count = [attachments count];
+
+	if (!count)
+	{
+		return 0;
+	}
+
+	NSUInteger oldCount = [_attachments count];
+	[self _ensureCapacity:oldCount + count];
+
+	memmove(_locations + index + count, _locations + index, (oldCount - index) * sizeof(NSUInteger));
+
+	for (NSUInteger i=0; i<count; i++)
+	{
+		_locations[index + i] = [[locations objectAtIndex:i] unsignedIntegerValue];
+	}
+
+	[_attachments insertObjects:attachments atIndexes:[NSIndexSet indexSetWithIndexesInRange:NSMakeRange(index, count)]];
+
+	if (_attachmentsByURL)
+	{
+		for (DTTextAttachment *attachment in attachments)
+		{
+			[self _addAttachmentToURLIndex:attachment];
+		}
+	}
+
+	return count;
+}
+
+#pragma mark - URL Index
+
+- (void)_addAttachmentToURLIndex:(DTTextAttachment *)attachment
+{
+	NSString *key = [attachment.contentURL absoluteString];
+
+	if (!key)
+	{
+		return;
+	}
+
+	NSMutableArray *attachments = [_attachmentsByURL objectForKey:key];
+
+	if (!attachments)
+	{
+		attachments = [[NSMutableArray alloc] init];
+		[_attachmentsByURL setObject:attachments forKey:key];
+	}
+
+	[attachments addObject:attachment];
+}
+
+- (void)_removeAttachmentFromURLIndex:(DTTextAttachment *)attachment
+{
+	NSString *key = [attachment.contentURL absoluteString];
+
+	if (!key)
+	{
+		return;
+	}
+
+	NSMutableArray *attachments = [_attachmentsByURL objectForKey:key];
+
+	// only one entry, the same attachment object might be in the string several times
+	NSUInteger index = [attachments indexOfObjectIdenticalTo:attachment];
+
+	if (index != NSNotFound)
+	{
+		[attachments removeObjectAtIndex:index];
+	}
+
+	if (attachments && ![attachments count])
+	{
+		[_attachmentsByURL removeObjectForKey:key];
+	}
+}
+
+- (void)_buildURLIndexIfNeeded
+{
+	if (_attachmentsByURL)
+	{
+		return;
+	}
+
+	_attachmentsByURL = [[NSMutableDictionary alloc] init];
+
+	for (DTTextAttachment *attachment in _attachments)
+	{
+		[self _addAttachmentToURLIndex:attachment];
+	}
+}
+
+#pragma mark - Updating the Index
+
+- (void)replaceAttachmentsInRange:(NSRange)range withAttachmentsOfText:(NSAttributedString *)text
+{
+	@synchronized(self)
+	{
+		NSUInteger firstIndex = [self _indexOfFirstAttachmentAtOrAfterLocation:range.location];
+		NSUInteger endIndex = [self _indexOfFirstAttachmentAtOrAfterLocation:NSMaxRange(range)];
+		NSUInteger count = [_attachments count];
+
+		// remove the replaced attachments
+		if (endIndex > firstIndex)
+		{
+			if (_attachmentsByURL)
+			{
+				for (NSUInteger i=firstIndex; i<endIndex; i++)
+				{
+					[self _removeAttachmentFromURLIndex:[_attachments objectAtIndex:i]];
+				}
+			}
+
+			memmove(_locations + firstIndex, _locations + endIndex, (count - endIndex) * sizeof(NSUInteger));
+			[_attachments removeObjectsInRange:NSMakeRange(firstIndex, endIndex - firstIndex)];
+
+			count -= endIndex - firstIndex;
+		}
+
+		// shift the ones after the range
+		NSInteger delta = (NSInteger)[text length] - (NSInteger)range.length;
+
+		if (delta)
+		{
+			for (NSUInteger i=firstIndex; i<count; i++)
+			{
+				_locations[i] = (NSUInteger)((NSInteger)_locations[i] + delta);
+			}
+		}
+
+		[self _insertAttachmentsOfText:text atIndex:firstIndex location:range.location];
+	}
+}
+
+- (NSArray *)replaceContentURL:(NSURL *)contentURL withURL:(NSURL *)newURL
+{
+	@synchronized(self)
+	{
+		NSArray *attachments = [self attachmentsWithContentURL:contentURL];
+
+		// entries of attachments that are in the string several times move along
+		NSMutableArray *entries = [_attachmentsByURL objectForKey:[contentURL absoluteString]];
+		[_attachmentsByURL removeObjectForKey:[contentURL absoluteString]];
+
+		for (DTTextAttachment *attachment in attachments)
+		{
+			attachment.contentURL = newURL;
+		}
+
+		for (DTTextAttachment *attachment in entries)
+		{
+			[self _addAttachmentToURLIndex:attachment];
+		}
+
+		return attachments;
+	}
+}
+
+#pragma mark - Getting Attachments
+
+- (NSArray *)attachments
+{
+	@synchronized(self)
+	{
+		return [_attachments copy];
+	}
+}
+
+- (NSArray *)attachmentsInRange:(NSRange)range
+{
+	@synchronized(self)
+	{
+		NSUInteger firstIndex = [self _indexOfFirstAttachmentAtOrAfterLocation:range.location];
+		NSUInteger endIndex = [self _indexOfFirstAttachmentAtOrAfterLocation:NSMaxRange(range)];
+
+		return [_attachments subarrayWithRange:NSMakeRange(firstIndex, endIndex - firstIndex)];
+	}
+}
+
+- (NSArray *)attachmentsOfClass:(Class)attachmentClass inRange:(NSRange)range
+{
+	NSArray *attachments = [self attachmentsInRange:range];
+
+	if (!attachmentClass)
+	{
+		return attachments;
+	}
+
+	NSMutableArray *tmpArray = [NSMutableArray array];
+
+	for (DTTextAttachment *attachment in attachments)
+	{
+		if ([attachment isKindOfClass:attachmentClass])
+		{
+			[tmpArray addObject:attachment];
+		}
+	}
+
+	return tmpArray;
+}
+
+- (NSArray *)attachmentsWithContentURL:(NSURL *)contentURL
+{
+	NSString *key = [contentURL absoluteString];
+
+	if (!key)
+	{
+		return nil;
+	}
+
+	@synchronized(self)
+	{
+		[self _buildURLIndexIfNeeded];
+
+		NSMutableArray *tmpArray = [NSMutableArray array];
+
+		for (DTTextAttachment *attachment in [_attachmentsByURL objectForKey:key])
+		{
+			// the URL might have been changed without telling the index
+			if (![[attachment.contentURL absoluteString] isEqualToString:key])
+			{
+				continue;
+			}
+
+			if ([tmpArray indexOfObjectIdenticalTo:attachment] == NSNotFound)
+			{
+				[tmpArray addObject:attachment];
+			}
+		}
+
+		return tmpArray;
+	}
+}
+
+- (NSIndexSet *)locationsOfAttachment:(DTTextAttachment *)attachment
+{
+	@synchronized(self)
+	{
+		NSMutableIndexSet *locations = [NSMutableIndexSet indexSet];
+		NSUInteger count = [_attachments count];
+
+		for (NSUInteger i=0; i<count; i++)
+		{
+			if ([_attachments objectAtIndex:i] == attachment)
+			{
+				[locations addIndex:_locations[i]];
+			}
+		}
+
+		return locations;
+	}
+}
+
+@end
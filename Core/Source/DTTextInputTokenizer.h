@@ -0,0 +1,41 @@
+//
+//  DTTextInputTokenizer.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+
+@class DTRichTextEditorView;
+
+/**
+ The tokenizer of <DTRichTextEditorView>. Word boundaries are determined for the paragraph that contains a position and cached in the <DTWordBoundaryCache> of the content view until the paragraph is modified, instead of looking at the whole document string like `UITextInputStringTokenizer` does. All other granularities and layout directions are answered by the superclass.
+ */
+@interface DTTextInputTokenizer : UITextInputStringTokenizer
+
+/**
+ @name Creating a Tokenizer
+ */
+
+/**
+ Creates a tokenizer for an editor view
+ @param editorView The editor view, it is not retained
+ @returns An initialized tokenizer
+ */
+- (instancetype)initWithEditorView:(DTRichTextEditorView *)editorView;
+
+/**
+ @name Finding Words
+ */
+
+/**
+ Determines the word enclosing a string index without creating text positions.
+ @param index The string index
+ @param direction In forward direction the word needs to start at or before the index, in backward direction it needs to end at or after the index
+ @returns The range of the word or a range with location `NSNotFound` if the index is not inside a word
+ */
+- (NSRange)rangeOfWordEnclosingIndex:(NSUInteger)index inDirection:(UITextStorageDirection)direction;
+
+@end
@@ -0,0 +1,264 @@
+//
+//  DTTextInputTokenizer.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTTextInputTokenizer.h"
+#import "DTRichTextEditorView.h"
+#import "DTRichTextEditorContentView.h"
+#import "DTMutableCoreTextLayoutFrame.h"
+#import "DTWordBoundaryCache.h"
+#import "DTTextPosition.h"
+#import "DTTextRange.h"
+
+// layout directions are left to the superclass
+static BOOL _DTIsStorageDirection(UITextDirection direction)
+{
+	return (direction == UITextStorageDirectionForward || direction == UITextStorageDirectionBackward);
+}
+
+@implementation DTTextInputTokenizer
+{
+	__weak DTRichTextEditorView *_editorView;
+}
+
+- (instancetype)initWithEditorView:(DTRichTextEditorView *)editorView
+{
+	self = [super initWithTextInput:editorView];
+
+	if (self)
+	{
+		_editorView = editorView;
+	}
+
+	return self;
+}
+
+#pragma mark - Paragraphs
+
+- (DTMutableCoreTextLayoutFrame *)_layoutFrame
+{
+	return (DTMutableCoreTextLayoutFrame *)_editorView.attributedTextContentView.layoutFrame;
+}
+
+- (DTWordBoundaryCache *)_wordBoundaryCache
+{
+	return [(DTRichTextEditorContentView *)_editorView.attributedTextContentView wordBoundaryCache];
+}
+
+// enumerates the words of the paragraph containing an index, the paragraph is passed back to continue with its neighbours
+- (void)_enumerateWordRangesInParagraphAtIndex:(NSUInteger)index paragraphRange:(NSRange *)paragraphRange usingBlock:(void (^)(NSRange wordRange, BOOL *stop))block
+{
+	DTMutableCoreTextLayoutFrame *layoutFrame = [self _layoutFrame];
+	NSString *string = [layoutFrame.attributedStringFragment string];
+	NSUInteger length = [string length];
+
+	if (!length)
+	{
+		if (paragraphRange)
+		{
+			*paragraphRange = NSMakeRange(0, 0);
+		}
+
+		return;
+	}
+
+	// the end of the text belongs to the last paragraph
+	NSRange range = [layoutFrame rangeOfParagraphAtIndex:MIN(index, length-1)];
+
+	if (paragraphRange)
+	{
+		*paragraphRange = range;
+	}
+
+	[[self _wordBoundaryCache] enumerateWordRangesInParagraphRange:range ofString:string usingBlock:block];
+}
+
+#pragma mark - Finding Words
+
+- (NSRange)rangeOfWordEnclosingIndex:(NSUInteger)index inDirection:(UITextStorageDirection)direction
+{
+	__block NSRange enclosingRange = NSMakeRange(NSNotFound, 0);
+
+	[self _enumerateWordRangesInParagraphAtIndex:index paragraphRange:NULL usingBlock:^(NSRange wordRange, BOOL *stop) {
+
+		if (wordRange.location > index)
+		{
+			*stop = YES;
+			return;
+		}
+
+		BOOL encloses;
+
+		if (direction == UITextStorageDirectionForward)
+		{
+			encloses = (index < NSMaxRange(wordRange));
+		}
+		else
+		{
+			encloses = (index > wordRange.location && index <= NSMaxRange(wordRange));
+		}
+
+		if (encloses)
+		{
+			enclosingRange = wordRange;
+			*stop = YES;
+		}
+	}];
+
+	return enclosingRange;
+}
+
+// the end of a word after an index, NSNotFound if there is none
+- (NSUInteger)_indexOfWordEndAfterIndex:(NSUInteger)index
+{
+	NSUInteger length = [[self _layoutFrame].attributedStringFragment length];
+	NSUInteger paragraphIndex = index;
+	__block NSUInteger wordEnd = NSNotFound;
+
+	while (wordEnd == NSNotFound && paragraphIndex < length)
+	{
+		NSRange paragraphRange;
+
+		[self _enumerateWordRangesInParagraphAtIndex:paragraphIndex paragraphRange:&paragraphRange usingBlock:^(NSRange wordRange, BOOL *stop) {
+
+			if (NSMaxRange(wordRange) > index)
+			{
+				wordEnd = NSMaxRange(wordRange);
+				*stop = YES;
+			}
+		}];
+
+		if (NSMaxRange(paragraphRange) <= paragraphIndex)
+		{
+			break;
+		}
+		
+		// continue with the next paragraph
+		paragraphIndex = NSMaxRange(paragraphRange);
+	}
+
+	return wordEnd;
+}
+
+// the start of a word before an index, NSNotFound if there is none
+- (NSUInteger)_indexOfWordStartBeforeIndex:(NSUInteger)index
+{
+	NSUInteger paragraphIndex = index;
+	__block NSUInteger wordStart = NSNotFound;
+
+	while (YES)
+	{
+		NSRange paragraphRange;
+
+		[self _enumerateWordRangesInParagraphAtIndex:paragraphIndex paragraphRange:&paragraphRange usingBlock:^(NSRange wordRange, BOOL *stop) {
+
+			if (wordRange.location >= index)
+			{
+				*stop = YES;
+				return;
+			}
+
+			// the last one before the index wins
+			wordStart = wordRange.location;
+		}];
+
+		if (wordStart != NSNotFound || !paragraphRange.location)
+		{
+			break;
+		}
+
+		// continue with the previous paragraph
+		paragraphIndex = paragraphRange.location - 1;
+	}
+
+	return wordStart;
+}
+
+#pragma mark - UITextInputTokenizer
+
+- (UITextRange *)rangeEnclosingPosition:(UITextPosition *)position withGranularity:(UITextGranularity)granularity inDirection:(UITextDirection)direction
+{
+	if (granularity != UITextGranularityWord || !_DTIsStorageDirection(direction) || !position)
+	{
+		return [super rangeEnclosingPosition:position withGranularity:granularity inDirection:direction];
+	}
+
+	NSRange range = [self rangeOfWordEnclosingIndex:[(DTTextPosition *)position location] inDirection:(UITextStorageDirection)direction];
+
+	if (range.location == NSNotFound)
+	{
+		return nil;
+	}
+
+	return [DTTextRange rangeWithNSRange:range];
+}
+
+- (BOOL)isPosition:(UITextPosition *)position withinTextUnit:(UITextGranularity)granularity inDirection:(UITextDirection)direction
+{
+	if (granularity != UITextGranularityWord || !_DTIsStorageDirection(direction) || !position)
+	{
+		return [super isPosition:position withinTextUnit:granularity inDirection:direction];
+	}
+
+	NSRange range = [self rangeOfWordEnclosingIndex:[(DTTextPosition *)position location] inDirection:(UITextStorageDirection)direction];
+
+	return (range.location != NSNotFound);
+}
+
+- (BOOL)isPosition:(UITextPosition *)position atBoundary:(UITextGranularity)granularity inDirection:(UITextDirection)direction
+{
+	if (granularity != UITextGranularityWord || !_DTIsStorageDirection(direction) || !position)
+	{
+		return [super isPosition:position atBoundary:granularity inDirection:direction];
+	}
+
+	NSUInteger index = [(DTTextPosition *)position location];
+	__block BOOL atBoundary = NO;
+
+	[self _enumerateWordRangesInParagraphAtIndex:index paragraphRange:NULL usingBlock:^(NSRange wordRange, BOOL *stop) {
+
+		// forward is the end of a word, backward the start
+		NSUInteger boundary = (direction == UITextStorageDirectionForward) ? NSMaxRange(wordRange) : wordRange.location;
+
+		if (boundary >= index)
+		{
+			atBoundary = (boundary == index);
+			*stop = YES;
+		}
+	}];
+
+	return atBoundary;
+}
+
+- (UITextPosition *)positionFromPosition:(UITextPosition *)position toBoundary:(UITextGranularity)granularity inDirection:(UITextDirection)direction
+{
+	if (granularity != UITextGranularityWord || !_DTIsStorageDirection(direction) || !position)
+	{
+		return [super positionFromPosition:position toBoundary:granularity inDirection:direction];
+	}
+
+	NSUInteger index = [(DTTextPosition *)position location];
+	NSUInteger boundary;
+
+	if (direction == UITextStorageDirectionForward)
+	{
+		boundary = [self _indexOfWordEndAfterIndex:index];
+	}
+	else
+	{
+		boundary = [self _indexOfWordStartBeforeIndex:index];
+	}
+
+	if (boundary == NSNotFound)
+	{
+		return nil;
+	}
+
+	return [DTTextPosition textPositionWithLocation:boundary];
+}
+
+@end
@@ -18,9 +18,9 @@
  */
 
 /**
- Convenience method for created a text position from a string location.
+ Convenience method for created a text position from a string location. Text positions are immutable, positions at small locations like the beginning of the document are shared instead of being created for every call.
  @param location The string location
- @returns An initialized text position
+ @returns A text position for the location
  */
 + (DTTextPosition *)textPositionWithLocation:(NSUInteger)location;
 
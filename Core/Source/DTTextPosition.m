@@ -8,6 +8,9 @@
 
 #import "DTTextPosition.h"
 
+// positions at small locations are shared, they are asked for all the time, for example for the beginning of the document
+#define DTTextPositionInternedLocationCount 64
+
 @interface DTTextPosition () // private
 
 @property (nonatomic, assign) NSUInteger location;
@@ -22,6 +25,26 @@
 
 + (DTTextPosition *)textPositionWithLocation:(NSUInteger)location
 {
+	static NSArray *_internedPositions = nil;
+	static dispatch_once_t onceToken;
+	
+	dispatch_once(&onceToken, ^{
+		NSMutableArray *tmpArray = [NSMutableArray arrayWithCapacity:DTTextPositionInternedLocationCount];
+		
+		for (NSUInteger i=0; i<DTTextPositionInternedLocationCount; i++)
+		{
+			[tmpArray addObject:[[DTTextPosition alloc] initWithLocation:i]];
+		}
+		
+		_internedPositions = [tmpArray copy];
+	});
+	
+	// positions are immutable, so they can be shared
+	if (location < DTTextPositionInternedLocationCount)
+	{
+		return [_internedPositions objectAtIndex:location];
+	}
+	
 	return [[DTTextPosition alloc] initWithLocation:location];
 }
 
@@ -53,7 +76,22 @@
 
 - (BOOL)isEqual:(DTTextPosition *)otherPosition;
 {
-	return [self compare:otherPosition]==NSOrderedSame;
+	if (otherPosition == self)
+	{
+		return YES;
+	}
+	
+	if (![otherPosition isKindOfClass:[DTTextPosition class]])
+	{
+		return NO;
+	}
+	
+	return _location == otherPosition->_location;
+}
+
+- (NSUInteger)hash
+{
+	return _location;
 }
 
 
@@ -64,6 +102,11 @@
 
 - (DTTextPosition *)textPositionWithOffset:(NSInteger)offset
 {
+	if (!offset)
+	{
+		return self;
+	}
+	
 	return [DTTextPosition textPositionWithLocation:_location + offset];
 }
 
@@ -71,10 +114,8 @@
 #pragma mark Copying
 - (id)copyWithZone:(NSZone *)zone
 {
-	DTTextPosition *newPosition = [[DTTextPosition allocWithZone:zone] init];
-	newPosition.location = self.location;
-	
-	return newPosition;
+	// immutable
+	return self;
 }
 
 
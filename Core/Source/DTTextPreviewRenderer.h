@@ -0,0 +1,106 @@
+//
+//  DTTextPreviewRenderer.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+
+#import "DTCacheRegistry.h"
+
+/**
+ Measures and renders attributed text without an editor view, for example for the cells of a table view that shows previews of many documents.
+
+ The text is laid out with a <DTMutableCoreTextLayoutFrame> just like in <DTRichTextEditorView>, so the heights match the content size the editor would have. All methods are thread-safe, the asynchronous variants do the work on a background queue.
+
+ Results are cached by the content of the text and the width: identical texts share one entry, a modified text simply no longer finds its old one. If the cached results exceed the <memoryBudget> the least recently used ones are evicted. The renderer registers itself with the shared <DTCacheRegistry> as a rendering cache.
+ */
+@interface DTTextPreviewRenderer : NSObject <DTCacheRegistryCache>
+
+/**
+ @name Creating a Renderer
+ */
+
+/**
+ A renderer that can be shared by the whole app
+ @returns The shared renderer
+ */
++ (DTTextPreviewRenderer *)sharedRenderer;
+
+/**
+ Creates a renderer
+ @param memoryBudget The maximum number of bytes for all cached results
+ @returns An initialized renderer
+ */
+- (instancetype)initWithMemoryBudget:(NSUInteger)memoryBudget;
+
+/**
+ @name Configuring the Renderer
+ */
+
+/**
+ The margins around the text, like the `edgeInsets` of the content view of the editor. Changing them removes all cached results.
+ */
+@property (nonatomic, assign) UIEdgeInsets edgeInsets;
+
+/**
+ The maximum number of bytes for all cached results, reducing it evicts the least recently used ones right away
+ */
+@property (nonatomic, assign) NSUInteger memoryBudget;
+
+/**
+ @name Measuring Text
+ */
+
+/**
+ Determines the size of a text laid out for a width, including the <edgeInsets>.
+ @param attributedString The text
+ @param width The width available for the text and the edge insets
+ @returns The size with the given width and the height of the laid out text
+ */
+- (CGSize)sizeOfAttributedString:(NSAttributedString *)attributedString width:(CGFloat)width;
+
+/**
+ Determines the size of a text on a background queue.
+ @param attributedString The text, it must not be modified until the completion is called
+ @param width The width available for the text and the edge insets
+ @param completion The block to execute on the main thread with the size, it is called right away if the size is cached
+ */
+- (void)measureAttributedString:(NSAttributedString *)attributedString width:(CGFloat)width completion:(void (^)(CGSize size))completion;
+
+/**
+ @name Rendering Text
+ */
+
+/**
+ Draws the first lines of a text into a bitmap. Images of attachments that are still being decoded are not drawn.
+ @param attributedString The text
+ @param width The width available for the text and the edge insets, this is the width of the image
+ @param numberOfLines The maximum number of lines to draw, 0 to draw all of them
+ @param scale The scale of the image
+ @returns The image which is as high as the lines it shows, `nil` if the text is empty
+ */
+- (UIImage *)imageOfAttributedString:(NSAttributedString *)attributedString width:(CGFloat)width maximumNumberOfLines:(NSUInteger)numberOfLines scale:(CGFloat)scale;
+
+/**
+ Draws the first lines of a text into a bitmap on a background queue.
+ @param attributedString The text, it must not be modified until the completion is called
+ @param width The width available for the text and the edge insets, this is the width of the image
+ @param numberOfLines The maximum number of lines to draw, 0 to draw all of them
+ @param scale The scale of the image
+ @param completion The block to execute on the main thread with the image, it is called right away if the image is cached
+ */
+- (void)renderAttributedString:(NSAttributedString *)attributedString width:(CGFloat)width maximumNumberOfLines:(NSUInteger)numberOfLines scale:(CGFloat)scale completion:(void (^)(UIImage *image))completion;
+
+/**
+ @name Managing the Cache
+ */
+
+/**
+ Removes all cached sizes and images
+ */
+- (void)removeAllCachedResults;
+
+@end
@@ -0,0 +1,525 @@
+//
+//  DTTextPreviewRenderer.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTTextPreviewRenderer.h"
+#import "DTMutableCoreTextLayoutFrame.h"
+
+#import <DTCoreText/DTCoreText.h>
+
+#define DTTextPreviewRendererDefaultMemoryBudget (8 * 1024 * 1024)
+
+// the results for a text laid out for a width, there is only one image per entry
+@interface DTTextPreviewEntry : NSObject
+{
+@public
+	NSAttributedString *_text;
+	CGFloat _width;
+	NSUInteger _hash;
+
+	BOOL _hasSize;
+	CGSize _size;
+
+	UIImage *_image;
+	NSUInteger _numberOfLines;
+	CGFloat _scale;
+
+	NSUInteger _cost;
+}
+
+@end
+
+@implementation DTTextPreviewEntry
+
+@end
+
+
+// FNV-1a over the characters and run boundaries, attribute values are only compared on a hit
+static NSUInteger _DTTextPreviewHash(NSAttributedString *text, CGFloat width)
+{
+	NSString *string = [text string];
+	NSUInteger length = [string length];
+
+	NSUInteger hash = 2166136261u;
+
+	unichar buffer[128];
+	NSUInteger index = 0;
+
+	while (index < length)
+	{
+		NSUInteger chunkLength = MIN(length - index, (NSUInteger)128);
+		[string getCharacters:buffer range:NSMakeRange(index, chunkLength)];
+
+		for (NSUInteger i=0; i<chunkLength; i++)
+		{
+			hash = (hash ^ buffer[i]) * 16777619u;
+		}
+
+		index += chunkLength;
+	}
+
+	index = 0;
+
+	while (index < length)
+	{
+		NSRange effectiveRange;
+		NSDictionary *attributes = [text attributesAtIndex:index effectiveRange:&effectiveRange];
+
+		hash = (hash ^ NSMaxRange(effectiveRange)) * 16777619u;
+		hash = (hash ^ [attributes count]) * 16777619u;
+
+		index = NSMaxRange(effectiveRange);
+	}
+
+	hash = (hash ^ (NSUInteger)roundf(width)) * 16777619u;
+
+	return hash;
+}
+
+
+@implementation DTTextPreviewRenderer
+{
+	// entries by hash, an array for each hash so that collisions are possible
+	NSMutableDictionary *_entriesByHash;
+
+	// least recently used first
+	NSMutableArray *_entries;
+
+	NSUInteger _memoryBudget;
+	NSUInteger _totalCost;
+
+	UIEdgeInsets _edgeInsets;
+
+	// incremented when all results are removed, so that results computed before are not stored
+	NSUInteger _generation;
+}
+
++ (DTTextPreviewRenderer *)sharedRenderer
+{
+	static DTTextPreviewRenderer *_sharedRenderer = nil;
+	static dispatch_once_t onceToken;
+
+	dispatch_once(&onceToken, ^{
+		_sharedRenderer = [[DTTextPreviewRenderer alloc] initWithMemoryBudget:DTTextPreviewRendererDefaultMemoryBudget];
+	});
+
+	return _sharedRenderer;
+}
+
+- (instancetype)initWithMemoryBudget:(NSUInteger)memoryBudget
+{
+	self = [super init];
+
+	if (self)
+	{
+		_entriesByHash = [[NSMutableDictionary alloc] init];
+		_entries = [[NSMutableArray alloc] init];
+		_memoryBudget = memoryBudget;
+
+		[[DTCacheRegistry sharedRegistry] registerCache:self evictionOrder:DTCacheEvictionOrderRendering];
+	}
+
+	return self;
+}
+
+- (id)init
+{
+	return [self initWithMemoryBudget:DTTextPreviewRendererDefaultMemoryBudget];
+}
+
+#pragma mark - Cache Entries
+
+// needs to be called while synchronized
+- (DTTextPreviewEntry *)_entryForText:(NSAttributedString *)text width:(CGFloat)width hash:(NSUInteger)hash
+{
+	for (DTTextPreviewEntry *entry in [_entriesByHash objectForKey:@(hash)])
+	{
+		if (entry->_width == width && [entry->_text isEqualToAttributedString:text])
+		{
+			// most recently used go to the end
+			if ([_entries lastObject] != entry)
+			{
+				[_entries removeObjectIdenticalTo:entry];
+				[_entries addObject:entry];
+			}
+
+			return entry;
+		}
+	}
+
+	return nil;
+}
+
+// needs to be called while synchronized
+- (DTTextPreviewEntry *)_addEntryForText:(NSAttributedString *)text width:(CGFloat)width hash:(NSUInteger)hash
+{
+	DTTextPreviewEntry *entry = [[DTTextPreviewEntry alloc] init];
+	entry->_text = [text copy];
+	entry->_width = width;
+	entry->_hash = hash;
+	entry->_cost = [text length] * sizeof(unichar);
+
+	NSNumber *key = @(hash);
+	NSMutableArray *bucket = [_entriesByHash objectForKey:key];
+
+	if (!bucket)
+	{
+		bucket = [[NSMutableArray alloc] init];
+		[_entriesByHash setObject:bucket forKey:key];
+	}
+
+	[bucket addObject:entry];
+	[_entries addObject:entry];
+
+	_totalCost += entry->_cost;
+
+	return entry;
+}
+
+// needs to be called while synchronized
+- (void)_removeEntry:(DTTextPreviewEntry *)entry
+{
+	NSNumber *key = @(entry->_hash);
+	NSMutableArray *bucket = [_entriesByHash objectForKey:key];
+
+	[bucket removeObjectIdenticalTo:entry];
+
+	if (![bucket count])
+	{
+		[_entriesByHash removeObjectForKey:key];
+	}
+
+	_totalCost -= entry->_cost;
+}
+
+// needs to be called while synchronized
+- (void)_evictEntriesExceedingBudget
+{
+	NSUInteger numberOfEvictedEntries = 0;
+	NSUInteger numberOfEntries = [_entries count];
+
+	while (_totalCost > _memoryBudget && numberOfEvictedEntries < numberOfEntries)
+	{
+		[self _removeEntry:[_entries objectAtIndex:numberOfEvictedEntries]];
+
+		numberOfEvictedEntries++;
+	}
+
+	if (numberOfEvictedEntries)
+	{
+		[_entries removeObjectsInRange:NSMakeRange(0, numberOfEvictedEntries)];
+	}
+}
+
+// stores a result unless the cache was cleared while it was computed
+- (void)_storeSize:(CGSize)size image:(UIImage *)image numberOfLines:(NSUInteger)numberOfLines scale:(CGFloat)scale forText:(NSAttributedString *)text width:(CGFloat)width hash:(NSUInteger)hash generation:(NSUInteger)generation
+{
+	@synchronized(self)
+	{
+		if (generation != _generation)
+		{
+			return;
+		}
+
+		DTTextPreviewEntry *entry = [self _entryForText:text width:width hash:hash];
+
+		if (!entry)
+		{
+			entry = [self _addEntryForText:text width:width hash:hash];
+		}
+
+		entry->_hasSize = YES;
+		entry->_size = size;
+
+		if (image)
+		{
+			CGImageRef cgImage = image.CGImage;
+			NSUInteger imageCost = CGImageGetBytesPerRow(cgImage) * CGImageGetHeight(cgImage);
+			NSUInteger oldImageCost = entry->_cost - [entry->_text length] * sizeof(unichar);
+
+			entry->_image = image;
+			entry->_numberOfLines = numberOfLines;
+			entry->_scale = scale;
+
+			entry->_cost = entry->_cost - oldImageCost + imageCost;
+			_totalCost = _totalCost - oldImageCost + imageCost;
+		}
+
+		[self _evictEntriesExceedingBudget];
+	}
+}
+
+#pragma mark - Layout
+
+- (DTMutableCoreTextLayoutFrame *)_newLayoutFrameForAttributedString:(NSAttributedString *)attributedString width:(CGFloat)width edgeInsets:(UIEdgeInsets)edgeInsets
+{
+	CGRect frame = CGRectMake(edgeInsets.left, edgeInsets.top, MAX(width - edgeInsets.left - edgeInsets.right, 1.0f), CGFLOAT_HEIGHT_UNKNOWN);
+
+	DTMutableCoreTextLayoutFrame *layoutFrame = [[DTMutableCoreTextLayoutFrame alloc] initWithFrame:frame attributedString:attributedString];
+
+	// the frame only lives for this call, it must not be purged while we use it
+	[[DTCacheRegistry sharedRegistry] unregisterCache:layoutFrame];
+
+	[layoutFrame relayoutText];
+
+	return layoutFrame;
+}
+
+- (CGSize)_sizeOfLayoutFrame:(DTMutableCoreTextLayoutFrame *)layoutFrame width:(CGFloat)width edgeInsets:(UIEdgeInsets)edgeInsets
+{
+	return CGSizeMake(width, ceilf(layoutFrame.frame.size.height + edgeInsets.top + edgeInsets.bottom));
+}
+
+#pragma mark - Measuring Text
+
+- (CGSize)_cachedSizeOfAttributedString:(NSAttributedString *)attributedString width:(CGFloat)width hash:(NSUInteger)hash found:(BOOL *)found
+{
+	@synchronized(self)
+	{
+		DTTextPreviewEntry *entry = [self _entryForText:attributedString width:width hash:hash];
+
+		*found = (entry && entry->_hasSize);
+
+		return *found ? entry->_size : CGSizeZero;
+	}
+}
+
+- (CGSize)_sizeOfAttributedString:(NSAttributedString *)attributedString width:(CGFloat)width hash:(NSUInteger)hash
+{
+	NSUInteger generation;
+	UIEdgeInsets edgeInsets;
+
+	@synchronized(self)
+	{
+		generation = _generation;
+		edgeInsets = _edgeInsets;
+	}
+
+	DTMutableCoreTextLayoutFrame *layoutFrame = [self _newLayoutFrameForAttributedString:attributedString width:width edgeInsets:edgeInsets];
+	CGSize size = [self _sizeOfLayoutFrame:layoutFrame width:width edgeInsets:edgeInsets];
+
+	[self _storeSize:size image:nil numberOfLines:0 scale:0 forText:attributedString width:width hash:hash generation:generation];
+
+	return size;
+}
+
+- (CGSize)sizeOfAttributedString:(NSAttributedString *)attributedString width:(CGFloat)width
+{
+	NSUInteger hash = _DTTextPreviewHash(attributedString, width);
+
+	BOOL found;
+	CGSize size = [self _cachedSizeOfAttributedString:attributedString width:width hash:hash found:&found];
+
+	if (found)
+	{
+		return size;
+	}
+
+	return [self _sizeOfAttributedString:attributedString width:width hash:hash];
+}
+
+- (void)measureAttributedString:(NSAttributedString *)attributedString width:(CGFloat)width completion:(void (^)(CGSize size))completion
+{
+	NSParameterAssert(completion);
+
+	NSUInteger hash = _DTTextPreviewHash(attributedString, width);
+
+	BOOL found;
+	CGSize size = [self _cachedSizeOfAttributedString:attributedString width:width hash:hash found:&found];
+
+	if (found)
+	{
+		completion(size);
+		return;
+	}
+
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+
+		CGSize measuredSize = [self _sizeOfAttributedString:attributedString width:width hash:hash];
+
+		dispatch_async(dispatch_get_main_queue(), ^{
+			completion(measuredSize);
+		});
+	});
+}
+
+#pragma mark - Rendering Text
+
+- (UIImage *)_cachedImageOfAttributedString:(NSAttributedString *)attributedString width:(CGFloat)width maximumNumberOfLines:(NSUInteger)numberOfLines scale:(CGFloat)scale hash:(NSUInteger)hash
+{
+	@synchronized(self)
+	{
+		DTTextPreviewEntry *entry = [self _entryForText:attributedString width:width hash:hash];
+
+		if (entry && entry->_image && entry->_numberOfLines == numberOfLines && entry->_scale == scale)
+		{
+			return entry->_image;
+		}
+
+		return nil;
+	}
+}
+
+- (UIImage *)_imageOfAttributedString:(NSAttributedString *)attributedString width:(CGFloat)width maximumNumberOfLines:(NSUInteger)numberOfLines scale:(CGFloat)scale hash:(NSUInteger)hash
+{
+	NSUInteger generation;
+	UIEdgeInsets edgeInsets;
+
+	@synchronized(self)
+	{
+		generation = _generation;
+		edgeInsets = _edgeInsets;
+	}
+
+	DTMutableCoreTextLayoutFrame *layoutFrame = [self _newLayoutFrameForAttributedString:attributedString width:width edgeInsets:edgeInsets];
+	CGSize size = [self _sizeOfLayoutFrame:layoutFrame width:width edgeInsets:edgeInsets];
+
+	NSArray *lines = layoutFrame.lines;
+
+	if (![lines count])
+	{
+		return nil;
+	}
+
+	CGSize imageSize = size;
+
+	if (numberOfLines && [lines count] > numberOfLines)
+	{
+		// cut off below the last line that is shown
+		DTCoreTextLayoutLine *lastLine = [lines objectAtIndex:numberOfLines-1];
+		imageSize.height = ceilf(CGRectGetMaxY(lastLine.frame) + edgeInsets.bottom);
+	}
+
+	UIGraphicsBeginImageContextWithOptions(imageSize, NO, scale);
+	CGContextRef context = UIGraphicsGetCurrentContext();
+
+	CGContextClipToRect(context, CGRectMake(0, 0, imageSize.width, imageSize.height));
+	[layoutFrame drawInContext:context options:DTCoreTextLayoutFrameDrawingDefault];
+
+	UIImage *image = UIGraphicsGetImageFromCurrentImageContext();
+	UIGraphicsEndImageContext();
+
+	[self _storeSize:size image:image numberOfLines:numberOfLines scale:scale forText:attributedString width:width hash:hash generation:generation];
+
+	return image;
+}
+
+- (UIImage *)imageOfAttributedString:(NSAttributedString *)attributedString width:(CGFloat)width maximumNumberOfLines:(NSUInteger)numberOfLines scale:(CGFloat)scale
+{
+	NSUInteger hash = _DTTextPreviewHash(attributedString, width);
+
+	UIImage *image = [self _cachedImageOfAttributedString:attributedString width:width maximumNumberOfLines:numberOfLines scale:scale hash:hash];
+
+	if (image)
+	{
+		return image;
+	}
+
+	return [self _imageOfAttributedString:attributedString width:width maximumNumberOfLines:numberOfLines scale:scale hash:hash];
+}
+
+- (void)renderAttributedString:(NSAttributedString *)attributedString width:(CGFloat)width maximumNumberOfLines:(NSUInteger)numberOfLines scale:(CGFloat)scale completion:(void (^)(UIImage *image))completion
+{
+	NSParameterAssert(completion);
+
+	NSUInteger hash = _DTTextPreviewHash(attributedString, width);
+
+	UIImage *image = [self _cachedImageOfAttributedString:attributedString width:width maximumNumberOfLines:numberOfLines scale:scale hash:hash];
+
+	if (image)
+	{
+		completion(image);
+		return;
+	}
+
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+
+		UIImage *renderedImage = [self _imageOfAttributedString:attributedString width:width maximumNumberOfLines:numberOfLines scale:scale hash:hash];
+
+		dispatch_async(dispatch_get_main_queue(), ^{
+			completion(renderedImage);
+		});
+	});
+}
+
+#pragma mark - Managing the Cache
+
+- (void)removeAllCachedResults
+{
+	@synchronized(self)
+	{
+		[_entriesByHash removeAllObjects];
+		[_entries removeAllObjects];
+		_totalCost = 0;
+
+		_generation++;
+	}
+}
+
+#pragma mark - DTCacheRegistryCache
+
+- (NSUInteger)cacheCost
+{
+	@synchronized(self)
+	{
+		return _totalCost;
+	}
+}
+
+- (void)purgeCache
+{
+	[self removeAllCachedResults];
+}
+
+#pragma mark - Properties
+
+- (UIEdgeInsets)edgeInsets
+{
+	@synchronized(self)
+	{
+		return _edgeInsets;
+	}
+}
+
+- (void)setEdgeInsets:(UIEdgeInsets)edgeInsets
+{
+	@synchronized(self)
+	{
+		if (UIEdgeInsetsEqualToEdgeInsets(edgeInsets, _edgeInsets))
+		{
+			return;
+		}
+
+		_edgeInsets = edgeInsets;
+	}
+
+	// the sizes and images depend on the insets
+	[self removeAllCachedResults];
+}
+
+- (NSUInteger)memoryBudget
+{
+	@synchronized(self)
+	{
+		return _memoryBudget;
+	}
+}
+
+- (void)setMemoryBudget:(NSUInteger)memoryBudget
+{
+	@synchronized(self)
+	{
+		_memoryBudget = memoryBudget;
+
+		[self _evictEntriesExceedingBudget];
+	}
+}
+
+@synthesize edgeInsets = _edgeInsets;
+@synthesize memoryBudget = _memoryBudget;
+
+@end
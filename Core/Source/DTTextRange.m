@@ -73,6 +73,8 @@
 	if (self)
 	{
 		_start = [DTTextPosition textPositionWithLocation:range.location];
+		
+		// empty ranges share one position
 		_end = [_start textPositionWithOffset:range.length];
 	}
 	
@@ -81,7 +83,7 @@
 
 - (BOOL)isEmpty
 {
-	return [_start isEqual:_end];
+	return _start.location == _end.location;
 }
 
 //- (UITextPosition *)start
@@ -121,16 +123,25 @@
 
 - (BOOL)isEqual:(id)object
 {
+	if (object == self)
+	{
+		return YES;
+	}
+	
 	UITextRange *otherRange = (DTTextRange *)object;
 	return ([_start isEqual:(id)otherRange.start] && [_end isEqual:(id)otherRange.end]);
 }
 
+- (NSUInteger)hash
+{
+	return _start.location ^ (_end.location << 16);
+}
+
 #pragma mark Copying
 - (id)copyWithZone:(NSZone *)zone
 {
-	DTTextRange *newRange = [[DTTextRange allocWithZone:zone] initWithStart:_start end:_end];
-	
-	return newRange;
+	// immutable, positions are immutable too
+	return self;
 }
 
 @synthesize start = _start;
@@ -0,0 +1,93 @@
+//
+//  DTTextSearchIndex.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "DTCacheRegistry.h"
+
+/**
+ The matches of a search string in the text of the editor, used by the **Search** category of <DTRichTextEditorView>.
+
+ The matches are found once and then maintained as the text is modified: the index is owned by <DTRichTextEditorContentView> which informs it about modifications via <invalidateRange:replacementLength:>. Matches after a modification only move, the modified paragraphs are searched again the next time the matches are needed.
+ */
+@interface DTTextSearchIndex : NSObject <DTCacheRegistryCache>
+
+/**
+ @name Creating a Search Index
+ */
+
+/**
+ Creates a search index, nothing is searched until the matches are first needed.
+ @param searchString The string to search for, must not be empty
+ @param options The compare options, `NSCaseInsensitiveSearch` and `NSDiacriticInsensitiveSearch` are the useful ones
+ @returns An initialized search index
+ */
+- (instancetype)initWithSearchString:(NSString *)searchString options:(NSStringCompareOptions)options;
+
+/**
+ The string that is searched for
+ */
+@property (nonatomic, readonly) NSString *searchString;
+
+/**
+ The compare options used for searching
+ */
+@property (nonatomic, readonly) NSStringCompareOptions options;
+
+/**
+ @name Invalidating Matches
+ */
+
+/**
+ Removes the matches touched by replacing a range of the string and marks the surrounding paragraphs to be searched again. Matches after the range are moved by the difference in length.
+ @param range The range of the string before the modification
+ @param length The length of the replacement text
+ */
+- (void)invalidateRange:(NSRange)range replacementLength:(NSUInteger)length;
+
+/**
+ Marks the entire string to be searched again, for example if the string was replaced entirely.
+ */
+- (void)invalidateAllMatches;
+
+/**
+ @name Getting Matches
+ */
+
+/**
+ The number of matches in the string
+ @param string The current string
+ @returns The number of matches
+ */
+- (NSUInteger)numberOfMatchesInString:(NSString *)string;
+
+/**
+ The ranges of the matches intersecting a range
+ @param range The range of the string
+ @param string The current string
+ @returns An array of `NSValue` ranges in ascending order
+ */
+- (NSArray *)rangesOfMatchesInRange:(NSRange)range ofString:(NSString *)string;
+
+/**
+ The first match that starts at or after a string index
+ @param index The string index
+ @param string The current string
+ @returns The range of the match or a range with location `NSNotFound` if there is none
+ */
+- (NSRange)rangeOfMatchAtOrAfterIndex:(NSUInteger)index ofString:(NSString *)string;
+
+/**
+ The last match that ends at or before a string index
+ @param index The string index
+ @param string The current string
+ @returns The range of the match or a range with location `NSNotFound` if there is none
+ */
+- (NSRange)rangeOfMatchAtOrBeforeIndex:(NSUInteger)index ofString:(NSString *)string;
+
+@end
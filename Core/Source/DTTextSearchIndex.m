@@ -0,0 +1,333 @@
+//
+//  DTTextSearchIndex.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTTextSearchIndex.h"
+
+@implementation DTTextSearchIndex
+{
+	NSString *_searchString;
+	NSStringCompareOptions _options;
+
+	// sorted by location, matches don't overlap
+	NSRange *_matches;
+	NSUInteger _numberOfMatches;
+	NSUInteger _capacity;
+
+	// the indexes of the string that need to be searched again
+	NSMutableIndexSet *_dirtyIndexes;
+
+	// the length of the string the matches belong to, NSNotFound if nothing was searched yet
+	NSUInteger _length;
+}
+
+- (instancetype)initWithSearchString:(NSString *)searchString options:(NSStringCompareOptions)options
+{
+	NSParameterAssert([searchString length]);
+
+	self = [super init];
+
+	if (self)
+	{
+		_searchString = [searchString copy];
+
+		// only the options that make sense for finding all matches
+		_options = options & (NSCaseInsensitiveSearch | NSDiacriticInsensitiveSearch | NSLiteralSearch | NSWidthInsensitiveSearch);
+
+		_dirtyIndexes = [[NSMutableIndexSet alloc] init];
+		_length = NSNotFound;
+
+		[[DTCacheRegistry sharedRegistry] registerCache:self evictionOrder:DTCacheEvictionOrderDerivedData];
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	free(_matches);
+}
+
+#pragma mark - Matches
+
+// the index of the first match that ends after a string index, the matches don't overlap so their ends are sorted too
+- (NSUInteger)_indexOfFirstMatchEndingAfterIndex:(NSUInteger)index
+{
+	NSUInteger lower = 0;
+	NSUInteger upper = _numberOfMatches;
+
+	while (lower < upper)
+	{
+		NSUInteger middle = lower + (upper - lower) / 2;
+
+		if (NSMaxRange(_matches[middle]) > index)
+		{
+			upper = middle;
+		}
+		else
+		{
+			lower = middle + 1;
+		}
+	}
+
+	return lower;
+}
+
+// replaces the matches in a range of indexes with new ones
+- (void)_replaceMatchesInRange:(NSRange)range withMatches:(NSRange *)matches count:(NSUInteger)count
+{
+	NSUInteger newNumberOfMatches = _numberOfMatches - range.length + count;
+
+	if (newNumberOfMatches > _capacity)
+	{
+		_capacity = MAX(MAX(16, _capacity * 2), newNumberOfMatches);
+		_matches = realloc(_matches, _capacity * sizeof(NSRange));
+	}
+
+	memmove(_matches + range.location + count, _matches + NSMaxRange(range), (_numberOfMatches - NSMaxRange(range)) * sizeof(NSRange));
+
+	if (count)
+	{
+		memcpy(_matches + range.location, matches, count * sizeof(NSRange));
+	}
+
+	_numberOfMatches = newNumberOfMatches;
+}
+
+// searches a range of the string again, the range is extended to include matches overlapping it
+- (void)_searchRange:(NSRange)range ofString:(NSString *)string
+{
+	NSUInteger firstIndex = [self _indexOfFirstMatchEndingAfterIndex:range.location];
+	NSUInteger lastIndex = firstIndex;
+
+	while (lastIndex < _numberOfMatches && _matches[lastIndex].location < NSMaxRange(range))
+	{
+		range = NSUnionRange(range, _matches[lastIndex]);
+		lastIndex++;
+	}
+
+	NSUInteger count = 0;
+	NSUInteger capacity = 16;
+	NSRange *matches = malloc(capacity * sizeof(NSRange));
+
+	NSRange searchRange = range;
+
+	while (searchRange.length)
+	{
+		NSRange match = [string rangeOfString:_searchString options:_options range:searchRange];
+
+		if (match.location == NSNotFound || !match.length)
+		{
+			break;
+		}
+
+		if (count == capacity)
+		{
+			capacity *= 2;
+			matches = realloc(matches, capacity * sizeof(NSRange));
+		}
+
+		matches[count++] = match;
+
+		searchRange = NSMakeRange(NSMaxRange(match), NSMaxRange(range) - NSMaxRange(match));
+	}
+
+	[self _replaceMatchesInRange:NSMakeRange(firstIndex, lastIndex - firstIndex) withMatches:matches count:count];
+
+	free(matches);
+}
+
+// searches the dirty parts of the string, starting over if the string does not match
+- (void)_updateMatchesInString:(NSString *)string
+{
+	NSUInteger length = [string length];
+
+	if (_length != length)
+	{
+		// we missed a modification
+		_numberOfMatches = 0;
+
+		[_dirtyIndexes removeAllIndexes];
+		[_dirtyIndexes addIndexesInRange:NSMakeRange(0, length)];
+
+		_length = length;
+	}
+
+	if (![_dirtyIndexes count])
+	{
+		return;
+	}
+
+	// whole paragraphs are searched again, with room for matches that span paragraph breaks
+	NSUInteger margin = [_searchString length];
+	NSMutableIndexSet *searchIndexes = [NSMutableIndexSet indexSet];
+
+	[_dirtyIndexes enumerateRangesUsingBlock:^(NSRange range, BOOL *stop) {
+
+		NSUInteger start = range.location - MIN(range.location, margin);
+		NSUInteger end = MIN(NSMaxRange(range) + margin, length);
+
+		[searchIndexes addIndexesInRange:[string paragraphRangeForRange:NSMakeRange(start, end - start)]];
+	}];
+
+	[_dirtyIndexes removeAllIndexes];
+
+	[searchIndexes enumerateRangesUsingBlock:^(NSRange range, BOOL *stop) {
+
+		[self _searchRange:range ofString:string];
+	}];
+}
+
+#pragma mark - Invalidating Matches
+
+- (void)invalidateRange:(NSRange)range replacementLength:(NSUInteger)length
+{
+	if (_length == NSNotFound)
+	{
+		// nothing searched yet
+		return;
+	}
+
+	if (NSMaxRange(range) > _length)
+	{
+		// we missed a modification
+		[self invalidateAllMatches];
+		return;
+	}
+
+	NSInteger delta = (NSInteger)length - (NSInteger)range.length;
+
+	// adjacent matches are included, a combining mark might have been added
+	NSUInteger firstIndex = [self _indexOfFirstMatchEndingAfterIndex:range.location - MIN(range.location, 1)];
+	NSUInteger lastIndex = firstIndex;
+
+	while (lastIndex < _numberOfMatches && _matches[lastIndex].location <= NSMaxRange(range))
+	{
+		lastIndex++;
+	}
+
+	for (NSUInteger i=lastIndex; i<_numberOfMatches; i++)
+	{
+		_matches[i].location = (NSUInteger)((NSInteger)_matches[i].location + delta);
+	}
+
+	[self _replaceMatchesInRange:NSMakeRange(firstIndex, lastIndex - firstIndex) withMatches:NULL count:0];
+
+	// the dirty indexes after the range move as well
+	[_dirtyIndexes removeIndexesInRange:range];
+	[_dirtyIndexes shiftIndexesStartingAtIndex:NSMaxRange(range) by:delta];
+
+	_length = (NSUInteger)((NSInteger)_length + delta);
+
+	// a deletion still needs its paragraph searched again
+	NSRange dirtyRange = NSMakeRange(range.location, MAX(length, 1));
+	dirtyRange = NSIntersectionRange(dirtyRange, NSMakeRange(0, _length));
+
+	if (dirtyRange.length)
+	{
+		[_dirtyIndexes addIndexesInRange:dirtyRange];
+	}
+	else if (_length)
+	{
+		// deleted at the end of the string
+		[_dirtyIndexes addIndex:_length - 1];
+	}
+}
+
+- (void)invalidateAllMatches
+{
+	_numberOfMatches = 0;
+	[_dirtyIndexes removeAllIndexes];
+
+	_length = NSNotFound;
+}
+
+#pragma mark - Getting Matches
+
+- (NSUInteger)numberOfMatchesInString:(NSString *)string
+{
+	[self _updateMatchesInString:string];
+
+	return _numberOfMatches;
+}
+
+- (NSArray *)rangesOfMatchesInRange:(NSRange)range ofString:(NSString *)string
+{
+	[self _updateMatchesInString:string];
+
+	NSMutableArray *ranges = [NSMutableArray array];
+
+	for (NSUInteger i=[self _indexOfFirstMatchEndingAfterIndex:range.location]; i<_numberOfMatches; i++)
+	{
+		NSRange match = _matches[i];
+
+		if (match.location >= NSMaxRange(range) && range.length)
+		{
+			break;
+		}
+
+		if (!range.length && match.location > range.location)
+		{
+			break;
+		}
+
+		[ranges addObject:[NSValue valueWithRange:match]];
+	}
+
+	return ranges;
+}
+
+- (NSRange)rangeOfMatchAtOrAfterIndex:(NSUInteger)index ofString:(NSString *)string
+{
+	[self _updateMatchesInString:string];
+
+	for (NSUInteger i=[self _indexOfFirstMatchEndingAfterIndex:index]; i<_numberOfMatches; i++)
+	{
+		if (_matches[i].location >= index)
+		{
+			return _matches[i];
+		}
+	}
+
+	return NSMakeRange(NSNotFound, 0);
+}
+
+- (NSRange)rangeOfMatchAtOrBeforeIndex:(NSUInteger)index ofString:(NSString *)string
+{
+	[self _updateMatchesInString:string];
+
+	// the first match ending after the index is the one after the one we want
+	NSUInteger matchIndex = [self _indexOfFirstMatchEndingAfterIndex:index];
+
+	if (!matchIndex)
+	{
+		return NSMakeRange(NSNotFound, 0);
+	}
+
+	return _matches[matchIndex-1];
+}
+
+#pragma mark - DTCacheRegistryCache
+
+- (NSUInteger)cacheCost
+{
+	return _capacity * sizeof(NSRange);
+}
+
+- (void)purgeCache
+{
+	[self invalidateAllMatches];
+
+	free(_matches);
+	_matches = NULL;
+	_capacity = 0;
+}
+
+@synthesize searchString = _searchString;
+@synthesize options = _options;
+
+@end
@@ -0,0 +1,98 @@
+//
+//  DTTypingAttributesCache.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <CoreText/CoreText.h>
+
+/**
+ Cache for the attributes that <DTRichTextEditorView> derives from the text at the caret, which are queried on every keystroke and selection change.
+
+ Resolved attributes are cached for the last attribute run they were derived from. Attribute runs are identified by the dictionary the attributed string returns for them, it stays the same object as long as the run is not modified. Moving the caret within a run only costs the lookup of the run.
+
+ The values derived from the text defaults of the editor, including the style table of parsed HTML snippets used by the styles methods, are cached until <removeAllObjects> is called when any of the defaults change. Since the typing attributes fill in missing values from the defaults they are removed as well.
+ */
+@interface DTTypingAttributesCache : NSObject
+
+/**
+ @name Typing Attributes
+ */
+
+/**
+ Returns the typing attributes that were resolved for an attribute run.
+ @param attributes The attributes of the run as returned by the attributed string
+ @param atEndOfLink Whether the caret is at the end of a hyperlink, in which case the link is not continued
+ @returns The cached typing attributes or `nil` if they were resolved for a different run
+ */
+- (NSDictionary *)typingAttributesForRunAttributes:(NSDictionary *)attributes atEndOfLink:(BOOL)atEndOfLink;
+
+/**
+ Stores the typing attributes resolved for an attribute run, replacing the ones of the previous run.
+ @param typingAttributes The resolved typing attributes
+ @param attributes The attributes of the run as returned by the attributed string
+ @param atEndOfLink Whether the caret is at the end of a hyperlink
+ */
+- (void)setTypingAttributes:(NSDictionary *)typingAttributes forRunAttributes:(NSDictionary *)attributes atEndOfLink:(BOOL)atEndOfLink;
+
+/**
+ @name Text Styling
+ */
+
+/**
+ Returns the UIKit text styling that was resolved for an attribute run.
+ @param attributes The attributes of the run as returned by the attributed string
+ @param backgroundColor The background color of the editor, which is part of the styling
+ @returns The cached styling or `nil` if it was resolved for a different run or background color
+ */
+- (NSDictionary *)textStylingForRunAttributes:(NSDictionary *)attributes backgroundColor:(UIColor *)backgroundColor;
+
+/**
+ Stores the UIKit text styling resolved for an attribute run, replacing the one of the previous run.
+ @param textStyling The resolved styling
+ @param attributes The attributes of the run as returned by the attributed string
+ @param backgroundColor The background color of the editor
+ */
+- (void)setTextStyling:(NSDictionary *)textStyling forRunAttributes:(NSDictionary *)attributes backgroundColor:(UIColor *)backgroundColor;
+
+/**
+ @name Values Derived from Text Defaults
+ */
+
+/**
+ Returns the attributes that parsing an HTML snippet with the text defaults resulted in. The styles methods of the editor describe a tag with its class, identifier and text size by such a snippet, the snippet is the key of the style table.
+ @param HTMLString The HTML snippet
+ @returns The attributes at the beginning of the parsed snippet or `nil` if the snippet was not parsed since the text defaults changed
+ */
+- (NSDictionary *)styleAttributesForHTMLString:(NSString *)HTMLString;
+
+/**
+ Stores the attributes that parsing an HTML snippet with the text defaults resulted in.
+ @param attributes The attributes at the beginning of the parsed snippet
+ @param HTMLString The HTML snippet
+ */
+- (void)setStyleAttributes:(NSDictionary *)attributes forHTMLString:(NSString *)HTMLString;
+
+/**
+ The font created from the default font family, size and text size multiplier, retained by the receiver
+ */
+@property (nonatomic, assign) CTFontRef defaultFont;
+
+/**
+ The paragraph style used for text without paragraph style, retained by the receiver
+ */
+@property (nonatomic, assign) CTParagraphStyleRef defaultParagraphStyle;
+
+/**
+ @name Invalidating the Cache
+ */
+
+/**
+ Removes all cached values, needs to be called whenever the text defaults change.
+ */
+- (void)removeAllObjects;
+
+@end
@@ -0,0 +1,125 @@
+//
+//  DTTypingAttributesCache.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTTypingAttributesCache.h"
+
+@implementation DTTypingAttributesCache
+{
+	// retained, so that the identity of the run attributes cannot be reused by a different dictionary
+	NSDictionary *_typingRunAttributes;
+	BOOL _typingAtEndOfLink;
+	NSDictionary *_typingAttributes;
+
+	NSDictionary *_stylingRunAttributes;
+	UIColor *_stylingBackgroundColor;
+	NSDictionary *_textStyling;
+
+	// parsed HTML snippets, keyed by the snippet
+	NSMutableDictionary *_styleTable;
+
+	id _defaultFont;
+	id _defaultParagraphStyle;
+}
+
+#pragma mark - Typing Attributes
+
+- (NSDictionary *)typingAttributesForRunAttributes:(NSDictionary *)attributes atEndOfLink:(BOOL)atEndOfLink
+{
+	if (!attributes || attributes != _typingRunAttributes || atEndOfLink != _typingAtEndOfLink)
+	{
+		return nil;
+	}
+
+	return _typingAttributes;
+}
+
+- (void)setTypingAttributes:(NSDictionary *)typingAttributes forRunAttributes:(NSDictionary *)attributes atEndOfLink:(BOOL)atEndOfLink
+{
+	_typingRunAttributes = attributes;
+	_typingAtEndOfLink = atEndOfLink;
+	_typingAttributes = [typingAttributes copy];
+}
+
+#pragma mark - Text Styling
+
+- (NSDictionary *)textStylingForRunAttributes:(NSDictionary *)attributes backgroundColor:(UIColor *)backgroundColor
+{
+	if (!attributes || attributes != _stylingRunAttributes || backgroundColor != _stylingBackgroundColor)
+	{
+		return nil;
+	}
+
+	return _textStyling;
+}
+
+- (void)setTextStyling:(NSDictionary *)textStyling forRunAttributes:(NSDictionary *)attributes backgroundColor:(UIColor *)backgroundColor
+{
+	_stylingRunAttributes = attributes;
+	_stylingBackgroundColor = backgroundColor;
+	_textStyling = [textStyling copy];
+}
+
+#pragma mark - Style Table
+
+- (NSDictionary *)styleAttributesForHTMLString:(NSString *)HTMLString
+{
+	return [_styleTable objectForKey:HTMLString];
+}
+
+- (void)setStyleAttributes:(NSDictionary *)attributes forHTMLString:(NSString *)HTMLString
+{
+	NSParameterAssert(HTMLString);
+
+	if (!attributes)
+	{
+		return;
+	}
+
+	if (!_styleTable)
+	{
+		_styleTable = [[NSMutableDictionary alloc] init];
+	}
+
+	[_styleTable setObject:[attributes copy] forKey:HTMLString];
+}
+
+#pragma mark - Invalidating the Cache
+
+- (void)removeAllObjects
+{
+	_typingRunAttributes = nil;
+	_typingAttributes = nil;
+
+	[_styleTable removeAllObjects];
+	_defaultFont = nil;
+	_defaultParagraphStyle = nil;
+}
+
+#pragma mark - Properties
+
+- (CTFontRef)defaultFont
+{
+	return (__bridge CTFontRef)_defaultFont;
+}
+
+- (void)setDefaultFont:(CTFontRef)defaultFont
+{
+	_defaultFont = (__bridge id)defaultFont;
+}
+
+- (CTParagraphStyleRef)defaultParagraphStyle
+{
+	return (__bridge CTParagraphStyleRef)_defaultParagraphStyle;
+}
+
+- (void)setDefaultParagraphStyle:(CTParagraphStyleRef)defaultParagraphStyle
+{
+	_defaultParagraphStyle = (__bridge id)defaultParagraphStyle;
+}
+
+@end
@@ -0,0 +1,106 @@
+//
+//  DTUndoDelta.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ A compact record of a single text modification, registered with <DTUndoManager> instead of invocations carrying full attributed substrings.
+
+ A text delta stores the replaced characters as a plain string plus a table of attribute runs, the attribute dictionaries are shared with the document. An attribute delta is used if only attributes changed, it stores the changed runs as (range, key, old value, new value) and no characters at all.
+ */
+@interface DTUndoDelta : NSObject
+
+/**
+ @name Creating Deltas
+ */
+
+/**
+ Creates a text delta that puts back the characters and attributes currently found in a range of a string.
+ @param range The range in the modified text that the stored text replaces when the delta gets undone
+ @param sourceRange The range of the characters to store
+ @param attributedString The string before the modification
+ @returns The text delta
+ */
++ (DTUndoDelta *)deltaForReplacingRange:(NSRange)range withCharactersInRange:(NSRange)sourceRange ofAttributedString:(NSAttributedString *)attributedString;
+
+/**
+ Creates an attribute delta from comparing a range of a string with its replacement.
+ @param range The range of the string that gets replaced
+ @param attributedString The string before the modification
+ @param newString The replacement which has to have the same characters
+ @returns The attribute delta or `nil` if the characters of the replacement differ
+ */
++ (DTUndoDelta *)deltaForChangingAttributesInRange:(NSRange)range ofAttributedString:(NSAttributedString *)attributedString toAttributedString:(NSAttributedString *)newString;
+
+/**
+ @name Getting Information about a Delta
+ */
+
+/**
+ The range of the modified text that is affected when the delta gets undone
+ */
+@property (nonatomic, readonly) NSRange range;
+
+/**
+ The selection to restore after undoing the delta, the location is `NSNotFound` if there was no selection. Defaults to {NSNotFound, 0}.
+ */
+@property (nonatomic, assign) NSRange selectedRange;
+
+/**
+ The undo action name to restore when the delta gets undone
+ */
+@property (nonatomic, copy) NSString *actionName;
+
+/**
+ Whether the receiver only restores attributes and keeps the characters.
+ */
+@property (nonatomic, readonly) BOOL changesAttributesOnly;
+
+/**
+ The approximate number of bytes used by the receiver. Attribute dictionaries and values are shared with the document and therefore not counted.
+ */
+@property (nonatomic, readonly) NSUInteger cost;
+
+/**
+ Whether <discard> was called for the receiver
+ */
+@property (nonatomic, readonly, getter = isDiscarded) BOOL discarded;
+
+/**
+ @name Applying Deltas
+ */
+
+/**
+ Rebuilds the stored text of a text delta.
+ @returns The attributed string to put back into <range>, `nil` for attribute deltas
+ */
+- (NSAttributedString *)attributedString;
+
+/**
+ Restores the old attributes of an attribute delta.
+ @param attributedString The text currently found in <range>, index 0 corresponds to the location of the range
+ */
+- (void)revertAttributesInAttributedString:(NSMutableAttributedString *)attributedString;
+
+/**
+ @name Managing Memory
+ */
+
+/**
+ Merges a delta for a modification that immediately followed the one of the receiver, like the next character typed or deleted.
+ @param delta The newer delta
+ @returns `YES` if the receiver now also undoes the modification of the delta
+ */
+- (BOOL)coalesceWithDelta:(DTUndoDelta *)delta;
+
+/**
+ Releases the stored characters, runs and attribute changes. A discarded delta can no longer be undone.
+ */
+- (void)discard;
+
+@end
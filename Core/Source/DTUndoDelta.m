@@ -0,0 +1,356 @@
+//
+//  DTUndoDelta.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTUndoDelta.h"
+
+// approximate fixed size of a delta or change object
+#define DTUndoDeltaObjectCost 64
+
+// a single attribute run changed by an attribute delta
+@interface DTUndoAttributeChange : NSObject
+{
+@public
+	NSRange _range;
+	NSString *_key;
+	id _oldValue;
+	id _newValue;
+}
+
+@end
+
+@implementation DTUndoAttributeChange
+
+@end
+
+
+static BOOL _DTUndoValuesEqual(id value, id otherValue)
+{
+	return (value == otherValue || [value isEqual:otherValue]);
+}
+
+
+@implementation DTUndoDelta
+{
+	NSRange _range;
+	NSRange _selectedRange;
+	NSString *_actionName;
+
+	// text deltas
+	NSMutableString *_characters;
+	NSMutableArray *_runLengths;
+	NSMutableArray *_runAttributes;
+
+	// attribute deltas
+	NSMutableArray *_attributeChanges;
+
+	BOOL _changesAttributesOnly;
+	BOOL _discarded;
+}
+
++ (DTUndoDelta *)deltaForReplacingRange:(NSRange)range withCharactersInRange:(NSRange)sourceRange ofAttributedString:(NSAttributedString *)attributedString
+{
+	DTUndoDelta *delta = [[DTUndoDelta alloc] initWithRange:range];
+
+	[delta _appendCharactersInRange:sourceRange ofAttributedString:attributedString];
+
+	return delta;
+}
+
++ (DTUndoDelta *)deltaForChangingAttributesInRange:(NSRange)range ofAttributedString:(NSAttributedString *)attributedString toAttributedString:(NSAttributedString *)newString
+{
+	if ([newString length] != range.length)
+	{
+		return nil;
+	}
+
+	// compare without creating a substring
+	if (range.length && [[attributedString string] compare:[newString string] options:NSLiteralSearch range:range] != NSOrderedSame)
+	{
+		return nil;
+	}
+
+	DTUndoDelta *delta = [[DTUndoDelta alloc] initWithRange:range];
+	delta->_changesAttributesOnly = YES;
+	delta->_attributeChanges = [[NSMutableArray alloc] init];
+
+	// last change per key, to merge adjacent runs with the same values
+	NSMutableDictionary *lastChangeByKey = [[NSMutableDictionary alloc] init];
+
+	NSUInteger index = 0;
+
+	while (index < range.length)
+	{
+		NSRange oldEffectiveRange;
+		NSRange newEffectiveRange;
+
+		NSDictionary *oldAttributes = [attributedString attributesAtIndex:range.location + index effectiveRange:&oldEffectiveRange];
+		NSDictionary *newAttributes = [newString attributesAtIndex:index effectiveRange:&newEffectiveRange];
+
+		NSUInteger segmentEnd = MIN(NSMaxRange(oldEffectiveRange) - range.location, NSMaxRange(newEffectiveRange));
+		segmentEnd = MIN(segmentEnd, range.length);
+
+		NSRange segmentRange = NSMakeRange(index, segmentEnd - index);
+
+		if (oldAttributes != newAttributes && ![oldAttributes isEqualToDictionary:newAttributes])
+		{
+			NSMutableSet *keys = [NSMutableSet setWithArray:[oldAttributes allKeys]];
+			[keys addObjectsFromArray:[newAttributes allKeys]];
+
+			for (NSString *key in keys)
+			{
+				id oldValue = [oldAttributes objectForKey:key];
+				id newValue = [newAttributes objectForKey:key];
+
+				if (_DTUndoValuesEqual(oldValue, newValue))
+				{
+					continue;
+				}
+
+				DTUndoAttributeChange *lastChange = [lastChangeByKey objectForKey:key];
+
+				if (lastChange && NSMaxRange(lastChange->_range) == segmentRange.location && _DTUndoValuesEqual(lastChange->_oldValue, oldValue) && _DTUndoValuesEqual(lastChange->_newValue, newValue))
+				{
+					lastChange->_range.length += segmentRange.length;
+					continue;
+				}
+
+				DTUndoAttributeChange *change = [[DTUndoAttributeChange alloc] init];
+				change->_range = segmentRange;
+				change->_key = key;
+				change->_oldValue = oldValue;
+				change->_newValue = newValue;
+
+				[delta->_attributeChanges addObject:change];
+				[lastChangeByKey setObject:change forKey:key];
+			}
+		}
+
+		index = segmentEnd;
+	}
+
+	return delta;
+}
+
+- (instancetype)initWithRange:(NSRange)range
+{
+	self = [super init];
+
+	if (self)
+	{
+		_range = range;
+		_selectedRange = NSMakeRange(NSNotFound, 0);
+	}
+
+	return self;
+}
+
+#pragma mark - Run Table
+
+- (void)_appendCharactersInRange:(NSRange)range ofAttributedString:(NSAttributedString *)attributedString
+{
+	if (!_characters)
+	{
+		_characters = [[NSMutableString alloc] init];
+		_runLengths = [[NSMutableArray alloc] init];
+		_runAttributes = [[NSMutableArray alloc] init];
+	}
+
+	if (!range.length)
+	{
+		return;
+	}
+
+	[_characters appendString:[[attributedString string] substringWithRange:range]];
+
+	[attributedString enumerateAttributesInRange:range options:0 usingBlock:^(NSDictionary *attrs, NSRange runRange, BOOL *stop) {
+		[self _appendRunWithLength:runRange.length attributes:attrs];
+	}];
+}
+
+- (void)_appendRunWithLength:(NSUInteger)length attributes:(NSDictionary *)attributes
+{
+	NSDictionary *lastAttributes = [_runAttributes lastObject];
+
+	if (lastAttributes && (lastAttributes == attributes || [lastAttributes isEqualToDictionary:attributes]))
+	{
+		NSUInteger lastLength = [[_runLengths lastObject] unsignedIntegerValue];
+		[_runLengths replaceObjectAtIndex:[_runLengths count]-1 withObject:@(lastLength + length)];
+
+		return;
+	}
+
+	[_runLengths addObject:@(length)];
+	[_runAttributes addObject:attributes];
+}
+
+- (void)_appendRunsOfDelta:(DTUndoDelta *)delta
+{
+	[_characters appendString:delta->_characters];
+
+	NSUInteger numberOfRuns = [delta->_runLengths count];
+
+	for (NSUInteger i=0; i<numberOfRuns; i++)
+	{
+		[self _appendRunWithLength:[[delta->_runLengths objectAtIndex:i] unsignedIntegerValue] attributes:[delta->_runAttributes objectAtIndex:i]];
+	}
+}
+
+#pragma mark - Applying
+
+- (NSAttributedString *)attributedString
+{
+	if (_changesAttributesOnly || _discarded)
+	{
+		return nil;
+	}
+
+	NSMutableAttributedString *attributedString = [[NSMutableAttributedString alloc] initWithString:_characters];
+
+	[attributedString beginEditing];
+
+	NSUInteger location = 0;
+	NSUInteger numberOfRuns = [_runLengths count];
+
+	for (NSUInteger i=0; i<numberOfRuns; i++)
+	{
+		NSUInteger length = [[_runLengths objectAtIndex:i] unsignedIntegerValue];
+
+		[attributedString setAttributes:[_runAttributes objectAtIndex:i] range:NSMakeRange(location, length)];
+
+		location += length;
+	}
+
+	[attributedString endEditing];
+
+	return attributedString;
+}
+
+- (void)revertAttributesInAttributedString:(NSMutableAttributedString *)attributedString
+{
+	NSAssert([attributedString length] == _range.length, @"String to revert needs to have the length of the delta range");
+
+	[attributedString beginEditing];
+
+	for (DTUndoAttributeChange *change in _attributeChanges)
+	{
+		if (change->_oldValue)
+		{
+			[attributedString addAttribute:change->_key value:change->_oldValue range:change->_range];
+		}
+		else
+		{
+			[attributedString removeAttribute:change->_key range:change->_range];
+		}
+	}
+
+	[attributedString endEditing];
+}
+
+#pragma mark - Managing Memory
+
+- (BOOL)coalesceWithDelta:(DTUndoDelta *)delta
+{
+	if (_changesAttributesOnly || delta->_changesAttributesOnly || _discarded || delta->_discarded)
+	{
+		return NO;
+	}
+
+	NSUInteger numberOfDeletedCharacters = [delta->_characters length];
+
+	// typing: the new insertion continues the inserted range
+	if (!numberOfDeletedCharacters && delta->_range.location == NSMaxRange(_range))
+	{
+		_range.length += delta->_range.length;
+
+		return YES;
+	}
+
+	if (delta->_range.length)
+	{
+		return NO;
+	}
+
+	// backspace over characters typed before, these don't need to be restored
+	if (delta->_range.location + numberOfDeletedCharacters == NSMaxRange(_range) && numberOfDeletedCharacters <= _range.length)
+	{
+		_range.length -= numberOfDeletedCharacters;
+
+		return YES;
+	}
+
+	if (_range.length)
+	{
+		return NO;
+	}
+
+	// backspace: the deleted characters precede the ones deleted before
+	if (delta->_range.location + numberOfDeletedCharacters == _range.location)
+	{
+		NSMutableString *characters = _characters;
+		NSMutableArray *runLengths = _runLengths;
+		NSMutableArray *runAttributes = _runAttributes;
+
+		_characters = [delta->_characters mutableCopy];
+		_runLengths = [delta->_runLengths mutableCopy];
+		_runAttributes = [delta->_runAttributes mutableCopy];
+
+		DTUndoDelta *previous = [[DTUndoDelta alloc] initWithRange:_range];
+		previous->_characters = characters;
+		previous->_runLengths = runLengths;
+		previous->_runAttributes = runAttributes;
+
+		[self _appendRunsOfDelta:previous];
+
+		_range.location = delta->_range.location;
+
+		return YES;
+	}
+
+	// forward delete: the deleted characters follow the ones deleted before
+	if (delta->_range.location == _range.location)
+	{
+		[self _appendRunsOfDelta:delta];
+
+		return YES;
+	}
+
+	return NO;
+}
+
+- (void)discard
+{
+	_discarded = YES;
+
+	_characters = nil;
+	_runLengths = nil;
+	_runAttributes = nil;
+	_attributeChanges = nil;
+}
+
+- (NSUInteger)cost
+{
+	NSUInteger cost = DTUndoDeltaObjectCost;
+
+	cost += [_characters length] * sizeof(unichar);
+
+	// a number and a dictionary reference per run
+	cost += [_runLengths count] * (DTUndoDeltaObjectCost/2 + sizeof(id));
+	cost += [_attributeChanges count] * DTUndoDeltaObjectCost;
+
+	return cost;
+}
+
+#pragma mark - Properties
+
+@synthesize range = _range;
+@synthesize selectedRange = _selectedRange;
+@synthesize actionName = _actionName;
+@synthesize changesAttributesOnly = _changesAttributesOnly;
+@synthesize discarded = _discarded;
+
+@end
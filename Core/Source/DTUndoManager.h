@@ -8,13 +8,19 @@
 
 #import <Foundation/Foundation.h>
 
+#import "DTCacheRegistry.h"
+
+@class DTUndoDelta;
+
 /**
  Specialized undo manager that automatically closes open undo groups.
  
  If you do an undo or removeAllActions then closeAllOpenGroups will be called. This is required because while typing you want all typed characters go into the same open undo group, but need to close the group in time before doing an undo, otherwise there will be a crash.
+ 
+ Text modifications are registered as <DTUndoDelta> objects which are kept in a journal. Deltas of consecutive typing steps in the same open group are coalesced into one. If the deltas on the undo stack exceed the <memoryBudget> then the oldest ones are discarded, undoing beyond those ends the undo history. Under memory pressure the shared <DTCacheRegistry> can discard the older half of the deltas as a last resort.
  */
 
-@interface DTUndoManager : NSUndoManager
+@interface DTUndoManager : NSUndoManager <DTCacheRegistryCache>
 
 /**
  Number of currently open undo groups
@@ -26,4 +32,30 @@
  */
 - (void)closeAllOpenGroups;
 
+/**
+ @name Registering Deltas
+ */
+
+/**
+ Registers a delta to be undone. If the last registration was a delta for the same target and selector in the same open undo group then the receiver tries to coalesce the two instead.
+ @param delta The delta
+ @param target The object to undo the delta, it is not retained
+ @param selector The method called on the target with the delta as single parameter
+ */
+- (void)registerUndoDelta:(DTUndoDelta *)delta withTarget:(id)target selector:(SEL)selector;
+
+/**
+ @name Limiting Memory
+ */
+
+/**
+ The maximum number of bytes that deltas on the undo stack should use, 0 means no limit. Defaults to 10 MB.
+ */
+@property (nonatomic, assign) NSUInteger memoryBudget;
+
+/**
+ The approximate number of bytes currently used by deltas on the undo stack
+ */
+@property (nonatomic, readonly) NSUInteger journalSize;
+
 @end
@@ -7,10 +7,57 @@
 //
 
 #import "DTUndoManager.h"
+#import "DTUndoDelta.h"
+
+#define DTUndoManagerDefaultMemoryBudget (10 * 1024 * 1024)
+
+// a registered delta together with the object undoing it
+@interface DTUndoJournalEntry : NSObject
+{
+@public
+	DTUndoDelta *_delta;
+	__weak id _target;
+	SEL _selector;
+	
+	// the cost accounted for in the journal size, 0 if not on the undo stack
+	NSUInteger _cost;
+}
+
+@end
+
+@implementation DTUndoJournalEntry
+
+@end
+
 
 @implementation DTUndoManager
 {
 	NSUInteger _numberOfOpenGroups;
+	
+	// entries on the undo stack, oldest first
+	NSMutableArray *_journal;
+	NSUInteger _journalSize;
+	NSUInteger _memoryBudget;
+	
+	// the entry new deltas can be coalesced with
+	DTUndoJournalEntry *_lastEntry;
+	
+	BOOL _didReachDiscardedDelta;
+}
+
+- (instancetype)init
+{
+	self = [super init];
+	
+	if (self)
+	{
+		_journal = [[NSMutableArray alloc] init];
+		_memoryBudget = DTUndoManagerDefaultMemoryBudget;
+		
+		[[DTCacheRegistry sharedRegistry] registerCache:self evictionOrder:DTCacheEvictionOrderHistory];
+	}
+	
+	return self;
 }
 
 - (void)beginUndoGrouping
@@ -29,6 +76,12 @@
     
 	_numberOfOpenGroups--;
 	
+	if (!_numberOfOpenGroups)
+	{
+		// only coalesce within the same group
+		_lastEntry = nil;
+	}
+	
 	[super endUndoGrouping];
 }
 
@@ -44,13 +97,55 @@
 {
 	[self closeAllOpenGroups];
 	[super removeAllActions];
+	
+	[_journal removeAllObjects];
+	_journalSize = 0;
+	_lastEntry = nil;
+}
+
+- (void)removeAllActionsWithTarget:(id)target
+{
+	[super removeAllActionsWithTarget:target];
+	
+	// deltas are registered with the receiver as target, they do nothing once their target is gone
+	for (DTUndoJournalEntry *entry in [_journal copy])
+	{
+		if (entry->_target == target)
+		{
+			entry->_target = nil;
+			[self _removeEntryFromJournal:entry];
+		}
+	}
+	
+	if (_lastEntry && !_lastEntry->_target)
+	{
+		_lastEntry = nil;
+	}
 }
 
 - (void)undo
 {
 	[self closeAllOpenGroups];
 	
+	_lastEntry = nil;
+	_didReachDiscardedDelta = NO;
+	
 	[super undo];
+	
+	if (_didReachDiscardedDelta)
+	{
+		// the history before the discarded delta cannot be restored
+		[self removeAllActions];
+	}
+}
+
+- (void)redo
+{
+	_lastEntry = nil;
+	
+	[super redo];
+	
+	[self _trimJournal];
 }
 
 - (void)disableUndoRegistration
@@ -67,8 +162,181 @@
     [super enableUndoRegistration];
 }
 
+- (id)prepareWithInvocationTarget:(id)target
+{
+	// other actions in between prevent coalescing
+	_lastEntry = nil;
+	
+	return [super prepareWithInvocationTarget:target];
+}
+
+- (void)registerUndoWithTarget:(id)target selector:(SEL)selector object:(id)anObject
+{
+	_lastEntry = nil;
+	
+	[super registerUndoWithTarget:target selector:selector object:anObject];
+}
+
+#pragma mark - Deltas
+
+- (void)registerUndoDelta:(DTUndoDelta *)delta withTarget:(id)target selector:(SEL)selector
+{
+	NSParameterAssert(delta);
+	NSParameterAssert(target);
+	
+	if (![self isUndoRegistrationEnabled])
+	{
+		return;
+	}
+	
+	BOOL isUndoing = [self isUndoing];
+	BOOL isRedoing = [self isRedoing];
+	
+	if (_lastEntry && _numberOfOpenGroups && !isUndoing && !isRedoing && _lastEntry->_target == target && _lastEntry->_selector == selector)
+	{
+		if ([_lastEntry->_delta coalesceWithDelta:delta])
+		{
+			NSUInteger cost = [_lastEntry->_delta cost];
+			
+			_journalSize = _journalSize - _lastEntry->_cost + cost;
+			_lastEntry->_cost = cost;
+			
+			[self _trimJournal];
+			
+			return;
+		}
+	}
+	
+	DTUndoJournalEntry *entry = [[DTUndoJournalEntry alloc] init];
+	entry->_delta = delta;
+	entry->_target = target;
+	entry->_selector = selector;
+	
+	[super registerUndoWithTarget:self selector:@selector(_undoJournalEntry:) object:entry];
+	
+	if (isUndoing)
+	{
+		// goes onto the redo stack which is not journaled
+		_lastEntry = nil;
+		
+		return;
+	}
+	
+	entry->_cost = [delta cost];
+	
+	[_journal addObject:entry];
+	_journalSize += entry->_cost;
+	
+	_lastEntry = entry;
+	
+	[self _trimJournal];
+}
+
+- (void)_undoJournalEntry:(DTUndoJournalEntry *)entry
+{
+	[self _removeEntryFromJournal:entry];
+	
+	DTUndoDelta *delta = entry->_delta;
+	
+	if ([delta isDiscarded])
+	{
+		_didReachDiscardedDelta = YES;
+		
+		return;
+	}
+	
+	id target = entry->_target;
+	
+	if (!target)
+	{
+		return;
+	}
+	
+	void (*function)(id, SEL, DTUndoDelta *) = (void *)[target methodForSelector:entry->_selector];
+	function(target, entry->_selector, delta);
+}
+
+- (void)_removeEntryFromJournal:(DTUndoJournalEntry *)entry
+{
+	// undone entries are usually the most recent ones
+	NSUInteger index = [_journal count];
+	
+	while (index>0)
+	{
+		index--;
+		
+		if ([_journal objectAtIndex:index] == entry)
+		{
+			_journalSize -= entry->_cost;
+			entry->_cost = 0;
+			
+			[_journal removeObjectAtIndex:index];
+			
+			return;
+		}
+	}
+}
+
+- (void)_trimJournal
+{
+	if (!_memoryBudget)
+	{
+		return;
+	}
+	
+	[self _trimJournalToSize:_memoryBudget];
+}
+
+// discards the oldest deltas until the journal fits into the size
+- (void)_trimJournalToSize:(NSUInteger)size
+{
+	NSUInteger numberOfEntries = [_journal count];
+	NSUInteger numberOfDiscardedEntries = 0;
+	
+	// always keep the newest delta, even if it alone is over budget
+	while (_journalSize > size && numberOfEntries - numberOfDiscardedEntries > 1)
+	{
+		DTUndoJournalEntry *entry = [_journal objectAtIndex:numberOfDiscardedEntries];
+		
+		_journalSize -= entry->_cost;
+		entry->_cost = 0;
+		
+		// the entry stays on the undo stack, but without its payload
+		[entry->_delta discard];
+		
+		numberOfDiscardedEntries++;
+	}
+	
+	if (numberOfDiscardedEntries)
+	{
+		[_journal removeObjectsInRange:NSMakeRange(0, numberOfDiscardedEntries)];
+	}
+}
+
+#pragma mark - DTCacheRegistryCache
+
+- (NSUInteger)cacheCost
+{
+	return _journalSize;
+}
+
+- (void)purgeCache
+{
+	// the undo history cannot be recreated, only the older half of it is given up
+	[self _trimJournalToSize:_journalSize / 2];
+}
+
 #pragma mark - Properties
 
+- (void)setMemoryBudget:(NSUInteger)memoryBudget
+{
+	_memoryBudget = memoryBudget;
+	
+	[self _trimJournal];
+}
+
 @synthesize numberOfOpenGroups = _numberOfOpenGroups;
+@synthesize memoryBudget = _memoryBudget;
+@synthesize journalSize = _journalSize;
 
 @end
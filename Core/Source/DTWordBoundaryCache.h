@@ -0,0 +1,59 @@
+//
+//  DTWordBoundaryCache.h
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "DTCacheRegistry.h"
+
+@class DTRichTextEditorMetrics;
+
+/**
+ Cache for the word ranges of the paragraphs of a string, used by <DTTextInputTokenizer> so that moving the cursor, double-tapping or extending a selection only tokenizes a paragraph once instead of the whole document every time.
+
+ Words are determined with `CFStringTokenizer` for a single paragraph. The cache is owned by <DTRichTextEditorContentView> which informs it about modifications via <invalidateRange:replacementLength:>, the cached paragraphs after a modification only move.
+ */
+@interface DTWordBoundaryCache : NSObject <DTCacheRegistryCache>
+
+/**
+ @name Invalidating Word Ranges
+ */
+
+/**
+ Removes the word ranges of the paragraphs touched by replacing a range of the string, including the adjacent paragraphs it might have merged with. Paragraphs after the range are moved by the difference in length.
+ @param range The range of the string before the modification
+ @param length The length of the replacement text
+ */
+- (void)invalidateRange:(NSRange)range replacementLength:(NSUInteger)length;
+
+/**
+ Removes all cached word ranges, for example if the string was replaced entirely.
+ */
+- (void)removeAllWordRanges;
+
+/**
+ @name Getting Word Ranges
+ */
+
+/**
+ Enumerates the words of a paragraph, tokenizing the paragraph if it is not cached yet. Whitespace, punctuation and attachments are not words.
+ @param paragraphRange The range of the paragraph in the string
+ @param string The current string
+ @param block The block to execute for every word in ascending order, set `stop` to `YES` to end the enumeration
+ */
+- (void)enumerateWordRangesInParagraphRange:(NSRange)paragraphRange ofString:(NSString *)string usingBlock:(void (^)(NSRange wordRange, BOOL *stop))block;
+
+/**
+ @name Measuring Performance
+ */
+
+/**
+ If set then every cached paragraph that is used counts as a hit and every paragraph that is tokenized again as a miss. Set by <DTRichTextEditorContentView>.
+ */
+@property (nonatomic, strong) DTRichTextEditorMetrics *metrics;
+
+@end
@@ -0,0 +1,267 @@
+//
+//  DTWordBoundaryCache.m
+//  DTRichTextEditor
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import "DTWordBoundaryCache.h"
+#import "DTRichTextEditorMetrics.h"
+
+#import <CoreFoundation/CoreFoundation.h>
+
+// the number of paragraphs whose words are kept
+#define DTWordBoundaryCacheMaximumParagraphs 64
+
+// a paragraph with its words, the word ranges are relative to the paragraph so that it can move
+@interface DTWordBoundaryParagraph : NSObject
+{
+@public
+	NSRange _range;
+	NSRange *_words;
+	NSUInteger _numberOfWords;
+}
+
+@end
+
+@implementation DTWordBoundaryParagraph
+
+- (void)dealloc
+{
+	free(_words);
+}
+
+@end
+
+
+@implementation DTWordBoundaryCache
+{
+	// sorted by location, paragraphs don't overlap
+	NSMutableArray *_paragraphs;
+
+	CFStringTokenizerRef _tokenizer;
+	CFLocaleRef _locale;
+
+	DTRichTextEditorMetrics *_metrics;
+}
+
+- (id)init
+{
+	self = [super init];
+
+	if (self)
+	{
+		_paragraphs = [[NSMutableArray alloc] init];
+		
+		[[DTCacheRegistry sharedRegistry] registerCache:self evictionOrder:DTCacheEvictionOrderDerivedData];
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	if (_tokenizer)
+	{
+		CFRelease(_tokenizer);
+	}
+
+	if (_locale)
+	{
+		CFRelease(_locale);
+	}
+}
+
+#pragma mark - Tokenizing
+
+- (DTWordBoundaryParagraph *)_newParagraphWithRange:(NSRange)paragraphRange ofString:(NSString *)string
+{
+	CFRange tokenizerRange = CFRangeMake(paragraphRange.location, paragraphRange.length);
+
+	if (!_tokenizer)
+	{
+		_locale = CFLocaleCopyCurrent();
+		_tokenizer = CFStringTokenizerCreate(NULL, (__bridge CFStringRef)string, tokenizerRange, kCFStringTokenizerUnitWord, _locale);
+	}
+	else
+	{
+		// only the paragraph is tokenized
+		CFStringTokenizerSetString(_tokenizer, (__bridge CFStringRef)string, tokenizerRange);
+	}
+
+	DTWordBoundaryParagraph *paragraph = [[DTWordBoundaryParagraph alloc] init];
+	paragraph->_range = paragraphRange;
+
+	NSUInteger capacity = 0;
+	NSCharacterSet *alphanumericCharacterSet = [NSCharacterSet alphanumericCharacterSet];
+
+	while (CFStringTokenizerAdvanceToNextToken(_tokenizer) != kCFStringTokenizerTokenNone)
+	{
+		CFRange tokenRange = CFStringTokenizerGetCurrentTokenRange(_tokenizer);
+		NSRange wordRange = NSMakeRange(tokenRange.location, tokenRange.length);
+
+		// attachment placeholders and punctuation are no words
+		if ([string rangeOfCharacterFromSet:alphanumericCharacterSet options:0 range:wordRange].location == NSNotFound)
+		{
+			continue;
+		}
+
+		if (paragraph->_numberOfWords == capacity)
+		{
+			capacity = MAX(16, capacity * 2);
+			paragraph->_words = realloc(paragraph->_words, capacity * sizeof(NSRange));
+		}
+
+		wordRange.location -= paragraphRange.location;
+		paragraph->_words[paragraph->_numberOfWords++] = wordRange;
+	}
+
+	// don't keep the string alive
+	CFStringTokenizerSetString(_tokenizer, CFSTR(""), CFRangeMake(0, 0));
+
+	return paragraph;
+}
+
+#pragma mark - Invalidating Word Ranges
+
+- (void)invalidateRange:(NSRange)range replacementLength:(NSUInteger)length
+{
+	NSInteger delta = (NSInteger)length - (NSInteger)range.length;
+
+	for (NSInteger i=[_paragraphs count]-1; i>=0; i--)
+	{
+		DTWordBoundaryParagraph *paragraph = [_paragraphs objectAtIndex:i];
+
+		if (paragraph->_range.location > NSMaxRange(range))
+		{
+			paragraph->_range.location = (NSUInteger)((NSInteger)paragraph->_range.location + delta);
+			continue;
+		}
+
+		// adjacent paragraphs are included, removing a newline merges paragraphs
+		if (NSMaxRange(paragraph->_range) >= range.location)
+		{
+			[_paragraphs removeObjectAtIndex:i];
+			continue;
+		}
+
+		// all others are before the range
+		break;
+	}
+}
+
+- (void)removeAllWordRanges
+{
+	[_paragraphs removeAllObjects];
+}
+
+#pragma mark - Getting Word Ranges
+
+- (DTWordBoundaryParagraph *)_paragraphWithRange:(NSRange)paragraphRange ofString:(NSString *)string
+{
+	NSUInteger count = [_paragraphs count];
+	NSUInteger index = 0;
+
+	// find the insertion index
+	while (index < count)
+	{
+		DTWordBoundaryParagraph *paragraph = [_paragraphs objectAtIndex:index];
+
+		if (paragraph->_range.location >= paragraphRange.location)
+		{
+			if (NSEqualRanges(paragraph->_range, paragraphRange))
+			{
+				[_metrics recordLookupInCache:DTRichTextEditorMetricsCacheWordBoundaries hit:YES];
+
+				return paragraph;
+			}
+
+			break;
+		}
+
+		index++;
+	}
+
+	[_metrics recordLookupInCache:DTRichTextEditorMetricsCacheWordBoundaries hit:NO];
+
+	DTWordBoundaryParagraph *paragraph = [self _newParagraphWithRange:paragraphRange ofString:string];
+
+	// remove paragraphs the new one overlaps, we missed a modification
+	while (index > 0 && NSMaxRange(((DTWordBoundaryParagraph *)[_paragraphs objectAtIndex:index-1])->_range) > paragraphRange.location)
+	{
+		[_paragraphs removeObjectAtIndex:--index];
+	}
+
+	while (index < [_paragraphs count] && ((DTWordBoundaryParagraph *)[_paragraphs objectAtIndex:index])->_range.location < NSMaxRange(paragraphRange))
+	{
+		[_paragraphs removeObjectAtIndex:index];
+	}
+
+	[_paragraphs insertObject:paragraph atIndex:index];
+
+	// drop the paragraph farthest away from the new one
+	if ([_paragraphs count] > DTWordBoundaryCacheMaximumParagraphs)
+	{
+		if (index < [_paragraphs count]/2)
+		{
+			[_paragraphs removeLastObject];
+		}
+		else
+		{
+			[_paragraphs removeObjectAtIndex:0];
+		}
+	}
+
+	return paragraph;
+}
+
+- (void)enumerateWordRangesInParagraphRange:(NSRange)paragraphRange ofString:(NSString *)string usingBlock:(void (^)(NSRange wordRange, BOOL *stop))block
+{
+	NSParameterAssert(block);
+
+	if (!paragraphRange.length || NSMaxRange(paragraphRange) > [string length])
+	{
+		return;
+	}
+
+	DTWordBoundaryParagraph *paragraph = [self _paragraphWithRange:paragraphRange ofString:string];
+
+	BOOL stop = NO;
+
+	for (NSUInteger i=0; i<paragraph->_numberOfWords; i++)
+	{
+		NSRange wordRange = paragraph->_words[i];
+		wordRange.location += paragraph->_range.location;
+
+		block(wordRange, &stop);
+
+		if (stop)
+		{
+			break;
+		}
+	}
+}
+
+#pragma mark - DTCacheRegistryCache
+
+- (NSUInteger)cacheCost
+{
+	NSUInteger cost = 0;
+	
+	for (DTWordBoundaryParagraph *paragraph in _paragraphs)
+	{
+		cost += paragraph->_numberOfWords * sizeof(NSRange);
+	}
+	
+	return cost;
+}
+
+- (void)purgeCache
+{
+	[self removeAllWordRanges];
+}
+
+@synthesize metrics = _metrics;
+
+@end
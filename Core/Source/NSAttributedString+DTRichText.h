@@ -22,6 +22,13 @@
  */
 - (NSDictionary *)typingAttributesForRange:(NSRange)range;
 
+/**
+ Determines the string index whose attributes <typingAttributesForRange:> returns.
+ @param range The string range to query
+ @returns The index of the character the typing attributes are taken from or `NSNotFound` if there is none
+ */
+- (NSUInteger)indexOfTypingAttributesForRange:(NSRange)range;
+
 /**
  Create an attributed string with text attachment for an image.
  
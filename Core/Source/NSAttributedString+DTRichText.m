@@ -14,9 +14,9 @@
 
 @implementation NSAttributedString (DTRichText)
 
-- (NSDictionary *)typingAttributesForRange:(NSRange)range
+- (NSUInteger)indexOfTypingAttributesForRange:(NSRange)range
 {
-	NSInteger index = 0;
+	NSUInteger index = 0;
 	
 	if (range.length)
 	{
@@ -38,6 +38,18 @@
 	}
 	
 	if (index >= [self length])
+	{
+		return NSNotFound;
+	}
+	
+	return index;
+}
+
+- (NSDictionary *)typingAttributesForRange:(NSRange)range
+{
+	NSUInteger index = [self indexOfTypingAttributesForRange:range];
+	
+	if (index == NSNotFound)
 	{
 		return nil;
 	}
@@ -14,7 +14,7 @@
 @interface NSAttributedString (DTWebArchive)
 
 /**
- Creates an attributed string from a web archive.
+ Creates an attributed string from a web archive. Plain image attachments are replaced with DTRichTextImageAttachment instances that keep the original bytes of their resources.
  @param webArchive The web archive
  @param options The DTAttributedStringBuilder options to use for parsing
  @param dict The resulting document attributes
@@ -29,4 +29,12 @@
  */
 - (DTWebArchive *)webArchive;
 
+/**
+ Writes a web archive of the receiver to a stream without building the archive in memory first.
+ @param stream An open output stream
+ @param error The error that occurred if writing failed
+ @returns `YES` if the archive was written
+ */
+- (BOOL)writeWebArchiveToStream:(NSOutputStream *)stream error:(NSError **)error;
+
 @end
@@ -12,6 +12,9 @@
 
 #import "NSAttributedString+DTWebArchive.h"
 #import "DTWebResource+DTRichText.h"
+#import "DTHTMLWriter+DTWebArchive.h"
+#import "DTRichTextImageAttachment.h"
+#import "DTTextAttachmentIndex.h"
 
 @implementation NSAttributedString (DTWebArchive)
 
@@ -46,65 +49,65 @@
 	// make attributed string
 	NSAttributedString *tmpStr = [[NSAttributedString alloc] initWithHTMLData:webArchive.mainResource.data options:localOptions documentAttributes:dict];
 	
+	// the image attachments keep the original bytes of the resources and only decode downsampled bitmaps
+	tmpStr = [DTRichTextImageAttachment attributedStringByReplacingImageAttachmentsInAttributedString:tmpStr];
+	
+	
+	// looked up by URL for every resource, instead of scanning the string each time
+	DTTextAttachmentIndex *attachmentIndex = [webArchive.subresources count] ? [[DTTextAttachmentIndex alloc] initWithAttributedString:tmpStr] : nil;
 	
 	// if data is available for image attachments fill it in
 	for (DTWebResource *oneResource in webArchive.subresources)
 	{
-		NSPredicate *pred = [NSPredicate predicateWithFormat:@"contentURL.absoluteString == %@", [oneResource.URL absoluteString]];
-		
 		// possibly multiple attachments with same URL
-		NSArray *attachments = [tmpStr textAttachmentsWithPredicate:pred class:[DTImageTextAttachment class]];
+		NSArray *attachments = [attachmentIndex attachmentsWithContentURL:oneResource.URL];
 		
-		UIImage *image = [oneResource image];
+		UIImage *image = nil;
 		
-		if (image)
+		for (DTImageTextAttachment *oneAttachment in attachments)
 		{
-			for (DTImageTextAttachment *oneAttachment in attachments)
+			if (![oneAttachment isKindOfClass:[DTImageTextAttachment class]])
 			{
-				// this avoids unnecessary lazy loading
-				oneAttachment.image = image;
+				continue;
 			}
-		}
-	}
-	
-	return tmpStr;
-}
-
-- (DTWebArchive *)webArchive
-{
-	NSString *htmlString = [self htmlString];
-	NSData *data = [htmlString dataUsingEncoding:NSUTF8StringEncoding];
-	
-	NSMutableArray *subresources = nil;
-	
-	NSArray *images = [self textAttachmentsWithPredicate:nil class:[DTImageTextAttachment class]];
-	
-	if ([images count])
-	{
-		subresources = [NSMutableArray array];
-		for (DTImageTextAttachment *oneAttachment in images)
-		{
-			// only add web resources for images that are not data URLs and that have a contentURL
-			if (oneAttachment.image && !oneAttachment.contentURL)
+			
+			// keeps the original bytes, these are also reused when writing a web archive again
+			if ([oneAttachment isKindOfClass:[DTRichTextImageAttachment class]])
 			{
-				// this is an image in a data URL, that's already represented in the HTML
+				[(DTRichTextImageAttachment *)oneAttachment setImageData:oneResource.data MIMEType:oneResource.MIMEType];
 				continue;
 			}
 			
-			NSData *data = UIImagePNGRepresentation(oneAttachment.image);
-			
-			if (data)
+			if (!image)
 			{
-				DTWebResource *resource = [[DTWebResource alloc] initWithData:data URL:oneAttachment.contentURL MIMEType:@"image/png" textEncodingName:nil frameName:nil];
-				[subresources addObject:resource];
+				image = [oneResource image];
+				
+				if (!image)
+				{
+					break;
+				}
 			}
+			
+			// this avoids unnecessary lazy loading
+			oneAttachment.image = image;
 		}
 	}
 	
-	DTWebResource *mainResource = [[DTWebResource alloc] initWithData:data URL:nil MIMEType:@"text/html" textEncodingName:@"UTF8" frameName:nil];
-	DTWebArchive *newArchive = [[DTWebArchive alloc] initWithMainResource:mainResource subresources:subresources subframeArchives:nil];
+	return tmpStr;
+}
+
+- (DTWebArchive *)webArchive
+{
+	DTHTMLWriter *writer = [[DTHTMLWriter alloc] initWithAttributedString:self];
+	
+	return [writer webArchive];
+}
+
+- (BOOL)writeWebArchiveToStream:(NSOutputStream *)stream error:(NSError **)error
+{
+	DTHTMLWriter *writer = [[DTHTMLWriter alloc] initWithAttributedString:self];
 	
-	return newArchive;
+	return [writer writeWebArchiveToStream:stream error:error];
 }
 
 
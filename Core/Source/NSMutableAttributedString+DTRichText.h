@@ -127,7 +127,7 @@ The color parameter is ignored if the method call toggles a previous URL off.
 - (void)toggleParagraphSpacing:(BOOL)spaceOn atIndex:(NSUInteger)index spacing:(CGFloat)spacing;
 
 /** 
- Method to correct paragraph styles on paragraphs belonging to list
+ Method to correct paragraph styles on paragraphs belonging to list. Only paragraphs with a different spacing are modified.
  @note List support is not complete
  */
 - (void)correctParagraphSpacing;
@@ -137,7 +137,7 @@ The color parameter is ignored if the method call toggles a previous URL off.
  */
 
 /**
- Convenience method to update list styling on entire paragraphs
+ Convenience method to update list styling on entire paragraphs. Paragraphs that already have the resulting prefix and attributes are not replaced.
  
  @param listStyle The list style to apply or `nil` to remove list styling
  @param range The range to update
@@ -159,7 +159,7 @@ The color parameter is ignored if the method call toggles a previous URL off.
  */
 
 /**
- Adding a marked range
+ Adding a marked range. The positions of the markers are remembered and moved by <updateListStyle:inRange:numberFrom:listIndent:spacingAfterList:removeNonPrefixedParagraphsFromList:>, other modifications of the string make <markedRangeRemove:> search the entire string.
  @param range The affected string range
  */
 - (void)addMarkersForSelectionRange:(NSRange)range;
@@ -14,6 +14,8 @@
 #import "NSMutableAttributedString+DTRichText.h"
 //#import "NSMutableAttributedString+HTML.h"
 #import "NSMutableDictionary+DTRichText.h"
+#import "DTFontCache.h"
+#import "DTParagraphStyleCache.h"
 
 //#import "DTTextAttachment.h"
 //#import "NSAttributedStringRunDelegates.h"
@@ -26,6 +28,28 @@
 //#import "UIFont+DTCoreText.h"
 #import "DTRichTextEditorConstants.h"
 
+#import <objc/runtime.h>
+
+// key for the associated object that remembers where the selection markers are
+static char DTSelectionMarkerPositionsKey;
+
+// the indexes that contain the selection markers, a replacement that covers a marker adds the entire replacement
+@interface DTSelectionMarkerPositions : NSObject
+{
+@public
+	NSMutableIndexSet *_indexes;
+	NSUInteger _numberOfMarkers;
+	
+	// any other modification of the string invalidates the indexes
+	NSUInteger _length;
+}
+
+@end
+
+@implementation DTSelectionMarkerPositions
+
+@end
+
 
 @implementation NSMutableAttributedString (DTRichText)
 
@@ -118,14 +142,11 @@
 	[self beginEditing];
 	
 	CTFontRef currentFont = (__bridge CTFontRef)[currentAttributes objectForKey:(id)kCTFontAttributeName];
-	DTCoreTextFontDescriptor *typingFontDescriptor = [DTCoreTextFontDescriptor fontDescriptorForCTFont:currentFont];
-	
-	// need to replace name with family
-	CFStringRef family = CTFontCopyFamilyName(currentFont);
-	typingFontDescriptor.fontFamily = (__bridge NSString *)family;
-	CFRelease(family);
+	BOOL isBold = (currentFont && (CTFontGetSymbolicTraits(currentFont) & kCTFontBoldTrait));
 	
-	typingFontDescriptor.fontName = nil;
+	// all runs get the same transform, the fonts are shared between runs
+	DTFontTraitTransform transform = isBold ? DTFontTraitTransformRemoveBold : DTFontTraitTransformAddBold;
+	DTFontCache *fontCache = [DTFontCache sharedCache];
 	
     NSRange attrRange;
     NSUInteger index=range.location;
@@ -137,19 +158,12 @@
 		
 		if (currentFont)
 		{
-			DTCoreTextFontDescriptor *desc = [DTCoreTextFontDescriptor fontDescriptorForCTFont:currentFont];
-			
-			// need to replace name with family
-			CFStringRef family = CTFontCopyFamilyName(currentFont);
-			desc.fontFamily = (__bridge NSString *)family;
-			CFRelease(family);
+			CTFontRef newFont = [fontCache newFontByApplyingTraitTransform:transform toFont:currentFont];
 			
-			desc.fontName = nil;
-			
-			desc.boldTrait = !typingFontDescriptor.boldTrait;
-			CTFontRef newFont = [desc newMatchingFont];
-			[attrs setObject:(__bridge id)newFont forKey:(id)kCTFontAttributeName];
-			CFRelease(newFont);
+			if (newFont)
+			{
+				[attrs setObject:CFBridgingRelease(newFont) forKey:(id)kCTFontAttributeName];
+			}
 			
 			if (attrRange.location < range.location)
 			{
@@ -185,14 +199,11 @@
 	[self beginEditing];
 	
 	CTFontRef currentFont = (__bridge CTFontRef)[currentAttributes objectForKey:(id)kCTFontAttributeName];
-	DTCoreTextFontDescriptor *typingFontDescriptor = [DTCoreTextFontDescriptor fontDescriptorForCTFont:currentFont];
-	
-	// need to replace name with family
-	CFStringRef family = CTFontCopyFamilyName(currentFont);
-	typingFontDescriptor.fontFamily = (__bridge NSString *)family;
-	CFRelease(family);
+	BOOL isItalic = (currentFont && (CTFontGetSymbolicTraits(currentFont) & kCTFontItalicTrait));
 	
-	typingFontDescriptor.fontName = nil;
+	// all runs get the same transform, the fonts are shared between runs
+	DTFontTraitTransform transform = isItalic ? DTFontTraitTransformRemoveItalic : DTFontTraitTransformAddItalic;
+	DTFontCache *fontCache = [DTFontCache sharedCache];
 	
     NSRange attrRange;
     NSUInteger index=range.location;
@@ -204,19 +215,12 @@
 		
 		if (currentFont)
 		{
-			DTCoreTextFontDescriptor *desc = [DTCoreTextFontDescriptor fontDescriptorForCTFont:currentFont];
+			CTFontRef newFont = [fontCache newFontByApplyingTraitTransform:transform toFont:currentFont];
 			
-			// need to replace name with family
-			CFStringRef family = CTFontCopyFamilyName(currentFont);
-			desc.fontFamily = (__bridge NSString *)family;
-			CFRelease(family);
-			
-			desc.fontName = nil;
-			
-			desc.italicTrait = !typingFontDescriptor.italicTrait;
-			CTFontRef newFont = [desc newMatchingFont];
-			[attrs setObject:(__bridge id)newFont forKey:(id)kCTFontAttributeName];
-			CFRelease(newFont);
+			if (newFont)
+			{
+				[attrs setObject:CFBridgingRelease(newFont) forKey:(id)kCTFontAttributeName];
+			}
 			
 			if (attrRange.location < range.location)
 			{
@@ -456,14 +460,18 @@
 		if (block(paragraphStyle, &stop))
 		{
 			// YES means we should update
-			CTParagraphStyleRef newStyle = [paragraphStyle createCTParagraphStyle];
-			
-			// remove old, works around old leak
-			[self removeAttribute:(id)kCTParagraphStyleAttributeName range:paragraphRange];
-			
-			[self addAttribute:(id)kCTParagraphStyleAttributeName value:(__bridge id)newStyle range:paragraphRange];
+			CTParagraphStyleRef newStyle = [[DTParagraphStyleCache sharedCache] newParagraphStyleWithParagraphStyle:paragraphStyle];
 			
-			didChange = YES;
+			// interned, so the same values result in the same style
+			if (newStyle != ctParaStyle)
+			{
+				// remove old, works around old leak
+				[self removeAttribute:(id)kCTParagraphStyleAttributeName range:paragraphRange];
+				
+				[self addAttribute:(id)kCTParagraphStyleAttributeName value:(__bridge id)newStyle range:paragraphRange];
+				
+				didChange = YES;
+			}
 			
 			CFRelease(newStyle);
 			
@@ -497,7 +505,7 @@
 			 
 			 if (didChangeRange)
 			 {
-				 CTFontRef newFont = [descriptor newMatchingFont];
+				 CTFontRef newFont = [[DTFontCache sharedCache] newFontMatchingFontDescriptor:descriptor];
 				 
 				 // remove the old font
 				 [self removeAttribute:(id)kCTFontAttributeName range:range];
@@ -556,8 +564,6 @@
 	
 	NSRange paragraphRange = [string rangeOfParagraphAtIndex:index];
 	
-	NSLog(@"toggle %d in '%@'", spaceOn, [string substringWithRange:paragraphRange]);
-	
 	// need to restore appropriate paragraph spacing
 	NSRange effectiveRange;
 	
@@ -565,18 +571,23 @@
 	
 	NSAssert(para!=nil, @"Empty Paragraph Style at index %lu", (unsigned long)index);
 	
-	// create our mutatable paragraph style
-	DTCoreTextParagraphStyle *paragraphStyle = [DTCoreTextParagraphStyle paragraphStyleWithCTParagraphStyle:para];
+	// the spacing can be read without converting the whole style
+	CGFloat currentSpacing = 0;
+	CTParagraphStyleGetValueForSpecifier(para, kCTParagraphStyleSpecifierParagraphSpacing, sizeof(currentSpacing), &currentSpacing);
 	
     NSNumber *overriddenSpacingNum = [self attribute:DTParagraphSpacingOverriddenByListAttribute atIndex:paragraphRange.location effectiveRange:NULL];
 
-    BOOL hasSpace = (paragraphStyle.paragraphSpacing>0) && !overriddenSpacingNum;
+    BOOL hasSpace = (currentSpacing>0) && !overriddenSpacingNum;
     
     if (hasSpace == spaceOn)
     {
+        [self endEditing];
+        
         return;
     }
     
+	CGFloat newSpacing;
+	
 	if (spaceOn)
 	{
         CGFloat spacing;
@@ -590,19 +601,19 @@
             spacing = CTFontGetSize(font);
         }
             
-		paragraphStyle.paragraphSpacing = spacing;
+		newSpacing = spacing;
         
         [self removeAttribute:DTParagraphSpacingOverriddenByListAttribute range:paragraphRange];
 	}
 	else
 	{
         // remember the previous paragraph spacing
-        [self addAttribute:DTParagraphSpacingOverriddenByListAttribute value:[NSNumber numberWithFloat:paragraphStyle.paragraphSpacing] range:paragraphRange];
+        [self addAttribute:DTParagraphSpacingOverriddenByListAttribute value:[NSNumber numberWithFloat:currentSpacing] range:paragraphRange];
         
-		paragraphStyle.paragraphSpacing = 0;
+		newSpacing = 0;
 	}
 	
-	para = [paragraphStyle createCTParagraphStyle];
+	para = [[DTParagraphStyleCache sharedCache] newParagraphStyleWithParagraphSpacing:newSpacing basedOnParagraphStyle:para];
 	
 	[self addAttribute:(id)kCTParagraphStyleAttributeName  value:(__bridge id)para range:paragraphRange];
 	
@@ -624,7 +635,12 @@
 	// extend range to include all paragraphs in their entirety
 	range = [[self string] rangeOfParagraphsContainingRange:range parBegIndex:NULL parEndIndex:NULL];
 	
-	NSMutableAttributedString *tmpString = [[NSMutableAttributedString alloc] init];
+	// modified paragraphs by their original range, unchanged ones are not replaced
+	NSMutableArray *replacedRanges = [NSMutableArray array];
+	NSMutableArray *replacementStrings = [NSMutableArray array];
+	__block NSUInteger replacedLength = 0;
+	
+	DTParagraphStyleCache *paragraphStyleCache = [DTParagraphStyleCache sharedCache];
 	
 	// enumerate the paragraphs in this range
 	NSString *string = [self string];
@@ -698,19 +714,21 @@
 					 tabParagraphStyle.headIndent = currentParagraphStyle.headIndent;
 					 tabParagraphStyle.firstLineHeadIndent = currentParagraphStyle.firstLineHeadIndent;
 					 
-					 CTParagraphStyleRef newPara = [tabParagraphStyle createCTParagraphStyle];
+					 CTParagraphStyleRef newPara = [paragraphStyleCache newParagraphStyleWithParagraphStyle:tabParagraphStyle];
 					 [paragraphString addAttribute:(id)kCTParagraphStyleAttributeName  value:(__bridge id)newPara range:NSMakeRange(0, [paragraphString length])];
 					 CFRelease(newPara);
 				 }
 				 else
 				 {
-					 // was not prefixed before
-					 [paragraphString addAttribute:(id)kCTParagraphStyleAttributeName  value:(__bridge id)tabPara range:NSMakeRange(0, [paragraphString length])];
+					 // was not prefixed before, the prefix creates a new style for every item
+					 CTParagraphStyleRef newPara = [paragraphStyleCache newParagraphStyleWithParagraphStyle:[DTCoreTextParagraphStyle paragraphStyleWithCTParagraphStyle:tabPara]];
+					 [paragraphString addAttribute:(id)kCTParagraphStyleAttributeName  value:(__bridge id)newPara range:NSMakeRange(0, [paragraphString length])];
+					 CFRelease(newPara);
 				 }
 			 }
 			 else
 			 {
-				 NSLog(@"should not get here!!! No paragraph style!!!");
+				 NSAssert(NO, @"List prefix without paragraph style");
 			 }
 		 }
 		 else
@@ -725,13 +743,15 @@
 				 paragraphStyle.paragraphSpacing = spacingAfterList;
 				 paragraphStyle.headIndent = paragraphStyle.firstLineHeadIndent;
 				 
-				 para = [paragraphStyle createCTParagraphStyle];
+				 para = [paragraphStyleCache newParagraphStyleWithParagraphStyle:paragraphStyle];
 				 
 				 [paragraphString addAttribute:(id)kCTParagraphStyleAttributeName  value:(__bridge id)para range:NSMakeRange(0, [paragraphString length])];
+				 
+				 CFRelease(para);
 			 }
 			 else
 			 {
-				 NSLog(@"should not get here!!! No paragraph and no font style!!!");
+				 NSAssert(NO, @"Paragraph at index %lu without paragraph style or font", (unsigned long)enclosingRange.location);
 			 }
 		 }
 		 
@@ -746,17 +766,31 @@
 			 [paragraphString removeAttribute:DTTextListsAttribute range:paragraphRange];
 		 }
 		 
-		 [tmpString appendAttributedString:paragraphString];
+		 replacedLength += [paragraphString length];
 		 
+		 // paragraphs that already have the list style stay untouched
+		 if (![paragraphString isEqualToAttributedString:[self attributedSubstringFromRange:enclosingRange]])
+		 {
+			 [replacedRanges addObject:[NSValue valueWithRange:enclosingRange]];
+			 [replacementStrings addObject:paragraphString];
+		 }
 		 
 		 itemNumber++;
      }
      ];
 	
-	[self replaceCharactersInRange:range withAttributedString:tmpString];
+	// back to front, so that the ranges of the preceding paragraphs stay valid
+	for (NSInteger i = (NSInteger)[replacedRanges count]-1; i>=0; i--)
+	{
+		NSRange replacedRange = [[replacedRanges objectAtIndex:i] rangeValue];
+		NSAttributedString *replacementString = [replacementStrings objectAtIndex:i];
+		
+		[self replaceCharactersInRange:replacedRange withAttributedString:replacementString];
+		[self _updateSelectionMarkerPositionsForReplacedRange:replacedRange replacementLength:[replacementString length]];
+	}
 	
 	// first paragraph after toggled range
-	NSInteger firstIndexInNextParagraph = range.location + [tmpString length];
+	NSInteger firstIndexInNextParagraph = range.location + replacedLength;
 	
 	if (firstIndexInNextParagraph && firstIndexInNextParagraph < [self length])
 	{
@@ -780,6 +814,10 @@
 	// extend to entire paragraphs
 	range = [string rangeOfParagraphsContainingRange:range parBegIndex:NULL parEndIndex:NULL];
 	
+	DTParagraphStyleCache *paragraphStyleCache = [DTParagraphStyleCache sharedCache];
+	
+	[self beginEditing];
+	
 	// enumerate paragraphs
 	[string enumerateSubstringsInRange:range options:NSStringEnumerationByParagraphs usingBlock:^(NSString *substring, NSRange substringRange, NSRange enclosingRange, BOOL *stop) {
 		
@@ -787,28 +825,84 @@
 		
 		CTParagraphStyleRef para = (__bridge CTParagraphStyleRef)[self attribute:(id)kCTParagraphStyleAttributeName atIndex:substringRange.location effectiveRange:NULL];
 		
-		DTCoreTextParagraphStyle *paragraphStyle = [DTCoreTextParagraphStyle paragraphStyleWithCTParagraphStyle:para];
-		
 		NSArray *textLists = [self attribute:DTTextListsAttribute atIndex:substringRange.location effectiveRange:NULL];
 		
-		if (![textLists count]||isLastParagraph)
+		CGFloat spacing = (![textLists count]||isLastParagraph) ? 12.0 : 0;
+		
+		if (para)
 		{
-			paragraphStyle.paragraphSpacing = 12.0;
+			CGFloat currentSpacing = 0;
+			CTParagraphStyleGetValueForSpecifier(para, kCTParagraphStyleSpecifierParagraphSpacing, sizeof(currentSpacing), &currentSpacing);
+			
+			// only paragraphs with a different spacing are modified
+			if (currentSpacing == spacing)
+			{
+				return;
+			}
+			
+			para = [paragraphStyleCache newParagraphStyleWithParagraphSpacing:spacing basedOnParagraphStyle:para];
 		}
 		else
 		{
-			paragraphStyle.paragraphSpacing = 0;
+			DTCoreTextParagraphStyle *paragraphStyle = [DTCoreTextParagraphStyle defaultParagraphStyle];
+			paragraphStyle.paragraphSpacing = spacing;
+			
+			para = [paragraphStyleCache newParagraphStyleWithParagraphStyle:paragraphStyle];
 		}
 		
-		NSLog(@"space: %f", paragraphStyle.paragraphSpacing);
-		
-		para = [paragraphStyle createCTParagraphStyle];
 		[self addAttribute:(id)kCTParagraphStyleAttributeName value:(__bridge id)para range:substringRange];
 		CFRelease(para);
 	}];
+	
+	[self endEditing];
 }
 
 #pragma mark Marking
+
+- (DTSelectionMarkerPositions *)_selectionMarkerPositions
+{
+	DTSelectionMarkerPositions *positions = objc_getAssociatedObject(self, &DTSelectionMarkerPositionsKey);
+	
+	if (positions && positions->_length != [self length])
+	{
+		// the string was modified behind our back
+		return nil;
+	}
+	
+	return positions;
+}
+
+- (void)_updateSelectionMarkerPositionsForReplacedRange:(NSRange)range replacementLength:(NSUInteger)length
+{
+	DTSelectionMarkerPositions *positions = objc_getAssociatedObject(self, &DTSelectionMarkerPositionsKey);
+	
+	if (!positions)
+	{
+		return;
+	}
+	
+	// the length before the replacement has to match
+	if (positions->_length != [self length] + range.length - length)
+	{
+		objc_setAssociatedObject(self, &DTSelectionMarkerPositionsKey, nil, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+		return;
+	}
+	
+	NSMutableIndexSet *indexes = positions->_indexes;
+	BOOL containsMarker = [indexes intersectsIndexesInRange:range];
+	
+	[indexes removeIndexesInRange:range];
+	[indexes shiftIndexesStartingAtIndex:NSMaxRange(range) by:(NSInteger)length - (NSInteger)range.length];
+	
+	if (containsMarker && length)
+	{
+		// the marker moved somewhere within the replacement
+		[indexes addIndexesInRange:NSMakeRange(range.location, length)];
+	}
+	
+	positions->_length = [self length];
+}
+
 - (void)addMarkersForSelectionRange:(NSRange)range
 {
     // avoid setting a margine into a prefix
@@ -848,19 +942,34 @@
 	{
 		[self addAttribute:DTSelectionMarkerAttribute value:[NSNumber numberWithInteger:endOffset] range:NSMakeRange(endPos, 1)];
 	}
+	
+	// remember the positions so that the markers don't have to be searched in the entire string
+	DTSelectionMarkerPositions *positions = [[DTSelectionMarkerPositions alloc] init];
+	positions->_indexes = [NSMutableIndexSet indexSetWithIndex:startPos];
+	positions->_length = [self length];
+	
+	if (range.length)
+	{
+		[positions->_indexes addIndex:endPos];
+	}
+	
+	positions->_numberOfMarkers = [positions->_indexes count];
+	
+	objc_setAssociatedObject(self, &DTSelectionMarkerPositionsKey, positions, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
 }
 
 - (NSRange)markedRangeRemove:(BOOL)remove
 {
-	__block NSInteger index=0;
+	NSMutableArray *markerRanges = [NSMutableArray arrayWithCapacity:2];
 	
 	__block NSInteger firstLocation = 0;
 	__block NSInteger lastLocation = NSNotFound;
+	__block NSUInteger numberOfMarkers = 2;
 	
-	[self enumerateAttribute:DTSelectionMarkerAttribute inRange:NSMakeRange(0, [self length]) options:0 usingBlock:^(NSNumber *value, NSRange range, BOOL *stop) {
+	void (^markerBlock)(NSNumber *value, NSRange range, BOOL *stop) = ^(NSNumber *value, NSRange range, BOOL *stop) {
 		if (value)
 		{
-			switch (index)
+			switch ([markerRanges count])
 			{
 				case 0:
 					firstLocation = range.location + [value integerValue];
@@ -868,18 +977,57 @@
 					break;
 				case 1:
 					lastLocation = range.location + [value integerValue];
-					*stop = YES;
 					break;
 			}
 			
-			if (remove)
+			[markerRanges addObject:[NSValue valueWithRange:range]];
+			
+			if ([markerRanges count] == numberOfMarkers)
 			{
-				[self removeAttribute:DTSelectionMarkerAttribute range:range];
+				*stop = YES;
 			}
+		}
+	};
+	
+	DTSelectionMarkerPositions *positions = [self _selectionMarkerPositions];
+	
+	if (positions)
+	{
+		numberOfMarkers = positions->_numberOfMarkers;
+		
+		// only look where the markers can be
+		[positions->_indexes enumerateRangesUsingBlock:^(NSRange range, BOOL *stop) {
 			
-			index++;
+			[self enumerateAttribute:DTSelectionMarkerAttribute inRange:range options:0 usingBlock:markerBlock];
+			
+			if ([markerRanges count] == numberOfMarkers)
+			{
+				*stop = YES;
+			}
+		}];
+	}
+	
+	if ([markerRanges count] < numberOfMarkers || !positions)
+	{
+		// markers are missing, search the entire string
+		[markerRanges removeAllObjects];
+		
+		firstLocation = 0;
+		lastLocation = NSNotFound;
+		numberOfMarkers = 2;
+		
+		[self enumerateAttribute:DTSelectionMarkerAttribute inRange:NSMakeRange(0, [self length]) options:0 usingBlock:markerBlock];
+	}
+	
+	if (remove)
+	{
+		for (NSValue *value in markerRanges)
+		{
+			[self removeAttribute:DTSelectionMarkerAttribute range:[value rangeValue]];
 		}
-	}];
+		
+		objc_setAssociatedObject(self, &DTSelectionMarkerPositionsKey, nil, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+	}
 	
 	return NSMakeRange(firstLocation, lastLocation-firstLocation);
 }
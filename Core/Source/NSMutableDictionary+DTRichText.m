@@ -9,6 +9,8 @@
 #import <DTCoreText/DTCoreText.h>
 
 #import "NSMutableDictionary+DTRichText.h"
+#import "DTFontCache.h"
+#import "DTParagraphStyleCache.h"
 
 @implementation NSMutableDictionary (DTRichText)
 
@@ -21,20 +23,14 @@
 		return;
 	}
 	
-	DTCoreTextFontDescriptor *desc = [DTCoreTextFontDescriptor fontDescriptorForCTFont:currentFont];
+	CTFontRef newFont = [[DTFontCache sharedCache] newFontByApplyingTraitTransform:DTFontTraitTransformToggleBold toFont:currentFont];
 	
-	// need to replace name with family
-	CFStringRef family = CTFontCopyFamilyName(currentFont);
-	desc.fontFamily = (__bridge NSString *)family;
-	CFRelease(family);
-	
-	desc.fontName = nil;
+	if (!newFont)
+	{
+		return;
+	}
 	
-	desc.boldTrait = !desc.boldTrait;
-
-	CTFontRef newFont = [desc newMatchingFont];
-	[self setObject:(__bridge id)newFont forKey:(id)kCTFontAttributeName];
-	CFRelease(newFont);
+	[self setObject:CFBridgingRelease(newFont) forKey:(id)kCTFontAttributeName];
 }
 
 - (void)toggleItalic
@@ -46,20 +42,14 @@
 		return;
 	}
 	
-	DTCoreTextFontDescriptor *desc = [DTCoreTextFontDescriptor fontDescriptorForCTFont:currentFont];
-	
-	// need to replace name with family
-	CFStringRef family = CTFontCopyFamilyName(currentFont);
-	desc.fontFamily = (__bridge NSString *)family;
-	CFRelease(family);
+	CTFontRef newFont = [[DTFontCache sharedCache] newFontByApplyingTraitTransform:DTFontTraitTransformToggleItalic toFont:currentFont];
 	
-	desc.fontName = nil;
-	
-	desc.italicTrait = !desc.italicTrait;
+	if (!newFont)
+	{
+		return;
+	}
 	
-	CTFontRef newFont = [desc newMatchingFont];
-	[self setObject:(__bridge id)newFont forKey:(id)kCTFontAttributeName];
-	CFRelease(newFont);
+	[self setObject:CFBridgingRelease(newFont) forKey:(id)kCTFontAttributeName];
 }
 
 - (void)toggleUnderline
@@ -105,7 +95,13 @@
         return;
     }
     
-    CTFontRef newFont = [fontDescriptor newMatchingFont];
+    CTFontRef newFont = [[DTFontCache sharedCache] newFontMatchingFontDescriptor:fontDescriptor];
+    
+    if (!newFont)
+    {
+        return;
+    }
+    
     [self setObject:CFBridgingRelease(newFont) forKey:(id)kCTFontAttributeName];
 }
 
@@ -114,16 +110,28 @@
 {
     CTParagraphStyleRef p = (__bridge CTParagraphStyleRef)([self objectForKey:(id)kCTParagraphStyleAttributeName]);
     
-    DTCoreTextParagraphStyle *paragraphStyle = [DTCoreTextParagraphStyle paragraphStyleWithCTParagraphStyle:p];
+    CTParagraphStyleRef newStyle;
     
-    if (paragraphSpacing == paragraphStyle.paragraphSpacing)
+    if (p)
     {
-        return;
+        CGFloat currentSpacing = 0;
+        CTParagraphStyleGetValueForSpecifier(p, kCTParagraphStyleSpecifierParagraphSpacing, sizeof(currentSpacing), &currentSpacing);
+        
+        if (paragraphSpacing == currentSpacing)
+        {
+            return;
+        }
+        
+        newStyle = [[DTParagraphStyleCache sharedCache] newParagraphStyleWithParagraphSpacing:paragraphSpacing basedOnParagraphStyle:p];
+    }
+    else
+    {
+        DTCoreTextParagraphStyle *paragraphStyle = [DTCoreTextParagraphStyle defaultParagraphStyle];
+        paragraphStyle.paragraphSpacing = paragraphSpacing;
+        
+        newStyle = [[DTParagraphStyleCache sharedCache] newParagraphStyleWithParagraphStyle:paragraphStyle];
     }
     
-    paragraphStyle.paragraphSpacing = paragraphSpacing;
-    
-    CTParagraphStyleRef newStyle = [paragraphStyle createCTParagraphStyle];
     [self setObject:CFBridgingRelease(newStyle) forKey:(id)kCTParagraphStyleAttributeName];
 }
 
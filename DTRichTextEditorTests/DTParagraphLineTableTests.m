@@ -0,0 +1,252 @@
+//
+//  DTParagraphLineTableTests.m
+//  DTRichTextEditorTests
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+
+#import <DTRichTextEditor/DTParagraphLineTable.h>
+
+// all estimated paragraphs have the same metrics so that every paragraph starts at a multiple of their height
+#define DTTestAscent 10.0f
+#define DTTestDescent 5.0f
+#define DTTestOriginY 20.0f
+
+/**
+ Tests for the paragraph index of <DTParagraphLineTable>, compared against a plain array of paragraph lengths.
+ */
+@interface DTParagraphLineTableTests : XCTestCase
+
+@end
+
+@implementation DTParagraphLineTableTests
+{
+	DTParagraphLineTable *_table;
+
+	// the reference the table is compared against
+	NSMutableArray *_lengths;
+}
+
+- (void)setUp
+{
+	[super setUp];
+
+	_lengths = [NSMutableArray array];
+
+	for (NSUInteger i=0; i<1000; i++)
+	{
+		[_lengths addObject:@((i % 7) + 1)];
+	}
+
+	_table = [self _tableWithLengths:_lengths];
+}
+
+- (void)tearDown
+{
+	_table = nil;
+	_lengths = nil;
+
+	[super tearDown];
+}
+
+#pragma mark - Helpers
+
+- (DTParagraphLineTable *)_tableWithLengths:(NSArray *)lengths
+{
+	NSUInteger count = [lengths count];
+
+	NSInteger *lengthValues = malloc(MAX(count, 1) * sizeof(NSInteger));
+	CGFloat *ascents = malloc(MAX(count, 1) * sizeof(CGFloat));
+	CGFloat *descents = malloc(MAX(count, 1) * sizeof(CGFloat));
+
+	for (NSUInteger i=0; i<count; i++)
+	{
+		lengthValues[i] = [[lengths objectAtIndex:i] integerValue];
+		ascents[i] = DTTestAscent;
+		descents[i] = DTTestDescent;
+	}
+
+	DTParagraphLineTable *table = [[DTParagraphLineTable alloc] initWithNumberOfEstimatedParagraphs:count lengths:lengthValues ascents:ascents descents:descents originY:DTTestOriginY];
+
+	free(lengthValues);
+	free(ascents);
+	free(descents);
+
+	return table;
+}
+
+// replaces paragraphs in the table and the reference with estimated paragraphs of the given lengths
+- (void)_replaceParagraphsInRange:(NSRange)range withLengths:(NSArray *)lengths
+{
+	NSUInteger count = [lengths count];
+
+	NSInteger *lengthValues = malloc(MAX(count, 1) * sizeof(NSInteger));
+	CGFloat *ascents = malloc(MAX(count, 1) * sizeof(CGFloat));
+	CGFloat *descents = malloc(MAX(count, 1) * sizeof(CGFloat));
+
+	for (NSUInteger i=0; i<count; i++)
+	{
+		lengthValues[i] = [[lengths objectAtIndex:i] integerValue];
+		ascents[i] = DTTestAscent;
+		descents[i] = DTTestDescent;
+	}
+
+	[_table replaceParagraphsInRange:range withEstimatedParagraphLengths:lengthValues ascents:ascents descents:descents count:count];
+	[_lengths replaceObjectsInRange:range withObjectsFromArray:lengths];
+
+	free(lengthValues);
+	free(ascents);
+	free(descents);
+}
+
+- (void)_assertTableMatchesLengths
+{
+	NSUInteger count = [_lengths count];
+
+	XCTAssertEqual([_table numberOfParagraphs], count, @"Wrong number of paragraphs");
+
+	NSUInteger location = 0;
+
+	for (NSUInteger i=0; i<count; i++)
+	{
+		NSUInteger length = [[_lengths objectAtIndex:i] unsignedIntegerValue];
+		NSRange range = [_table stringRangeOfParagraphAtIndex:i];
+
+		XCTAssertEqual(range.location, location, @"Paragraph %lu starts at the wrong location", (unsigned long)i);
+		XCTAssertEqual(range.length, length, @"Paragraph %lu has the wrong length", (unsigned long)i);
+
+		XCTAssertEqual([_table indexOfParagraphContainingStringIndex:location], i, @"Wrong paragraph for its first index");
+		XCTAssertEqual([_table indexOfParagraphContainingStringIndex:location + length - 1], i, @"Wrong paragraph for its last index");
+
+		CGFloat top = DTTestOriginY + i * (DTTestAscent + DTTestDescent);
+
+		XCTAssertEqualWithAccuracy([_table topOfParagraphAtIndex:i], top, 0.001, @"Paragraph %lu has the wrong top", (unsigned long)i);
+		XCTAssertEqualWithAccuracy([_table baselineOriginYOfParagraphAtIndex:i], top + DTTestAscent, 0.001, @"Paragraph %lu has the wrong baseline", (unsigned long)i);
+		XCTAssertEqual([_table indexOfParagraphAtVerticalPosition:top + 1.0f], i, @"Wrong paragraph for vertical position inside of it");
+
+		location += length;
+	}
+
+	// an index at the very end belongs to the last paragraph
+	if (count)
+	{
+		XCTAssertEqual([_table indexOfParagraphContainingStringIndex:location], count - 1, @"Wrong paragraph for end of text");
+		XCTAssertEqualWithAccuracy([_table maxY], DTTestOriginY + count * (DTTestAscent + DTTestDescent), 0.001, @"Wrong maximum y");
+	}
+}
+
+#pragma mark - Tests
+
+- (void)testEstimatedParagraphs
+{
+	[self _assertTableMatchesLengths];
+
+	for (NSUInteger i=0; i<[_lengths count]; i++)
+	{
+		XCTAssertFalse([_table isParagraphLaidOutAtIndex:i], @"Estimated paragraph should not have lines");
+	}
+}
+
+- (void)testEmptyTable
+{
+	DTParagraphLineTable *table = [self _tableWithLengths:@[]];
+
+	XCTAssertEqual([table numberOfParagraphs], (NSUInteger)0, @"Table should be empty");
+	XCTAssertEqual([table indexOfParagraphContainingStringIndex:0], (NSUInteger)NSNotFound, @"Empty table has no paragraphs");
+	XCTAssertEqual([table indexOfParagraphAtVerticalPosition:100], (NSUInteger)NSNotFound, @"Empty table has no paragraphs");
+	XCTAssertEqualWithAccuracy([table maxY], 0, 0.001, @"Empty table has no height");
+}
+
+- (void)testInsertingParagraphs
+{
+	// a Return in the middle of a paragraph splits it into two
+	[self _replaceParagraphsInRange:NSMakeRange(500, 1) withLengths:@[@3, @4]];
+	[self _assertTableMatchesLengths];
+
+	// at the very beginning and the very end
+	[self _replaceParagraphsInRange:NSMakeRange(0, 1) withLengths:@[@1, @2, @3]];
+	[self _replaceParagraphsInRange:NSMakeRange([_lengths count] - 1, 1) withLengths:@[@5, @6]];
+	[self _assertTableMatchesLengths];
+}
+
+- (void)testRemovingParagraphs
+{
+	// joining two paragraphs
+	[self _replaceParagraphsInRange:NSMakeRange(200, 2) withLengths:@[@9]];
+	[self _assertTableMatchesLengths];
+
+	// deleting a selection across many paragraphs
+	[self _replaceParagraphsInRange:NSMakeRange(10, 300) withLengths:@[@7]];
+	[self _assertTableMatchesLengths];
+
+	[self _replaceParagraphsInRange:NSMakeRange(0, [_lengths count]) withLengths:@[@1]];
+	[self _assertTableMatchesLengths];
+}
+
+- (void)testManyModifications
+{
+	// a fixed sequence of edits all over the table to exercise rebalancing
+	NSUInteger seed = 12345;
+
+	for (NSUInteger i=0; i<500; i++)
+	{
+		seed = (seed * 1103515245 + 12345) & 0x7fffffff;
+
+		NSUInteger count = [_lengths count];
+		NSUInteger location = seed % count;
+		NSUInteger length = MIN((seed >> 8) % 4, count - location);
+
+		NSMutableArray *lengths = [NSMutableArray array];
+		NSUInteger numberOfNewParagraphs = (seed >> 12) % 4;
+
+		// keep the table from running empty
+		if (!numberOfNewParagraphs && length >= count)
+		{
+			numberOfNewParagraphs = 1;
+		}
+
+		for (NSUInteger j=0; j<numberOfNewParagraphs; j++)
+		{
+			[lengths addObject:@(((seed >> (16 + j)) % 9) + 1)];
+		}
+
+		[self _replaceParagraphsInRange:NSMakeRange(location, length) withLengths:lengths];
+	}
+
+	[self _assertTableMatchesLengths];
+}
+
+- (void)testReplacingSameNumberOfParagraphsKeepsMetrics
+{
+	CGFloat topOfNextParagraph = [_table topOfParagraphAtIndex:6];
+
+	NSInteger length = 100;
+	CGFloat ascent = 50.0f;
+	CGFloat descent = 50.0f;
+
+	// typing inside of a paragraph only changes its length, the estimate stays
+	[_table replaceParagraphsInRange:NSMakeRange(5, 1) withEstimatedParagraphLengths:&length ascents:&ascent descents:&descent count:1];
+	[_lengths replaceObjectAtIndex:5 withObject:@(length)];
+
+	XCTAssertEqualWithAccuracy([_table topOfParagraphAtIndex:6], topOfNextParagraph, 0.001, @"Following paragraph should not move");
+	[self _assertTableMatchesLengths];
+}
+
+- (void)testSettingBaselineOriginMovesFollowingParagraphs
+{
+	CGFloat topOfPreviousParagraph = [_table topOfParagraphAtIndex:99];
+	CGFloat topOfLastParagraph = [_table topOfParagraphAtIndex:999];
+	CGFloat baselineOriginY = [_table baselineOriginYOfParagraphAtIndex:100];
+
+	[_table setBaselineOriginY:baselineOriginY + 30.0f ofParagraphAtIndex:100];
+
+	XCTAssertEqualWithAccuracy([_table topOfParagraphAtIndex:99], topOfPreviousParagraph, 0.001, @"Previous paragraph should not move");
+	XCTAssertEqualWithAccuracy([_table baselineOriginYOfParagraphAtIndex:100], baselineOriginY + 30.0f, 0.001, @"Paragraph should move");
+	XCTAssertEqualWithAccuracy([_table topOfParagraphAtIndex:999], topOfLastParagraph + 30.0f, 0.001, @"Following paragraphs should move by the same amount");
+}
+
+@end
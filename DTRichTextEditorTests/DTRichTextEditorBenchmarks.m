@@ -0,0 +1,565 @@
+//
+//  DTRichTextEditorBenchmarks.m
+//  DTRichTextEditorTests
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import <mach/mach.h>
+#import <sys/sysctl.h>
+
+#import <DTCoreText/DTCoreText.h>
+#import <DTFoundation/DTBase64Coding.h>
+#import <DTWebArchive/DTWebArchive.h>
+#import <DTRichTextEditor/DTRichTextEditor.h>
+#import <DTRichTextEditor/DTMutableCoreTextLayoutFrame.h>
+#import <DTRichTextEditor/NSAttributedString+DTWebArchive.h>
+
+// on the device the baselines were recorded on, a benchmark fails if it takes this much longer or uses this much more memory than its baseline
+#define DTBenchmarkTolerance 0.25
+
+// set this environment variable to write the measured values to a baselines file in the temporary directory
+#define DTBenchmarkRecordBaselinesEnvironmentKey @"DTRichTextEditorRecordBenchmarkBaselines"
+
+#define DTBenchmarkDeviceKey @"Device"
+#define DTBenchmarkBenchmarksKey @"Benchmarks"
+#define DTBenchmarkTimeKey @"Time"
+#define DTBenchmarkMemoryGrowthKey @"MemoryGrowth"
+
+// the current resident size of the process, unlike the maximum resident size this also goes down when memory is freed
+static uint64_t _DTResidentSize(void)
+{
+	struct mach_task_basic_info info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+	{
+		return 0;
+	}
+
+	return info.resident_size;
+}
+
+// the hardware model, e.g. iPad2,1
+static NSString *_DTDeviceModel(void)
+{
+	size_t size = 0;
+	sysctlbyname("hw.machine", NULL, &size, NULL, 0);
+
+	if (!size)
+	{
+		return nil;
+	}
+
+	char *machine = malloc(size);
+	sysctlbyname("hw.machine", machine, &size, NULL, 0);
+
+	NSString *model = [NSString stringWithUTF8String:machine];
+	free(machine);
+
+	return model;
+}
+
+/**
+ Benchmarks for the hot paths of the editor with synthetic documents of 1k, 10k and 100k paragraphs containing text with links, lists and images.
+
+ Each benchmark reports the wall clock time through XCTest and additionally measures the average time and how much the resident size grew while the benchmark ran, measured after its autorelease pool was drained. These are compared against DTRichTextEditorBenchmarkBaselines.plist, but only when running on the device model the baselines were recorded on. Otherwise, or if there is no baseline for a benchmark, the values are only logged. Run the tests with the `DTRichTextEditorRecordBenchmarkBaselines` environment variable set on the reference device to generate a new baselines file, it names the device it was recorded on.
+ */
+@interface DTRichTextEditorBenchmarks : XCTestCase
+
+@end
+
+@implementation DTRichTextEditorBenchmarks
+{
+	DTRichTextEditorView *_editor;
+}
+
+#pragma mark - Synthetic Documents
+
++ (NSString *)_imageDataURL
+{
+	static NSString *dataURL = nil;
+	static dispatch_once_t onceToken;
+
+	dispatch_once(&onceToken, ^{
+		UIGraphicsBeginImageContextWithOptions(CGSizeMake(64, 48), YES, 1.0f);
+		[[UIColor orangeColor] setFill];
+		UIRectFill(CGRectMake(0, 0, 64, 48));
+		UIImage *image = UIGraphicsGetImageFromCurrentImageContext();
+		UIGraphicsEndImageContext();
+
+		NSString *encodedData = [DTBase64Coding stringByEncodingData:UIImagePNGRepresentation(image)];
+		dataURL = [NSString stringWithFormat:@"data:image/png;base64,%@", encodedData];
+	});
+
+	return dataURL;
+}
+
+// every block of 10 paragraphs has 5 text paragraphs with styles and a link, a list with 4 items and an image
++ (NSString *)HTMLStringWithNumberOfParagraphs:(NSUInteger)numberOfParagraphs
+{
+	static NSMutableDictionary *HTMLStrings = nil;
+
+	if (!HTMLStrings)
+	{
+		HTMLStrings = [NSMutableDictionary dictionary];
+	}
+
+	NSString *cachedHTML = [HTMLStrings objectForKey:@(numberOfParagraphs)];
+
+	if (cachedHTML)
+	{
+		return cachedHTML;
+	}
+
+	NSString *imageDataURL = [self _imageDataURL];
+	NSMutableString *HTML = [NSMutableString string];
+
+	for (NSUInteger i=0; i<numberOfParagraphs/10; i++)
+	{
+		for (NSUInteger j=0; j<5; j++)
+		{
+			[HTML appendFormat:@"<p>Paragraph %lu.%lu with <b>bold</b>, <i>italic</i> and a <a href=\"http://www.cocoanetics.com/%lu\">link</a> in the middle of a sentence that is long enough to wrap onto a second line in the editor.</p>\n", (unsigned long)i, (unsigned long)j, (unsigned long)i];
+		}
+
+		[HTML appendString:@"<ul>\n<li>First item</li>\n<li>Second item with <b>bold</b> text</li>\n"];
+		[HTML appendString:@"<li>Third item</li>\n<li>Fourth item</li>\n</ul>\n"];
+
+		[HTML appendFormat:@"<p><img src=\"%@\" width=\"64\" height=\"48\"></p>\n", imageDataURL];
+	}
+
+	[HTMLStrings setObject:HTML forKey:@(numberOfParagraphs)];
+
+	return HTML;
+}
+
+// parsing the 100k document takes a while, so each document is only created once
++ (NSAttributedString *)attributedStringWithNumberOfParagraphs:(NSUInteger)numberOfParagraphs options:(NSDictionary *)options
+{
+	static NSMutableDictionary *attributedStrings = nil;
+
+	if (!attributedStrings)
+	{
+		attributedStrings = [NSMutableDictionary dictionary];
+	}
+
+	NSAttributedString *attributedString = [attributedStrings objectForKey:@(numberOfParagraphs)];
+
+	if (!attributedString)
+	{
+		NSData *data = [[self HTMLStringWithNumberOfParagraphs:numberOfParagraphs] dataUsingEncoding:NSUTF8StringEncoding];
+		attributedString = [[NSAttributedString alloc] initWithHTMLData:data options:options documentAttributes:NULL];
+
+		[attributedStrings setObject:attributedString forKey:@(numberOfParagraphs)];
+	}
+
+	return attributedString;
+}
+
+#pragma mark - Helpers
+
+- (void)tearDown
+{
+	_editor = nil;
+
+	[super tearDown];
+}
+
+- (DTRichTextEditorView *)_editorWithNumberOfParagraphs:(NSUInteger)numberOfParagraphs
+{
+	DTRichTextEditorView *editor = [[DTRichTextEditorView alloc] initWithFrame:CGRectMake(0, 0, 768, 1024)];
+
+	// the 100k document cannot be laid out in full for each run, all sizes use the same layout mode to be comparable
+	[(DTRichTextEditorContentView *)editor.attributedTextContentView setShouldLayoutLazily:YES];
+
+	editor.attributedText = [[self class] attributedStringWithNumberOfParagraphs:numberOfParagraphs options:[editor textDefaults]];
+
+	return editor;
+}
+
+// a range in the middle of the document covering a couple of paragraphs, including a list
+- (DTTextRange *)_rangeInMiddleOfEditor:(DTRichTextEditorView *)editor length:(NSUInteger)length
+{
+	NSString *string = [editor.attributedText string];
+	NSUInteger location = [string length] / 2;
+
+	NSRange paragraphRange = [string paragraphRangeForRange:NSMakeRange(location, 0)];
+	length = MIN(length, [string length] - paragraphRange.location - 1);
+
+	return [DTTextRange rangeWithNSRange:NSMakeRange(paragraphRange.location, length)];
+}
+
++ (NSDictionary *)_baselines
+{
+	static NSDictionary *baselines = nil;
+	static dispatch_once_t onceToken;
+
+	dispatch_once(&onceToken, ^{
+		NSString *path = [[NSBundle bundleForClass:self] pathForResource:@"DTRichTextEditorBenchmarkBaselines" ofType:@"plist"];
+		baselines = [NSDictionary dictionaryWithContentsOfFile:path];
+	});
+
+	return baselines;
+}
+
++ (NSMutableDictionary *)_recordedValues
+{
+	static NSMutableDictionary *recordedValues = nil;
+	static dispatch_once_t onceToken;
+
+	dispatch_once(&onceToken, ^{
+		recordedValues = [NSMutableDictionary dictionary];
+	});
+
+	return recordedValues;
+}
+
+- (void)_compareResultsOfBenchmark:(NSString *)name time:(NSTimeInterval)time memoryGrowth:(uint64_t)memoryGrowth
+{
+	NSLog(@"Benchmark %@: %.4f s, %llu KB memory growth", name, time, memoryGrowth / 1024);
+
+	if ([[[NSProcessInfo processInfo] environment] objectForKey:DTBenchmarkRecordBaselinesEnvironmentKey])
+	{
+		NSMutableDictionary *recordedValues = [[self class] _recordedValues];
+		[recordedValues setObject:@{DTBenchmarkTimeKey: @(time), DTBenchmarkMemoryGrowthKey: @(memoryGrowth)} forKey:name];
+
+		NSMutableDictionary *baselines = [NSMutableDictionary dictionary];
+		[baselines setObject:recordedValues forKey:DTBenchmarkBenchmarksKey];
+
+		NSString *deviceModel = _DTDeviceModel();
+
+		if (deviceModel)
+		{
+			[baselines setObject:deviceModel forKey:DTBenchmarkDeviceKey];
+		}
+
+		NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"DTRichTextEditorBenchmarkBaselines.plist"];
+		[baselines writeToFile:path atomically:YES];
+
+		NSLog(@"Recorded baselines for %@ to %@", deviceModel, path);
+	}
+
+	NSDictionary *baselines = [[self class] _baselines];
+	NSString *baselineDevice = [baselines objectForKey:DTBenchmarkDeviceKey];
+
+	// timings of other devices are not comparable
+	if (!baselineDevice || ![baselineDevice isEqualToString:_DTDeviceModel()])
+	{
+		return;
+	}
+
+	NSDictionary *baseline = [[baselines objectForKey:DTBenchmarkBenchmarksKey] objectForKey:name];
+
+	if (!baseline)
+	{
+		return;
+	}
+
+	NSTimeInterval baselineTime = [[baseline objectForKey:DTBenchmarkTimeKey] doubleValue];
+	uint64_t baselineMemoryGrowth = [[baseline objectForKey:DTBenchmarkMemoryGrowthKey] unsignedLongLongValue];
+
+	XCTAssertLessThanOrEqual(time, baselineTime * (1.0 + DTBenchmarkTolerance), @"%@ took %.4f s, baseline is %.4f s", name, time, baselineTime);
+	XCTAssertLessThanOrEqual((double)memoryGrowth, (double)baselineMemoryGrowth * (1.0 + DTBenchmarkTolerance), @"%@ grew resident memory by %llu KB, baseline is %llu KB", name, memoryGrowth / 1024, baselineMemoryGrowth / 1024);
+}
+
+// the preparation block runs for each iteration outside of the measured time
+- (void)_measureBenchmark:(NSString *)name numberOfParagraphs:(NSUInteger)numberOfParagraphs preparation:(void (^)(void))preparation block:(void (^)(void))block
+{
+	NSString *benchmarkName = [NSString stringWithFormat:@"%@ (%lu paragraphs)", name, (unsigned long)numberOfParagraphs];
+
+	__block NSTimeInterval totalTime = 0;
+	__block NSUInteger iterations = 0;
+	__block uint64_t memoryGrowth = 0;
+
+	[self measureMetrics:@[XCTPerformanceMetric_WallClockTime] automaticallyStartMeasuring:NO forBlock:^{
+
+		if (preparation)
+		{
+			preparation();
+		}
+
+		uint64_t residentSizeBefore = _DTResidentSize();
+		CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+
+		[self startMeasuring];
+
+		@autoreleasepool
+		{
+			block();
+		}
+
+		[self stopMeasuring];
+
+		totalTime += CFAbsoluteTimeGetCurrent() - start;
+		iterations++;
+
+		uint64_t residentSizeAfter = _DTResidentSize();
+
+		// the resident size can also shrink during an iteration, that is no growth
+		if (residentSizeAfter > residentSizeBefore)
+		{
+			memoryGrowth = MAX(memoryGrowth, residentSizeAfter - residentSizeBefore);
+		}
+	}];
+
+	[self _compareResultsOfBenchmark:benchmarkName time:totalTime / iterations memoryGrowth:memoryGrowth];
+}
+
+#pragma mark - Benchmarks
+
+- (void)_benchmarkReplaceRangeWithNumberOfParagraphs:(NSUInteger)numberOfParagraphs
+{
+	__block DTTextRange *range = nil;
+
+	[self _measureBenchmark:@"replaceRange:withText:" numberOfParagraphs:numberOfParagraphs preparation:^{
+
+		_editor = [self _editorWithNumberOfParagraphs:numberOfParagraphs];
+		range = [self _rangeInMiddleOfEditor:_editor length:0];
+	} block:^{
+
+		// typing a short word, one character at a time
+		for (NSUInteger i=0; i<10; i++)
+		{
+			[_editor replaceRange:range withText:@"a"];
+			range = [DTTextRange rangeWithNSRange:NSMakeRange([range NSRangeValue].location + 1, 0)];
+		}
+	}];
+}
+
+- (void)_benchmarkReplaceTextInLayoutFrameWithNumberOfParagraphs:(NSUInteger)numberOfParagraphs
+{
+	__block DTMutableCoreTextLayoutFrame *layoutFrame = nil;
+	__block NSRange range;
+	__block NSAttributedString *text = nil;
+
+	[self _measureBenchmark:@"replaceTextInRange:withText:dirtyRect:" numberOfParagraphs:numberOfParagraphs preparation:^{
+
+		_editor = [self _editorWithNumberOfParagraphs:numberOfParagraphs];
+		layoutFrame = (DTMutableCoreTextLayoutFrame *)_editor.attributedTextContentView.layoutFrame;
+		range = [[self _rangeInMiddleOfEditor:_editor length:0] NSRangeValue];
+
+		NSDictionary *attributes = [layoutFrame.attributedStringFragment attributesAtIndex:range.location effectiveRange:NULL];
+		text = [[NSAttributedString alloc] initWithString:@"a" attributes:attributes];
+	} block:^{
+
+		for (NSUInteger i=0; i<10; i++)
+		{
+			CGRect dirtyRect = CGRectNull;
+			[layoutFrame replaceTextInRange:NSMakeRange(range.location + i, 0) withText:text dirtyRect:&dirtyRect];
+		}
+	}];
+}
+
+- (void)_benchmarkSelectionRectsWithNumberOfParagraphs:(NSUInteger)numberOfParagraphs
+{
+	__block DTTextRange *range = nil;
+
+	_editor = [self _editorWithNumberOfParagraphs:numberOfParagraphs];
+
+	[self _measureBenchmark:@"selectionRectsForRange:" numberOfParagraphs:numberOfParagraphs preparation:^{
+
+		range = [self _rangeInMiddleOfEditor:_editor length:2000];
+	} block:^{
+
+		[_editor selectionRectsForRange:range];
+	}];
+}
+
+- (void)_benchmarkToggleBoldWithNumberOfParagraphs:(NSUInteger)numberOfParagraphs
+{
+	__block DTTextRange *range = nil;
+
+	_editor = [self _editorWithNumberOfParagraphs:numberOfParagraphs];
+
+	[self _measureBenchmark:@"toggleBoldInRange:" numberOfParagraphs:numberOfParagraphs preparation:^{
+
+		range = [self _rangeInMiddleOfEditor:_editor length:2000];
+	} block:^{
+
+		[_editor toggleBoldInRange:range];
+	}];
+}
+
+- (void)_benchmarkUpdateListsWithNumberOfParagraphs:(NSUInteger)numberOfParagraphs
+{
+	__block DTTextRange *range = nil;
+
+	_editor = [self _editorWithNumberOfParagraphs:numberOfParagraphs];
+
+	[self _measureBenchmark:@"updateListsInRange:" numberOfParagraphs:numberOfParagraphs preparation:^{
+
+		range = [self _rangeInMiddleOfEditor:_editor length:2000];
+	} block:^{
+
+		[_editor updateListsInRange:range removeNonPrefixedLinesFromLists:NO];
+	}];
+}
+
+- (void)_benchmarkSetHTMLStringWithNumberOfParagraphs:(NSUInteger)numberOfParagraphs
+{
+	NSString *HTMLString = [[self class] HTMLStringWithNumberOfParagraphs:numberOfParagraphs];
+
+	[self _measureBenchmark:@"setHTMLString:" numberOfParagraphs:numberOfParagraphs preparation:^{
+
+		_editor = [[DTRichTextEditorView alloc] initWithFrame:CGRectMake(0, 0, 768, 1024)];
+		[(DTRichTextEditorContentView *)_editor.attributedTextContentView setShouldLayoutLazily:YES];
+	} block:^{
+
+		[_editor setHTMLString:HTMLString];
+	}];
+}
+
+- (void)_benchmarkHTMLStringWithNumberOfParagraphs:(NSUInteger)numberOfParagraphs
+{
+	[self _measureBenchmark:@"HTMLStringWithOptions:" numberOfParagraphs:numberOfParagraphs preparation:^{
+
+		// a new editor each time, otherwise the fragment cache would answer all but the first run
+		_editor = [self _editorWithNumberOfParagraphs:numberOfParagraphs];
+	} block:^{
+
+		[_editor HTMLStringWithOptions:DTHTMLWriterOptionFragment];
+	}];
+}
+
+- (void)_benchmarkWebArchiveWithNumberOfParagraphs:(NSUInteger)numberOfParagraphs
+{
+	_editor = [self _editorWithNumberOfParagraphs:numberOfParagraphs];
+
+	[self _measureBenchmark:@"webArchive" numberOfParagraphs:numberOfParagraphs preparation:nil block:^{
+
+		[_editor.attributedText webArchive];
+	}];
+}
+
+#pragma mark - Typing
+
+- (void)testReplaceRange1k
+{
+	[self _benchmarkReplaceRangeWithNumberOfParagraphs:1000];
+}
+
+- (void)testReplaceRange10k
+{
+	[self _benchmarkReplaceRangeWithNumberOfParagraphs:10000];
+}
+
+- (void)testReplaceRange100k
+{
+	[self _benchmarkReplaceRangeWithNumberOfParagraphs:100000];
+}
+
+- (void)testReplaceTextInLayoutFrame1k
+{
+	[self _benchmarkReplaceTextInLayoutFrameWithNumberOfParagraphs:1000];
+}
+
+- (void)testReplaceTextInLayoutFrame10k
+{
+	[self _benchmarkReplaceTextInLayoutFrameWithNumberOfParagraphs:10000];
+}
+
+- (void)testReplaceTextInLayoutFrame100k
+{
+	[self _benchmarkReplaceTextInLayoutFrameWithNumberOfParagraphs:100000];
+}
+
+#pragma mark - Selection
+
+- (void)testSelectionRects1k
+{
+	[self _benchmarkSelectionRectsWithNumberOfParagraphs:1000];
+}
+
+- (void)testSelectionRects10k
+{
+	[self _benchmarkSelectionRectsWithNumberOfParagraphs:10000];
+}
+
+- (void)testSelectionRects100k
+{
+	[self _benchmarkSelectionRectsWithNumberOfParagraphs:100000];
+}
+
+#pragma mark - Formatting
+
+- (void)testToggleBold1k
+{
+	[self _benchmarkToggleBoldWithNumberOfParagraphs:1000];
+}
+
+- (void)testToggleBold10k
+{
+	[self _benchmarkToggleBoldWithNumberOfParagraphs:10000];
+}
+
+- (void)testToggleBold100k
+{
+	[self _benchmarkToggleBoldWithNumberOfParagraphs:100000];
+}
+
+- (void)testUpdateLists1k
+{
+	[self _benchmarkUpdateListsWithNumberOfParagraphs:1000];
+}
+
+- (void)testUpdateLists10k
+{
+	[self _benchmarkUpdateListsWithNumberOfParagraphs:10000];
+}
+
+- (void)testUpdateLists100k
+{
+	[self _benchmarkUpdateListsWithNumberOfParagraphs:100000];
+}
+
+#pragma mark - Import and Export
+
+- (void)testSetHTMLString1k
+{
+	[self _benchmarkSetHTMLStringWithNumberOfParagraphs:1000];
+}
+
+- (void)testSetHTMLString10k
+{
+	[self _benchmarkSetHTMLStringWithNumberOfParagraphs:10000];
+}
+
+- (void)testSetHTMLString100k
+{
+	[self _benchmarkSetHTMLStringWithNumberOfParagraphs:100000];
+}
+
+- (void)testHTMLString1k
+{
+	[self _benchmarkHTMLStringWithNumberOfParagraphs:1000];
+}
+
+- (void)testHTMLString10k
+{
+	[self _benchmarkHTMLStringWithNumberOfParagraphs:10000];
+}
+
+- (void)testHTMLString100k
+{
+	[self _benchmarkHTMLStringWithNumberOfParagraphs:100000];
+}
+
+- (void)testWebArchive1k
+{
+	[self _benchmarkWebArchiveWithNumberOfParagraphs:1000];
+}
+
+- (void)testWebArchive10k
+{
+	[self _benchmarkWebArchiveWithNumberOfParagraphs:10000];
+}
+
+- (void)testWebArchive100k
+{
+	[self _benchmarkWebArchiveWithNumberOfParagraphs:100000];
+}
+
+@end
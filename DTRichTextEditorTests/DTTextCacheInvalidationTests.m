@@ -0,0 +1,251 @@
+//
+//  DTTextCacheInvalidationTests.m
+//  DTRichTextEditorTests
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+
+#import <DTCoreText/DTCoreText.h>
+#import <DTRichTextEditor/DTHTMLFragmentCache.h>
+#import <DTRichTextEditor/DTWordBoundaryCache.h>
+#import <DTRichTextEditor/DTRichTextEditorMetrics.h>
+
+/**
+ Tests that the paragraph caches of the content view only forget the paragraphs touched by a modification and move the others.
+ */
+@interface DTTextCacheInvalidationTests : XCTestCase
+
+@end
+
+@implementation DTTextCacheInvalidationTests
+{
+	DTRichTextEditorMetrics *_metrics;
+}
+
+- (void)setUp
+{
+	[super setUp];
+
+	_metrics = [[DTRichTextEditorMetrics alloc] init];
+	_metrics.enabled = YES;
+}
+
+- (void)tearDown
+{
+	_metrics = nil;
+
+	[super tearDown];
+}
+
+#pragma mark - Helpers
+
+- (NSMutableAttributedString *)_attributedStringWithHTML:(NSString *)HTML
+{
+	NSData *data = [HTML dataUsingEncoding:NSUTF8StringEncoding];
+	NSAttributedString *attributedString = [[NSAttributedString alloc] initWithHTMLData:data documentAttributes:NULL];
+
+	return [attributedString mutableCopy];
+}
+
+// the words of all paragraphs in the order they are enumerated
+- (NSArray *)_wordsOfString:(NSString *)string withCache:(DTWordBoundaryCache *)cache
+{
+	NSMutableArray *words = [NSMutableArray array];
+
+	[string enumerateSubstringsInRange:NSMakeRange(0, [string length]) options:NSStringEnumerationByParagraphs | NSStringEnumerationSubstringNotRequired usingBlock:^(NSString *substring, NSRange substringRange, NSRange enclosingRange, BOOL *stop) {
+
+		[cache enumerateWordRangesInParagraphRange:enclosingRange ofString:string usingBlock:^(NSRange wordRange, BOOL *stopWords) {
+			[words addObject:[string substringWithRange:wordRange]];
+		}];
+	}];
+
+	return words;
+}
+
+- (void)_replaceCharactersInRange:(NSRange)range ofString:(NSMutableString *)string withString:(NSString *)replacement cache:(DTWordBoundaryCache *)cache
+{
+	[string replaceCharactersInRange:range withString:replacement];
+	[cache invalidateRange:range replacementLength:[replacement length]];
+}
+
+// the cached HTML has to be the same as the one of a single writer for the whole text
+- (void)_assertHTMLOfCache:(DTHTMLFragmentCache *)cache matchesWriterForAttributedString:(NSAttributedString *)attributedString
+{
+	DTHTMLWriter *writer = [[DTHTMLWriter alloc] initWithAttributedString:attributedString];
+
+	NSString *fragment = [cache HTMLFragmentForParagraphsInRange:NSMakeRange(0, [attributedString length]) ofAttributedString:attributedString textScale:1.0f];
+	XCTAssertEqualObjects(fragment, [writer HTMLFragment], @"Cached fragment should match the writer");
+
+	NSString *document = [cache HTMLStringForAttributedString:attributedString textScale:1.0f];
+	XCTAssertEqualObjects(document, [writer HTMLString], @"Cached document should match the writer");
+}
+
+#pragma mark - Word Boundaries
+
+- (void)testWordBoundariesOfModifiedParagraphAreUpdated
+{
+	NSMutableString *string = [NSMutableString stringWithString:@"first paragraph\nsecond paragraph\nthird paragraph\n"];
+
+	DTWordBoundaryCache *cache = [[DTWordBoundaryCache alloc] init];
+	cache.metrics = _metrics;
+
+	[self _wordsOfString:string withCache:cache];
+	[_metrics reset];
+
+	// insert a word inside of the second paragraph
+	NSRange range = [string rangeOfString:@"paragraph" options:0 range:NSMakeRange(16, 16)];
+	[self _replaceCharactersInRange:NSMakeRange(range.location, 0) ofString:string withString:@"new " cache:cache];
+
+	NSArray *words = [self _wordsOfString:string withCache:cache];
+	NSArray *expectedWords = @[@"first", @"paragraph", @"second", @"new", @"paragraph", @"third", @"paragraph"];
+
+	XCTAssertEqualObjects(words, expectedWords, @"Words should match the modified string");
+
+	// the first paragraph is before the range, the third moved, only the second is tokenized again
+	XCTAssertEqualWithAccuracy([_metrics hitRateOfCache:DTRichTextEditorMetricsCacheWordBoundaries], 2.0 / 3.0, 0.001, @"Only the modified paragraph should be tokenized again");
+}
+
+- (void)testWordBoundariesAfterJoiningParagraphs
+{
+	NSMutableString *string = [NSMutableString stringWithString:@"first paragraph\nsecond paragraph\nthird paragraph\n"];
+
+	DTWordBoundaryCache *cache = [[DTWordBoundaryCache alloc] init];
+
+	[self _wordsOfString:string withCache:cache];
+
+	// deleting the paragraph break after the first paragraph
+	[self _replaceCharactersInRange:NSMakeRange(15, 1) ofString:string withString:@" " cache:cache];
+
+	NSArray *words = [self _wordsOfString:string withCache:cache];
+	NSArray *expectedWords = @[@"first", @"paragraph", @"second", @"paragraph", @"third", @"paragraph"];
+
+	XCTAssertEqualObjects(words, expectedWords, @"Words of the joined paragraph should be found");
+
+	// the joined paragraph is tokenized as a whole
+	__block NSUInteger numberOfWords = 0;
+
+	[cache enumerateWordRangesInParagraphRange:[string paragraphRangeForRange:NSMakeRange(0, 0)] ofString:string usingBlock:^(NSRange wordRange, BOOL *stop) {
+		numberOfWords++;
+	}];
+
+	XCTAssertEqual(numberOfWords, (NSUInteger)4, @"Joined paragraph should have the words of both paragraphs");
+}
+
+- (void)testPurgedWordBoundariesAreTokenizedAgain
+{
+	NSString *string = @"first paragraph\nsecond paragraph\n";
+
+	DTWordBoundaryCache *cache = [[DTWordBoundaryCache alloc] init];
+	cache.metrics = _metrics;
+
+	[self _wordsOfString:string withCache:cache];
+
+	XCTAssertGreaterThan([cache cacheCost], (NSUInteger)0, @"Words should be cached");
+
+	[cache purgeCache];
+	[_metrics reset];
+
+	NSArray *words = [self _wordsOfString:string withCache:cache];
+
+	XCTAssertEqual([words count], (NSUInteger)4, @"Purged cache should still find all words");
+	XCTAssertEqualWithAccuracy([_metrics hitRateOfCache:DTRichTextEditorMetricsCacheWordBoundaries], 0, 0.001, @"All paragraphs should be tokenized again");
+}
+
+#pragma mark - HTML Fragments
+
+- (void)testHTMLFragmentOfModifiedParagraphIsDirty
+{
+	NSMutableAttributedString *attributedString = [self _attributedStringWithHTML:@"<p>First</p><p>Second</p><p>Third</p>"];
+	NSString *string = [attributedString string];
+
+	DTHTMLFragmentCache *cache = [[DTHTMLFragmentCache alloc] init];
+
+	[cache HTMLFragmentForParagraphsInRange:NSMakeRange(0, [attributedString length]) ofAttributedString:attributedString textScale:1.0f];
+
+	XCTAssertEqual([[cache rangesOfDirtyParagraphsInAttributedString:attributedString] count], (NSUInteger)0, @"All paragraphs should be converted");
+
+	// append a character at the end of the second paragraph, before its paragraph break
+	NSRange secondParagraphRange = [string paragraphRangeForRange:NSMakeRange([string rangeOfString:@"Second"].location, 0)];
+	NSRange range = NSMakeRange(NSMaxRange(secondParagraphRange) - 1, 0);
+
+	[attributedString replaceCharactersInRange:range withString:@"!"];
+	[cache invalidateRange:range replacementLength:1];
+
+	NSArray *dirtyRanges = [cache rangesOfDirtyParagraphsInAttributedString:attributedString];
+	NSRange expectedRange = NSMakeRange(secondParagraphRange.location, secondParagraphRange.length + 1);
+
+	XCTAssertEqual([dirtyRanges count], (NSUInteger)1, @"Only the modified paragraph should be dirty");
+	XCTAssertTrue(NSEqualRanges([[dirtyRanges firstObject] rangeValue], expectedRange), @"Dirty range should be the modified paragraph, not %@", NSStringFromRange([[dirtyRanges firstObject] rangeValue]));
+
+	NSString *HTML = [cache HTMLFragmentForParagraphsInRange:NSMakeRange(0, [attributedString length]) ofAttributedString:attributedString textScale:1.0f];
+
+	XCTAssertTrue([HTML rangeOfString:@"Second!"].location != NSNotFound, @"HTML should contain the modification");
+	XCTAssertEqual([[cache rangesOfDirtyParagraphsInAttributedString:attributedString] count], (NSUInteger)0, @"All paragraphs should be clean again");
+}
+
+- (void)testHTMLFragmentsAreDiscardedForMissedModification
+{
+	NSMutableAttributedString *attributedString = [self _attributedStringWithHTML:@"<p>First</p><p>Second</p>"];
+
+	DTHTMLFragmentCache *cache = [[DTHTMLFragmentCache alloc] init];
+
+	[cache HTMLFragmentForParagraphsInRange:NSMakeRange(0, [attributedString length]) ofAttributedString:attributedString textScale:1.0f];
+
+	// the cache is not informed about this one
+	[attributedString replaceCharactersInRange:NSMakeRange(0, 5) withString:@"Changed"];
+
+	NSArray *dirtyRanges = [cache rangesOfDirtyParagraphsInAttributedString:attributedString];
+	NSUInteger dirtyLength = 0;
+
+	for (NSValue *value in dirtyRanges)
+	{
+		dirtyLength += [value rangeValue].length;
+	}
+
+	XCTAssertEqual(dirtyLength, [attributedString length], @"A length mismatch should make the whole string dirty");
+
+	NSString *HTML = [cache HTMLFragmentForParagraphsInRange:NSMakeRange(0, [attributedString length]) ofAttributedString:attributedString textScale:1.0f];
+
+	XCTAssertTrue([HTML rangeOfString:@"Changed"].location != NSNotFound, @"HTML should contain the modification");
+}
+
+- (void)testCachedHTMLMatchesWriterAfterModifications
+{
+	NSMutableAttributedString *attributedString = [self _attributedStringWithHTML:@"<p>Intro</p><ul><li>One</li><li>Two<ul><li>Nested</li></ul></li><li>Three</li></ul><p>Middle</p><ol><li>First</li><li>Second</li></ol><p><b>Bold</b> end</p>"];
+
+	DTHTMLFragmentCache *cache = [[DTHTMLFragmentCache alloc] init];
+	cache.metrics = _metrics;
+
+	[self _assertHTMLOfCache:cache matchesWriterForAttributedString:attributedString];
+
+	// typing in a nested list item converts the whole list again
+	NSRange range = NSMakeRange(NSMaxRange([[attributedString string] rangeOfString:@"Nested"]), 0);
+	[attributedString replaceCharactersInRange:range withString:@" item"];
+	[cache invalidateRange:range replacementLength:5];
+
+	[_metrics reset];
+	[self _assertHTMLOfCache:cache matchesWriterForAttributedString:attributedString];
+
+	XCTAssertGreaterThan([_metrics hitRateOfCache:DTRichTextEditorMetricsCacheHTMLFragments], 0, @"Paragraphs outside of the list should not be converted again");
+
+	// removing the paragraph between the lists makes them adjacent
+	NSString *string = [attributedString string];
+	range = [string paragraphRangeForRange:NSMakeRange([string rangeOfString:@"Middle"].location, 0)];
+	[attributedString deleteCharactersInRange:range];
+	[cache invalidateRange:range replacementLength:0];
+
+	[self _assertHTMLOfCache:cache matchesWriterForAttributedString:attributedString];
+
+	// a new paragraph at the end
+	range = NSMakeRange([attributedString length], 0);
+	[attributedString replaceCharactersInRange:range withString:@"Appended\n"];
+	[cache invalidateRange:range replacementLength:9];
+
+	[self _assertHTMLOfCache:cache matchesWriterForAttributedString:attributedString];
+}
+
+@end
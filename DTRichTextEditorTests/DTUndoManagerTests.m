@@ -0,0 +1,222 @@
+//
+//  DTUndoManagerTests.m
+//  DTRichTextEditorTests
+//
+//  Created by Oliver Drobnik on 10/14/14.
+//  Copyright (c) 2014 Cocoanetics. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+
+#import <DTRichTextEditor/DTUndoManager.h>
+#import <DTRichTextEditor/DTUndoDelta.h>
+
+/**
+ Tests for the delta journal of <DTUndoManager>. The test case itself is the undo target, it modifies a plain attributed string the same way the editor does.
+ */
+@interface DTUndoManagerTests : XCTestCase
+
+@end
+
+@implementation DTUndoManagerTests
+{
+	DTUndoManager *_undoManager;
+	NSMutableAttributedString *_text;
+}
+
+- (void)setUp
+{
+	[super setUp];
+
+	_undoManager = [[DTUndoManager alloc] init];
+
+	// groups are opened and closed by the tests, not by the run loop
+	_undoManager.groupsByEvent = NO;
+
+	_text = [[NSMutableAttributedString alloc] initWithString:@"Hello World"];
+}
+
+- (void)tearDown
+{
+	[_undoManager removeAllActions];
+
+	_undoManager = nil;
+	_text = nil;
+
+	[super tearDown];
+}
+
+#pragma mark - Helpers
+
+- (void)_replaceCharactersInRange:(NSRange)range withString:(NSString *)string
+{
+	NSRange insertedRange = NSMakeRange(range.location, [string length]);
+
+	DTUndoDelta *delta = [DTUndoDelta deltaForReplacingRange:insertedRange withCharactersInRange:range ofAttributedString:_text];
+	[_undoManager registerUndoDelta:delta withTarget:self selector:@selector(_undoDelta:)];
+
+	[_text replaceCharactersInRange:range withString:string];
+}
+
+- (void)_setAttributes:(NSDictionary *)attributes range:(NSRange)range
+{
+	NSMutableAttributedString *newText = [[_text attributedSubstringFromRange:range] mutableCopy];
+	[newText setAttributes:attributes range:NSMakeRange(0, range.length)];
+
+	DTUndoDelta *delta = [DTUndoDelta deltaForChangingAttributesInRange:range ofAttributedString:_text toAttributedString:newText];
+	[_undoManager registerUndoDelta:delta withTarget:self selector:@selector(_undoDelta:)];
+
+	[_text replaceCharactersInRange:range withAttributedString:newText];
+}
+
+- (void)_undoDelta:(DTUndoDelta *)delta
+{
+	NSRange range = [delta range];
+
+	if ([delta changesAttributesOnly])
+	{
+		NSMutableAttributedString *text = [[_text attributedSubstringFromRange:range] mutableCopy];
+		[delta revertAttributesInAttributedString:text];
+
+		[_text replaceCharactersInRange:range withAttributedString:text];
+
+		return;
+	}
+
+	[_text replaceCharactersInRange:range withAttributedString:[delta attributedString]];
+}
+
+// registers each replacement in its own undo group
+- (void)_replaceCharactersInSeparateGroupsWithStrings:(NSArray *)strings
+{
+	for (NSString *string in strings)
+	{
+		[_undoManager beginUndoGrouping];
+		[self _replaceCharactersInRange:NSMakeRange(0, [_text length]) withString:string];
+		[_undoManager endUndoGrouping];
+	}
+}
+
+#pragma mark - Tests
+
+- (void)testUndoReplacement
+{
+	[_undoManager beginUndoGrouping];
+	[self _replaceCharactersInRange:NSMakeRange(6, 5) withString:@"There"];
+	[_undoManager endUndoGrouping];
+
+	XCTAssertEqualObjects([_text string], @"Hello There", @"Text should be replaced");
+
+	[_undoManager undo];
+
+	XCTAssertEqualObjects([_text string], @"Hello World", @"Undo should restore the replaced text");
+	XCTAssertEqual([_undoManager journalSize], (NSUInteger)0, @"Undone delta should leave the journal");
+}
+
+- (void)testUndoRestoresAttributes
+{
+	NSDictionary *attributes = @{@"TestAttribute": @YES};
+
+	[_undoManager beginUndoGrouping];
+	[self _setAttributes:attributes range:NSMakeRange(0, 5)];
+	[_undoManager endUndoGrouping];
+
+	XCTAssertEqualObjects([_text attribute:@"TestAttribute" atIndex:2 effectiveRange:NULL], @YES, @"Attribute should be set");
+
+	[_undoManager undo];
+
+	XCTAssertEqualObjects([_text string], @"Hello World", @"Characters should not change");
+	XCTAssertNil([_text attribute:@"TestAttribute" atIndex:2 effectiveRange:NULL], @"Undo should remove the attribute");
+}
+
+- (void)testTypingIsCoalesced
+{
+	[_undoManager beginUndoGrouping];
+
+	[self _replaceCharactersInRange:NSMakeRange(5, 0) withString:@","];
+	NSUInteger journalSize = [_undoManager journalSize];
+
+	[self _replaceCharactersInRange:NSMakeRange(6, 0) withString:@"a"];
+	[self _replaceCharactersInRange:NSMakeRange(7, 0) withString:@"b"];
+
+	XCTAssertEqual([_undoManager journalSize], journalSize, @"Typed characters should be coalesced into the first delta");
+
+	// backspace over a typed character
+	[self _replaceCharactersInRange:NSMakeRange(7, 1) withString:@""];
+
+	[_undoManager endUndoGrouping];
+
+	XCTAssertEqualObjects([_text string], @"Hello,a World", @"Wrong text after typing");
+
+	[_undoManager undo];
+
+	XCTAssertEqualObjects([_text string], @"Hello World", @"Undo should remove all typed characters at once");
+	XCTAssertFalse([_undoManager canUndo], @"There should be a single undo action");
+}
+
+- (void)testMemoryBudgetDiscardsOldestDeltas
+{
+	NSString *longString = [@"" stringByPaddingToLength:10000 withString:@"abc" startingAtIndex:0];
+	[_text replaceCharactersInRange:NSMakeRange(0, [_text length]) withString:longString];
+
+	// each delta stores the long string
+	[self _replaceCharactersInSeparateGroupsWithStrings:@[longString]];
+	NSUInteger costOfDelta = [_undoManager journalSize];
+
+	// room for two of them
+	_undoManager.memoryBudget = costOfDelta * 5 / 2;
+
+	[self _replaceCharactersInSeparateGroupsWithStrings:@[longString, longString, @"Last"]];
+
+	XCTAssertLessThanOrEqual([_undoManager journalSize], _undoManager.memoryBudget, @"Journal should be trimmed to the budget");
+
+	[_undoManager undo];
+	XCTAssertEqualObjects([_text string], longString, @"Newest delta should be kept");
+
+	[_undoManager undo];
+	XCTAssertEqualObjects([_text string], longString, @"Second newest delta should be kept");
+
+	// reaching a discarded delta ends the history
+	[_undoManager undo];
+	[_undoManager undo];
+
+	XCTAssertFalse([_undoManager canUndo], @"History before the discarded delta should be gone");
+	XCTAssertEqual([_undoManager journalSize], (NSUInteger)0, @"Journal should be empty");
+}
+
+- (void)testPurgeKeepsNewestDeltas
+{
+	NSMutableArray *strings = [NSMutableArray array];
+
+	for (NSUInteger i=0; i<10; i++)
+	{
+		[strings addObject:[NSString stringWithFormat:@"Version %lu of the text", (unsigned long)i]];
+	}
+
+	[self _replaceCharactersInSeparateGroupsWithStrings:strings];
+
+	NSUInteger journalSize = [_undoManager journalSize];
+
+	[_undoManager purgeCache];
+
+	XCTAssertLessThanOrEqual([_undoManager journalSize], journalSize / 2, @"Purging should give up the older half");
+	XCTAssertGreaterThan([_undoManager journalSize], (NSUInteger)0, @"Purging should keep the newest deltas");
+
+	[_undoManager undo];
+
+	XCTAssertEqualObjects([_text string], @"Version 8 of the text", @"Newest delta should still be undoable");
+}
+
+- (void)testRemovingTargetEmptiesJournal
+{
+	[self _replaceCharactersInSeparateGroupsWithStrings:@[@"One", @"Two"]];
+
+	XCTAssertGreaterThan([_undoManager journalSize], (NSUInteger)0, @"Deltas should be journaled");
+
+	[_undoManager removeAllActionsWithTarget:self];
+
+	XCTAssertEqual([_undoManager journalSize], (NSUInteger)0, @"Deltas of the removed target should leave the journal");
+}
+
+@end
@@ -19,8 +19,6 @@
 	UITextRange *lastSelection;
 	
     UIPopoverController *popover;
-    
-    NSCache *_imageViewCache;
 	
 	
 	// demonstrating inputAccessoryView
@@ -52,10 +50,12 @@
     
     // Insert Menu
     BOOL _showInsertMenu;
+    
+    // image views of the visible image attachments, views are reused for other attachments
+    NSMapTable *_imageViewsByAttachment;
+    NSMapTable *_attachmentsByImageView;
 }
 
-@property (nonatomic, retain) NSCache *imageViewCache;
-
 @property (nonatomic, retain) NSArray *menuItems;
 @property (nonatomic, retain) DTRichTextEditorTestState *testState;
 @property (nonatomic, retain) UIPopoverController *testOptionsPopover;
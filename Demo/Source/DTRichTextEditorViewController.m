@@ -119,6 +119,11 @@ NSString *DTTestStateDataKey = @"DTTestStateDataKey";
     // notifications
     NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
 	[center addObserver:self selector:@selector(menuDidHide:) name:UIMenuControllerDidHideMenuNotification object:nil];
+	
+	// image views show the downsampled bitmaps once they are decoded
+	_imageViewsByAttachment = [NSMapTable weakToWeakObjectsMapTable];
+	_attachmentsByImageView = [NSMapTable weakToWeakObjectsMapTable];
+	[center addObserver:self selector:@selector(imageAttachmentDidDecodeImage:) name:DTRichTextImageAttachmentDidDecodeImageNotification object:nil];
 }
 
 // Override to allow orientations other than the default portrait orientation.
@@ -208,24 +213,46 @@ NSString *DTTestStateDataKey = @"DTTestStateDataKey";
 
 - (UIView *)attributedTextContentView:(DTAttributedTextContentView *)attributedTextContentView viewForAttachment:(DTTextAttachment *)attachment frame:(CGRect)frame
 {
-    NSNumber *cacheKey = [NSNumber numberWithUnsignedInteger:[attachment hash]];
-    
-    UIImageView *imageView = [self.imageViewCache objectForKey:cacheKey];
-    
-    if (imageView)
-    {
-        imageView.frame = frame;
-        return imageView;
-    }
-    
     if ([attachment isKindOfClass:[DTImageTextAttachment class]])
 	{
         DTImageTextAttachment *imageAttachment = (DTImageTextAttachment *)attachment;
         
-        imageView = [[UIImageView alloc] initWithFrame:frame];
-        imageView.image = imageAttachment.image;
+        UIImageView *imageView = nil;
         
-        [self.imageViewCache setObject:imageView forKey:cacheKey];
+        // views of attachments that scrolled out of sight are recycled by the content view
+        if ([attributedTextContentView isKindOfClass:[DTRichTextEditorContentView class]])
+        {
+            UIView *reusableView = [(DTRichTextEditorContentView *)attributedTextContentView dequeueReusableViewForAttachmentClass:[attachment class]];
+            
+            if ([reusableView isKindOfClass:[UIImageView class]])
+            {
+                imageView = (UIImageView *)reusableView;
+            }
+        }
+        
+        if (imageView)
+        {
+            imageView.frame = frame;
+        }
+        else
+        {
+            imageView = [[UIImageView alloc] initWithFrame:frame];
+        }
+        
+        if ([attachment isKindOfClass:[DTRichTextImageAttachment class]])
+        {
+            // the image property decodes the full resolution image on every access, the downsampled bitmap is decoded in the background
+            DTRichTextImageAttachment *richTextImageAttachment = (DTRichTextImageAttachment *)attachment;
+            
+            imageView.image = [richTextImageAttachment displayImageForScale:[UIScreen mainScreen].scale];
+            
+            [_imageViewsByAttachment setObject:imageView forKey:attachment];
+            [_attachmentsByImageView setObject:attachment forKey:imageView];
+        }
+        else
+        {
+            imageView.image = imageAttachment.image;
+        }
         
         return imageView;
     }
@@ -472,6 +499,20 @@ NSString *DTTestStateDataKey = @"DTTestStateDataKey";
     _showInsertMenu = NO;
 }
 
+- (void)imageAttachmentDidDecodeImage:(NSNotification *)notification
+{
+    DTRichTextImageAttachment *attachment = [notification object];
+    UIImageView *imageView = [_imageViewsByAttachment objectForKey:attachment];
+
+    // the view might show a different attachment by now
+    if (!imageView || [_attachmentsByImageView objectForKey:imageView] != attachment)
+    {
+        return;
+    }
+
+    imageView.image = [attachment displayImageForScale:[UIScreen mainScreen].scale];
+}
+
 - (void)displayInsertMenu:(id)sender
 {
     _showInsertMenu = YES;
@@ -494,20 +535,6 @@ NSString *DTTestStateDataKey = @"DTTestStateDataKey";
 }
 
 
-#pragma mark Properties
-
-- (NSCache *)imageViewCache
-{
-    if (!_imageViewCache)
-    {
-        _imageViewCache = [[NSCache alloc] init];
-    }
-    
-    return _imageViewCache;
-}
-
-@synthesize imageViewCache = _imageViewCache;
-
 #pragma mark - DTFormatDelegate
 - (void)formatDidSelectFont:(DTCoreTextFontDescriptor *)font
 {